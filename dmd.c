@@ -23,6 +23,8 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
+#include <math.h>
 
 #ifndef MIN
 #define	MIN(a,b) (((a)<(b))?(a):(b))
@@ -32,250 +34,2772 @@
 #endif	/* MAX */
 
 
-DMDColor *DMDGetAlphaMap(void); /** Private function for fetching the alpha map. */
+const DMDColor *DMDGetAlphaMap(void); /** Private function for fetching the alpha map. */
 
 
+/**
+ * Frame Allocation
+ * 
+ * Frames are allocated as one block: a private header, the DMDFrame structure and
+ * then the dots.  Deleted blocks are kept on per-size-class free lists and handed
+ * out again by DMDFrameCreate(), which saves a calloc/free pair and the page faults
+ * that go with it for the many short-lived frames a render loop creates.  Size
+ * classes are spaced four per power of two, so a block is at most 25% larger than
+ * it needs to be.  Frames may also be carved out of a DMDFrameArena, which is reset
+ * as a whole instead of deleting its frames one at a time.
+ */
+
+#define kDMDBlockPooled (0x1) /* Block size is a pool size class; return it to the pool. */
+#define kDMDBlockArena  (0x2) /* Block belongs to an arena; DMDFrameDelete() leaves it alone. */
+
+typedef struct _DMDFrameBlock {
+	struct _DMDFrameBlock *next; /* Free list link while the block is in the pool. */
+	unsigned sizeClass;
+	unsigned flags;
+	size_t blockSize;
+} DMDFrameBlock;
+
+#define kDMDPoolMinShift (6)  /* Smallest size class is 64 bytes. */
+#define kDMDPoolMaxShift (20) /* Blocks over 1 MiB are not pooled. */
+#define kDMDPoolSizeClasses (4 * (kDMDPoolMaxShift - kDMDPoolMinShift) + 1)
+
+static DMDFrameBlock *gPoolFreeLists[kDMDPoolSizeClasses];
+static size_t gPoolCachedBytes = 0;
+static size_t gPoolLimit = 16 * 1024 * 1024;
+static DMDFrameStats gFrameStats;
+
+/* A mutex rather than a spin lock: a thread preempted while holding it would leave the others
+ * spinning for the rest of its time slice.  The lock is only held for a few loads and stores. */
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+static SRWLOCK gPoolLock = SRWLOCK_INIT;
+#define DMDPoolLock()   AcquireSRWLockExclusive(&gPoolLock)
+#define DMDPoolUnlock() ReleaseSRWLockExclusive(&gPoolLock)
+#else
+#include <pthread.h>
+static pthread_mutex_t gPoolLock = PTHREAD_MUTEX_INITIALIZER;
+#define DMDPoolLock()   pthread_mutex_lock(&gPoolLock)
+#define DMDPoolUnlock() pthread_mutex_unlock(&gPoolLock)
+#endif
+
+/* Returns the size class for a block of `size` bytes and stores its rounded size, or -1 if too large to pool. */
+static int DMDPoolSizeClass(size_t size, size_t *classSize)
+{
+	if (size <= ((size_t)1 << kDMDPoolMinShift))
+	{
+		*classSize = (size_t)1 << kDMDPoolMinShift;
+		return 0;
+	}
+	if (size > ((size_t)1 << kDMDPoolMaxShift))
+		return -1;
+	
+	unsigned shift = kDMDPoolMinShift;
+	while (((size_t)2 << shift) < size)
+		shift++;
+	/* Now 2^shift < size <= 2^(shift+1); split that range in four. */
+	size_t step = (size_t)1 << (shift - 2);
+	size_t quarter = (size - ((size_t)1 << shift) + step - 1) / step;
+	*classSize = ((size_t)1 << shift) + quarter * step;
+	return 4 * (shift - kDMDPoolMinShift) + (int)quarter;
+}
+
+static inline DMDFrameBlock *DMDFrameGetBlock(DMDFrame *frame)
+{
+	return (DMDFrameBlock *)frame - 1;
+}
+
+/* Each frame's generation starts at a fresh multiple of 2^32, so frames never share one. */
+static volatile unsigned long long gFrameGenerations = 0;
+
+static DMDFrame *DMDFrameInitBlock(DMDFrameBlock *block, DMDSize size)
+{
+	DMDFrame *frame = (DMDFrame *)(block + 1);
+	frame->size = size;
+	frame->buffer = (DMDColor *)(frame + 1);
+	frame->dirtyRect = DMDFrameGetBounds(frame);
+	frame->generation = __sync_add_and_fetch(&gFrameGenerations, 1) << 32;
+	return frame;
+}
+
+/* Allocates a frame whose dots are zeroed if `zero` is set, or left undefined otherwise. */
+static DMDFrame *DMDFrameAllocate(DMDSize size, int zero)
+{
+	if (size.width < 0 || size.height < 0)
+		return NULL;
+	
+	size_t bufferSize = sizeof(DMDColor) * size.width * size.height;
+	size_t blockSize = sizeof(DMDFrameBlock) + sizeof(DMDFrame) + bufferSize;
+	size_t classSize = blockSize;
+	int sizeClass = DMDPoolSizeClass(blockSize, &classSize);
+	DMDFrameBlock *block = NULL;
+	
+	DMDPoolLock();
+	if (sizeClass >= 0 && gPoolFreeLists[sizeClass] != NULL)
+	{
+		block = gPoolFreeLists[sizeClass];
+		gPoolFreeLists[sizeClass] = block->next;
+		gPoolCachedBytes -= block->blockSize;
+		gFrameStats.poolHits++;
+	}
+	else
+	{
+		gFrameStats.poolMisses++;
+	}
+	gFrameStats.live++;
+	DMDPoolUnlock();
+	
+	if (block != NULL)
+	{
+		DMDFrame *frame = DMDFrameInitBlock(block, size);
+		if (zero)
+			memset(frame->buffer, 0, bufferSize);
+		return frame;
+	}
+	
+	block = (DMDFrameBlock *)calloc(classSize, 1);
+	if (block == NULL)
+	{
+		DMDPoolLock();
+		gFrameStats.live--;
+		DMDPoolUnlock();
+		return NULL;
+	}
+	block->sizeClass = sizeClass;
+	block->flags = sizeClass >= 0 ? kDMDBlockPooled : 0;
+	block->blockSize = classSize;
+	return DMDFrameInitBlock(block, size);
+}
+
 DMDFrame *DMDFrameCreate(DMDSize size)
 {
-	/* Allocate the memory for the structure *and* the buffer at the same time.    *
-	 * Note that this means we only free the DMDFrame pointer when the time comes. */
-	unsigned char *ptr = (DMDColor *)calloc(sizeof(DMDFrame) + sizeof(DMDColor) * size.width * size.height, 1);
-	if (ptr == NULL)
-		return NULL;
-	
-	DMDFrame *frame = (DMDFrame *)ptr;
-	frame->size = size;
-	frame->buffer = (DMDColor *)(ptr + sizeof(DMDFrame));
-	
-	return frame;
+	return DMDFrameAllocate(size, 1);
+}
+
+void DMDFrameDelete(DMDFrame *frame)
+{
+	DMDFrameBlock *block = DMDFrameGetBlock(frame);
+	if (block->flags & kDMDBlockArena)
+		return; /* Reclaimed by DMDFrameArenaReset(). */
+	
+	frame->buffer = NULL;
+	
+	DMDPoolLock();
+	gFrameStats.live--;
+	if ((block->flags & kDMDBlockPooled) && gPoolCachedBytes + block->blockSize <= gPoolLimit)
+	{
+		block->next = gPoolFreeLists[block->sizeClass];
+		gPoolFreeLists[block->sizeClass] = block;
+		gPoolCachedBytes += block->blockSize;
+		block = NULL;
+	}
+	DMDPoolUnlock();
+	
+	if (block != NULL)
+		free(block);
+}
+
+DMDFrame *DMDFrameCreateWithBuffer(DMDSize size, DMDColor *buffer)
+{
+	if (size.width < 0 || size.height < 0)
+		return NULL;
+	
+	/* Just the header: not pooled, so DMDFrameDelete() frees it and leaves the dots alone. */
+	DMDFrameBlock *block = (DMDFrameBlock *)calloc(sizeof(DMDFrameBlock) + sizeof(DMDFrame), 1);
+	if (block == NULL)
+		return NULL;
+	block->blockSize = sizeof(DMDFrameBlock) + sizeof(DMDFrame);
+	
+	DMDFrame *frame = DMDFrameInitBlock(block, size);
+	frame->buffer = buffer;
+	
+	DMDPoolLock();
+	gFrameStats.live++;
+	DMDPoolUnlock();
+	return frame;
+}
+
+DMDFrame *DMDFrameCopy(DMDFrame *frame)
+{
+	DMDFrame *copy = DMDFrameAllocate(frame->size, 0);
+	if (copy == NULL)
+		return NULL;
+	memcpy(copy->buffer, frame->buffer, sizeof(DMDColor) * frame->size.width * frame->size.height);
+	return copy;
+}
+
+void DMDFrameGetStats(DMDFrameStats *stats)
+{
+	DMDPoolLock();
+	*stats = gFrameStats;
+	stats->pooledBytes = gPoolCachedBytes;
+	DMDPoolUnlock();
+}
+
+void DMDFramePoolSetLimit(size_t bytes)
+{
+	DMDPoolLock();
+	gPoolLimit = bytes;
+	int trim = gPoolCachedBytes > gPoolLimit;
+	DMDPoolUnlock();
+	if (trim)
+		DMDFramePoolTrim();
+}
+
+void DMDFramePoolTrim(void)
+{
+	DMDFrameBlock *freeLists[kDMDPoolSizeClasses];
+	int i;
+	
+	DMDPoolLock();
+	memcpy(freeLists, gPoolFreeLists, sizeof(freeLists));
+	memset(gPoolFreeLists, 0, sizeof(gPoolFreeLists));
+	gPoolCachedBytes = 0;
+	DMDPoolUnlock();
+	
+	for (i = 0; i < kDMDPoolSizeClasses; i++)
+	{
+		while (freeLists[i] != NULL)
+		{
+			DMDFrameBlock *block = freeLists[i];
+			freeLists[i] = block->next;
+			free(block);
+		}
+	}
+}
+
+
+struct _DMDFrameArena {
+	unsigned char *memory;
+	size_t capacity;
+	size_t used;
+};
+
+DMDFrameArena *DMDFrameArenaCreate(size_t capacity)
+{
+	DMDFrameArena *arena = (DMDFrameArena *)calloc(sizeof(DMDFrameArena), 1);
+	if (arena == NULL)
+		return NULL;
+	arena->memory = (unsigned char *)malloc(capacity);
+	if (arena->memory == NULL)
+	{
+		free(arena);
+		return NULL;
+	}
+	arena->capacity = capacity;
+	return arena;
+}
+
+void DMDFrameArenaDelete(DMDFrameArena *arena)
+{
+	free(arena->memory);
+	free(arena);
+}
+
+DMDFrame *DMDFrameArenaCreateFrame(DMDFrameArena *arena, DMDSize size)
+{
+	if (size.width < 0 || size.height < 0)
+		return NULL;
+	
+	size_t bufferSize = sizeof(DMDColor) * size.width * size.height;
+	size_t blockSize = sizeof(DMDFrameBlock) + sizeof(DMDFrame) + bufferSize;
+	blockSize = (blockSize + 15) & ~(size_t)15;
+	if (arena->used + blockSize > arena->capacity)
+		return NULL;
+	
+	DMDFrameBlock *block = (DMDFrameBlock *)(arena->memory + arena->used);
+	arena->used += blockSize;
+	block->next = NULL;
+	block->sizeClass = 0;
+	block->flags = kDMDBlockArena;
+	block->blockSize = blockSize;
+	
+	DMDFrame *frame = DMDFrameInitBlock(block, size);
+	memset(frame->buffer, 0, bufferSize);
+	return frame;
+}
+
+void DMDFrameArenaReset(DMDFrameArena *arena)
+{
+	arena->used = 0;
+}
+
+
+void DMDFrameMarkDirty(DMDFrame *frame, DMDRect rect)
+{
+	rect = DMDRectIntersection(DMDFrameGetBounds(frame), rect);
+	if (!DMDRectIsEmpty(rect))
+	{
+		frame->dirtyRect = DMDRectUnion(frame->dirtyRect, rect);
+		frame->generation++;
+	}
+}
+
+
+DMDRect DMDFrameGetBounds(DMDFrame *frame)
+{
+	return DMDRectMake(0, 0, frame->size.width, frame->size.height);
+}
+
+DMDSize DMDFrameGetSize(DMDFrame *frame)
+{
+	return frame->size;
+}
+
+unsigned DMDFrameGetBufferSize(DMDFrame *frame)
+{
+	return frame->size.width * frame->size.height * sizeof(DMDColor);
+}
+
+/**
+ * Worker Pool
+ * 
+ * Large fills and copies are split into bands of rows that are run on a pool of
+ * worker threads, with the calling thread taking bands too.  Each band writes its
+ * own rows with the same kernels as the inline path, so the result doesn't depend
+ * on how the work was split.  There are no workers until DMDSetWorkerCount() asks
+ * for some, and areas of fewer than the parallel threshold dots are always done
+ * inline, since waking the workers costs more than it saves on small rects.  Dots
+ * drawn with a table lookup mode count kDMDTableBlendCost times towards that.  Only
+ * one operation uses the pool at a time; others that arrive meanwhile run inline.
+ */
+
+typedef void (*DMDBandFunc)(void *context, DMDDimension minRow, DMDDimension maxRow);
+
+#define kDMDMaxWorkers (32)
+
+static unsigned gParallelThreshold = 64 * 1024;
+
+#define kDMDTableBlendCost (8)
+
+#if !defined(_WIN32)
+#include <pthread.h>
+#include <signal.h>
+#define DMD_HAVE_WORKERS 1
+
+static pthread_mutex_t gWorkerMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t gWorkerDispatchMutex = PTHREAD_MUTEX_INITIALIZER; /* Held by the thread running a job. */
+static pthread_cond_t gWorkerWake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t gWorkerDone = PTHREAD_COND_INITIALIZER;
+static pthread_t gWorkers[kDMDMaxWorkers];
+static unsigned gWorkerCount = 0;
+static int gWorkerShutdown = 0;
+
+typedef struct _DMDJob {
+	DMDBandFunc func;
+	void *context;
+	DMDDimension rows;
+	unsigned bands;
+	unsigned generation;
+} DMDJob;
+
+/* The current job; set up under gWorkerMutex, where each worker takes its own copy. */
+static DMDJob gJob;
+static volatile uint64_t gJobNextBand; /* The job's generation << 32 | the next band to claim. */
+static int gJobActive;          /* Workers still inside the current job. */
+
+/* Bands are claimed by compare and swap on the generation as well as the band, so a
+ * worker that is late for one job can't claim a band of the next. */
+static void DMDRunJobBands(const DMDJob *job)
+{
+	for (;;)
+	{
+		uint64_t next = gJobNextBand;
+		unsigned band = (unsigned)(next & 0xffffffff);
+		if ((unsigned)(next >> 32) != job->generation || band >= job->bands)
+			break;
+		if (__sync_val_compare_and_swap(&gJobNextBand, next, next + 1) != next)
+			continue;
+		DMDDimension minRow = (DMDDimension)((long long)job->rows * band / job->bands);
+		DMDDimension maxRow = (DMDDimension)((long long)job->rows * (band + 1) / job->bands);
+		job->func(job->context, minRow, maxRow);
+	}
+}
+
+static void *DMDWorkerMain(void *arg)
+{
+	DMDJob job;
+	(void)arg;
+	pthread_mutex_lock(&gWorkerMutex);
+	job = gJob;
+	for (;;)
+	{
+		while (gJob.generation == job.generation && !gWorkerShutdown)
+			pthread_cond_wait(&gWorkerWake, &gWorkerMutex);
+		if (gWorkerShutdown)
+			break;
+		job = gJob;
+		gJobActive++;
+		pthread_mutex_unlock(&gWorkerMutex);
+		
+		DMDRunJobBands(&job);
+		
+		pthread_mutex_lock(&gWorkerMutex);
+		if (--gJobActive == 0)
+			pthread_cond_signal(&gWorkerDone);
+	}
+	pthread_mutex_unlock(&gWorkerMutex);
+	return NULL;
+}
+
+static void DMDStopWorkers(void)
+{
+	unsigned i;
+	pthread_mutex_lock(&gWorkerMutex);
+	gWorkerShutdown = 1;
+	pthread_cond_broadcast(&gWorkerWake);
+	pthread_mutex_unlock(&gWorkerMutex);
+	for (i = 0; i < gWorkerCount; i++)
+		pthread_join(gWorkers[i], NULL);
+	gWorkerCount = 0;
+	gWorkerShutdown = 0;
+}
+#endif /* !_WIN32 */
+
+unsigned DMDSetWorkerCount(unsigned count)
+{
+#if DMD_HAVE_WORKERS
+	pthread_mutex_lock(&gWorkerDispatchMutex);
+	DMDStopWorkers();
+	count = MIN(count, kDMDMaxWorkers);
+	/* Workers start with every signal blocked, so that signals go to the application's threads. */
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	while (gWorkerCount < count && pthread_create(&gWorkers[gWorkerCount], NULL, DMDWorkerMain, NULL) == 0)
+		gWorkerCount++;
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	count = gWorkerCount;
+	pthread_mutex_unlock(&gWorkerDispatchMutex);
+	return count;
+#else
+	return 0;
+#endif
+}
+
+unsigned DMDGetWorkerCount(void)
+{
+#if DMD_HAVE_WORKERS
+	return gWorkerCount;
+#else
+	return 0;
+#endif
+}
+
+void DMDSetParallelThreshold(unsigned dots)
+{
+	gParallelThreshold = dots;
+}
+
+unsigned DMDGetParallelThreshold(void)
+{
+	return gParallelThreshold;
+}
+
+/* Calls func for bands covering rows [0, rows), on the workers if there's enough work for it to be worth it.
+ * rowCost is the width of a row in dots, scaled up for kernels that are slower than a plain copy. */
+static void DMDRunBands(DMDBandFunc func, void *context, DMDDimension rows, unsigned rowCost)
+{
+#if DMD_HAVE_WORKERS
+	if (gWorkerCount > 0 && rows > 1 && (long long)rows * rowCost >= gParallelThreshold &&
+		pthread_mutex_trylock(&gWorkerDispatchMutex) == 0)
+	{
+		if (gWorkerCount > 0)
+		{
+			DMDJob job;
+			pthread_mutex_lock(&gWorkerMutex);
+			gJob.func = func;
+			gJob.context = context;
+			gJob.rows = rows;
+			gJob.bands = MIN((unsigned)rows, 2 * (gWorkerCount + 1));
+			gJob.generation++;
+			job = gJob;
+			__sync_lock_test_and_set(&gJobNextBand, (uint64_t)job.generation << 32); /* A barrier too. */
+			pthread_cond_broadcast(&gWorkerWake);
+			pthread_mutex_unlock(&gWorkerMutex);
+			
+			DMDRunJobBands(&job);
+			
+			/* Every band has been claimed; wait for the workers that joined in to finish theirs. */
+			pthread_mutex_lock(&gWorkerMutex);
+			while (gJobActive > 0)
+				pthread_cond_wait(&gWorkerDone, &gWorkerMutex);
+			pthread_mutex_unlock(&gWorkerMutex);
+			pthread_mutex_unlock(&gWorkerDispatchMutex);
+			return;
+		}
+		pthread_mutex_unlock(&gWorkerDispatchMutex);
+	}
+#endif
+	func(context, 0, rows);
+}
+
+
+typedef struct _DMDFillRectJob {
+	DMDFrame *frame;
+	DMDRect rect;
+	DMDColor color;
+} DMDFillRectJob;
+
+static void DMDFillRectBand(void *context, DMDDimension minRow, DMDDimension maxRow)
+{
+	DMDFillRectJob *job = (DMDFillRectJob *)context;
+	DMDDimension y;
+	for (y = minRow; y < maxRow; y++)
+		memset(DMDFrameGetDotPointer(job->frame, DMDPointMake(job->rect.origin.x, job->rect.origin.y + y)), job->color, job->rect.size.width);
+}
+
+void DMDFrameFillRect(DMDFrame *frame, DMDRect rect, DMDColor color)
+{
+	rect = DMDRectIntersection(DMDFrameGetBounds(frame), rect);
+	if (DMDRectIsEmpty(rect))
+		return;
+	
+	DMDFillRectJob job = { frame, rect, color };
+	DMDRunBands(DMDFillRectBand, &job, rect.size.height, rect.size.width);
+	
+	DMDFrameMarkDirty(frame, rect);
+}
+
+/**
+ * Blend Kernels
+ * 
+ * Each blend mode is implemented as a function that blends one row of dots from
+ * src into dst, given the lookup table of the mode if it has one.  The scalar
+ * versions are the reference implementations; the SSE2 and AVX2 versions must
+ * produce exactly the same output and fall back to the scalar code for any tail
+ * or for cases they don't handle.
+ */
+
+typedef void (*DMDRowBlendFunc)(DMDColor *dst, const DMDColor *src, DMDDimension width, const DMDColor *table);
+
+/* The alpha map is generated at build time by gendmdtables.py (see dmdtables.c), along
+ * with the properties of it that the vector kernels rely on.  The fast paths are only
+ * used if they hold. */
+extern const DMDColor gDMDAlphaMap[256 * 256];
+extern const int gDMDAlphaClearKeepsDst;    /* 'alpha': src alpha 0x0 leaves the dst dot alone. */
+extern const int gDMDAlphaOpaqueTakesSrc;   /* 'alpha': src alpha 0xf replaces the dst dot. */
+extern const int gDMDAlphaBothOpaqueIsSrc;  /* 'alphaboth': src alpha 0xf yields the src value. */
+
+/* The scalar loops are written forwards, so a src row that overlaps dst slightly to the
+ * left sees values written earlier in the same row.  Vector kernels must not reorder that. */
+static inline int DMDRowOverlapsForward(DMDColor *dst, const DMDColor *src, DMDDimension width)
+{
+	return src < dst && dst < src + width;
+}
+
+static void DMDBlendRowCopy(DMDColor *dst, const DMDColor *src, DMDDimension width, const DMDColor *table)
+{
+	(void)table;
+	memcpy(dst, src, width);
+}
+
+static void DMDBlendRowAddScalar(DMDColor *dst, const DMDColor *src, DMDDimension width, const DMDColor *table)
+{
+	DMDDimension x;
+	(void)table;
+	for (x = 0; x < width; x++)
+		dst[x] = MIN(dst[x] + src[x], 0xF);
+}
+
+static void DMDBlendRowSubtractScalar(DMDColor *dst, const DMDColor *src, DMDDimension width, const DMDColor *table)
+{
+	DMDDimension x;
+	(void)table;
+	for (x = 0; x < width; x++)
+		dst[x] = MAX(dst[x] - src[x], 0);
+}
+
+static void DMDBlendRowBlackSourceScalar(DMDColor *dst, const DMDColor *src, DMDDimension width, const DMDColor *table)
+{
+	DMDDimension x;
+	(void)table;
+	for (x = 0; x < width; x++)
+	{
+		// Only write dots into black dots.
+		if ((src[x] & 0xf) != 0)
+			dst[x] = (dst[x] & 0xf0) | (src[x] & 0xf);
+	}
+}
+
+static void DMDBlendRowAlphaScalar(DMDColor *dst, const DMDColor *src, DMDDimension width, const DMDColor *table)
+{
+	DMDDimension x;
+	for (x = 0; x < width; x++)
+	{
+		DMDColor dstValue = dst[x];
+		DMDColor srcValue = src[x];
+		
+		// Use the alpha map for 'alphaboth', but act as if the dst frame has
+		// alpha of 0xf and preserve its original alpha value.
+		
+		DMDColor v = table[(unsigned char)srcValue * 256 + (unsigned char)(dstValue | 0xf0)];
+		
+		dst[x] = (dstValue & 0xf0) | (v & 0x0f);
+	}
+}
+
+static void DMDBlendRowAlphaBothScalar(DMDColor *dst, const DMDColor *src, DMDDimension width, const DMDColor *table)
+{
+	DMDDimension x;
+	for (x = 0; x < width; x++)
+		dst[x] = table[(unsigned char)src[x] * 256 + (unsigned char)dst[x]];
+}
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define DMD_X86_KERNELS 1
+#include <immintrin.h>
+
+/* SSE2 kernels: 16 dots per iteration. */
+
+__attribute__((target("sse2")))
+static void DMDBlendRowAddSSE2(DMDColor *dst, const DMDColor *src, DMDDimension width, const DMDColor *table)
+{
+	DMDDimension x = 0;
+	if (!DMDRowOverlapsForward(dst, src, width))
+	{
+		const __m128i max = _mm_set1_epi8(0x0f);
+		for (; x + 16 <= width; x += 16)
+		{
+			__m128i s = _mm_loadu_si128((const __m128i *)(src + x));
+			__m128i d = _mm_loadu_si128((const __m128i *)(dst + x));
+			_mm_storeu_si128((__m128i *)(dst + x), _mm_min_epu8(_mm_adds_epu8(d, s), max));
+		}
+	}
+	DMDBlendRowAddScalar(dst + x, src + x, width - x, table);
+}
+
+__attribute__((target("sse2")))
+static void DMDBlendRowSubtractSSE2(DMDColor *dst, const DMDColor *src, DMDDimension width, const DMDColor *table)
+{
+	DMDDimension x = 0;
+	if (!DMDRowOverlapsForward(dst, src, width))
+	{
+		for (; x + 16 <= width; x += 16)
+		{
+			__m128i s = _mm_loadu_si128((const __m128i *)(src + x));
+			__m128i d = _mm_loadu_si128((const __m128i *)(dst + x));
+			_mm_storeu_si128((__m128i *)(dst + x), _mm_subs_epu8(d, s));
+		}
+	}
+	DMDBlendRowSubtractScalar(dst + x, src + x, width - x, table);
+}
+
+__attribute__((target("sse2")))
+static void DMDBlendRowBlackSourceSSE2(DMDColor *dst, const DMDColor *src, DMDDimension width, const DMDColor *table)
+{
+	DMDDimension x = 0;
+	if (!DMDRowOverlapsForward(dst, src, width))
+	{
+		const __m128i lo = _mm_set1_epi8(0x0f);
+		const __m128i hi = _mm_set1_epi8((char)0xf0);
+		const __m128i zero = _mm_setzero_si128();
+		for (; x + 16 <= width; x += 16)
+		{
+			__m128i s = _mm_and_si128(_mm_loadu_si128((const __m128i *)(src + x)), lo);
+			__m128i d = _mm_loadu_si128((const __m128i *)(dst + x));
+			__m128i keep = _mm_cmpeq_epi8(s, zero);
+			__m128i blended = _mm_or_si128(_mm_and_si128(d, hi), s);
+			_mm_storeu_si128((__m128i *)(dst + x), _mm_or_si128(_mm_and_si128(keep, d), _mm_andnot_si128(keep, blended)));
+		}
+	}
+	DMDBlendRowBlackSourceScalar(dst + x, src + x, width - x, table);
+}
+
+/* The alpha kernels vectorize the common case of fully clear or fully opaque src dots
+ * (sprites and fonts with a mask) and use the alpha map for any other block of dots. */
+
+__attribute__((target("sse2")))
+static void DMDBlendRowAlphaSSE2(DMDColor *dst, const DMDColor *src, DMDDimension width, const DMDColor *table)
+{
+	DMDDimension x = 0;
+	if (gDMDAlphaClearKeepsDst && gDMDAlphaOpaqueTakesSrc && !DMDRowOverlapsForward(dst, src, width))
+	{
+		const __m128i lo = _mm_set1_epi8(0x0f);
+		const __m128i hi = _mm_set1_epi8((char)0xf0);
+		const __m128i zero = _mm_setzero_si128();
+		for (; x + 16 <= width; x += 16)
+		{
+			__m128i s = _mm_loadu_si128((const __m128i *)(src + x));
+			__m128i a = _mm_and_si128(s, hi);
+			__m128i opaque = _mm_cmpeq_epi8(a, hi);
+			if (_mm_movemask_epi8(_mm_or_si128(opaque, _mm_cmpeq_epi8(a, zero))) != 0xffff)
+			{
+				DMDBlendRowAlphaScalar(dst + x, src + x, 16, table);
+				continue;
+			}
+			__m128i d = _mm_loadu_si128((const __m128i *)(dst + x));
+			__m128i blended = _mm_or_si128(_mm_and_si128(d, hi), _mm_and_si128(s, lo));
+			_mm_storeu_si128((__m128i *)(dst + x), _mm_or_si128(_mm_and_si128(opaque, blended), _mm_andnot_si128(opaque, d)));
+		}
+	}
+	DMDBlendRowAlphaScalar(dst + x, src + x, width - x, table);
+}
+
+__attribute__((target("sse2")))
+static void DMDBlendRowAlphaBothSSE2(DMDColor *dst, const DMDColor *src, DMDDimension width, const DMDColor *table)
+{
+	DMDDimension x = 0;
+	if (gDMDAlphaBothOpaqueIsSrc && !DMDRowOverlapsForward(dst, src, width))
+	{
+		const __m128i hi = _mm_set1_epi8((char)0xf0);
+		for (; x + 16 <= width; x += 16)
+		{
+			__m128i s = _mm_loadu_si128((const __m128i *)(src + x));
+			if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(s, hi), hi)) != 0xffff)
+			{
+				DMDBlendRowAlphaBothScalar(dst + x, src + x, 16, table);
+				continue;
+			}
+			_mm_storeu_si128((__m128i *)(dst + x), s);
+		}
+	}
+	DMDBlendRowAlphaBothScalar(dst + x, src + x, width - x, table);
+}
+
+/* AVX2 kernels: 32 dots per iteration.  Each finishes the row with the SSE2 (or
+ * scalar) kernel. */
+
+__attribute__((target("avx2")))
+static void DMDBlendRowAddAVX2(DMDColor *dst, const DMDColor *src, DMDDimension width, const DMDColor *table)
+{
+	DMDDimension x = 0;
+	if (!DMDRowOverlapsForward(dst, src, width))
+	{
+		const __m256i max = _mm256_set1_epi8(0x0f);
+		for (; x + 32 <= width; x += 32)
+		{
+			__m256i s = _mm256_loadu_si256((const __m256i *)(src + x));
+			__m256i d = _mm256_loadu_si256((const __m256i *)(dst + x));
+			_mm256_storeu_si256((__m256i *)(dst + x), _mm256_min_epu8(_mm256_adds_epu8(d, s), max));
+		}
+	}
+	DMDBlendRowAddSSE2(dst + x, src + x, width - x, table);
+}
+
+__attribute__((target("avx2")))
+static void DMDBlendRowSubtractAVX2(DMDColor *dst, const DMDColor *src, DMDDimension width, const DMDColor *table)
+{
+	DMDDimension x = 0;
+	if (!DMDRowOverlapsForward(dst, src, width))
+	{
+		for (; x + 32 <= width; x += 32)
+		{
+			__m256i s = _mm256_loadu_si256((const __m256i *)(src + x));
+			__m256i d = _mm256_loadu_si256((const __m256i *)(dst + x));
+			_mm256_storeu_si256((__m256i *)(dst + x), _mm256_subs_epu8(d, s));
+		}
+	}
+	DMDBlendRowSubtractSSE2(dst + x, src + x, width - x, table);
+}
+
+__attribute__((target("avx2")))
+static void DMDBlendRowBlackSourceAVX2(DMDColor *dst, const DMDColor *src, DMDDimension width, const DMDColor *table)
+{
+	DMDDimension x = 0;
+	if (!DMDRowOverlapsForward(dst, src, width))
+	{
+		const __m256i lo = _mm256_set1_epi8(0x0f);
+		const __m256i hi = _mm256_set1_epi8((char)0xf0);
+		const __m256i zero = _mm256_setzero_si256();
+		for (; x + 32 <= width; x += 32)
+		{
+			__m256i s = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(src + x)), lo);
+			__m256i d = _mm256_loadu_si256((const __m256i *)(dst + x));
+			__m256i keep = _mm256_cmpeq_epi8(s, zero);
+			__m256i blended = _mm256_or_si256(_mm256_and_si256(d, hi), s);
+			_mm256_storeu_si256((__m256i *)(dst + x), _mm256_blendv_epi8(blended, d, keep));
+		}
+	}
+	DMDBlendRowBlackSourceSSE2(dst + x, src + x, width - x, table);
+}
+
+__attribute__((target("avx2")))
+static void DMDBlendRowAlphaAVX2(DMDColor *dst, const DMDColor *src, DMDDimension width, const DMDColor *table)
+{
+	DMDDimension x = 0;
+	if (gDMDAlphaClearKeepsDst && gDMDAlphaOpaqueTakesSrc && !DMDRowOverlapsForward(dst, src, width))
+	{
+		const __m256i lo = _mm256_set1_epi8(0x0f);
+		const __m256i hi = _mm256_set1_epi8((char)0xf0);
+		const __m256i zero = _mm256_setzero_si256();
+		for (; x + 32 <= width; x += 32)
+		{
+			__m256i s = _mm256_loadu_si256((const __m256i *)(src + x));
+			__m256i a = _mm256_and_si256(s, hi);
+			__m256i opaque = _mm256_cmpeq_epi8(a, hi);
+			if (_mm256_movemask_epi8(_mm256_or_si256(opaque, _mm256_cmpeq_epi8(a, zero))) != -1)
+			{
+				DMDBlendRowAlphaSSE2(dst + x, src + x, 32, table);
+				continue;
+			}
+			__m256i d = _mm256_loadu_si256((const __m256i *)(dst + x));
+			__m256i blended = _mm256_or_si256(_mm256_and_si256(d, hi), _mm256_and_si256(s, lo));
+			_mm256_storeu_si256((__m256i *)(dst + x), _mm256_blendv_epi8(d, blended, opaque));
+		}
+	}
+	DMDBlendRowAlphaSSE2(dst + x, src + x, width - x, table);
+}
+
+__attribute__((target("avx2")))
+static void DMDBlendRowAlphaBothAVX2(DMDColor *dst, const DMDColor *src, DMDDimension width, const DMDColor *table)
+{
+	DMDDimension x = 0;
+	if (gDMDAlphaBothOpaqueIsSrc && !DMDRowOverlapsForward(dst, src, width))
+	{
+		const __m256i hi = _mm256_set1_epi8((char)0xf0);
+		for (; x + 32 <= width; x += 32)
+		{
+			__m256i s = _mm256_loadu_si256((const __m256i *)(src + x));
+			if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(s, hi), hi)) != -1)
+			{
+				DMDBlendRowAlphaBothSSE2(dst + x, src + x, 32, table);
+				continue;
+			}
+			_mm256_storeu_si256((__m256i *)(dst + x), s);
+		}
+	}
+	DMDBlendRowAlphaBothSSE2(dst + x, src + x, width - x, table);
+}
+
+#endif /* DMD_X86_KERNELS */
+
+#define kDMDBlendModeCount (6)
+
+static const DMDRowBlendFunc gBlendFuncsScalar[kDMDBlendModeCount] = {
+	DMDBlendRowCopy, DMDBlendRowAddScalar, DMDBlendRowSubtractScalar,
+	DMDBlendRowBlackSourceScalar, DMDBlendRowAlphaScalar, DMDBlendRowAlphaBothScalar,
+};
+#if DMD_X86_KERNELS
+static const DMDRowBlendFunc gBlendFuncsSSE2[kDMDBlendModeCount] = {
+	DMDBlendRowCopy, DMDBlendRowAddSSE2, DMDBlendRowSubtractSSE2,
+	DMDBlendRowBlackSourceSSE2, DMDBlendRowAlphaSSE2, DMDBlendRowAlphaBothSSE2,
+};
+static const DMDRowBlendFunc gBlendFuncsAVX2[kDMDBlendModeCount] = {
+	DMDBlendRowCopy, DMDBlendRowAddAVX2, DMDBlendRowSubtractAVX2,
+	DMDBlendRowBlackSourceAVX2, DMDBlendRowAlphaAVX2, DMDBlendRowAlphaBothAVX2,
+};
+#endif
+
+static int gKernelLevel = -1; /* Not yet detected. */
+static const DMDRowBlendFunc *gBlendFuncs = gBlendFuncsScalar;
+
+static DMDKernelLevel DMDGetSupportedKernelLevel(void)
+{
+#if DMD_X86_KERNELS
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return DMDKernelLevelAVX2;
+	if (__builtin_cpu_supports("sse2"))
+		return DMDKernelLevelSSE2;
+#endif
+	return DMDKernelLevelScalar;
+}
+
+DMDKernelLevel DMDSetKernelLevel(DMDKernelLevel level)
+{
+	DMDKernelLevel supported = DMDGetSupportedKernelLevel();
+	if (level > supported)
+		level = supported;
+	
+	switch (level)
+	{
+#if DMD_X86_KERNELS
+		case DMDKernelLevelAVX2: gBlendFuncs = gBlendFuncsAVX2; break;
+		case DMDKernelLevelSSE2: gBlendFuncs = gBlendFuncsSSE2; break;
+#endif
+		default: level = DMDKernelLevelScalar; gBlendFuncs = gBlendFuncsScalar; break;
+	}
+	gKernelLevel = level;
+	return level;
+}
+
+DMDKernelLevel DMDGetKernelLevel(void)
+{
+	if (gKernelLevel < 0)
+		DMDSetKernelLevel(DMDKernelLevelAVX2);
+	return (DMDKernelLevel)gKernelLevel;
+}
+
+/* Blend modes registered at runtime are table lookups, like 'alphaboth', so they run
+ * through its scalar kernel with their own table.  Slots are claimed atomically and
+ * a mode only becomes visible once its table has been stored. */
+
+#define kDMDCustomBlendModeCount (16)
+
+static const DMDColor *volatile gCustomBlendTables[kDMDCustomBlendModeCount];
+static volatile int gCustomBlendModesClaimed = 0;
+
+#if defined(__GNUC__) || defined(__clang__)
+#define DMDAtomicIncrement(p) __sync_fetch_and_add((p), 1)
+#define DMDMemoryBarrier()    __sync_synchronize()
+#else
+#define DMDAtomicIncrement(p) ((*(p))++)
+#define DMDMemoryBarrier()
+#endif
+
+DMDBlendMode DMDBlendModeRegister(const DMDColor *table)
+{
+	int slot = DMDAtomicIncrement(&gCustomBlendModesClaimed);
+	if (slot >= kDMDCustomBlendModeCount)
+		return (DMDBlendMode)-1;
+	
+	DMDColor *copy = (DMDColor *)malloc(256 * 256);
+	if (copy == NULL)
+		return (DMDBlendMode)-1; /* The slot is wasted, but that is the least of our worries. */
+	memcpy(copy, table, 256 * 256);
+	DMDMemoryBarrier();
+	gCustomBlendTables[slot] = copy;
+	return (DMDBlendMode)(kDMDBlendModeCount + slot);
+}
+
+int DMDBlendModeIsValid(DMDBlendMode blendMode)
+{
+	unsigned mode = (unsigned)blendMode;
+	if (mode < kDMDBlendModeCount)
+		return 1;
+	mode -= kDMDBlendModeCount;
+	return mode < kDMDCustomBlendModeCount && gCustomBlendTables[mode] != NULL;
+}
+
+void DMDBlendTableInit(DMDColor *table, DMDBlendTableKind kind, unsigned char opacity)
+{
+	unsigned src, dst;
+	for (src = 0; src < 256; src++)
+	{
+		for (dst = 0; dst < 256; dst++)
+		{
+			unsigned s = src & 0x0f, d = dst & 0x0f, v;
+			switch (kind)
+			{
+				case DMDBlendTableMultiply: v = (s * d + 7) / 15; break;
+				case DMDBlendTableScreen:   v = 15 - ((15 - s) * (15 - d) + 7) / 15; break;
+				case DMDBlendTableMin:      v = MIN(s, d); break;
+				case DMDBlendTableMax:      v = MAX(s, d); break;
+				default:                    v = (s * opacity + d * (255 - opacity) + 127) / 255; break;
+			}
+			/* Like 'alpha', keep the dst alpha. */
+			table[src * 256 + dst] = (DMDColor)((dst & 0xf0) | v);
+		}
+	}
+}
+
+/* Returns the kernel for blendMode and sets *table to the table it needs, or returns NULL for an unknown mode. */
+static DMDRowBlendFunc DMDGetRowBlendFunc(DMDBlendMode blendMode, const DMDColor **table)
+{
+	unsigned mode = (unsigned)blendMode;
+	DMDGetKernelLevel();
+	if (mode < kDMDBlendModeCount)
+	{
+		*table = gDMDAlphaMap;
+		return gBlendFuncs[mode];
+	}
+	mode -= kDMDBlendModeCount;
+	if (mode >= kDMDCustomBlendModeCount || (*table = gCustomBlendTables[mode]) == NULL)
+		return NULL;
+	return DMDBlendRowAlphaBothScalar;
+}
+
+/* Clips srcRect, drawn at dstPoint, against the bounds of both frames.  Returns 0 if there is nothing to draw. */
+static int DMDClipCopyRectToBounds(DMDRect srcBounds, DMDRect *srcRect, DMDRect dstBounds, DMDPoint dstPoint, DMDRect *dstRect)
+{
+	*srcRect = DMDRectIntersection(srcBounds, *srcRect);
+	*dstRect = DMDRectIntersection(dstBounds, DMDRectMake(dstPoint.x, dstPoint.y, srcRect->size.width, srcRect->size.height));
+	// Short term fix for negative destination points:
+	if (dstPoint.x < 0)
+	{
+		srcRect->origin.x += -dstPoint.x;
+		srcRect->size.width -= -dstPoint.x;
+	}
+	if (dstPoint.y < 0)
+	{
+		srcRect->origin.y += -dstPoint.y;
+		srcRect->size.height -= -dstPoint.y;
+	}
+	if (srcRect->size.width == 0 || srcRect->size.height == 0)
+		return 0; /* nothing to do */
+	return 1;
+}
+
+static int DMDClipCopyRect(DMDFrame *src, DMDRect *srcRect, DMDFrame *dst, DMDPoint dstPoint, DMDRect *dstRect)
+{
+	return DMDClipCopyRectToBounds(DMDFrameGetBounds(src), srcRect, DMDFrameGetBounds(dst), dstPoint, dstRect);
+}
+
+typedef struct _DMDCopyRectJob {
+	DMDFrame *src, *dst;
+	DMDRect srcRect, dstRect;
+	DMDRowBlendFunc blendRow;
+	const DMDColor *table;
+	unsigned weight; /* Opacity for DMDCopyRectWithOpacityBand(), 0-256. */
+} DMDCopyRectJob;
+
+/* Rows of a copy within one buffer may read rows written earlier in the same copy, so those must run in order. */
+static int DMDCopyRectCanSplit(DMDCopyRectJob *job)
+{
+	const DMDColor *src = job->src->buffer, *dst = job->dst->buffer;
+	return src + DMDFrameGetBufferSize(job->src) <= dst || dst + DMDFrameGetBufferSize(job->dst) <= src;
+}
+
+static unsigned DMDCopyRectRowCost(DMDCopyRectJob *job, DMDBlendMode blendMode)
+{
+	unsigned width = (unsigned)job->dstRect.size.width;
+	return blendMode >= DMDBlendModeAlpha ? width * kDMDTableBlendCost : width;
+}
+
+static void DMDCopyRectBand(void *context, DMDDimension minRow, DMDDimension maxRow)
+{
+	DMDCopyRectJob *job = (DMDCopyRectJob *)context;
+	DMDDimension y;
+	
+	for (y = minRow; y < maxRow; y++)
+	{
+		DMDColor *srcPtr = DMDFrameGetDotPointer(job->src, DMDPointMake(job->srcRect.origin.x, job->srcRect.origin.y + y));
+		DMDColor *dstPtr = DMDFrameGetDotPointer(job->dst, DMDPointMake(job->dstRect.origin.x, job->dstRect.origin.y + y));
+		job->blendRow(dstPtr, srcPtr, job->dstRect.size.width, job->table);
+	}
+}
+
+void DMDFrameCopyRect(DMDFrame *src, DMDRect srcRect, DMDFrame *dst, DMDPoint dstPoint, DMDBlendMode blendMode)
+{
+	DMDCopyRectJob job;
+	if (!DMDClipCopyRect(src, &srcRect, dst, dstPoint, &job.dstRect))
+		return;
+	
+	job.blendRow = DMDGetRowBlendFunc(blendMode, &job.table);
+	if (job.blendRow == NULL)
+		return;
+	job.src = src;
+	job.dst = dst;
+	job.srcRect = srcRect;
+	
+	if (DMDCopyRectCanSplit(&job))
+		DMDRunBands(DMDCopyRectBand, &job, job.dstRect.size.height, DMDCopyRectRowCost(&job, blendMode));
+	else
+		DMDCopyRectBand(&job, 0, job.dstRect.size.height);
+	
+	DMDFrameMarkDirty(dst, job.dstRect);
+}
+
+void DMDFrameCopyRects(DMDFrame *src, const DMDRect *srcRects, unsigned srcRectCount, DMDFrame *dst, const DMDPoint *dstPoints, unsigned count, DMDBlendMode blendMode)
+{
+	DMDCopyRectJob job;
+	DMDRect srcBounds = DMDFrameGetBounds(src), dstBounds = DMDFrameGetBounds(dst);
+	DMDRect dirtyRect = DMDRectMake(0, 0, 0, 0);
+	unsigned i;
+	
+	job.blendRow = DMDGetRowBlendFunc(blendMode, &job.table);
+	if (job.blendRow == NULL)
+		return;
+	job.src = src;
+	job.dst = dst;
+	int canSplit = DMDCopyRectCanSplit(&job);
+	
+	for (i = 0; i < count; i++)
+	{
+		job.srcRect = srcRects[srcRectCount == 1 ? 0 : i];
+		if (!DMDClipCopyRectToBounds(srcBounds, &job.srcRect, dstBounds, dstPoints[i], &job.dstRect))
+			continue;
+		/* Sprites are rarely big enough for the workers, so only go through DMDRunBands() for large rects. */
+		if (canSplit && (long long)job.dstRect.size.width * job.dstRect.size.height >= DMDGetParallelThreshold())
+			DMDRunBands(DMDCopyRectBand, &job, job.dstRect.size.height, DMDCopyRectRowCost(&job, blendMode));
+		else
+			DMDCopyRectBand(&job, 0, job.dstRect.size.height);
+		dirtyRect = DMDRectUnion(dirtyRect, job.dstRect);
+	}
+	
+	if (!DMDRectIsEmpty(dirtyRect))
+		DMDFrameMarkDirty(dst, dirtyRect);
+}
+
+/* Moves each nibble of dst towards the same nibble of blended by weight/256. */
+static void DMDLerpRow(DMDColor *dst, const DMDColor *blended, DMDDimension width, unsigned weight)
+{
+	DMDDimension x;
+	for (x = 0; x < width; x++)
+	{
+		int d = dst[x], b = blended[x];
+		int lo = (d & 0x0f) + ((((b & 0x0f) - (d & 0x0f)) * (int)weight + 128) >> 8);
+		int hi = (d >> 4) + ((((b >> 4) - (d >> 4)) * (int)weight + 128) >> 8);
+		dst[x] = (DMDColor)((hi << 4) | lo);
+	}
+}
+
+static void DMDCopyRectWithOpacityBand(void *context, DMDDimension minRow, DMDDimension maxRow)
+{
+	DMDCopyRectJob *job = (DMDCopyRectJob *)context;
+	DMDDimension width = job->dstRect.size.width;
+	DMDDimension x, y;
+	
+	/* Blend into a copy of each row, then mix that back into dst. */
+	DMDColor scratch[256];
+	for (y = minRow; y < maxRow; y++)
+	{
+		DMDColor *srcPtr = DMDFrameGetDotPointer(job->src, DMDPointMake(job->srcRect.origin.x, job->srcRect.origin.y + y));
+		DMDColor *dstPtr = DMDFrameGetDotPointer(job->dst, DMDPointMake(job->dstRect.origin.x, job->dstRect.origin.y + y));
+		for (x = 0; x < width; x += sizeof(scratch))
+		{
+			DMDDimension n = MIN(width - x, (DMDDimension)sizeof(scratch));
+			memcpy(scratch, dstPtr + x, n);
+			job->blendRow(scratch, srcPtr + x, n, job->table);
+			DMDLerpRow(dstPtr + x, scratch, n, job->weight);
+		}
+	}
+}
+
+void DMDFrameCopyRectWithOpacity(DMDFrame *src, DMDRect srcRect, DMDFrame *dst, DMDPoint dstPoint, DMDBlendMode blendMode, unsigned char opacity)
+{
+	if (opacity == 0xff)
+	{
+		DMDFrameCopyRect(src, srcRect, dst, dstPoint, blendMode);
+		return;
+	}
+	if (opacity == 0)
+		return;
+	
+	DMDCopyRectJob job;
+	if (!DMDClipCopyRect(src, &srcRect, dst, dstPoint, &job.dstRect))
+		return;
+	
+	job.blendRow = DMDGetRowBlendFunc(blendMode, &job.table);
+	if (job.blendRow == NULL)
+		return;
+	job.src = src;
+	job.dst = dst;
+	job.srcRect = srcRect;
+	job.weight = opacity + (opacity >> 7); /* 0-255 -> 0-256 */
+	
+	if (DMDCopyRectCanSplit(&job))
+		DMDRunBands(DMDCopyRectWithOpacityBand, &job, job.dstRect.size.height, DMDCopyRectRowCost(&job, blendMode));
+	else
+		DMDCopyRectWithOpacityBand(&job, 0, job.dstRect.size.height);
+	
+	DMDFrameMarkDirty(dst, job.dstRect);
+}
+
+void DMDFrameCompositeLayers(DMDFrame *dst, const DMDLayer *layers, unsigned count)
+{
+	unsigned i;
+	for (i = 0; i < count; i++)
+	{
+		const DMDLayer *layer = &layers[i];
+		if (layer->frame == NULL)
+			continue;
+		DMDFrameCopyRectWithOpacity(layer->frame, layer->srcRect, dst, layer->dstPoint, layer->blendMode, layer->opacity);
+	}
+}
+
+
+
+/**
+ * Transforms
+ * 
+ * Transforms build their result in a pooled scratch frame a row at a time, using
+ * memcpy() where rows or runs of dots just move, then draw it with the normal
+ * blend kernels.  That makes in-place transforms safe and keeps the blend modes,
+ * clipping and dirty tracking in one place.
+ */
+
+static void DMDReverseRowScalar(DMDColor *dst, const DMDColor *src, DMDDimension width)
+{
+	DMDDimension x;
+	for (x = 0; x < width; x++)
+		dst[x] = src[width - 1 - x];
+}
+
+#if DMD_X86_KERNELS
+__attribute__((target("sse2")))
+static void DMDReverseRowSSE2(DMDColor *dst, const DMDColor *src, DMDDimension width)
+{
+	DMDDimension x = 0;
+	for (; x + 16 <= width; x += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + width - 16 - x));
+		v = _mm_shuffle_epi32(v, 0x1B);     /* Reverse the dwords, */
+		v = _mm_shufflelo_epi16(v, 0xB1);   /* the words within them, */
+		v = _mm_shufflehi_epi16(v, 0xB1);
+		v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8)); /* and the bytes within those. */
+		_mm_storeu_si128((__m128i *)(dst + x), v);
+	}
+	DMDReverseRowScalar(dst + x, src, width - x);
+}
+
+__attribute__((target("avx2")))
+static void DMDReverseRowAVX2(DMDColor *dst, const DMDColor *src, DMDDimension width)
+{
+	const __m256i reverse = _mm256_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+	                                         15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+	DMDDimension x = 0;
+	for (; x + 32 <= width; x += 32)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i *)(src + width - 32 - x));
+		v = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(v, reverse), 0x4E);
+		_mm256_storeu_si256((__m256i *)(dst + x), v);
+	}
+	DMDReverseRowSSE2(dst + x, src, width - x);
+}
+#endif /* DMD_X86_KERNELS */
+
+static void DMDReverseRow(DMDColor *dst, const DMDColor *src, DMDDimension width)
+{
+	switch (DMDGetKernelLevel())
+	{
+#if DMD_X86_KERNELS
+		case DMDKernelLevelAVX2: DMDReverseRowAVX2(dst, src, width); break;
+		case DMDKernelLevelSSE2: DMDReverseRowSSE2(dst, src, width); break;
+#endif
+		default: DMDReverseRowScalar(dst, src, width); break;
+	}
+}
+
+/* Draws a finished scratch frame and returns it to the pool. */
+static void DMDFrameDrawTransformed(DMDFrame *result, DMDFrame *to, DMDPoint toPoint, DMDBlendMode blendMode)
+{
+	DMDFrameCopyRect(result, DMDFrameGetBounds(result), to, toPoint, blendMode);
+	DMDFrameDelete(result);
+}
+
+void DMDFrameScroll(DMDFrame *from, DMDFrame *to, DMDPoint toPoint, DMDPoint offset, DMDBlendMode blendMode)
+{
+	DMDDimension width = from->size.width, height = from->size.height;
+	if (width == 0 || height == 0)
+		return;
+	DMDFrame *result = DMDFrameAllocate(from->size, 0);
+	if (result == NULL)
+		return;
+	
+	DMDDimension dx = ((offset.x % width) + width) % width;
+	DMDDimension dy = ((offset.y % height) + height) % height;
+	DMDDimension y;
+	for (y = 0; y < height; y++)
+	{
+		const DMDColor *src = &from->buffer[(size_t)((y + height - dy) % height) * width];
+		DMDColor *dst = &result->buffer[(size_t)y * width];
+		memcpy(dst + dx, src, width - dx);
+		memcpy(dst, src + width - dx, dx);
+	}
+	DMDFrameDrawTransformed(result, to, toPoint, blendMode);
+}
+
+void DMDFrameFlip(DMDFrame *from, DMDFrame *to, DMDPoint toPoint, unsigned flip, DMDBlendMode blendMode)
+{
+	DMDDimension width = from->size.width, height = from->size.height;
+	DMDFrame *result = DMDFrameAllocate(from->size, 0);
+	if (result == NULL)
+		return;
+	
+	DMDDimension y;
+	for (y = 0; y < height; y++)
+	{
+		DMDDimension srcY = (flip & DMDFlipVertical) ? height - 1 - y : y;
+		const DMDColor *src = &from->buffer[(size_t)srcY * width];
+		DMDColor *dst = &result->buffer[(size_t)y * width];
+		if (flip & DMDFlipHorizontal)
+			DMDReverseRow(dst, src, width);
+		else
+			memcpy(dst, src, width);
+	}
+	DMDFrameDrawTransformed(result, to, toPoint, blendMode);
+}
+
+void DMDFrameRotate(DMDFrame *from, DMDFrame *to, DMDPoint toPoint, int quarterTurns, DMDBlendMode blendMode)
+{
+	DMDDimension width = from->size.width, height = from->size.height;
+	quarterTurns = ((quarterTurns % 4) + 4) % 4;
+	if (quarterTurns == 0 || quarterTurns == 2)
+	{
+		DMDFrameFlip(from, to, toPoint, quarterTurns ? DMDFlipHorizontal|DMDFlipVertical : 0, blendMode);
+		return;
+	}
+	
+	DMDFrame *result = DMDFrameAllocate(DMDSizeMake(height, width), 0);
+	if (result == NULL)
+		return;
+	
+	/* Each row of the result is a column of the source, read bottom up (clockwise) or top down. */
+	DMDDimension x, y;
+	for (y = 0; y < width; y++)
+	{
+		DMDColor *dst = &result->buffer[(size_t)y * height];
+		if (quarterTurns == 1)
+		{
+			const DMDColor *src = &from->buffer[(size_t)(height - 1) * width + y];
+			for (x = 0; x < height; x++, src -= width)
+				dst[x] = *src;
+		}
+		else
+		{
+			const DMDColor *src = &from->buffer[width - 1 - y];
+			for (x = 0; x < height; x++, src += width)
+				dst[x] = *src;
+		}
+	}
+	DMDFrameDrawTransformed(result, to, toPoint, blendMode);
+}
+
+#if DMD_X86_KERNELS
+__attribute__((target("sse2")))
+static DMDDimension DMDDoubleRowSSE2(DMDColor *dst, const DMDColor *src, DMDDimension srcWidth)
+{
+	DMDDimension x = 0;
+	for (; x + 16 <= srcWidth; x += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + x));
+		_mm_storeu_si128((__m128i *)(dst + 2 * x), _mm_unpacklo_epi8(v, v));
+		_mm_storeu_si128((__m128i *)(dst + 2 * x + 16), _mm_unpackhi_epi8(v, v));
+	}
+	return x;
+}
+#endif
+
+void DMDFrameScale(DMDFrame *from, DMDFrame *to, DMDPoint toPoint, unsigned scaleUp, unsigned scaleDown, DMDBlendMode blendMode)
+{
+	if (scaleUp == 0 || scaleDown == 0)
+		return;
+	DMDDimension width = (DMDDimension)((unsigned long long)from->size.width * scaleUp / scaleDown);
+	DMDDimension height = (DMDDimension)((unsigned long long)from->size.height * scaleUp / scaleDown);
+	if (width == 0 || height == 0)
+		return;
+	DMDFrame *result = DMDFrameAllocate(DMDSizeMake(width, height), 0);
+	if (result == NULL)
+		return;
+	
+	DMDDimension *columns = (DMDDimension *)malloc(sizeof(DMDDimension) * width);
+	if (columns == NULL)
+	{
+		DMDFrameDelete(result);
+		return;
+	}
+	DMDDimension x, y;
+	for (x = 0; x < width; x++)
+		columns[x] = (DMDDimension)((unsigned long long)x * scaleDown / scaleUp);
+	
+	DMDDimension lastSrcY = -1;
+	for (y = 0; y < height; y++)
+	{
+		DMDDimension srcY = (DMDDimension)((unsigned long long)y * scaleDown / scaleUp);
+		DMDColor *dst = &result->buffer[(size_t)y * width];
+		if (srcY == lastSrcY)
+		{
+			/* Enlarging repeats rows. */
+			memcpy(dst, dst - width, width);
+			continue;
+		}
+		const DMDColor *src = &from->buffer[(size_t)srcY * from->size.width];
+		x = 0;
+#if DMD_X86_KERNELS
+		if (scaleUp == 2 && scaleDown == 1 && DMDGetKernelLevel() >= DMDKernelLevelSSE2)
+			x = 2 * DMDDoubleRowSSE2(dst, src, from->size.width);
+#endif
+		for (; x < width; x++)
+			dst[x] = src[columns[x]];
+		lastSrcY = srcY;
+	}
+	free(columns);
+	DMDFrameDrawTransformed(result, to, toPoint, blendMode);
+}
+
+
+/**
+ * Transitions
+ * 
+ * Wipes, pushes, slides and irises are one or two rect copies.  A crossfade mixes
+ * the dots through the 'alpha' blend table with the incoming frame's alpha set by
+ * the progress; the 16x16 slice of the table for that alpha is pulled out first so
+ * each dot costs a single lookup.
+ */
+
+static void DMDFrameCrossfade(DMDFrame *from, DMDFrame *to, DMDFrame *dst, float progress)
+{
+	const DMDColor *alphaMap = DMDGetAlphaMap();
+	DMDColor mix[256]; /* Indexed by (to << 4) | from. */
+	unsigned alpha = (unsigned)(progress * 15.0f + 0.5f);
+	unsigned s, d;
+	for (s = 0; s < 16; s++)
+		for (d = 0; d < 16; d++)
+			mix[(s << 4) | d] = alphaMap[((alpha << 4) | s) * 256 + (0xf0 | d)] & 0x0f;
+	
+	size_t i, n = (size_t)dst->size.width * dst->size.height;
+	for (i = 0; i < n; i++)
+	{
+		DMDColor f = from->buffer[i];
+		dst->buffer[i] = (f & 0xf0) | mix[((to->buffer[i] & 0x0f) << 4) | (f & 0x0f)];
+	}
+	DMDFrameMarkDirty(dst, DMDFrameGetBounds(dst));
+}
+
+void DMDFrameTransition(DMDFrame *from, DMDFrame *to, DMDFrame *dst, DMDTransition transition, DMDDirection direction, float progress)
+{
+	DMDDimension width = dst->size.width, height = dst->size.height;
+	if (from->size.width != width || from->size.height != height || to->size.width != width || to->size.height != height)
+		return;
+	progress = MAX(0.0f, MIN(progress, 1.0f));
+	
+	if (transition == DMDTransitionCrossfade)
+	{
+		DMDFrameCrossfade(from, to, dst, progress);
+		return;
+	}
+	
+	/* The rect moves read both frames at different offsets, so work in a scratch frame if dst is one of them. */
+	DMDFrame *out = dst;
+	if (dst == from || dst == to)
+	{
+		out = DMDFrameAllocate(dst->size, 0);
+		if (out == NULL)
+			return;
+	}
+	
+	int horizontal = (direction == DMDDirectionEast || direction == DMDDirectionWest);
+	DMDDimension extent = horizontal ? width : height;
+	DMDDimension offset = (DMDDimension)(progress * extent + 0.5f);
+	DMDRect bounds = DMDFrameGetBounds(dst);
+	DMDPoint origin = DMDPointMake(0, 0);
+	
+	switch (transition)
+	{
+		case DMDTransitionWipe:
+		{
+			/* The edge between the frames travels in the given direction. */
+			DMDRect reveal;
+			switch (direction)
+			{
+				case DMDDirectionNorth: reveal = DMDRectMake(0, height - offset, width, offset); break;
+				case DMDDirectionSouth: reveal = DMDRectMake(0, 0, width, offset); break;
+				case DMDDirectionEast:  reveal = DMDRectMake(0, 0, offset, height); break;
+				default:                reveal = DMDRectMake(width - offset, 0, offset, height); break;
+			}
+			DMDFrameCopyRect(from, bounds, out, origin, DMDBlendModeCopy);
+			DMDFrameCopyRect(to, reveal, out, reveal.origin, DMDBlendModeCopy);
+			break;
+		}
+		case DMDTransitionPush:
+		case DMDTransitionSlide:
+		{
+			/* The incoming frame enters from the opposite edge; a push moves the outgoing one along with it. */
+			DMDPoint shift;
+			switch (direction)
+			{
+				case DMDDirectionNorth: shift = DMDPointMake(0, -offset); break;
+				case DMDDirectionSouth: shift = DMDPointMake(0, offset); break;
+				case DMDDirectionEast:  shift = DMDPointMake(offset, 0); break;
+				default:                shift = DMDPointMake(-offset, 0); break;
+			}
+			DMDPoint toPoint = DMDPointMake(shift.x, shift.y);
+			if (horizontal)
+				toPoint.x += direction == DMDDirectionEast ? -width : width;
+			else
+				toPoint.y += direction == DMDDirectionSouth ? -height : height;
+			
+			DMDFrameCopyRect(from, bounds, out, transition == DMDTransitionPush ? shift : origin, DMDBlendModeCopy);
+			DMDFrameCopyRect(to, bounds, out, toPoint, DMDBlendModeCopy);
+			break;
+		}
+		case DMDTransitionIris:
+		{
+			DMDDimension irisWidth = (DMDDimension)(progress * width + 0.5f);
+			DMDDimension irisHeight = (DMDDimension)(progress * height + 0.5f);
+			DMDRect iris = DMDRectMake((width - irisWidth) / 2, (height - irisHeight) / 2, irisWidth, irisHeight);
+			DMDFrameCopyRect(from, bounds, out, origin, DMDBlendModeCopy);
+			DMDFrameCopyRect(to, iris, out, iris.origin, DMDBlendModeCopy);
+			break;
+		}
+		default:
+			break;
+	}
+	
+	if (out != dst)
+	{
+		DMDFrameCopyRect(out, bounds, dst, origin, DMDBlendModeCopy);
+		DMDFrameDelete(out);
+	}
+}
+
+void DMDFrameTransitionSteps(DMDFrame *from, DMDFrame *to, DMDFrame **dsts, unsigned count, DMDTransition transition, DMDDirection direction, float start, float end)
+{
+	unsigned i;
+	for (i = 0; i < count; i++)
+	{
+		float progress = count > 1 ? start + (end - start) * i / (count - 1) : start;
+		DMDFrameTransition(from, to, dsts[i], transition, direction, progress);
+	}
+}
+
+
+const DMDColor *DMDGetAlphaMap(void)
+{
+	return gDMDAlphaMap;
+}
+
+
+/**
+ * Delta Compression
+ * 
+ * An encoded frame is a type byte (0 for a keyframe, 1 for a delta) followed by
+ * ops that together cover every dot in order.  Each op starts with a byte whose
+ * top two bits give the kind and low six bits the length less one; a length field
+ * of 63 means the real length less 64 follows as a 16-bit little endian value.
+ * Skips leave dots as they are, fills set them to the following byte and literals
+ * copy the bytes that follow, so decoding is nothing but memset() and memcpy().
+ */
+
+#define kDMDDeltaOpSkip    (0)
+#define kDMDDeltaOpFill    (1)
+#define kDMDDeltaOpLiteral (2)
+#define kDMDDeltaMaxRun    (64 + 0xffff)
+
+size_t DMDFrameGetMaxDeltaSize(DMDSize size)
+{
+	/* Worst case is alternating single changed dots: two bytes per dot. */
+	return 1 + 2 * (size_t)size.width * size.height;
+}
+
+static unsigned char *DMDDeltaPutOp(unsigned char *out, unsigned kind, size_t length)
+{
+	if (length < 64)
+	{
+		*out++ = (unsigned char)((kind << 6) | (length - 1));
+	}
+	else
+	{
+		*out++ = (unsigned char)((kind << 6) | 63);
+		*out++ = (unsigned char)((length - 64) & 0xff);
+		*out++ = (unsigned char)((length - 64) >> 8);
+	}
+	return out;
+}
+
+/* Length of the run starting at i of dots that match the reference (a NULL reference is all black). */
+static inline size_t DMDDeltaSameRun(const DMDColor *dots, const DMDColor *ref, size_t i, size_t n)
+{
+	size_t j = i;
+	if (ref)
+		while (j < n && j - i < kDMDDeltaMaxRun && dots[j] == ref[j]) j++;
+	else
+		while (j < n && j - i < kDMDDeltaMaxRun && dots[j] == 0) j++;
+	return j - i;
+}
+
+/* Length of the run starting at i of dots with the same value. */
+static inline size_t DMDDeltaFillRun(const DMDColor *dots, size_t i, size_t n)
+{
+	size_t j = i + 1;
+	while (j < n && j - i < kDMDDeltaMaxRun && dots[j] == dots[i]) j++;
+	return j - i;
+}
+
+size_t DMDFrameEncodeDelta(DMDFrame *frame, DMDFrame *previous, unsigned char *out)
+{
+	const DMDColor *dots = frame->buffer;
+	const DMDColor *ref = previous ? previous->buffer : NULL;
+	size_t n = (size_t)frame->size.width * frame->size.height;
+	size_t i = 0;
+	unsigned char *start = out;
+	
+	*out++ = previous ? 1 : 0;
+	while (i < n)
+	{
+		size_t run = DMDDeltaSameRun(dots, ref, i, n);
+		if (run > 0)
+		{
+			out = DMDDeltaPutOp(out, kDMDDeltaOpSkip, run);
+			i += run;
+			continue;
+		}
+		run = DMDDeltaFillRun(dots, i, n);
+		if (run >= 3)
+		{
+			out = DMDDeltaPutOp(out, kDMDDeltaOpFill, run);
+			*out++ = dots[i];
+			i += run;
+			continue;
+		}
+		/* Literal: carry on until a skip or fill would be cheaper than including the dots. */
+		size_t j = i + 1;
+		while (j < n && j - i < kDMDDeltaMaxRun &&
+			DMDDeltaSameRun(dots, ref, j, MIN(n, j + 3)) < 3 &&
+			DMDDeltaFillRun(dots, j, MIN(n, j + 4)) < 4)
+			j++;
+		out = DMDDeltaPutOp(out, kDMDDeltaOpLiteral, j - i);
+		memcpy(out, &dots[i], j - i);
+		out += j - i;
+		i = j;
+	}
+	return out - start;
+}
+
+int DMDFrameDecodeDelta(DMDFrame *frame, const unsigned char *data, size_t length)
+{
+	DMDColor *dots = frame->buffer;
+	size_t n = (size_t)frame->size.width * frame->size.height;
+	const unsigned char *end = data + length;
+	size_t i = 0;
+	size_t firstChanged = n, lastChanged = 0;
+	
+	if (length < 1 || data[0] > 1)
+		return -1;
+	if (*data++ == 0)
+	{
+		memset(dots, 0, n);
+		firstChanged = 0;
+		lastChanged = n;
+	}
+	while (i < n && data < end)
+	{
+		unsigned kind = *data >> 6;
+		size_t run = (*data++ & 63) + 1;
+		if (run == 64)
+		{
+			if (end - data < 2)
+				return -1;
+			run = 64 + (data[0] | (data[1] << 8));
+			data += 2;
+		}
+		if (run > n - i)
+			return -1;
+		
+		if (kind == kDMDDeltaOpSkip)
+		{
+			i += run;
+			continue;
+		}
+		if (kind == kDMDDeltaOpFill)
+		{
+			if (data >= end)
+				return -1;
+			memset(&dots[i], *data++, run);
+		}
+		else if (kind == kDMDDeltaOpLiteral)
+		{
+			if ((size_t)(end - data) < run)
+				return -1;
+			memcpy(&dots[i], data, run);
+			data += run;
+		}
+		else
+		{
+			return -1;
+		}
+		firstChanged = MIN(firstChanged, i);
+		lastChanged = MAX(lastChanged, i + run);
+		i += run;
+	}
+	
+	if (firstChanged < lastChanged)
+	{
+		DMDDimension width = frame->size.width;
+		DMDDimension minRow = (DMDDimension)(firstChanged / width);
+		DMDDimension maxRow = (DMDDimension)((lastChanged + width - 1) / width);
+		DMDFrameMarkDirty(frame, DMDRectMake(0, minRow, width, maxRow - minRow));
+	}
+	return (i == n && data == end) ? 0 : -1;
+}
+
+
+/**
+ * Hashing
+ * 
+ * The hash is the xxHash64 construction: four independent lanes each take every
+ * fourth 64-bit word of the dots, so the multiplies of neighbouring words overlap,
+ * then the lanes and the remaining bytes are folded together and mixed.  It is
+ * seeded with the frame size so that differently shaped frames of the same dots
+ * differ.  Words are read in native byte order.
+ */
+
+#define kDMDHashPrime1 (0x9E3779B185EBCA87ULL)
+#define kDMDHashPrime2 (0xC2B2AE3D27D4EB4FULL)
+#define kDMDHashPrime3 (0x165667B19E3779F9ULL)
+#define kDMDHashPrime4 (0x85EBCA77C2B2AE63ULL)
+#define kDMDHashPrime5 (0x27D4EB2F165667C5ULL)
+
+static inline uint64_t DMDHashRotate(uint64_t x, int bits)
+{
+	return (x << bits) | (x >> (64 - bits));
+}
+
+static inline uint64_t DMDHashRound(uint64_t acc, uint64_t word)
+{
+	return DMDHashRotate(acc + word * kDMDHashPrime2, 31) * kDMDHashPrime1;
+}
+
+static inline uint64_t DMDHashMergeRound(uint64_t acc, uint64_t lane)
+{
+	return (acc ^ DMDHashRound(0, lane)) * kDMDHashPrime1 + kDMDHashPrime4;
+}
+
+static inline uint64_t DMDHashReadWord(const DMDColor *p)
+{
+	uint64_t word;
+	memcpy(&word, p, sizeof(word));
+	return word;
+}
+
+unsigned long long DMDFrameHash(DMDFrame *frame)
+{
+	const DMDColor *p = frame->buffer;
+	size_t n = DMDFrameGetBufferSize(frame);
+	const DMDColor *end = p + n;
+	uint64_t seed = ((uint64_t)(uint32_t)frame->size.width << 32) | (uint32_t)frame->size.height;
+	uint64_t hash;
+	
+	if (n >= 32)
+	{
+		uint64_t lane0 = seed + kDMDHashPrime1 + kDMDHashPrime2;
+		uint64_t lane1 = seed + kDMDHashPrime2;
+		uint64_t lane2 = seed;
+		uint64_t lane3 = seed - kDMDHashPrime1;
+		for (; p + 32 <= end; p += 32)
+		{
+			lane0 = DMDHashRound(lane0, DMDHashReadWord(p));
+			lane1 = DMDHashRound(lane1, DMDHashReadWord(p + 8));
+			lane2 = DMDHashRound(lane2, DMDHashReadWord(p + 16));
+			lane3 = DMDHashRound(lane3, DMDHashReadWord(p + 24));
+		}
+		hash = DMDHashRotate(lane0, 1) + DMDHashRotate(lane1, 7) + DMDHashRotate(lane2, 12) + DMDHashRotate(lane3, 18);
+		hash = DMDHashMergeRound(hash, lane0);
+		hash = DMDHashMergeRound(hash, lane1);
+		hash = DMDHashMergeRound(hash, lane2);
+		hash = DMDHashMergeRound(hash, lane3);
+	}
+	else
+	{
+		hash = seed + kDMDHashPrime5;
+	}
+	hash += n;
+	
+	for (; p + 8 <= end; p += 8)
+		hash = DMDHashRotate(hash ^ DMDHashRound(0, DMDHashReadWord(p)), 27) * kDMDHashPrime1 + kDMDHashPrime4;
+	for (; p < end; p++)
+		hash = DMDHashRotate(hash ^ (*p * kDMDHashPrime5), 11) * kDMDHashPrime1;
+	
+	hash ^= hash >> 33;
+	hash *= kDMDHashPrime2;
+	hash ^= hash >> 29;
+	hash *= kDMDHashPrime3;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+int DMDFrameIsEqual(DMDFrame *a, DMDFrame *b)
+{
+	if (a->size.width != b->size.width || a->size.height != b->size.height)
+		return 0;
+	return a->buffer == b->buffer || memcmp(a->buffer, b->buffer, DMDFrameGetBufferSize(a)) == 0;
+}
+
+
+/**
+ * Grayscale Import
+ * 
+ * Thresholding and ordered dithering are the same sum, shade = (v * 15 + d) / 255,
+ * with d = 127 to round to the nearest shade or d taken from a 4x4 Bayer matrix
+ * (spread over 7-247) to dither.  v * 15 + d fits in 16 bits, so the SIMD kernels
+ * work in 16-bit lanes and divide by 255 as ((x + 1) * 257) >> 16, which is exact
+ * over that range.  Error diffusion carries each pixel's error on to the next, so
+ * it has to go a pixel at a time.
+ */
+
+static const unsigned char gDMDBayer4x4[4][4] = {
+	{ 0,  8,  2, 10},
+	{12,  4, 14,  6},
+	{ 3, 11,  1,  9},
+	{15,  7, 13,  5},
+};
+
+void DMDGrayCurveInit(unsigned char *curve, float gamma, float contrast)
+{
+	unsigned i;
+	for (i = 0; i < 256; i++)
+	{
+		double v = pow(i / 255.0, gamma);
+		v = (v - 0.5) * contrast + 0.5;
+		curve[i] = (unsigned char)(MAX(0.0, MIN(v, 1.0)) * 255.0 + 0.5);
+	}
+}
+
+/* d holds the term added for x & 3 == 0, 1, 2, 3. */
+typedef void (*DMDQuantizeRowFunc)(DMDColor *dst, const unsigned char *src, DMDDimension width, const unsigned short *d);
+
+static void DMDQuantizeRowScalar(DMDColor *dst, const unsigned char *src, DMDDimension width, const unsigned short *d)
+{
+	DMDDimension x;
+	for (x = 0; x < width; x++)
+		dst[x] = (DMDColor)((src[x] * 15 + d[x & 3]) / 255);
+}
+
+#if DMD_X86_KERNELS
+__attribute__((target("sse2")))
+static void DMDQuantizeRowSSE2(DMDColor *dst, const unsigned char *src, DMDDimension width, const unsigned short *d)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i fifteen = _mm_set1_epi16(15);
+	const __m128i m257 = _mm_set1_epi16(257);
+	/* x stays a multiple of 4, so lane i always gets d[i & 3]; the + 1 is the division's. */
+	const __m128i dither = _mm_set_epi16(d[3] + 1, d[2] + 1, d[1] + 1, d[0] + 1, d[3] + 1, d[2] + 1, d[1] + 1, d[0] + 1);
+	DMDDimension x = 0;
+	for (; x + 16 <= width; x += 16)
+	{
+		__m128i p = _mm_loadu_si128((const __m128i *)(src + x));
+		__m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(p, zero), fifteen), dither);
+		__m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(p, zero), fifteen), dither);
+		lo = _mm_mulhi_epu16(lo, m257);
+		hi = _mm_mulhi_epu16(hi, m257);
+		_mm_storeu_si128((__m128i *)(dst + x), _mm_packus_epi16(lo, hi));
+	}
+	DMDQuantizeRowScalar(dst + x, src + x, width - x, d);
+}
+
+__attribute__((target("avx2")))
+static void DMDQuantizeRowAVX2(DMDColor *dst, const unsigned char *src, DMDDimension width, const unsigned short *d)
+{
+	const __m256i fifteen = _mm256_set1_epi16(15);
+	const __m256i m257 = _mm256_set1_epi16(257);
+	const __m256i dither = _mm256_set_epi16(d[3] + 1, d[2] + 1, d[1] + 1, d[0] + 1, d[3] + 1, d[2] + 1, d[1] + 1, d[0] + 1,
+	                                        d[3] + 1, d[2] + 1, d[1] + 1, d[0] + 1, d[3] + 1, d[2] + 1, d[1] + 1, d[0] + 1);
+	DMDDimension x = 0;
+	for (; x + 32 <= width; x += 32)
+	{
+		__m256i lo = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(src + x)));
+		__m256i hi = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(src + x + 16)));
+		lo = _mm256_mulhi_epu16(_mm256_add_epi16(_mm256_mullo_epi16(lo, fifteen), dither), m257);
+		hi = _mm256_mulhi_epu16(_mm256_add_epi16(_mm256_mullo_epi16(hi, fifteen), dither), m257);
+		/* packus works within 128-bit lanes; put the quarters back in order. */
+		_mm256_storeu_si256((__m256i *)(dst + x), _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xd8));
+	}
+	DMDQuantizeRowSSE2(dst + x, src + x, width - x, d);
+}
+#endif
+
+static DMDQuantizeRowFunc DMDGetQuantizeRowFunc(void)
+{
+#if DMD_X86_KERNELS
+	DMDKernelLevel level = DMDGetKernelLevel();
+	if (level >= DMDKernelLevelAVX2)
+		return DMDQuantizeRowAVX2;
+	if (level >= DMDKernelLevelSSE2)
+		return DMDQuantizeRowSSE2;
+#endif
+	return DMDQuantizeRowScalar;
+}
+
+/* errors holds two rows of width + 2 accumulators, each the sum of error * weight (out of 16) carried to a pixel. */
+static void DMDQuantizeErrorDiffusion(DMDFrame *frame, const unsigned char *pixels, size_t rowBytes, const unsigned char *curve, int *errors)
+{
+	DMDDimension width = frame->size.width, height = frame->size.height;
+	DMDDimension x, y, i;
+	memset(errors, 0, 2 * (width + 2) * sizeof(int));
+	for (y = 0; y < height; y++)
+	{
+		const unsigned char *src = pixels + y * rowBytes;
+		DMDColor *dst = DMDFrameGetDotPointer(frame, DMDPointMake(0, y));
+		int *cur = errors + (y & 1) * (width + 2) + 1;
+		int *next = errors + (~y & 1) * (width + 2) + 1;
+		int dir = (y & 1) ? -1 : 1;
+		memset(next - 1, 0, (width + 2) * sizeof(int));
+		for (i = 0, x = (dir > 0 ? 0 : width - 1); i < width; i++, x += dir)
+		{
+			int carried = cur[x] >= 0 ? (cur[x] + 8) / 16 : -((8 - cur[x]) / 16);
+			int v = (curve ? curve[src[x]] : src[x]) + carried;
+			v = MAX(0, MIN(v, 255));
+			int shade = (v * 15 + 127) / 255;
+			int error = v - shade * 17;
+			dst[x] = (DMDColor)shade;
+			cur[x + dir] += error * 7;
+			next[x - dir] += error * 3;
+			next[x] += error * 5;
+			next[x + dir] += error;
+		}
+	}
+}
+
+void DMDFrameQuantizeGray(DMDFrame *frame, const unsigned char *pixels, size_t rowBytes, const unsigned char *curve, DMDQuantizeMethod method)
+{
+	DMDDimension width = frame->size.width, height = frame->size.height;
+	DMDDimension y;
+	if (width <= 0 || height <= 0)
+		return;
+	
+	if (method == DMDQuantizeFloydSteinberg)
+	{
+		int *errors = (int *)malloc(2 * (width + 2) * sizeof(int));
+		if (errors == NULL)
+			return;
+		DMDQuantizeErrorDiffusion(frame, pixels, rowBytes, curve, errors);
+		free(errors);
+	}
+	else
+	{
+		DMDQuantizeRowFunc quantizeRow = DMDGetQuantizeRowFunc();
+		unsigned char *scratch = NULL;
+		if (curve != NULL && (scratch = (unsigned char *)malloc(width)) == NULL)
+			return;
+		for (y = 0; y < height; y++)
+		{
+			unsigned short d[4] = {127, 127, 127, 127};
+			const unsigned char *src = pixels + y * rowBytes;
+			DMDDimension x;
+			if (method == DMDQuantizeOrdered)
+			{
+				for (x = 0; x < 4; x++)
+					d[x] = (unsigned short)((gDMDBayer4x4[y & 3][x] * 2 + 1) * 255 / 32);
+			}
+			if (scratch != NULL)
+			{
+				for (x = 0; x < width; x++)
+					scratch[x] = curve[src[x]];
+				src = scratch;
+			}
+			quantizeRow(DMDFrameGetDotPointer(frame, DMDPointMake(0, y)), src, width, d);
+		}
+		free(scratch);
+	}
+	DMDFrameMarkDirty(frame, DMDFrameGetBounds(frame));
+}
+
+
+/**
+ * Packed Frames
+ * 
+ * The nibble kernels work on whole bytes of a row, two dots at a time; the
+ * callers restore the nibble that lies outside the rect at either end of a row.
+ * The scalar versions handle 16 dots at once in a uint64_t by spreading the low
+ * and high nibbles of each byte into separate bytes, where they can't carry into
+ * their neighbors.
+ */
+
+DMDPackedFrame *DMDPackedFrameCreate(DMDSize size)
+{
+	if (size.width < 0 || size.height < 0)
+		return NULL;
+	
+	size_t bufferSize = (size_t)((size.width + 1) / 2) * size.height;
+	DMDPackedFrame *frame = (DMDPackedFrame *)calloc(sizeof(DMDPackedFrame) + bufferSize, 1);
+	if (frame == NULL)
+		return NULL;
+	frame->size = size;
+	frame->buffer = (unsigned char *)(frame + 1);
+	frame->dirtyRect = DMDPackedFrameGetBounds(frame);
+	return frame;
+}
+
+DMDPackedFrame *DMDPackedFrameCreateWithBuffer(DMDSize size, unsigned char *buffer)
+{
+	if (size.width < 0 || size.height < 0)
+		return NULL;
+	
+	DMDPackedFrame *frame = (DMDPackedFrame *)calloc(sizeof(DMDPackedFrame), 1);
+	if (frame == NULL)
+		return NULL;
+	frame->size = size;
+	frame->buffer = buffer;
+	frame->dirtyRect = DMDPackedFrameGetBounds(frame);
+	return frame;
+}
+
+void DMDPackedFrameDelete(DMDPackedFrame *frame)
+{
+	/* The dots are either part of the same block or belong to the caller. */
+	free(frame);
+}
+
+void DMDPackedFrameMarkDirty(DMDPackedFrame *frame, DMDRect rect)
+{
+	rect = DMDRectIntersection(DMDPackedFrameGetBounds(frame), rect);
+	if (!DMDRectIsEmpty(rect))
+		frame->dirtyRect = DMDRectUnion(frame->dirtyRect, rect);
+}
+
+#define kDMDNibbleLow  (0x0F0F0F0F0F0F0F0FULL)
+#define kDMDNibbleCarry (0x1010101010101010ULL)
+
+/* Each byte of the result is 0x0F where bit 4 of the same byte of x is set, 0x00 otherwise. */
+static inline uint64_t DMDNibbleMaskFromCarry(uint64_t x)
+{
+	return ((x & kDMDNibbleCarry) >> 4) * 0x0F;
+}
+
+static inline uint64_t DMDNibblesAdd(uint64_t d, uint64_t s)
+{
+	uint64_t lo = (d & kDMDNibbleLow) + (s & kDMDNibbleLow);
+	uint64_t hi = ((d >> 4) & kDMDNibbleLow) + ((s >> 4) & kDMDNibbleLow);
+	lo = (lo | DMDNibbleMaskFromCarry(lo)) & kDMDNibbleLow;
+	hi = (hi | DMDNibbleMaskFromCarry(hi)) & kDMDNibbleLow;
+	return lo | (hi << 4);
+}
+
+static inline uint64_t DMDNibblesSubtract(uint64_t d, uint64_t s)
+{
+	/* Borrowing from the 0x10 set in each byte leaves it set only where d >= s. */
+	uint64_t lo = ((d & kDMDNibbleLow) | kDMDNibbleCarry) - (s & kDMDNibbleLow);
+	uint64_t hi = (((d >> 4) & kDMDNibbleLow) | kDMDNibbleCarry) - ((s >> 4) & kDMDNibbleLow);
+	lo &= DMDNibbleMaskFromCarry(lo);
+	hi &= DMDNibbleMaskFromCarry(hi);
+	return lo | (hi << 4);
+}
+
+static inline uint64_t DMDNibblesBlackSource(uint64_t d, uint64_t s)
+{
+	uint64_t mask = DMDNibbleMaskFromCarry((s & kDMDNibbleLow) + kDMDNibbleLow) |
+	                (DMDNibbleMaskFromCarry(((s >> 4) & kDMDNibbleLow) + kDMDNibbleLow) << 4);
+	return (s & mask) | (d & ~mask);
+}
+
+typedef void (*DMDPackedRowBlendFunc)(unsigned char *dst, const unsigned char *src, size_t count);
+
+/* Applies op to 8 bytes at a time; once inlined with a constant op the call goes away. */
+static inline void DMDPackedRowApply(unsigned char *dst, const unsigned char *src, size_t count, uint64_t (*op)(uint64_t, uint64_t))
+{
+	size_t i = 0;
+	uint64_t d, s;
+	for (; i + 8 <= count; i += 8)
+	{
+		memcpy(&d, dst + i, 8);
+		memcpy(&s, src + i, 8);
+		d = op(d, s);
+		memcpy(dst + i, &d, 8);
+	}
+	if (i < count)
+	{
+		d = s = 0;
+		memcpy(&d, dst + i, count - i);
+		memcpy(&s, src + i, count - i);
+		d = op(d, s);
+		memcpy(dst + i, &d, count - i);
+	}
 }
 
-void DMDFrameDelete(DMDFrame *frame)
+static void DMDPackedRowAddScalar(unsigned char *dst, const unsigned char *src, size_t count)
 {
-	/* Only free the frame because it was allocated as one chunk of memory. */
-	frame->buffer = NULL;
-	free(frame);
+	DMDPackedRowApply(dst, src, count, DMDNibblesAdd);
 }
 
-DMDFrame *DMDFrameCopy(DMDFrame *frame)
+static void DMDPackedRowSubtractScalar(unsigned char *dst, const unsigned char *src, size_t count)
 {
-	DMDFrame *copy = DMDFrameCreate(frame->size);
-	memcpy(copy->buffer, frame->buffer, sizeof(DMDColor) * frame->size.width * frame->size.height);
-	return copy;
+	DMDPackedRowApply(dst, src, count, DMDNibblesSubtract);
 }
 
+static void DMDPackedRowBlackSourceScalar(unsigned char *dst, const unsigned char *src, size_t count)
+{
+	DMDPackedRowApply(dst, src, count, DMDNibblesBlackSource);
+}
 
-DMDRect DMDFrameGetBounds(DMDFrame *frame)
+static void DMDPackedRowCopy(unsigned char *dst, const unsigned char *src, size_t count)
 {
-	return DMDRectMake(0, 0, frame->size.width, frame->size.height);
+	memcpy(dst, src, count);
 }
 
-DMDSize DMDFrameGetSize(DMDFrame *frame)
+#if DMD_X86_KERNELS
+/* SSE2: 32 dots per iteration, working on the low and high nibbles separately. */
+
+__attribute__((target("sse2")))
+static void DMDPackedRowAddSSE2(unsigned char *dst, const unsigned char *src, size_t count)
 {
-	return frame->size;
+	const __m128i lo = _mm_set1_epi8(0x0f);
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		__m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+		__m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i l = _mm_min_epu8(_mm_add_epi8(_mm_and_si128(d, lo), _mm_and_si128(s, lo)), lo);
+		__m128i h = _mm_min_epu8(_mm_add_epi8(_mm_and_si128(_mm_srli_epi16(d, 4), lo), _mm_and_si128(_mm_srli_epi16(s, 4), lo)), lo);
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_or_si128(l, _mm_slli_epi16(h, 4)));
+	}
+	DMDPackedRowAddScalar(dst + i, src + i, count - i);
 }
 
-unsigned DMDFrameGetBufferSize(DMDFrame *frame)
+__attribute__((target("sse2")))
+static void DMDPackedRowSubtractSSE2(unsigned char *dst, const unsigned char *src, size_t count)
 {
-	return frame->size.width * frame->size.height * sizeof(DMDColor);
+	const __m128i lo = _mm_set1_epi8(0x0f);
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		__m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+		__m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i l = _mm_subs_epu8(_mm_and_si128(d, lo), _mm_and_si128(s, lo));
+		__m128i h = _mm_subs_epu8(_mm_and_si128(_mm_srli_epi16(d, 4), lo), _mm_and_si128(_mm_srli_epi16(s, 4), lo));
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_or_si128(l, _mm_slli_epi16(h, 4)));
+	}
+	DMDPackedRowSubtractScalar(dst + i, src + i, count - i);
 }
 
-void DMDFrameFillRect(DMDFrame *frame, DMDRect rect, DMDColor color)
+__attribute__((target("sse2")))
+static void DMDPackedRowBlackSourceSSE2(unsigned char *dst, const unsigned char *src, size_t count)
 {
-	rect = DMDRectIntersection(DMDFrameGetBounds(frame), rect);
-	
-	DMDDimension maxX = DMDRectGetMaxX(rect);
-	DMDDimension maxY = DMDRectGetMaxY(rect);
-	
-	DMDDimension x, y;
+	const __m128i lo = _mm_set1_epi8(0x0f);
+	const __m128i hi = _mm_set1_epi8((char)0xf0);
+	const __m128i zero = _mm_setzero_si128();
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		__m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+		__m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+		/* Mask of the nibbles of s that are zero, which keep the dst nibble. */
+		__m128i keep = _mm_or_si128(_mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(s, lo), zero), lo),
+		                            _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(s, hi), zero), hi));
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_or_si128(_mm_and_si128(keep, d), _mm_andnot_si128(keep, s)));
+	}
+	DMDPackedRowBlackSourceScalar(dst + i, src + i, count - i);
+}
+
+/* AVX2: the same, 64 dots per iteration. */
+
+__attribute__((target("avx2")))
+static void DMDPackedRowAddAVX2(unsigned char *dst, const unsigned char *src, size_t count)
+{
+	const __m256i lo = _mm256_set1_epi8(0x0f);
+	size_t i = 0;
+	for (; i + 32 <= count; i += 32)
+	{
+		__m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+		__m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+		__m256i l = _mm256_min_epu8(_mm256_add_epi8(_mm256_and_si256(d, lo), _mm256_and_si256(s, lo)), lo);
+		__m256i h = _mm256_min_epu8(_mm256_add_epi8(_mm256_and_si256(_mm256_srli_epi16(d, 4), lo), _mm256_and_si256(_mm256_srli_epi16(s, 4), lo)), lo);
+		_mm256_storeu_si256((__m256i *)(dst + i), _mm256_or_si256(l, _mm256_slli_epi16(h, 4)));
+	}
+	DMDPackedRowAddSSE2(dst + i, src + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static void DMDPackedRowSubtractAVX2(unsigned char *dst, const unsigned char *src, size_t count)
+{
+	const __m256i lo = _mm256_set1_epi8(0x0f);
+	size_t i = 0;
+	for (; i + 32 <= count; i += 32)
+	{
+		__m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+		__m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+		__m256i l = _mm256_subs_epu8(_mm256_and_si256(d, lo), _mm256_and_si256(s, lo));
+		__m256i h = _mm256_subs_epu8(_mm256_and_si256(_mm256_srli_epi16(d, 4), lo), _mm256_and_si256(_mm256_srli_epi16(s, 4), lo));
+		_mm256_storeu_si256((__m256i *)(dst + i), _mm256_or_si256(l, _mm256_slli_epi16(h, 4)));
+	}
+	DMDPackedRowSubtractSSE2(dst + i, src + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static void DMDPackedRowBlackSourceAVX2(unsigned char *dst, const unsigned char *src, size_t count)
+{
+	const __m256i lo = _mm256_set1_epi8(0x0f);
+	const __m256i hi = _mm256_set1_epi8((char)0xf0);
+	const __m256i zero = _mm256_setzero_si256();
+	size_t i = 0;
+	for (; i + 32 <= count; i += 32)
+	{
+		__m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+		__m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+		__m256i keep = _mm256_or_si256(_mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(s, lo), zero), lo),
+		                               _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(s, hi), zero), hi));
+		_mm256_storeu_si256((__m256i *)(dst + i), _mm256_or_si256(_mm256_and_si256(keep, d), _mm256_andnot_si256(keep, s)));
+	}
+	DMDPackedRowBlackSourceSSE2(dst + i, src + i, count - i);
+}
+#endif
+
+static DMDPackedRowBlendFunc DMDGetPackedRowBlendFunc(DMDBlendMode blendMode)
+{
+	static const DMDPackedRowBlendFunc scalar[] = { DMDPackedRowCopy, DMDPackedRowAddScalar, DMDPackedRowSubtractScalar, DMDPackedRowBlackSourceScalar };
+#if DMD_X86_KERNELS
+	static const DMDPackedRowBlendFunc sse2[] = { DMDPackedRowCopy, DMDPackedRowAddSSE2, DMDPackedRowSubtractSSE2, DMDPackedRowBlackSourceSSE2 };
+	static const DMDPackedRowBlendFunc avx2[] = { DMDPackedRowCopy, DMDPackedRowAddAVX2, DMDPackedRowSubtractAVX2, DMDPackedRowBlackSourceAVX2 };
+#endif
 	
-	/* TOOD: Rewrite this to use memset for rows. */
-	for (x = DMDRectGetMinX(rect); x < maxX; x++)
-		for (y = DMDRectGetMinY(rect); y < maxY; y++)
-			frame->buffer[y * frame->size.width + x] = color;
+	/* The alpha modes and registered modes need the alpha nibble. */
+	if ((unsigned)blendMode > DMDBlendModeBlackSource)
+		return NULL;
+#if DMD_X86_KERNELS
+	switch (DMDGetKernelLevel())
+	{
+		case DMDKernelLevelAVX2: return avx2[blendMode];
+		case DMDKernelLevelSSE2: return sse2[blendMode];
+		default: break;
+	}
+#endif
+	return scalar[blendMode];
 }
 
-void DMDFrameCopyRect(DMDFrame *src, DMDRect srcRect, DMDFrame *dst, DMDPoint dstPoint, DMDBlendMode blendMode)
+/* Writes count bytes to out holding the dots of row from dot srcX on, shifted so that
+ * the first one lands in the nibble given by dstParity (0 low, 1 high).  Nibbles
+ * before srcX or past the end of the row come out as 0. */
+static void DMDPackedAlignRow(unsigned char *out, const unsigned char *row, unsigned rowBytes, DMDDimension srcX, unsigned dstParity, size_t count)
 {
-	srcRect = DMDRectIntersection(DMDFrameGetBounds(src), srcRect);
-	DMDRect dstRect = DMDRectIntersection(DMDFrameGetBounds(dst), DMDRectMake(dstPoint.x, dstPoint.y, srcRect.size.width, srcRect.size.height));
-	// Short term fix for negative destination points:
-	if (dstPoint.x < 0)
+	long first = (long)srcX - (long)dstParity; /* Dot that goes into the low nibble of out[0]. */
+	size_t i;
+	if ((first & 1) == 0)
 	{
-		srcRect.origin.x += -dstPoint.x;
-		srcRect.size.width -= -dstPoint.x;
+		memcpy(out, row + first / 2, count);
+		return;
 	}
-	if (dstPoint.y < 0)
+	for (i = 0; i < count; i++)
 	{
-		srcRect.origin.y += -dstPoint.y;
-		srcRect.size.height -= -dstPoint.y;
+		long dot = first + 2 * (long)i;
+		unsigned char low = dot >= 0 ? row[dot >> 1] >> 4 : 0;
+		unsigned char high = (unsigned long)(dot + 1) / 2 < rowBytes ? row[(dot + 1) >> 1] & 0x0f : 0;
+		out[i] = low | (high << 4);
 	}
-	if (srcRect.size.width == 0 || srcRect.size.height == 0)
-		return; /* nothing to do */
+}
+
+/* Puts back the nibbles of the first and last bytes of a span that lie outside [x, x + width). */
+static inline void DMDPackedRestoreEdges(unsigned char *span, size_t count, DMDDimension x, DMDDimension width, unsigned char first, unsigned char last)
+{
+	if (x & 1)
+		span[0] = (span[0] & 0xf0) | (first & 0x0f);
+	if ((x + width) & 1)
+		span[count - 1] = (span[count - 1] & 0x0f) | (last & 0xf0);
+}
+
+void DMDPackedFrameFillRect(DMDPackedFrame *frame, DMDRect rect, DMDColor color)
+{
+	rect = DMDRectIntersection(DMDPackedFrameGetBounds(frame), rect);
+	if (DMDRectIsEmpty(rect))
+		return;
 	
-	DMDDimension width  = dstRect.size.width;
-	DMDDimension height = dstRect.size.height;
-	DMDDimension x, y;
+	unsigned rowBytes = DMDPackedFrameGetRowBytes(frame);
+	size_t count = ((rect.origin.x & 1) + rect.size.width + 1) / 2;
+	unsigned char pair = (color & 0x0f) | (color << 4);
+	DMDDimension y;
+	for (y = DMDRectGetMinY(rect); y < DMDRectGetMaxY(rect); y++)
+	{
+		unsigned char *span = frame->buffer + y * rowBytes + rect.origin.x / 2;
+		unsigned char first = span[0], last = span[count - 1];
+		memset(span, pair, count);
+		DMDPackedRestoreEdges(span, count, rect.origin.x, rect.size.width, first, last);
+	}
+	DMDPackedFrameMarkDirty(frame, rect);
+}
+
+/* Returns nonzero if the dots of the two frames share any memory. */
+static int DMDPackedFramesOverlap(DMDPackedFrame *a, DMDPackedFrame *b)
+{
+	return a->buffer < b->buffer + DMDPackedFrameGetBufferSize(b) && b->buffer < a->buffer + DMDPackedFrameGetBufferSize(a);
+}
+
+int DMDPackedFrameCopyRect(DMDPackedFrame *src, DMDRect srcRect, DMDPackedFrame *dst, DMDPoint dstPoint, DMDBlendMode blendMode)
+{
+	DMDPackedRowBlendFunc blendRow = DMDGetPackedRowBlendFunc(blendMode);
+	if (blendRow == NULL)
+		return -1;
 	
-	if (blendMode == DMDBlendModeCopy)
+	DMDRect dstRect;
+	if (!DMDClipCopyRectToBounds(DMDPackedFrameGetBounds(src), &srcRect, DMDPackedFrameGetBounds(dst), dstPoint, &dstRect))
+		return 0;
+	DMDDimension width = MIN(srcRect.size.width, dstRect.size.width);
+	DMDDimension height = MIN(srcRect.size.height, dstRect.size.height);
+	if (width <= 0 || height <= 0)
+		return 0;
+	
+	unsigned srcRowBytes = DMDPackedFrameGetRowBytes(src), dstRowBytes = DMDPackedFrameGetRowBytes(dst);
+	unsigned dstParity = dstRect.origin.x & 1;
+	size_t count = (dstParity + width + 1) / 2;
+	const unsigned char *srcRows = src->buffer + srcRect.origin.y * srcRowBytes;
+	int sameBuffer = src->buffer == dst->buffer && srcRowBytes == dstRowBytes;
+	
+	/* Frames that share dots any other way, such as views of one buffer at different offsets
+	 * or with different row lengths, have no safe order to go through the rows in, so read
+	 * the source rows from a copy. */
+	unsigned char *copy = NULL;
+	if (!sameBuffer && DMDPackedFramesOverlap(src, dst))
 	{
-		for (y = 0; y < height; y++)
-		{
-			DMDColor *srcPtr = DMDFrameGetDotPointer(src, DMDPointMake(srcRect.origin.x, srcRect.origin.y + y));
-			DMDColor *dstPtr = DMDFrameGetDotPointer(dst, DMDPointMake(dstRect.origin.x, dstRect.origin.y + y));
-			memcpy(dstPtr, srcPtr, width);
-		}
+		copy = (unsigned char *)malloc((size_t)height * srcRowBytes);
+		if (copy == NULL)
+			return 0;
+		memcpy(copy, srcRows, (size_t)height * srcRowBytes);
+		srcRows = copy;
 	}
-	else if(blendMode == DMDBlendModeAdd)
+	
+	/* Rows are read through a scratch row when they need shifting by a nibble or may overlap dst. */
+	unsigned char *scratch = NULL;
+	if (sameBuffer || ((srcRect.origin.x ^ dstRect.origin.x) & 1))
 	{
-		for (y = 0; y < height; y++)
+		scratch = (unsigned char *)malloc(count);
+		if (scratch == NULL)
 		{
-			DMDColor *srcPtr = DMDFrameGetDotPointer(src, DMDPointMake(srcRect.origin.x, srcRect.origin.y + y));
-			DMDColor *dstPtr = DMDFrameGetDotPointer(dst, DMDPointMake(dstRect.origin.x, dstRect.origin.y + y));
-			for (x = 0; x < width; x++)
-			{
-				dstPtr[x] = MIN(dstPtr[x] + srcPtr[x], 0xF);
-			}
+			free(copy);
+			return 0;
 		}
 	}
-	else if(blendMode == DMDBlendModeSubtract)
+	
+	/* Whole rows of frames of the same even width are one contiguous span. */
+	if (scratch == NULL && width == src->size.width && width == dst->size.width && !(width & 1))
 	{
-		for (y = 0; y < height; y++)
-		{
-			DMDColor *srcPtr = DMDFrameGetDotPointer(src, DMDPointMake(srcRect.origin.x, srcRect.origin.y + y));
-			DMDColor *dstPtr = DMDFrameGetDotPointer(dst, DMDPointMake(dstRect.origin.x, dstRect.origin.y + y));
-			for (x = 0; x < width; x++)
-			{
-				dstPtr[x] = MAX(dstPtr[x] - srcPtr[x], 0);
-			}
-		}
+		blendRow(dst->buffer + dstRect.origin.y * dstRowBytes, srcRows, (size_t)height * dstRowBytes);
+		free(copy);
+		DMDPackedFrameMarkDirty(dst, DMDRectMake(0, dstRect.origin.y, width, height));
+		return 0;
 	}
-	else if(blendMode == DMDBlendModeBlackSource)
+	
+	/* Work from the bottom up when moving down within a frame so that no row is overwritten before it's read. */
+	int bottomUp = sameBuffer && dstRect.origin.y > srcRect.origin.y;
+	DMDDimension i;
+	for (i = 0; i < height; i++)
 	{
-		for (y = 0; y < height; y++)
+		DMDDimension y = bottomUp ? height - 1 - i : i;
+		const unsigned char *srcRow = srcRows + y * srcRowBytes;
+		unsigned char *span = dst->buffer + (dstRect.origin.y + y) * dstRowBytes + dstRect.origin.x / 2;
+		const unsigned char *srcSpan = srcRow + srcRect.origin.x / 2;
+		if (scratch != NULL)
 		{
-			DMDColor *srcPtr = DMDFrameGetDotPointer(src, DMDPointMake(srcRect.origin.x, srcRect.origin.y + y));
-			DMDColor *dstPtr = DMDFrameGetDotPointer(dst, DMDPointMake(dstRect.origin.x, dstRect.origin.y + y));
-			for (x = 0; x < width; x++)
-			{
-				// Only write dots into black dots.
-				if ((srcPtr[x] & 0xf) != 0)
-					dstPtr[x] = (dstPtr[x] & 0xf0) | (srcPtr[x] & 0xf);
-			}
+			DMDPackedAlignRow(scratch, srcRow, srcRowBytes, srcRect.origin.x, dstParity, count);
+			srcSpan = scratch;
 		}
+		unsigned char first = span[0], last = span[count - 1];
+		blendRow(span, srcSpan, count);
+		DMDPackedRestoreEdges(span, count, dstRect.origin.x, width, first, last);
 	}
-	else if(blendMode == DMDBlendModeAlpha)
+	
+	free(scratch);
+	free(copy);
+	DMDPackedFrameMarkDirty(dst, DMDRectMake(dstRect.origin.x, dstRect.origin.y, width, height));
+	return 0;
+}
+
+static void DMDPackRowScalar(unsigned char *dst, const DMDColor *src, DMDDimension width)
+{
+	DMDDimension x;
+	for (x = 0; x + 1 < width; x += 2)
+		dst[x / 2] = (src[x] & 0x0f) | (src[x + 1] << 4);
+	if (x < width)
+		dst[x / 2] = src[x] & 0x0f;
+}
+
+static void DMDUnpackRowScalar(DMDColor *dst, const unsigned char *src, DMDDimension width)
+{
+	DMDDimension x;
+	for (x = 0; x + 1 < width; x += 2)
 	{
-		DMDColor *alphaMap = DMDGetAlphaMap();
-		
-		for (y = 0; y < height; y++)
-		{
-			DMDColor *srcPtr = DMDFrameGetDotPointer(src, DMDPointMake(srcRect.origin.x, srcRect.origin.y + y));
-			DMDColor *dstPtr = DMDFrameGetDotPointer(dst, DMDPointMake(dstRect.origin.x, dstRect.origin.y + y));
-			for (x = 0; x < width; x++)
-			{
-				DMDColor dstValue = dstPtr[x];
-				DMDColor srcValue = srcPtr[x];
-				
-				// Use the alpha map for 'alphaboth', but act as if the dst frame has
-				// alpha of 0xf and preserve its original alpha value.
-				
-				DMDColor v = alphaMap[(unsigned char)srcValue * 256 + (unsigned char)(dstValue | 0xf0)];
-				
-				dstPtr[x] = (dstValue & 0xf0) | (v & 0x0f);
-			}
-		}
+		dst[x] = src[x / 2] & 0x0f;
+		dst[x + 1] = src[x / 2] >> 4;
 	}
-	else if(blendMode == DMDBlendModeAlphaBoth)
+	if (x < width)
+		dst[x] = src[x / 2] & 0x0f;
+}
+
+#if DMD_X86_KERNELS
+__attribute__((target("sse2")))
+static void DMDPackRowSSE2(unsigned char *dst, const DMDColor *src, DMDDimension width)
+{
+	const __m128i lo = _mm_set1_epi16(0x0f0f);
+	const __m128i byte = _mm_set1_epi16(0x00ff);
+	DMDDimension x = 0;
+	for (; x + 32 <= width; x += 32)
 	{
-		DMDColor *alphaMap = DMDGetAlphaMap();
-		
-		for (y = 0; y < height; y++)
-		{
-			DMDColor *srcPtr = DMDFrameGetDotPointer(src, DMDPointMake(srcRect.origin.x, srcRect.origin.y + y));
-			DMDColor *dstPtr = DMDFrameGetDotPointer(dst, DMDPointMake(dstRect.origin.x, dstRect.origin.y + y));
-			for (x = 0; x < width; x++)
-			{
-				char dstValue = dstPtr[x];
-				char srcValue = srcPtr[x];
-				
-				dstPtr[x] = alphaMap[(unsigned char)srcValue * 256 + (unsigned char)dstValue];
-			}
-		}
+		/* In each 16-bit lane: low byte | high byte << 4, then narrow to bytes. */
+		__m128i a = _mm_and_si128(_mm_loadu_si128((const __m128i *)(src + x)), lo);
+		__m128i b = _mm_and_si128(_mm_loadu_si128((const __m128i *)(src + x + 16)), lo);
+		a = _mm_and_si128(_mm_or_si128(a, _mm_srli_epi16(a, 4)), byte);
+		b = _mm_and_si128(_mm_or_si128(b, _mm_srli_epi16(b, 4)), byte);
+		_mm_storeu_si128((__m128i *)(dst + x / 2), _mm_packus_epi16(a, b));
+	}
+	DMDPackRowScalar(dst + x / 2, src + x, width - x);
+}
+
+__attribute__((target("sse2")))
+static void DMDUnpackRowSSE2(DMDColor *dst, const unsigned char *src, DMDDimension width)
+{
+	const __m128i lo = _mm_set1_epi8(0x0f);
+	DMDDimension x = 0;
+	for (; x + 32 <= width; x += 32)
+	{
+		__m128i p = _mm_loadu_si128((const __m128i *)(src + x / 2));
+		__m128i l = _mm_and_si128(p, lo);
+		__m128i h = _mm_and_si128(_mm_srli_epi16(p, 4), lo);
+		_mm_storeu_si128((__m128i *)(dst + x), _mm_unpacklo_epi8(l, h));
+		_mm_storeu_si128((__m128i *)(dst + x + 16), _mm_unpackhi_epi8(l, h));
+	}
+	DMDUnpackRowScalar(dst + x, src + x / 2, width - x);
+}
+#endif
+
+void DMDPackedFramePack(DMDPackedFrame *packed, DMDFrame *frame)
+{
+	DMDRect rect = DMDRectIntersection(DMDPackedFrameGetBounds(packed), DMDFrameGetBounds(frame));
+	if (DMDRectIsEmpty(rect))
+		return;
+	
+	void (*packRow)(unsigned char *, const DMDColor *, DMDDimension) = DMDPackRowScalar;
+#if DMD_X86_KERNELS
+	if (DMDGetKernelLevel() >= DMDKernelLevelSSE2)
+		packRow = DMDPackRowSSE2;
+#endif
+	
+	unsigned rowBytes = DMDPackedFrameGetRowBytes(packed);
+	DMDDimension y;
+	for (y = 0; y < rect.size.height; y++)
+	{
+		unsigned char *row = packed->buffer + y * rowBytes;
+		/* Keep the dot that shares the last byte when the frame is narrower than the packed frame. */
+		unsigned char last = row[(rect.size.width - 1) / 2];
+		packRow(row, DMDFrameGetDotPointer(frame, DMDPointMake(0, y)), rect.size.width);
+		if (rect.size.width & 1)
+			row[rect.size.width / 2] = (row[rect.size.width / 2] & 0x0f) | (last & 0xf0);
 	}
+	DMDPackedFrameMarkDirty(packed, rect);
+}
+
+void DMDPackedFrameUnpack(DMDPackedFrame *packed, DMDFrame *frame)
+{
+	DMDRect rect = DMDRectIntersection(DMDPackedFrameGetBounds(packed), DMDFrameGetBounds(frame));
+	if (DMDRectIsEmpty(rect))
+		return;
+	
+	void (*unpackRow)(DMDColor *, const unsigned char *, DMDDimension) = DMDUnpackRowScalar;
+#if DMD_X86_KERNELS
+	if (DMDGetKernelLevel() >= DMDKernelLevelSSE2)
+		unpackRow = DMDUnpackRowSSE2;
+#endif
+	
+	unsigned rowBytes = DMDPackedFrameGetRowBytes(packed);
+	DMDDimension y;
+	for (y = 0; y < rect.size.height; y++)
+		unpackRow(DMDFrameGetDotPointer(frame, DMDPointMake(0, y)), packed->buffer + y * rowBytes, rect.size.width);
+	DMDFrameMarkDirty(frame, rect);
 }
 
 
+/**
+ * P-ROC Subframe Encoding
+ * 
+ * The P-ROC expects each frame as 1 to 8 bit planes (subframes), least significant
+ * dot first within each byte.  DMDPROCColorTableInitForSubframes() folds the user's
+ * color map and the mapping from shades to subframes into a single table indexed by
+ * the raw dot value, so the encoder does one lookup per dot and then transposes 8
+ * dots at a time into the plane bytes.  The row encoders are written once for any
+ * number of planes and instantiated for each count, so the plane loop is unrolled.
+ */
 
-DMDColor *DMDGetAlphaMap(void)
+void DMDPROCColorTableInitForSubframes(DMDPROCColorTable *table, unsigned char *colorMap, unsigned subframes)
 {
-	static DMDColor *gAlphaMap = NULL;
+	DMDColor defaultColorMap[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
+	/* Color map specific to P-ROC: */
+	DMDColor procColorMap[] = {0, 2, 8, 10, 1, 3, 9, 11, 4, 6, 12, 14, 5, 7, 13, 15};
+	
+	/* If the user doesn't specify a color map, use the default. */
+	if (!colorMap)
+		colorMap = defaultColorMap;
+	
+	unsigned i;
+	for (i = 0; i < 16; i++)
+	{
+		unsigned shade = colorMap[i] & 0x0f; // Apply the mapping from dmd_set_color_mapping()
+		if (subframes == 4)
+			table->nibbleBits[i] = procColorMap[shade];
+		else
+			/* Spread the 16 shades evenly over the 2^subframes levels, subframe k weighing 2^k. */
+			table->nibbleBits[i] = (unsigned char)((shade * ((1u << subframes) - 1) + 7) / 15);
+	}
+	
+	/* Only a dot value of exactly zero is skipped; alpha-only values still go through the map. */
+	table->bits[0] = 0;
+	for (i = 1; i < 256; i++)
+		table->bits[i] = table->nibbleBits[i & 0x0f];
 	
-	if (gAlphaMap == NULL)
+	/* Packed dots have no alpha, so a zero nibble is always skipped. */
+	for (i = 0; i < 256; i++)
+		table->pairBits[i] = table->bits[i & 0x0f] | (table->bits[i >> 4] << 8);
+}
+
+void DMDPROCColorTableInit(DMDPROCColorTable *table, unsigned char *colorMap)
+{
+	DMDPROCColorTableInitForSubframes(table, colorMap, 4);
+}
+
+/* Gathers bit `plane` of each byte of `x` into one byte, byte 0 going to bit 0. */
+static inline unsigned char DMDGatherPlane(uint64_t x, unsigned plane)
+{
+	return (unsigned char)((((x >> plane) & 0x0101010101010101ULL) * 0x0102040810204080ULL) >> 56);
+}
+
+typedef void (*DMDEncodePROCRowFunc)(const DMDColor *src, unsigned char *dots, unsigned planeSize, DMDDimension width, const DMDPROCColorTable *table);
+typedef void (*DMDEncodePackedPROCRowFunc)(const unsigned char *src, unsigned char *dots, unsigned planeSize, DMDDimension width, const DMDPROCColorTable *table);
+
+/* Rows of a standard 128 column display also get encoders with the width fixed, so their loops unroll. */
+#define kDMDPROCStandardWidth (128)
+
+/* Defines encoders of each kind for a plane count, one for any width and one for the standard
+ * width; `kernel` takes the count as its last argument. */
+#define DMD_PROC_ROW_ENCODER(name, kernel, planes, srcType, attributes) \
+	attributes static void name##planes(const srcType *src, unsigned char *dots, unsigned planeSize, DMDDimension width, const DMDPROCColorTable *table) \
+	{ kernel(src, dots, planeSize, width, table, planes); } \
+	attributes static void name##planes##Standard(const srcType *src, unsigned char *dots, unsigned planeSize, DMDDimension width, const DMDPROCColorTable *table) \
+	{ (void)width; kernel(src, dots, planeSize, kDMDPROCStandardWidth, table, planes); }
+#define DMD_PROC_ROW_ENCODERS(name, kernel, srcType, attributes) \
+	DMD_PROC_ROW_ENCODER(name, kernel, 1, srcType, attributes) DMD_PROC_ROW_ENCODER(name, kernel, 2, srcType, attributes) \
+	DMD_PROC_ROW_ENCODER(name, kernel, 3, srcType, attributes) DMD_PROC_ROW_ENCODER(name, kernel, 4, srcType, attributes) \
+	DMD_PROC_ROW_ENCODER(name, kernel, 5, srcType, attributes) DMD_PROC_ROW_ENCODER(name, kernel, 6, srcType, attributes) \
+	DMD_PROC_ROW_ENCODER(name, kernel, 7, srcType, attributes) DMD_PROC_ROW_ENCODER(name, kernel, 8, srcType, attributes)
+#define DMD_PROC_ROW_ENCODER_TABLE(name) {NULL, name##1, name##2, name##3, name##4, name##5, name##6, name##7, name##8}
+#define DMD_PROC_ROW_ENCODER_STANDARD_TABLE(name) \
+	{NULL, name##1##Standard, name##2##Standard, name##3##Standard, name##4##Standard, \
+	 name##5##Standard, name##6##Standard, name##7##Standard, name##8##Standard}
+
+static inline void DMDEncodePROCRowScalar(const DMDColor *src, unsigned char *dots, unsigned planeSize, DMDDimension width, const DMDPROCColorTable *table, unsigned planes)
+{
+	const unsigned char *bits = table->bits;
+	DMDDimension col;
+	unsigned plane;
+	for (col = 0; col < width; col += 8)
+	{
+		uint64_t x = (uint64_t)bits[src[col + 0]]       | (uint64_t)bits[src[col + 1]] << 8  |
+		             (uint64_t)bits[src[col + 2]] << 16 | (uint64_t)bits[src[col + 3]] << 24 |
+		             (uint64_t)bits[src[col + 4]] << 32 | (uint64_t)bits[src[col + 5]] << 40 |
+		             (uint64_t)bits[src[col + 6]] << 48 | (uint64_t)bits[src[col + 7]] << 56;
+		if (x == 0)
+			continue;
+		unsigned char *out = dots + col / 8;
+		for (plane = 0; plane < planes; plane++)
+			out[plane * planeSize] |= DMDGatherPlane(x, plane);
+	}
+}
+
+DMD_PROC_ROW_ENCODERS(DMDEncodePROCRowScalar, DMDEncodePROCRowScalar, DMDColor, )
+
+#if DMD_X86_KERNELS
+static inline void DMDOrPlaneBits(unsigned char *out, uint32_t bits)
+{
+	/* 32 dots -> 4 bytes, first dot in the low bit of the first byte (x86 is little endian). */
+	uint32_t existing;
+	memcpy(&existing, out, sizeof(existing));
+	existing |= bits;
+	memcpy(out, &existing, sizeof(existing));
+}
+
+/* Moves bit `plane` of each byte up to bit 7 and gathers them.  Bits shifted out of the low
+ * byte of a 16 bit lane land below bit 7 of the high byte, so they don't get in the way. */
+__attribute__((target("avx2")))
+static inline uint32_t DMDMovePlaneAVX2(__m256i v, unsigned plane)
+{
+	return (uint32_t)_mm256_movemask_epi8(_mm256_sll_epi16(v, _mm_cvtsi32_si128(7 - plane)));
+}
+
+/* AVX2: a 16-entry shuffle does the lookup for 32 dots at once and movemask pulls out each plane. */
+__attribute__((target("avx2")))
+static inline void DMDEncodePROCRowAVX2(const DMDColor *src, unsigned char *dots, unsigned planeSize, DMDDimension width, const DMDPROCColorTable *table, unsigned planes)
+{
+	const __m256i lut = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)table->nibbleBits));
+	const __m256i lo = _mm256_set1_epi8(0x0f);
+	const __m256i zero = _mm256_setzero_si256();
+	DMDDimension col = 0;
+	unsigned plane;
+	for (; col + 32 <= width; col += 32)
+	{
+		__m256i s = _mm256_loadu_si256((const __m256i *)(src + col));
+		__m256i v = _mm256_shuffle_epi8(lut, _mm256_and_si256(s, lo));
+		v = _mm256_andnot_si256(_mm256_cmpeq_epi8(s, zero), v);
+		if (_mm256_testz_si256(v, v))
+			continue;
+		unsigned char *out = dots + col / 8;
+		for (plane = 0; plane < planes; plane++)
+			DMDOrPlaneBits(out + plane * planeSize, DMDMovePlaneAVX2(v, plane));
+	}
+	if (col < width)
+		DMDEncodePROCRowScalar(src + col, dots + col / 8, planeSize, width - col, table, planes);
+}
+
+DMD_PROC_ROW_ENCODERS(DMDEncodePROCRowAVX2, DMDEncodePROCRowAVX2, DMDColor, __attribute__((target("avx2"))))
+#endif
+
+static inline void DMDEncodePackedPROCRowScalar(const unsigned char *src, unsigned char *dots, unsigned planeSize, DMDDimension width, const DMDPROCColorTable *table, unsigned planes)
+{
+	const unsigned short *pairBits = table->pairBits;
+	DMDDimension col;
+	unsigned plane;
+	for (col = 0; col < width; col += 8)
 	{
-		gAlphaMap = (DMDColor*)malloc(256 * 256);
-		//fflush(stderr);
-		unsigned src, dst;
-		for (src = 0x00; src <= 0xff; src++)
+		const unsigned char *pairs = src + col / 2;
+		uint64_t x = (uint64_t)pairBits[pairs[0]]       | (uint64_t)pairBits[pairs[1]] << 16 |
+		             (uint64_t)pairBits[pairs[2]] << 32 | (uint64_t)pairBits[pairs[3]] << 48;
+		if (x == 0)
+			continue;
+		unsigned char *out = dots + col / 8;
+		for (plane = 0; plane < planes; plane++)
+			out[plane * planeSize] |= DMDGatherPlane(x, plane);
+	}
+}
+
+DMD_PROC_ROW_ENCODERS(DMDEncodePackedPROCRowScalar, DMDEncodePackedPROCRowScalar, unsigned char, )
+
+#if DMD_X86_KERNELS
+/* AVX2: 32 bytes give 64 dots.  The lookup is done on the low and high nibbles separately and
+ * the results interleaved back into dot order, then each half goes through movemask as above. */
+__attribute__((target("avx2")))
+static inline void DMDEncodePackedPROCRowAVX2(const unsigned char *src, unsigned char *dots, unsigned planeSize, DMDDimension width, const DMDPROCColorTable *table, unsigned planes)
+{
+	const __m256i lut = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)table->bits));
+	const __m256i lo = _mm256_set1_epi8(0x0f);
+	DMDDimension col = 0;
+	unsigned plane;
+	for (; col + 64 <= width; col += 64)
+	{
+		__m256i p = _mm256_loadu_si256((const __m256i *)(src + col / 2));
+		if (_mm256_testz_si256(p, p))
+			continue;
+		__m256i l = _mm256_shuffle_epi8(lut, _mm256_and_si256(p, lo));
+		__m256i h = _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(p, 4), lo));
+		/* unpack works within 128-bit lanes: a holds dots 0-15 and 32-47, b 16-31 and 48-63. */
+		__m256i a = _mm256_unpacklo_epi8(l, h);
+		__m256i b = _mm256_unpackhi_epi8(l, h);
+		__m256i v0 = _mm256_permute2x128_si256(a, b, 0x20);
+		__m256i v1 = _mm256_permute2x128_si256(a, b, 0x31);
+		unsigned char *out = dots + col / 8;
+		for (plane = 0; plane < planes; plane++)
 		{
-			for (dst = 0x00; dst <= 0xff; dst++)
-			{
-				char src_dot = (src & 0xf);
-				char src_a   = (src >>  4);
-				char dst_dot = (dst & 0xf);
-				char dst_a   = (dst >>  4);
-			
-				//Implementation of these formulas: http://en.wikipedia.org/wiki/Alpha_compositing#Alpha_blending
-				char a = src_a + dst_a * ((15.0f - src_a) / 15.0f);
-				char dot = (src_dot * (src_a / 15.0f) + dst_dot * (dst_a / 15.0f) * ((15.0f - src_a) / 15.0f)) / (a / 15.0f);
-				
-				gAlphaMap[src * 256 + dst] = (a << 4) | (dot & 0xf);
-				// fprintf(stderr, "%02x -> %02x = %02x\n", src, dst, (unsigned char)gAlphaMap[src * 256 + dst]);
-			}
+			DMDOrPlaneBits(out + plane * planeSize, DMDMovePlaneAVX2(v0, plane));
+			DMDOrPlaneBits(out + 4 + plane * planeSize, DMDMovePlaneAVX2(v1, plane));
 		}
 	}
-	return gAlphaMap;
+	if (col < width)
+		DMDEncodePackedPROCRowScalar(src + col / 2, dots + col / 8, planeSize, width - col, table, planes);
 }
 
+DMD_PROC_ROW_ENCODERS(DMDEncodePackedPROCRowAVX2, DMDEncodePackedPROCRowAVX2, unsigned char, __attribute__((target("avx2"))))
+#endif
+
+/* Indexed by [width == kDMDPROCStandardWidth][subframes]. */
+static const DMDEncodePROCRowFunc gEncodePROCRowScalar[2][kDMDPROCMaxSubframes + 1] = {
+	DMD_PROC_ROW_ENCODER_TABLE(DMDEncodePROCRowScalar), DMD_PROC_ROW_ENCODER_STANDARD_TABLE(DMDEncodePROCRowScalar)};
+static const DMDEncodePackedPROCRowFunc gEncodePackedPROCRowScalar[2][kDMDPROCMaxSubframes + 1] = {
+	DMD_PROC_ROW_ENCODER_TABLE(DMDEncodePackedPROCRowScalar), DMD_PROC_ROW_ENCODER_STANDARD_TABLE(DMDEncodePackedPROCRowScalar)};
+#if DMD_X86_KERNELS
+static const DMDEncodePROCRowFunc gEncodePROCRowAVX2[2][kDMDPROCMaxSubframes + 1] = {
+	DMD_PROC_ROW_ENCODER_TABLE(DMDEncodePROCRowAVX2), DMD_PROC_ROW_ENCODER_STANDARD_TABLE(DMDEncodePROCRowAVX2)};
+static const DMDEncodePackedPROCRowFunc gEncodePackedPROCRowAVX2[2][kDMDPROCMaxSubframes + 1] = {
+	DMD_PROC_ROW_ENCODER_TABLE(DMDEncodePackedPROCRowAVX2), DMD_PROC_ROW_ENCODER_STANDARD_TABLE(DMDEncodePackedPROCRowAVX2)};
+#endif
 
 #define drawdot(subFrame) dots[subFrame*(width*height/8) + ((row*width+col)/8)] |= 1 << (col % 8)
 
-void DMDFrameCopyPROCSubframes(DMDFrame *frame, unsigned char *dots, DMDDimension width, DMDDimension height, unsigned subframes, unsigned char *colorMap)
+static void DMDEncodePROCRows(DMDFrame *frame, unsigned char *dots, DMDDimension width, DMDDimension height, unsigned subframes, const DMDPROCColorTable *table, DMDDimension minRow, DMDDimension maxRow)
 {
-	if (subframes != 4)
+	int row, col;
+	unsigned plane;
+	
+	if (width % 8 != 0)
 	{
-		fprintf(stderr, "ERROR in DMDFrameCopyPROCSubframes(): subframes must be 4.");
+		/* Rows don't start on a byte boundary; encode dot by dot. */
+		for (row = minRow; row < maxRow; row++)
+		{
+			for (col = 0; col < width; col++)
+			{
+				DMDColor dot = table->bits[DMDFrameGetDot(frame, DMDPointMake(col, row))];
+				for (plane = 0; plane < subframes; plane++)
+					if (dot & (1 << plane)) drawdot(plane);
+			}
+		}
 		return;
 	}
-	DMDColor defaultColorMap[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
-	/* Color map specific to P-ROC: */
-	DMDColor procColorMap[] = {0, 2, 8, 10, 1, 3, 9, 11, 4, 6, 12, 14, 5, 7, 13, 15};
 	
-	/* If the user doesn't specify a color map, use the default. */
-	if (!colorMap)
-		colorMap = defaultColorMap;
+	DMDEncodePROCRowFunc encodeRow = gEncodePROCRowScalar[width == kDMDPROCStandardWidth][subframes];
+#if DMD_X86_KERNELS
+	if (DMDGetKernelLevel() >= DMDKernelLevelAVX2)
+		encodeRow = gEncodePROCRowAVX2[width == kDMDPROCStandardWidth][subframes];
+#endif
+	
+	unsigned planeSize = width * height / 8;
+	for (row = minRow; row < maxRow; row++)
+		encodeRow(DMDFrameGetDotPointer(frame, DMDPointMake(0, row)), dots + row * width / 8, planeSize, width, table);
+}
 
+static void DMDEncodePackedPROCRows(DMDPackedFrame *frame, unsigned char *dots, DMDDimension width, DMDDimension height, unsigned subframes, const DMDPROCColorTable *table, DMDDimension minRow, DMDDimension maxRow)
+{
 	int row, col;
+	unsigned plane;
 	
-	for (row = 0; row < height; row++)
+	if (width % 8 != 0)
 	{
-		for (col = 0; col < width; col++)
+		for (row = minRow; row < maxRow; row++)
 		{
-			DMDColor dot = DMDFrameGetDot(frame, DMDPointMake(col, row));
-			if (dot == 0)
-				continue;
-			else
+			for (col = 0; col < width; col++)
 			{
-				dot &= 0x0f;
-				dot = colorMap[(int)dot]; // Apply the mapping from dmd_set_color_mapping()
-				dot = procColorMap[(int)dot];
-				if (dot & 0x1) drawdot(0);
-				if (dot & 0x2) drawdot(1);
-				if (dot & 0x4) drawdot(2);
-				if (dot & 0x8) drawdot(3);
+				DMDColor dot = table->bits[DMDPackedFrameGetDot(frame, DMDPointMake(col, row))];
+				for (plane = 0; plane < subframes; plane++)
+					if (dot & (1 << plane)) drawdot(plane);
 			}
 		}
+		return;
+	}
+	
+	DMDEncodePackedPROCRowFunc encodeRow = gEncodePackedPROCRowScalar[width == kDMDPROCStandardWidth][subframes];
+#if DMD_X86_KERNELS
+	if (DMDGetKernelLevel() >= DMDKernelLevelAVX2)
+		encodeRow = gEncodePackedPROCRowAVX2[width == kDMDPROCStandardWidth][subframes];
+#endif
+	
+	unsigned planeSize = width * height / 8;
+	unsigned rowBytes = DMDPackedFrameGetRowBytes(frame);
+	for (row = minRow; row < maxRow; row++)
+		encodeRow(frame->buffer + row * rowBytes, dots + row * width / 8, planeSize, width, table);
+}
+
+/* Clears the encoded bits of rows [*minRow, *maxRow) ahead of re-encoding them, widening the
+ * range to the whole frame if rows share bytes.  Returns 0 if there is nothing to do. */
+static int DMDClearPROCSubframeRows(unsigned char *dots, DMDDimension width, DMDDimension height, unsigned subframes, DMDDimension *minRow, DMDDimension *maxRow)
+{
+	*minRow = MAX(*minRow, 0);
+	*maxRow = MIN(*maxRow, height);
+	if (*minRow >= *maxRow)
+		return 0;
+	
+	unsigned planeSize = width * height / 8;
+	unsigned plane;
+	if (width % 8 != 0)
+	{
+		/* Rows share bytes with their neighbors, so start over. */
+		memset(dots, 0, planeSize * subframes);
+		*minRow = 0;
+		*maxRow = height;
+	}
+	else
+	{
+		for (plane = 0; plane < subframes; plane++)
+			memset(dots + plane * planeSize + *minRow * width / 8, 0, (*maxRow - *minRow) * width / 8);
+	}
+	return 1;
+}
+
+static int DMDCheckPROCSubframes(unsigned subframes, const char *caller)
+{
+	if (subframes < 1 || subframes > kDMDPROCMaxSubframes)
+	{
+		fprintf(stderr, "ERROR in %s(): subframes must be 1 to %d.", caller, kDMDPROCMaxSubframes);
+		return 0;
 	}
+	return 1;
+}
+
+void DMDFrameCopyPROCSubframesWithTable(DMDFrame *frame, unsigned char *dots, DMDDimension width, DMDDimension height, unsigned subframes, const DMDPROCColorTable *table)
+{
+	if (!DMDCheckPROCSubframes(subframes, "DMDFrameCopyPROCSubframes"))
+		return;
+	DMDEncodePROCRows(frame, dots, width, height, subframes, table, 0, height);
+}
+
+void DMDFrameUpdatePROCSubframeRows(DMDFrame *frame, unsigned char *dots, DMDDimension width, DMDDimension height, unsigned subframes, const DMDPROCColorTable *table, DMDDimension minRow, DMDDimension maxRow)
+{
+	if (!DMDCheckPROCSubframes(subframes, "DMDFrameUpdatePROCSubframeRows"))
+		return;
+	if (DMDClearPROCSubframeRows(dots, width, height, subframes, &minRow, &maxRow))
+		DMDEncodePROCRows(frame, dots, width, height, subframes, table, minRow, maxRow);
+}
+
+void DMDPackedFrameCopyPROCSubframesWithTable(DMDPackedFrame *frame, unsigned char *dots, DMDDimension width, DMDDimension height, unsigned subframes, const DMDPROCColorTable *table)
+{
+	if (!DMDCheckPROCSubframes(subframes, "DMDPackedFrameCopyPROCSubframesWithTable"))
+		return;
+	DMDEncodePackedPROCRows(frame, dots, width, height, subframes, table, 0, height);
+}
+
+void DMDPackedFrameUpdatePROCSubframeRows(DMDPackedFrame *frame, unsigned char *dots, DMDDimension width, DMDDimension height, unsigned subframes, const DMDPROCColorTable *table, DMDDimension minRow, DMDDimension maxRow)
+{
+	if (!DMDCheckPROCSubframes(subframes, "DMDPackedFrameUpdatePROCSubframeRows"))
+		return;
+	if (DMDClearPROCSubframeRows(dots, width, height, subframes, &minRow, &maxRow))
+		DMDEncodePackedPROCRows(frame, dots, width, height, subframes, table, minRow, maxRow);
+}
+
+void DMDFrameCopyPROCSubframes(DMDFrame *frame, unsigned char *dots, DMDDimension width, DMDDimension height, unsigned subframes, unsigned char *colorMap)
+{
+	DMDPROCColorTable table;
+	DMDPROCColorTableInitForSubframes(&table, colorMap, subframes);
+	DMDFrameCopyPROCSubframesWithTable(frame, dots, width, height, subframes, &table);
 }
 
 
@@ -305,4 +2829,21 @@ DMDRect DMDRectIntersection(DMDRect rect0, DMDRect rect1)
    return result;
 }
 
+DMDRect DMDRectUnion(DMDRect rect0, DMDRect rect1)
+{
+   DMDRect result;
+
+   if(DMDRectIsEmpty(rect0))
+    return rect1;
+   if(DMDRectIsEmpty(rect1))
+    return rect0;
+
+   result.origin.x=MIN(DMDRectGetMinX(rect0),DMDRectGetMinX(rect1));
+   result.origin.y=MIN(DMDRectGetMinY(rect0),DMDRectGetMinY(rect1));
+   result.size.width=MAX(DMDRectGetMaxX(rect0),DMDRectGetMaxX(rect1))-result.origin.x;
+   result.size.height=MAX(DMDRectGetMaxY(rect0),DMDRectGetMaxY(rect1))-result.origin.y;
+
+   return result;
+}
+
 
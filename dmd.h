@@ -35,6 +35,8 @@
 #ifndef _DMD_H_
 #define _DMD_H_
 
+#include <stddef.h>
+
 #if defined(__cplusplus)
     #define DMD_EXTERN_C_BEGIN extern "C" {
     #define DMD_EXTERN_C_END   }
@@ -78,6 +80,8 @@ static inline DMDDimension DMDRectGetMaxX(DMDRect r) { return r.origin.x + r.siz
 static inline DMDDimension DMDRectGetMaxY(DMDRect r) { return r.origin.y + r.size.height; }
 
 DMDRect DMDRectIntersection(DMDRect a, DMDRect b);
+DMDRect DMDRectUnion(DMDRect a, DMDRect b);
+static inline int DMDRectIsEmpty(DMDRect r) { return r.size.width <= 0 || r.size.height <= 0; }
 
 
 /**
@@ -87,12 +91,65 @@ DMDRect DMDRectIntersection(DMDRect a, DMDRect b);
 typedef struct _DMDFrame {
 	DMDSize size;
 	DMDColor *buffer;
+	DMDRect dirtyRect; /* Area changed since the last DMDFrameClearDirty(); see below. */
+	unsigned long long generation; /* Changes whenever the frame is marked dirty; see below. */
 } DMDFrame;
 
 DMDFrame *DMDFrameCreate(DMDSize size);
 void DMDFrameDelete(DMDFrame *frame);
 DMDFrame *DMDFrameCopy(DMDFrame *frame);
 
+/* Creates a frame that draws into the caller's dots rather than its own, such as a
+ * frame of a memory-mapped animation.  The dots must outlive the frame; deleting
+ * the frame doesn't touch them. */
+DMDFrame *DMDFrameCreateWithBuffer(DMDSize size, DMDColor *buffer);
+
+/* Deleted frames are kept in a pool of size classes and reused by DMDFrameCreate()
+ * and DMDFrameCopy().  The pool holds at most DMDFramePoolSetLimit() bytes (16 MiB
+ * by default); DMDFramePoolTrim() returns everything it holds to the system. */
+
+typedef struct _DMDFrameStats {
+	unsigned long live;        /* Frames created and not yet deleted (excluding arena frames). */
+	unsigned long poolHits;    /* Frames allocated by reusing a pooled block. */
+	unsigned long poolMisses;  /* Frames that needed a new block from the system. */
+	size_t pooledBytes;        /* Bytes currently held by the pool. */
+} DMDFrameStats;
+
+void DMDFrameGetStats(DMDFrameStats *stats);
+void DMDFramePoolSetLimit(size_t bytes);
+void DMDFramePoolTrim(void);
+
+/* An arena hands out frames from one preallocated block, for scratch frames that
+ * only live until the end of the current display frame.  DMDFrameDelete() ignores
+ * arena frames; DMDFrameArenaReset() invalidates all of them at once.
+ * DMDFrameArenaCreateFrame() returns NULL when the arena is full. */
+
+typedef struct _DMDFrameArena DMDFrameArena;
+
+DMDFrameArena *DMDFrameArenaCreate(size_t capacity);
+void DMDFrameArenaDelete(DMDFrameArena *arena);
+DMDFrame *DMDFrameArenaCreateFrame(DMDFrameArena *arena, DMDSize size);
+void DMDFrameArenaReset(DMDFrameArena *arena);
+
+
+/**
+ * DMDFrame - Dirty Region
+ * 
+ * Each frame keeps the bounding rect of the dots changed since the dirty region was
+ * last cleared, so consumers such as the P-ROC encoder only need to revisit those rows.
+ * New frames start out entirely dirty.  The DMDFrame functions mark the areas they
+ * modify; code that writes through frame->buffer or DMDFrameGetDotPointer() directly
+ * must call DMDFrameMarkDirty() itself.
+ *
+ * Marking a frame dirty also changes its generation, which no other frame shares, so
+ * holding on to the generation tells whether a frame has been drawn into since.
+ */
+
+void DMDFrameMarkDirty(DMDFrame *frame, DMDRect rect);
+static inline DMDRect DMDFrameGetDirtyRect(DMDFrame *frame) { return frame->dirtyRect; }
+static inline void DMDFrameClearDirty(DMDFrame *frame) { frame->dirtyRect = DMDRectMake(0, 0, 0, 0); }
+static inline unsigned long long DMDFrameGetGeneration(DMDFrame *frame) { return frame->generation; }
+
 
 /**
  * DMDFrame - Accessors
@@ -103,7 +160,7 @@ DMDSize DMDFrameGetSize(DMDFrame *frame);
 unsigned DMDFrameGetBufferSize(DMDFrame *frame);
 static inline DMDColor *DMDFrameGetDotPointer(DMDFrame *frame, DMDPoint p) { return &frame->buffer[p.y * frame->size.width + p.x]; }
 static inline DMDColor DMDFrameGetDot(DMDFrame *frame, DMDPoint p) { return frame->buffer[p.y * frame->size.width + p.x]; }
-static inline void DMDFrameSetDot(DMDFrame *frame, DMDPoint p, DMDColor c) { frame->buffer[p.y * frame->size.width + p.x] = c; }
+static inline void DMDFrameSetDot(DMDFrame *frame, DMDPoint p, DMDColor c) { frame->buffer[p.y * frame->size.width + p.x] = c; DMDFrameMarkDirty(frame, DMDRectMake(p.x, p.y, 1, 1)); }
 
 /**
  * DMDFrame - Manipulation
@@ -122,13 +179,273 @@ typedef enum {
 
 void DMDFrameCopyRect(DMDFrame *from, DMDRect fromRect, DMDFrame *to, DMDPoint toPoint, DMDBlendMode blendMode);
 
+/* Copies many rects from one frame to another with the same blend mode, as for a sheet of sprites:
+ * srcRects[i] is drawn at toPoints[i].  srcRects holds either count rects or a single rect that is
+ * drawn at every point.  The blits are clipped like DMDFrameCopyRect() and drawn in order. */
+void DMDFrameCopyRects(DMDFrame *from, const DMDRect *srcRects, unsigned srcRectCount, DMDFrame *to, const DMDPoint *toPoints, unsigned count, DMDBlendMode blendMode);
+
+/* Further blend modes can be registered at runtime from a 256x256 table indexed by
+ * src * 256 + dst, as the dot values are laid out in 'alphaboth'.  The table is copied.
+ * DMDBlendModeRegister() returns the new mode, or -1 once all 16 slots are taken.
+ * DMDBlendTableInit() fills a table for some common modes, mixing the colors and
+ * keeping the dst alpha; opacity is only used by DMDBlendTableOpacity. */
+
+typedef enum {
+	DMDBlendTableMultiply = 0,
+	DMDBlendTableScreen = 1,
+	DMDBlendTableMin = 2,
+	DMDBlendTableMax = 3,
+	DMDBlendTableOpacity = 4,
+} DMDBlendTableKind;
+
+DMDBlendMode DMDBlendModeRegister(const DMDColor *table);
+int DMDBlendModeIsValid(DMDBlendMode blendMode);
+void DMDBlendTableInit(DMDColor *table, DMDBlendTableKind kind, unsigned char opacity);
+
+/* As DMDFrameCopyRect(), then mixes the result with the original dst dots; opacity 0xff is a plain copy. */
+void DMDFrameCopyRectWithOpacity(DMDFrame *from, DMDRect fromRect, DMDFrame *to, DMDPoint toPoint, DMDBlendMode blendMode, unsigned char opacity);
+
+/* One layer of a composite; layers are drawn in order, so the last one ends up on top. */
+typedef struct _DMDLayer {
+	DMDFrame *frame;       /* Layers with a NULL frame are skipped. */
+	DMDRect srcRect;
+	DMDPoint dstPoint;
+	DMDBlendMode blendMode;
+	unsigned char opacity; /* 0x00 (invisible) - 0xff (opaque) */
+} DMDLayer;
+
+void DMDFrameCompositeLayers(DMDFrame *dst, const DMDLayer *layers, unsigned count);
+
+
+/**
+ * DMDFrame - Transforms
+ * 
+ * Each transform draws the whole of `from`, transformed, at toPoint in `to` using
+ * the given blend mode, clipped to `to` like DMDFrameCopyRect().  `to` may be
+ * `from` for an in-place transform.  Scrolling moves the dots by offset with
+ * wrap-around, rotation is clockwise in quarter turns and scaling is nearest
+ * neighbour by scaleUp/scaleDown in both directions, so scaleUp 2 doubles the
+ * size and scaleDown 2 halves it.
+ */
+
+typedef enum {
+	DMDFlipHorizontal = 1,
+	DMDFlipVertical = 2,
+} DMDFlip;
+
+void DMDFrameScroll(DMDFrame *from, DMDFrame *to, DMDPoint toPoint, DMDPoint offset, DMDBlendMode blendMode);
+void DMDFrameFlip(DMDFrame *from, DMDFrame *to, DMDPoint toPoint, unsigned flip, DMDBlendMode blendMode);
+void DMDFrameRotate(DMDFrame *from, DMDFrame *to, DMDPoint toPoint, int quarterTurns, DMDBlendMode blendMode);
+void DMDFrameScale(DMDFrame *from, DMDFrame *to, DMDPoint toPoint, unsigned scaleUp, unsigned scaleDown, DMDBlendMode blendMode);
+
+
+/**
+ * DMDFrame - Transitions
+ * 
+ * DMDFrameTransition() draws the state of a transition from one frame to another
+ * at progress 0.0 (all `from`) to 1.0 (all `to`) into dst.  All three frames must
+ * be the same size; dst may be either of the others.  The direction is the way the
+ * moving edge or content travels for wipes, pushes and slides; it is ignored by
+ * crossfades, which mix the frames through the 'alpha' blend table, and irises,
+ * which open from the center.  DMDFrameTransitionSteps() draws count evenly spaced
+ * states from progress start to end, inclusive, into dsts.
+ */
+
+typedef enum {
+	DMDTransitionCrossfade = 0,
+	DMDTransitionWipe = 1,
+	DMDTransitionPush = 2,
+	DMDTransitionSlide = 3,
+	DMDTransitionIris = 4,
+} DMDTransition;
+
+typedef enum {
+	DMDDirectionNorth = 0,
+	DMDDirectionSouth = 1,
+	DMDDirectionEast = 2,
+	DMDDirectionWest = 3,
+} DMDDirection;
+
+void DMDFrameTransition(DMDFrame *from, DMDFrame *to, DMDFrame *dst, DMDTransition transition, DMDDirection direction, float progress);
+void DMDFrameTransitionSteps(DMDFrame *from, DMDFrame *to, DMDFrame **dsts, unsigned count, DMDTransition transition, DMDDirection direction, float start, float end);
+
+
+/**
+ * Kernel Selection
+ * 
+ * The blend modes are implemented as per-row kernels.  On x86 CPUs SSE2 and AVX2
+ * versions are selected at runtime based on the features of the CPU; all levels
+ * produce identical output.  DMDSetKernelLevel() is mainly useful for testing and
+ * benchmarking; it clamps the requested level to what the CPU supports and returns
+ * the level actually in effect.
+ */
+
+typedef enum {
+	DMDKernelLevelScalar = 0,
+	DMDKernelLevelSSE2 = 1,
+	DMDKernelLevelAVX2 = 2,
+} DMDKernelLevel;
+
+DMDKernelLevel DMDGetKernelLevel(void);
+DMDKernelLevel DMDSetKernelLevel(DMDKernelLevel level);
+
+/**
+ * Worker Pool
+ * 
+ * DMDFrameFillRect() and the rect copies can split large areas into bands of rows
+ * and run them on worker threads.  The pool starts with no workers; pass 0 to
+ * DMDSetWorkerCount() to stop them again.  It returns the number actually started,
+ * which is 0 where threads aren't supported.  Areas of fewer dots than the parallel
+ * threshold (64K by default; alpha and registered modes count 8 per dot) are always
+ * done on the calling thread.  Output is identical either way.  dmdbench shows where
+ * the pool starts to win on a given machine.
+ */
+
+unsigned DMDSetWorkerCount(unsigned count);
+unsigned DMDGetWorkerCount(void);
+void DMDSetParallelThreshold(unsigned dots);
+unsigned DMDGetParallelThreshold(void);
+
+
+/**
+ * DMDFrame - Delta Compression
+ * 
+ * Frames of an animation can be stored as a delta against the previous frame:
+ * runs of unchanged dots are skipped and changed dots are stored as literal or
+ * run-length filled spans.  A keyframe is a delta against an all-black frame, so
+ * it can be decoded without its predecessor.  DMDFrameEncodeDelta() returns the
+ * number of bytes written, which is at most DMDFrameGetMaxDeltaSize(); pass a NULL
+ * previous frame for a keyframe.  DMDFrameDecodeDelta() applies an encoded frame
+ * to a frame that holds the previous one (or anything, for a keyframe), marks the
+ * changed rows dirty and returns 0, or -1 if the data is malformed.
+ */
+
+size_t DMDFrameGetMaxDeltaSize(DMDSize size);
+size_t DMDFrameEncodeDelta(DMDFrame *frame, DMDFrame *previous, unsigned char *out);
+int DMDFrameDecodeDelta(DMDFrame *frame, const unsigned char *data, size_t length);
+static inline int DMDDeltaIsKeyframe(const unsigned char *data) { return data[0] == 0; }
+
+
+/**
+ * DMDFrame - Hashing
+ * 
+ * DMDFrameHash() returns a 64 bit hash of a frame's size and dots, for caches and
+ * stores keyed on frame content.  It is the same from run to run on machines of the
+ * same byte order, but different frames can share a hash, so use DMDFrameIsEqual()
+ * before treating two frames with equal hashes as the same.
+ */
+
+unsigned long long DMDFrameHash(DMDFrame *frame);
+int DMDFrameIsEqual(DMDFrame *a, DMDFrame *b);
+
+
+/**
+ * DMDFrame - Grayscale Import
+ * 
+ * DMDFrameQuantizeGray() converts an image of 8 bit gray levels, one byte per
+ * pixel and rowBytes from one row to the next, into the 16 shades of a frame's
+ * dots.  The image must be the size of the frame; the dots get no alpha
+ * (0x00-0x0f).  Each level is first mapped through curve, 256 levels as built by
+ * DMDGrayCurveInit(), or left as it is if curve is NULL.
+ * 
+ * DMDGrayCurveInit() applies gamma (level^gamma over 0-1, so a gamma above 1
+ * darkens the mid tones) then contrast (a scale about mid gray; 1 leaves it be).
+ */
+
+typedef enum {
+	DMDQuantizeThreshold = 0,      /* Nearest shade. */
+	DMDQuantizeOrdered = 1,        /* 4x4 Bayer matrix. */
+	DMDQuantizeFloydSteinberg = 2, /* Error diffusion, alternating direction from row to row. */
+} DMDQuantizeMethod;
+
+void DMDGrayCurveInit(unsigned char *curve, float gamma, float contrast);
+void DMDFrameQuantizeGray(DMDFrame *frame, const unsigned char *pixels, size_t rowBytes, const unsigned char *curve, DMDQuantizeMethod method);
+
+
+/**
+ * DMDPackedFrame - 4 Bits per Dot
+ * 
+ * A packed frame holds two dots per byte, the left dot of each pair in the low
+ * nibble, and each row starts on a byte boundary.  It stores the 16 shades only,
+ * at half the memory and bandwidth of a DMDFrame: DMDPackedFramePack() drops the
+ * alpha nibble of each dot and DMDPackedFrameUnpack() writes dots with alpha 0x0,
+ * both over the area the two frames have in common.  DMDPackedFrameCopyRect()
+ * supports the copy, add, subtract and black source blend modes, which work the
+ * same as for DMDFrame; it returns -1 for the modes that need an alpha nibble and
+ * 0 otherwise.  Copies within one frame, or between frames whose dots overlap in
+ * memory, behave as if the source rect was read in full before anything was written.
+ *
+ * As a packed dot has no alpha, a dot that is clear but for its alpha packs to 0,
+ * like a clear dot.  The P-ROC encoder skips a dot of 0 and maps every other value
+ * through the color map.  So a DMDFrame and its packed copy only encode differently
+ * for alpha-only dots under a color map that takes shade 0 to something other than 0.
+ */
+
+typedef struct _DMDPackedFrame {
+	DMDSize size;
+	unsigned char *buffer; /* DMDPackedFrameGetRowBytes() bytes per row. */
+	DMDRect dirtyRect;
+} DMDPackedFrame;
+
+DMDPackedFrame *DMDPackedFrameCreate(DMDSize size);
+DMDPackedFrame *DMDPackedFrameCreateWithBuffer(DMDSize size, unsigned char *buffer);
+void DMDPackedFrameDelete(DMDPackedFrame *frame);
+
+static inline unsigned DMDPackedFrameGetRowBytes(DMDPackedFrame *frame) { return (frame->size.width + 1) / 2; }
+static inline unsigned DMDPackedFrameGetBufferSize(DMDPackedFrame *frame) { return DMDPackedFrameGetRowBytes(frame) * frame->size.height; }
+static inline DMDRect DMDPackedFrameGetBounds(DMDPackedFrame *frame) { return DMDRectMake(0, 0, frame->size.width, frame->size.height); }
+
+void DMDPackedFrameMarkDirty(DMDPackedFrame *frame, DMDRect rect);
+static inline DMDRect DMDPackedFrameGetDirtyRect(DMDPackedFrame *frame) { return frame->dirtyRect; }
+static inline void DMDPackedFrameClearDirty(DMDPackedFrame *frame) { frame->dirtyRect = DMDRectMake(0, 0, 0, 0); }
+
+static inline DMDColor DMDPackedFrameGetDot(DMDPackedFrame *frame, DMDPoint p)
+{
+	unsigned char pair = frame->buffer[p.y * DMDPackedFrameGetRowBytes(frame) + p.x / 2];
+	return (p.x & 1) ? pair >> 4 : pair & 0x0f;
+}
+static inline void DMDPackedFrameSetDot(DMDPackedFrame *frame, DMDPoint p, DMDColor c)
+{
+	unsigned char *pair = &frame->buffer[p.y * DMDPackedFrameGetRowBytes(frame) + p.x / 2];
+	*pair = (p.x & 1) ? (*pair & 0x0f) | (c << 4) : (*pair & 0xf0) | (c & 0x0f);
+	DMDPackedFrameMarkDirty(frame, DMDRectMake(p.x, p.y, 1, 1));
+}
+
+void DMDPackedFrameFillRect(DMDPackedFrame *frame, DMDRect rect, DMDColor color);
+int DMDPackedFrameCopyRect(DMDPackedFrame *from, DMDRect fromRect, DMDPackedFrame *to, DMDPoint toPoint, DMDBlendMode blendMode);
+void DMDPackedFramePack(DMDPackedFrame *packed, DMDFrame *frame);
+void DMDPackedFrameUnpack(DMDPackedFrame *packed, DMDFrame *frame);
+
 
 /**
  * DMDFrame - P-ROC DMD Driver Support
  */
 
+/* The P-ROC takes 1 to this many subframes (bit planes) per frame; dots is width*height/8 bytes per subframe. */
+#define kDMDPROCMaxSubframes (8)
+
 void DMDFrameCopyPROCSubframes(DMDFrame *frame, unsigned char *dots, DMDDimension width, DMDDimension height, unsigned subframes, unsigned char *colorMap);
 
+/* Precomputed mapping from dot value to the P-ROC subframe bits for a given color map.
+ * Build it once with DMDPROCColorTableInit() when the color map changes, rather than per frame.
+ * A table is only good for the number of subframes it was built for. */
+typedef struct _DMDPROCColorTable {
+	unsigned char bits[256];
+	unsigned char nibbleBits[16];
+	unsigned short pairBits[256]; /* A byte of a DMDPackedFrame to the bits of its two dots, one per byte. */
+} DMDPROCColorTable;
+
+void DMDPROCColorTableInit(DMDPROCColorTable *table, unsigned char *colorMap); /* 4 subframes */
+void DMDPROCColorTableInitForSubframes(DMDPROCColorTable *table, unsigned char *colorMap, unsigned subframes);
+void DMDFrameCopyPROCSubframesWithTable(DMDFrame *frame, unsigned char *dots, DMDDimension width, DMDDimension height, unsigned subframes, const DMDPROCColorTable *table);
+
+/* Re-encodes rows [minRow, maxRow) of a previously encoded frame in place, clearing their old bits first. */
+void DMDFrameUpdatePROCSubframeRows(DMDFrame *frame, unsigned char *dots, DMDDimension width, DMDDimension height, unsigned subframes, const DMDPROCColorTable *table, DMDDimension minRow, DMDDimension maxRow);
+
+/* The same for packed frames, which only need half as many bytes read per frame. */
+void DMDPackedFrameCopyPROCSubframesWithTable(DMDPackedFrame *frame, unsigned char *dots, DMDDimension width, DMDDimension height, unsigned subframes, const DMDPROCColorTable *table);
+void DMDPackedFrameUpdatePROCSubframeRows(DMDPackedFrame *frame, unsigned char *dots, DMDDimension width, DMDDimension height, unsigned subframes, const DMDPROCColorTable *table, DMDDimension minRow, DMDDimension maxRow);
+
 
 DMD_EXTERN_C_END
 
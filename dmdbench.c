@@ -0,0 +1,497 @@
+/**
+ * dmdbench - benchmarks for the DMD library.
+ *
+ * Build with `python setup.py build_bench`, which puts an optimized dmdbench in
+ * build/, or by hand from the source directory with:
+ *   python gendmdtables.py
+ *   cc -O2 -o dmdbench dmdbench.c dmd.c dmdtables.c -lpthread -lm
+ *
+ * Usage:
+ *   dmdbench [-o results.csv] [-t seconds] [-l scalar|sse2|avx2] [-f filter]
+ *   dmdbench --compare base.csv new.csv
+ *   dmdbench --parallel [workers]
+ *
+ * By default every blend mode, the fills and the P-ROC subframe encoder are
+ * timed on a set of rect sizes and alignments, for both DMDFrame and
+ * DMDPackedFrame, and the results reported in ns per dot and GB/s of frame
+ * memory touched.  -o saves them as CSV; --compare lines up two such files, from
+ * two builds or two machines, and flags the cases that got slower.  --parallel
+ * times DMDFrameCopyRect() and DMDFrameFillRect() on growing areas, inline and on
+ * the worker pool, to show where the pool starts to pay off; use the result to
+ * tune DMDSetParallelThreshold().
+ */
+
+#include "dmd.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define kDMDBenchRuns (5)           /* Each case is timed this many times and the fastest run kept. */
+#define kDMDBenchRegression (1.05)  /* --compare flags cases at least this much slower. */
+
+static double DMDBenchNow(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void DMDBenchFill(DMDFrame *frame)
+{
+	unsigned i, n = DMDFrameGetBufferSize(frame);
+	for (i = 0; i < n; i++)
+		frame->buffer[i] = (DMDColor)(rand() & 0xff);
+}
+
+
+/**
+ * Kernel Suite
+ */
+
+typedef enum {
+	DMDBenchFillRect,
+	DMDBenchCopyRect,
+	DMDBenchCopyRectWithOpacity,
+	DMDBenchEncode,
+	DMDBenchEncodeRows,
+	DMDBenchHash,
+	DMDBenchQuantize,
+	DMDBenchPackedFillRect,
+	DMDBenchPackedCopyRect,
+	DMDBenchPackedEncode,
+} DMDBenchKind;
+
+typedef struct {
+	const char *name;
+	DMDBenchKind kind;
+	int blendMode;          /* -1 for the registered 'multiply' mode. */
+	double bytesPerDot;     /* Frame memory read and written per dot, for GB/s. */
+} DMDBenchOp;
+
+typedef struct {
+	const char *name;
+	DMDSize frameSize;
+	DMDRect rect;           /* Source rect, or the rect filled. */
+	DMDPoint dstPoint;
+} DMDBenchGeometry;
+
+static const DMDBenchOp gBenchOps[] = {
+	{"fill",             DMDBenchFillRect, 0, 1},
+	{"copy",             DMDBenchCopyRect, DMDBlendModeCopy, 2},
+	{"add",              DMDBenchCopyRect, DMDBlendModeAdd, 3},
+	{"sub",              DMDBenchCopyRect, DMDBlendModeSubtract, 3},
+	{"blacksrc",         DMDBenchCopyRect, DMDBlendModeBlackSource, 3},
+	{"alpha",            DMDBenchCopyRect, DMDBlendModeAlpha, 3},
+	{"alphaboth",        DMDBenchCopyRect, DMDBlendModeAlphaBoth, 3},
+	{"multiply",         DMDBenchCopyRect, -1, 3},
+	{"copy@50%",         DMDBenchCopyRectWithOpacity, DMDBlendModeCopy, 3},
+	{"alpha@50%",        DMDBenchCopyRectWithOpacity, DMDBlendModeAlpha, 3},
+	{"encode",           DMDBenchEncode, 0, 1.5},
+	{"encode-rows",      DMDBenchEncodeRows, 0, 1.5},
+	{"hash",             DMDBenchHash, 0, 1},
+	{"quantize",         DMDBenchQuantize, DMDQuantizeThreshold, 2},
+	{"quantize-ordered", DMDBenchQuantize, DMDQuantizeOrdered, 2},
+	{"quantize-fs",      DMDBenchQuantize, DMDQuantizeFloydSteinberg, 2},
+	{"packed-fill",      DMDBenchPackedFillRect, 0, 0.5},
+	{"packed-copy",      DMDBenchPackedCopyRect, DMDBlendModeCopy, 1},
+	{"packed-add",       DMDBenchPackedCopyRect, DMDBlendModeAdd, 1.5},
+	{"packed-sub",       DMDBenchPackedCopyRect, DMDBlendModeSubtract, 1.5},
+	{"packed-blacksrc",  DMDBenchPackedCopyRect, DMDBlendModeBlackSource, 1.5},
+	{"packed-encode",    DMDBenchPackedEncode, 0, 1},
+};
+
+static const DMDBenchGeometry gBenchGeometries[] = {
+	/* A whole P-ROC frame. */
+	{"frame",     {128, 32},  {{0, 0}, {128, 32}},  {0, 0}},
+	/* A sprite drawn at an odd position. */
+	{"sprite",    {128, 32},  {{0, 0}, {16, 16}},   {37, 9}},
+	/* A line of text. */
+	{"text",      {128, 32},  {{0, 0}, {96, 7}},    {5, 12}},
+	/* Nearly a whole frame, offset by a dot so nothing is aligned. */
+	{"unaligned", {128, 32},  {{1, 1}, {125, 30}},  {2, 1}},
+	/* A large frame, such as a high resolution display or an off-screen layer. */
+	{"large",     {512, 256}, {{0, 0}, {512, 256}}, {0, 0}},
+};
+
+/* The encoder only handles whole frames; encode-rows re-encodes this many dirty rows of one. */
+#define kDMDBenchDirtyRows (8)
+
+typedef struct {
+	DMDFrame *src, *dst;
+	DMDPackedFrame *packedSrc, *packedDst;
+	unsigned char *dots;
+	unsigned char *gray;      /* 8 bit pixels the size of the frame, for the quantizers. */
+	DMDPROCColorTable table;
+	DMDBlendMode multiply;
+	volatile unsigned long long hash;  /* Written so that hashing isn't optimized away. */
+} DMDBenchState;
+
+static int DMDBenchApplies(const DMDBenchOp *op, const DMDBenchGeometry *geometry)
+{
+	switch (op->kind)
+	{
+		case DMDBenchEncode:
+		case DMDBenchPackedEncode:
+		case DMDBenchHash:
+		case DMDBenchQuantize:
+			return geometry->rect.size.width == geometry->frameSize.width && geometry->rect.size.height == geometry->frameSize.height;
+		case DMDBenchEncodeRows:
+			return strcmp(geometry->name, "frame") == 0;
+		default:
+			return 1;
+	}
+}
+
+static unsigned DMDBenchDots(const DMDBenchOp *op, const DMDBenchGeometry *geometry)
+{
+	if (op->kind == DMDBenchEncodeRows)
+		return geometry->frameSize.width * kDMDBenchDirtyRows;
+	return geometry->rect.size.width * geometry->rect.size.height;
+}
+
+static void DMDBenchRunOp(const DMDBenchOp *op, const DMDBenchGeometry *geometry, DMDBenchState *state, unsigned i)
+{
+	DMDBlendMode blendMode = op->blendMode < 0 ? state->multiply : (DMDBlendMode)op->blendMode;
+	DMDSize size = geometry->frameSize;
+	switch (op->kind)
+	{
+		case DMDBenchFillRect:
+			DMDFrameFillRect(state->dst, geometry->rect, (DMDColor)i);
+			break;
+		case DMDBenchCopyRect:
+			DMDFrameCopyRect(state->src, geometry->rect, state->dst, geometry->dstPoint, blendMode);
+			break;
+		case DMDBenchCopyRectWithOpacity:
+			DMDFrameCopyRectWithOpacity(state->src, geometry->rect, state->dst, geometry->dstPoint, blendMode, 0x80);
+			break;
+		case DMDBenchEncode:
+			DMDFrameCopyPROCSubframesWithTable(state->src, state->dots, size.width, size.height, 4, &state->table);
+			break;
+		case DMDBenchEncodeRows:
+			DMDFrameUpdatePROCSubframeRows(state->src, state->dots, size.width, size.height, 4, &state->table, 12, 12 + kDMDBenchDirtyRows);
+			break;
+		case DMDBenchHash:
+			state->hash = DMDFrameHash(state->src);
+			break;
+		case DMDBenchQuantize:
+			DMDFrameQuantizeGray(state->dst, state->gray, size.width, NULL, (DMDQuantizeMethod)op->blendMode);
+			break;
+		case DMDBenchPackedFillRect:
+			DMDPackedFrameFillRect(state->packedDst, geometry->rect, (DMDColor)i);
+			break;
+		case DMDBenchPackedCopyRect:
+			DMDPackedFrameCopyRect(state->packedSrc, geometry->rect, state->packedDst, geometry->dstPoint, blendMode);
+			break;
+		case DMDBenchPackedEncode:
+			DMDPackedFrameCopyPROCSubframesWithTable(state->packedSrc, state->dots, size.width, size.height, 4, &state->table);
+			break;
+	}
+}
+
+/* Returns the mean time of one operation in seconds over the fastest of several runs of at least minTime each. */
+static double DMDBenchTimeCase(const DMDBenchOp *op, const DMDBenchGeometry *geometry, DMDBenchState *state, double minTime)
+{
+	double best = 0;
+	unsigned run;
+	for (run = 0; run < kDMDBenchRuns; run++)
+	{
+		unsigned iterations = 0, batch = 1;
+		double start = DMDBenchNow(), elapsed;
+		do
+		{
+			unsigned i;
+			for (i = 0; i < batch; i++)
+				DMDBenchRunOp(op, geometry, state, i);
+			iterations += batch;
+			batch *= 2;
+			elapsed = DMDBenchNow() - start;
+		} while (elapsed < minTime / kDMDBenchRuns);
+		if (run == 0 || elapsed / iterations < best)
+			best = elapsed / iterations;
+	}
+	return best;
+}
+
+static const char *DMDBenchKernelLevelName(DMDKernelLevel level)
+{
+	switch (level)
+	{
+		case DMDKernelLevelAVX2: return "avx2";
+		case DMDKernelLevelSSE2: return "sse2";
+		default: return "scalar";
+	}
+}
+
+static int DMDBenchKernels(const char *outputPath, const char *filter, double minTime)
+{
+	FILE *output = NULL;
+	unsigned g, o;
+
+	if (outputPath != NULL)
+	{
+		output = fopen(outputPath, "w");
+		if (output == NULL)
+		{
+			perror(outputPath);
+			return 1;
+		}
+		fprintf(output, "# dmdbench kernel=%s\n", DMDBenchKernelLevelName(DMDGetKernelLevel()));
+		fprintf(output, "op,geometry,dots,ns_per_call,ns_per_dot,gb_per_s\n");
+	}
+
+	DMDColor *multiplyTable = (DMDColor *)malloc(256 * 256);
+	DMDBlendTableInit(multiplyTable, DMDBlendTableMultiply, 0);
+	DMDBenchState state;
+	state.hash = 0;
+	state.multiply = DMDBlendModeRegister(multiplyTable);
+	free(multiplyTable);
+	DMDPROCColorTableInit(&state.table, NULL);
+
+	printf("Kernels: %s (times per call; GB/s of frame memory read and written)\n", DMDBenchKernelLevelName(DMDGetKernelLevel()));
+	printf("%-16s %-10s %7s %12s %10s %8s\n", "op", "geometry", "dots", "ns/call", "ns/dot", "GB/s");
+	for (g = 0; g < sizeof(gBenchGeometries) / sizeof(gBenchGeometries[0]); g++)
+	{
+		const DMDBenchGeometry *geometry = &gBenchGeometries[g];
+		DMDSize size = geometry->frameSize;
+		state.src = DMDFrameCreate(size);
+		state.dst = DMDFrameCreate(size);
+		state.packedSrc = DMDPackedFrameCreate(size);
+		state.packedDst = DMDPackedFrameCreate(size);
+		state.dots = (unsigned char *)calloc(size.width * size.height / 2, 1);
+		state.gray = (unsigned char *)malloc(size.width * size.height);
+		memcpy(state.gray, state.src->buffer, size.width * size.height);
+		DMDBenchFill(state.src);
+		DMDBenchFill(state.dst);
+		DMDPackedFramePack(state.packedSrc, state.src);
+		DMDPackedFramePack(state.packedDst, state.dst);
+
+		for (o = 0; o < sizeof(gBenchOps) / sizeof(gBenchOps[0]); o++)
+		{
+			const DMDBenchOp *op = &gBenchOps[o];
+			if (!DMDBenchApplies(op, geometry) || (filter != NULL && strstr(op->name, filter) == NULL))
+				continue;
+
+			double seconds = DMDBenchTimeCase(op, geometry, &state, minTime);
+			unsigned dots = DMDBenchDots(op, geometry);
+			double nsPerDot = seconds * 1e9 / dots;
+			double gbPerSecond = dots * op->bytesPerDot / seconds / 1e9;
+			printf("%-16s %-10s %7u %12.1f %10.3f %8.2f\n", op->name, geometry->name, dots, seconds * 1e9, nsPerDot, gbPerSecond);
+			if (output != NULL)
+				fprintf(output, "%s,%s,%u,%.1f,%.4f,%.3f\n", op->name, geometry->name, dots, seconds * 1e9, nsPerDot, gbPerSecond);
+		}
+
+		free(state.dots);
+		free(state.gray);
+		DMDFrameDelete(state.src);
+		DMDFrameDelete(state.dst);
+		DMDPackedFrameDelete(state.packedSrc);
+		DMDPackedFrameDelete(state.packedDst);
+	}
+
+	if (output != NULL)
+		fclose(output);
+	return 0;
+}
+
+
+/**
+ * Comparing Results
+ */
+
+typedef struct {
+	char op[32], geometry[32];
+	double nsPerDot;
+} DMDBenchResult;
+
+/* Reads a file written by -o.  Returns the number of results, or -1 if it can't be read. */
+static int DMDBenchReadResults(const char *path, DMDBenchResult *results, int capacity)
+{
+	FILE *input = fopen(path, "r");
+	char line[256];
+	int count = 0;
+	if (input == NULL)
+	{
+		perror(path);
+		return -1;
+	}
+	while (count < capacity && fgets(line, sizeof(line), input) != NULL)
+	{
+		DMDBenchResult *result = &results[count];
+		unsigned dots;
+		double nsPerCall;
+		if (line[0] == '#')
+			continue;
+		if (sscanf(line, "%31[^,],%31[^,],%u,%lf,%lf", result->op, result->geometry, &dots, &nsPerCall, &result->nsPerDot) == 5)
+			count++;
+	}
+	fclose(input);
+	return count;
+}
+
+static int DMDBenchCompare(const char *basePath, const char *newPath)
+{
+	static DMDBenchResult base[512], current[512];
+	int baseCount = DMDBenchReadResults(basePath, base, 512);
+	int currentCount = DMDBenchReadResults(newPath, current, 512);
+	int i, j, regressions = 0;
+	if (baseCount < 0 || currentCount < 0)
+		return 1;
+
+	printf("%-16s %-10s %10s %10s %8s\n", "op", "geometry", "base", "new", "change");
+	for (i = 0; i < currentCount; i++)
+	{
+		for (j = 0; j < baseCount; j++)
+		{
+			if (strcmp(base[j].op, current[i].op) == 0 && strcmp(base[j].geometry, current[i].geometry) == 0)
+				break;
+		}
+		if (j == baseCount)
+		{
+			printf("%-16s %-10s %10s %10.3f %8s\n", current[i].op, current[i].geometry, "-", current[i].nsPerDot, "new");
+			continue;
+		}
+		double ratio = current[i].nsPerDot / base[j].nsPerDot;
+		int slower = ratio >= kDMDBenchRegression;
+		regressions += slower;
+		printf("%-16s %-10s %10.3f %10.3f %+7.1f%%%s\n", current[i].op, current[i].geometry, base[j].nsPerDot, current[i].nsPerDot, (ratio - 1) * 100, slower ? " SLOWER" : "");
+	}
+	printf("%d case(s) at least %.0f%% slower (ns/dot)\n", regressions, (kDMDBenchRegression - 1) * 100);
+	return regressions > 0 ? 2 : 0;
+}
+
+
+/**
+ * Parallel Suite
+ */
+
+/* Returns the mean time of one fill (blendMode -1) or copy in seconds, running it for at least minTime. */
+static double DMDBenchTimeParallelOp(int blendMode, DMDFrame *src, DMDFrame *dst, double minTime)
+{
+	DMDRect bounds = DMDFrameGetBounds(src);
+	unsigned iterations = 0, batch = 1;
+	double start = DMDBenchNow(), elapsed;
+	do
+	{
+		unsigned i;
+		for (i = 0; i < batch; i++)
+		{
+			if (blendMode < 0)
+				DMDFrameFillRect(dst, bounds, (DMDColor)i);
+			else
+				DMDFrameCopyRect(src, bounds, dst, DMDPointMake(0, 0), (DMDBlendMode)blendMode);
+		}
+		iterations += batch;
+		batch *= 2;
+		elapsed = DMDBenchNow() - start;
+	} while (elapsed < minTime);
+	return elapsed / iterations;
+}
+
+static void DMDBenchParallel(unsigned workers)
+{
+	static const struct {
+		const char *name;
+		int blendMode;
+	} ops[] = {
+		{"fill", -1},
+		{"copy", DMDBlendModeCopy},
+		{"add", DMDBlendModeAdd},
+		{"alpha", DMDBlendModeAlpha},
+		{"alphaboth", DMDBlendModeAlphaBoth},
+	};
+	static const DMDSize sizes[] = {
+		{128, 32}, {256, 64}, {512, 128}, {512, 256}, {1024, 256}, {1024, 512}, {2048, 1024},
+	};
+	unsigned o, s;
+
+	workers = DMDSetWorkerCount(workers);
+	printf("Parallel crossover, %u workers (times in microseconds per call)\n", workers);
+	printf("%-10s %10s %10s %10s %8s\n", "op", "size", "inline", "pool", "speedup");
+	for (o = 0; o < sizeof(ops) / sizeof(ops[0]); o++)
+	{
+		unsigned crossover = 0;
+		for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+		{
+			DMDFrame *src = DMDFrameCreate(sizes[s]);
+			DMDFrame *dst = DMDFrameCreate(sizes[s]);
+			DMDBenchFill(src);
+			DMDBenchFill(dst);
+
+			DMDSetParallelThreshold(~0u);
+			double inlineTime = DMDBenchTimeParallelOp(ops[o].blendMode, src, dst, 0.05);
+			DMDSetParallelThreshold(0);
+			double poolTime = DMDBenchTimeParallelOp(ops[o].blendMode, src, dst, 0.05);
+
+			char size[32];
+			snprintf(size, sizeof(size), "%dx%d", sizes[s].width, sizes[s].height);
+			printf("%-10s %10s %10.2f %10.2f %7.2fx\n", ops[o].name, size, inlineTime * 1e6, poolTime * 1e6, inlineTime / poolTime);
+			if (crossover == 0 && poolTime < inlineTime)
+				crossover = sizes[s].width * sizes[s].height;
+
+			DMDFrameDelete(src);
+			DMDFrameDelete(dst);
+		}
+		if (crossover)
+			printf("%-10s pool wins from %u dots\n", ops[o].name, crossover);
+		else
+			printf("%-10s pool never wins\n", ops[o].name);
+	}
+	DMDSetWorkerCount(0);
+}
+
+
+static void DMDBenchUsage(void)
+{
+	fprintf(stderr, "usage: dmdbench [-o results.csv] [-t seconds] [-l scalar|sse2|avx2] [-f filter]\n");
+	fprintf(stderr, "       dmdbench --compare base.csv new.csv\n");
+	fprintf(stderr, "       dmdbench --parallel [workers]\n");
+}
+
+int main(int argc, char **argv)
+{
+	const char *outputPath = NULL, *filter = NULL;
+	double minTime = 0.1;
+	int i;
+
+	for (i = 1; i < argc; i++)
+	{
+		const char *arg = argv[i];
+		if (strcmp(arg, "--compare") == 0 && i + 2 < argc)
+			return DMDBenchCompare(argv[i + 1], argv[i + 2]);
+		else if (strcmp(arg, "--parallel") == 0)
+		{
+			DMDBenchParallel(i + 1 < argc ? (unsigned)atoi(argv[i + 1]) : 3);
+			return 0;
+		}
+		else if (strcmp(arg, "-o") == 0 && i + 1 < argc)
+			outputPath = argv[++i];
+		else if (strcmp(arg, "-f") == 0 && i + 1 < argc)
+			filter = argv[++i];
+		else if (strcmp(arg, "-t") == 0 && i + 1 < argc)
+			minTime = atof(argv[++i]);
+		else if (strcmp(arg, "-l") == 0 && i + 1 < argc)
+		{
+			const char *level = argv[++i];
+			if (strcmp(level, "scalar") == 0)
+				DMDSetKernelLevel(DMDKernelLevelScalar);
+			else if (strcmp(level, "sse2") == 0)
+				DMDSetKernelLevel(DMDKernelLevelSSE2);
+			else if (strcmp(level, "avx2") == 0)
+				DMDSetKernelLevel(DMDKernelLevelAVX2);
+			else
+			{
+				DMDBenchUsage();
+				return 1;
+			}
+		}
+		else
+		{
+			DMDBenchUsage();
+			return 1;
+		}
+	}
+
+	srand(1);
+	return DMDBenchKernels(outputPath, filter, minTime);
+}
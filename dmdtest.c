@@ -0,0 +1,258 @@
+/**
+ * dmdtest - behavioural tests for the DMD library.
+ *
+ * Build and run with `python setup.py test_dmd`, or by hand from the source directory with:
+ *   python gendmdtables.py
+ *   cc -O2 -o dmdtest dmdtest.c dmd.c dmdtables.c -lpthread -lm && ./dmdtest
+ *
+ * Each test compares an optimized path (SIMD kernels, the worker pool, the packed
+ * format) against a plain reference written here, on random frames.  The exit
+ * status is the number of failed checks.
+ */
+
+#include "dmd.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int gFailures = 0;
+
+#define DMDTestCheck(condition, ...) \
+	do { if (!(condition)) { gFailures++; printf("FAIL %s:%d: ", __FILE__, __LINE__); printf(__VA_ARGS__); printf("\n"); } } while (0)
+
+static void DMDTestFill(DMDFrame *frame)
+{
+	unsigned i, n = DMDFrameGetBufferSize(frame);
+	for (i = 0; i < n; i++)
+		frame->buffer[i] = (DMDColor)(rand() & 0xff);
+}
+
+
+/**
+ * Worker Pool
+ */
+
+/* Runs back to back copies of differing shapes, so that bands are split differently from one
+ * job to the next, and checks them against the same copies done inline.  Add and subtract
+ * show up a band that was applied twice. */
+static void DMDTestWorkerDeterminism(void)
+{
+	static const DMDBlendMode modes[] = {DMDBlendModeCopy, DMDBlendModeAdd, DMDBlendModeSubtract, DMDBlendModeAlpha};
+	static const DMDSize sizes[] = {{512, 256}, {2048, 8}, {64, 64}, {4096, 3}, {128, 32}};
+	unsigned threshold = DMDGetParallelThreshold();
+	unsigned m, s, run;
+
+	if (DMDSetWorkerCount(4) == 0)
+	{
+		printf("skip worker determinism: no worker threads on this platform\n");
+		return;
+	}
+	DMDSetParallelThreshold(1);
+	for (run = 0; run < 50; run++)
+	for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+	for (m = 0; m < sizeof(modes) / sizeof(modes[0]); m++)
+	{
+		DMDSize size = sizes[s];
+		DMDFrame *src = DMDFrameCreate(size), *pooled = DMDFrameCreate(size), *inline_ = DMDFrameCreate(size);
+		DMDTestFill(src);
+		DMDTestFill(pooled);
+		memcpy(inline_->buffer, pooled->buffer, DMDFrameGetBufferSize(pooled));
+
+		DMDFrameCopyRect(src, DMDFrameGetBounds(src), pooled, DMDPointMake(0, 0), modes[m]);
+		DMDSetParallelThreshold(0xffffffff);
+		DMDFrameCopyRect(src, DMDFrameGetBounds(src), inline_, DMDPointMake(0, 0), modes[m]);
+		DMDSetParallelThreshold(1);
+		DMDTestCheck(memcmp(pooled->buffer, inline_->buffer, DMDFrameGetBufferSize(pooled)) == 0,
+			"pooled copy differs from inline, mode %d, %dx%d", (int)modes[m], size.width, size.height);
+		DMDFrameDelete(src);
+		DMDFrameDelete(pooled);
+		DMDFrameDelete(inline_);
+	}
+	DMDSetParallelThreshold(threshold);
+	DMDSetWorkerCount(0);
+}
+
+
+/**
+ * P-ROC Encoders
+ */
+
+/* Sets the bits of each dot one at a time, as the encoder did before it was vectorized. */
+static void DMDTestEncodeReference(DMDFrame *frame, unsigned char *dots, unsigned subframes, const DMDPROCColorTable *table)
+{
+	DMDDimension width = frame->size.width, height = frame->size.height;
+	unsigned planeSize = width * height / 8;
+	int row, col;
+	unsigned plane;
+	for (row = 0; row < height; row++)
+	for (col = 0; col < width; col++)
+	{
+		unsigned char bits = table->bits[DMDFrameGetDot(frame, DMDPointMake(col, row))];
+		for (plane = 0; plane < subframes; plane++)
+			if (bits & (1 << plane))
+				dots[plane * planeSize + (row * width + col) / 8] |= 1 << (col % 8);
+	}
+}
+
+/* Encodes random frames at every width class, plane count and kernel level, from both frame
+ * formats, and re-encodes a band of rows in place, checking each against the reference.  The
+ * packed frame has no alpha, so its reference is the byte frame with the alpha dropped. */
+static void DMDTestPROCEncoders(void)
+{
+	static const DMDSize sizes[] = {{128, 32}, {64, 16}, {200, 7}, {16, 3}, {13, 8}};
+	DMDKernelLevel level = DMDGetKernelLevel(), k;
+	unsigned s, subframes, i;
+	
+	for (k = DMDKernelLevelScalar; k <= level; k++)
+	for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+	for (subframes = 1; subframes <= kDMDPROCMaxSubframes; subframes++)
+	{
+		DMDSize size = sizes[s];
+		unsigned dotsSize = subframes * size.width * size.height / 8;
+		unsigned char colorMap[16];
+		DMDPROCColorTable table;
+		DMDFrame *frame = DMDFrameCreate(size), *opaque = DMDFrameCreate(size);
+		DMDPackedFrame *packed = DMDPackedFrameCreate(size);
+		unsigned char *expected = calloc(dotsSize, 1), *actual = calloc(dotsSize, 1);
+		
+		for (i = 0; i < 16; i++)
+			colorMap[i] = (unsigned char)(rand() & 0x0f);
+		DMDPROCColorTableInitForSubframes(&table, colorMap, subframes);
+		DMDTestFill(frame);
+		for (i = 0; i < DMDFrameGetBufferSize(frame); i++)
+			opaque->buffer[i] = frame->buffer[i] & 0x0f;
+		DMDPackedFramePack(packed, frame);
+		DMDSetKernelLevel(k);
+		
+		DMDTestEncodeReference(frame, expected, subframes, &table);
+		DMDFrameCopyPROCSubframesWithTable(frame, actual, size.width, size.height, subframes, &table);
+		DMDTestCheck(memcmp(expected, actual, dotsSize) == 0,
+			"byte encoder differs from reference, level %d, %d planes, %dx%d", (int)k, subframes, size.width, size.height);
+		
+		/* Redraw some rows and re-encode only those over the previous encoding. */
+		for (i = size.width; i < 3 * (unsigned)size.width && i < DMDFrameGetBufferSize(frame); i++)
+			frame->buffer[i] = (DMDColor)(rand() & 0xff);
+		memset(expected, 0, dotsSize);
+		DMDTestEncodeReference(frame, expected, subframes, &table);
+		DMDFrameUpdatePROCSubframeRows(frame, actual, size.width, size.height, subframes, &table, 1, 3);
+		DMDTestCheck(memcmp(expected, actual, dotsSize) == 0,
+			"byte row update differs from reference, level %d, %d planes, %dx%d", (int)k, subframes, size.width, size.height);
+		
+		memset(expected, 0, dotsSize);
+		memset(actual, 0, dotsSize);
+		DMDTestEncodeReference(opaque, expected, subframes, &table);
+		DMDPackedFrameCopyPROCSubframesWithTable(packed, actual, size.width, size.height, subframes, &table);
+		DMDTestCheck(memcmp(expected, actual, dotsSize) == 0,
+			"packed encoder differs from reference, level %d, %d planes, %dx%d", (int)k, subframes, size.width, size.height);
+		
+		DMDSetKernelLevel(level);
+		free(expected);
+		free(actual);
+		DMDPackedFrameDelete(packed);
+		DMDFrameDelete(frame);
+		DMDFrameDelete(opaque);
+	}
+}
+
+
+/**
+ * Packed Frames
+ */
+
+/* Copies between views of one buffer, at row offsets either side of the source and with
+ * a different row length, checked against the same copy made from a snapshot of the source. */
+static void DMDTestPackedOverlap(void)
+{
+	enum { kRowBytes = 16, kRows = 64, kBase = 8 * kRowBytes };
+	static const DMDBlendMode modes[] = {DMDBlendModeCopy, DMDBlendModeAdd, DMDBlendModeSubtract, DMDBlendModeBlackSource};
+	static const struct { DMDSize size; int offset; } views[] = {
+		{{32, 40}, 0}, {{32, 40}, 3 * kRowBytes}, {{32, 40}, -3 * kRowBytes}, {{20, 40}, 5}, {{31, 20}, -kRowBytes - 1}};
+	unsigned char original[kRowBytes * kRows], inPlace[kRowBytes * kRows], expected[kRowBytes * kRows];
+	unsigned v, m, run, i;
+	
+	for (run = 0; run < 20; run++)
+	for (v = 0; v < sizeof(views) / sizeof(views[0]); v++)
+	for (m = 0; m < sizeof(modes) / sizeof(modes[0]); m++)
+	{
+		DMDSize srcSize = {32, 40};
+		DMDRect srcRect = DMDRectMake(rand() % 32, rand() % 40, 1 + rand() % 32, 1 + rand() % 40);
+		DMDPoint dstPoint = DMDPointMake(rand() % 32, rand() % 40);
+		for (i = 0; i < sizeof(original); i++)
+			original[i] = (unsigned char)rand();
+		memcpy(inPlace, original, sizeof(original));
+		memcpy(expected, original, sizeof(original));
+		
+		DMDPackedFrame *src = DMDPackedFrameCreateWithBuffer(srcSize, inPlace + kBase);
+		DMDPackedFrame *dst = DMDPackedFrameCreateWithBuffer(views[v].size, inPlace + kBase + views[v].offset);
+		DMDPackedFrameCopyRect(src, srcRect, dst, dstPoint, modes[m]);
+		DMDPackedFrameDelete(src);
+		DMDPackedFrameDelete(dst);
+		
+		DMDPackedFrame *snapshot = DMDPackedFrameCreate(srcSize);
+		memcpy(snapshot->buffer, expected + kBase, DMDPackedFrameGetBufferSize(snapshot));
+		dst = DMDPackedFrameCreateWithBuffer(views[v].size, expected + kBase + views[v].offset);
+		DMDPackedFrameCopyRect(snapshot, srcRect, dst, dstPoint, modes[m]);
+		DMDPackedFrameDelete(snapshot);
+		DMDPackedFrameDelete(dst);
+		
+		DMDTestCheck(memcmp(inPlace, expected, sizeof(expected)) == 0,
+			"overlapping packed copy differs from a copy of a snapshot, view %u, mode %d", v, (int)modes[m]);
+	}
+}
+
+/* Packing drops alpha, so the packed encoding only differs from the byte encoding for
+ * alpha-only dots, and only if the color map lights shade 0. */
+static void DMDTestPackedAlphaOnlyDots(void)
+{
+	DMDSize size = {128, 32};
+	unsigned dotsSize = 4 * size.width * size.height / 8;
+	unsigned char colorMap[16], *byteDots = calloc(dotsSize, 1), *packedDots = calloc(dotsSize, 1);
+	DMDFrame *frame = DMDFrameCreate(size);
+	DMDPackedFrame *packed = DMDPackedFrameCreate(size);
+	DMDPROCColorTable table;
+	unsigned i;
+	
+	for (i = 0; i < 16; i++)
+		colorMap[i] = (unsigned char)i;
+	DMDPROCColorTableInitForSubframes(&table, colorMap, 4);
+	DMDTestFill(frame);
+	DMDPackedFramePack(packed, frame);
+	DMDFrameCopyPROCSubframesWithTable(frame, byteDots, size.width, size.height, 4, &table);
+	DMDPackedFrameCopyPROCSubframesWithTable(packed, packedDots, size.width, size.height, 4, &table);
+	DMDTestCheck(memcmp(byteDots, packedDots, dotsSize) == 0, "packed encoding differs with shade 0 mapped to 0");
+	
+	colorMap[0] = 5;
+	DMDPROCColorTableInitForSubframes(&table, colorMap, 4);
+	for (i = 0; i < DMDFrameGetBufferSize(frame); i++)
+		frame->buffer[i] = 0x30;
+	DMDPackedFramePack(packed, frame);
+	memset(byteDots, 0, dotsSize);
+	memset(packedDots, 0, dotsSize);
+	DMDFrameCopyPROCSubframesWithTable(frame, byteDots, size.width, size.height, 4, &table);
+	DMDPackedFrameCopyPROCSubframesWithTable(packed, packedDots, size.width, size.height, 4, &table);
+	for (i = 0; i < dotsSize && packedDots[i] == 0; i++)
+		;
+	DMDTestCheck(i == dotsSize, "packed alpha-only dots were encoded");
+	for (i = 0; i < dotsSize && byteDots[i] == 0; i++)
+		;
+	DMDTestCheck(i < dotsSize, "alpha-only dots were skipped by the byte encoder");
+	
+	free(byteDots);
+	free(packedDots);
+	DMDFrameDelete(frame);
+	DMDPackedFrameDelete(packed);
+}
+
+
+int main(int argc, char **argv)
+{
+	(void)argc;
+	(void)argv;
+	srand(1);
+	DMDTestWorkerDeterminism();
+	DMDTestPROCEncoders();
+	DMDTestPackedOverlap();
+	DMDTestPackedAlphaOnlyDots();
+	printf("%s: %d failure%s\n", gFailures ? "FAILED" : "ok", gFailures, gFailures == 1 ? "" : "s");
+	return gFailures;
+}
@@ -1,4 +1,10 @@
 #include "dmdutil.h"
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 #ifndef MIN
 #define	MIN(a,b) (((a)<(b))?(a):(b))
@@ -7,6 +13,10 @@
 #define	MAX(a,b) (((a)>(b))?(a):(b))
 #endif	/* MAX */
 
+/* Copies of at least this many dots release the GIL while they run.  Below it the cost of
+ * handing the GIL over outweighs what other threads gain. */
+#define kDMDBufferReleaseGILDots (64 * 1024)
+
 extern "C" {
 
 static PyObject *
@@ -17,6 +27,11 @@ DMDBuffer_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
     self = (pinproc_DMDBufferObject *)type->tp_alloc(type, 0);
     if (self != NULL) {
 		self->frame = NULL;
+		self->base = NULL;
+		self->exports = 0;
+		self->legacyWriteExported = false;
+		self->threadUses = 0;
+		self->readonly = false;
     }
 
     return (PyObject *)self;
@@ -31,9 +46,21 @@ DMDBuffer_dealloc(PyObject* _self)
 		DMDFrameDelete(self->frame);
 		self->frame = NULL;
 	}
+	Py_CLEAR(self->base);
     self->ob_type->tp_free((PyObject*)self);
 }
 
+/* Gives a new (or emptied) DMDBuffer the frame it draws into. */
+static void
+DMDBuffer_set_frame(pinproc_DMDBufferObject *self, DMDFrame *frame)
+{
+	self->frame = frame;
+	self->shape[0] = frame->size.height;
+	self->shape[1] = frame->size.width;
+	self->strides[0] = frame->size.width;
+	self->strides[1] = 1;
+}
+
 static int
 DMDBuffer_init(pinproc_DMDBufferObject *self, PyObject *args, PyObject *kwds)
 {
@@ -43,39 +70,87 @@ DMDBuffer_init(pinproc_DMDBufferObject *self, PyObject *args, PyObject *kwds)
 	{
 		return -1;
 	}
-	self->frame = DMDFrameCreate(DMDSizeMake(width, height));
-	if (self->frame == NULL)
+	if (self->exports > 0)
+	{
+		PyErr_SetString(PyExc_BufferError, "Cannot resize a DMDBuffer while its buffer is exported");
+		return -1;
+	}
+	if (self->threadUses > 0)
+	{
+		PyErr_SetString(PyExc_BufferError, "Cannot resize a DMDBuffer while another thread is drawing with it");
+		return -1;
+	}
+	if (!DMDBufferCheckWritable(self))
+		return -1;
+	if (self->frame != NULL)
+	{
+		DMDFrameDelete(self->frame);
+		self->frame = NULL;
+	}
+	Py_CLEAR(self->base);
+	DMDFrame *frame = DMDFrameCreate(DMDSizeMake(width, height));
+	if (frame == NULL)
 	{
 		PyErr_SetString(PyExc_IOError, "Failed to allocate memory");
 		return -1;
 	}
+	DMDBuffer_set_frame(self, frame);
     return 0;
 }
 static PyObject *
 DMDBuffer_clear(pinproc_DMDBufferObject *self, PyObject *args)
 {
+	if (!DMDBufferCheckWritable(self))
+		return NULL;
 	memset(self->frame->buffer, 0, DMDFrameGetBufferSize(self->frame));
+	DMDFrameMarkDirty(self->frame, DMDFrameGetBounds(self->frame));
 	Py_INCREF(Py_None);
 	return Py_None;
 }
 static PyObject *
 DMDBuffer_set_data(pinproc_DMDBufferObject *self, PyObject *args, PyObject *kwds)
 {
-	PyObject *data_str;
+	PyObject *data_obj;
 	static char *kwlist[] = {"data", NULL};
-	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O", kwlist, &data_str))
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O", kwlist, &data_obj))
+	{
+		return NULL;
+	}
+	if (!DMDBufferCheckWritable(self))
+		return NULL;
+	
+	// Accept anything that exposes its bytes: str, bytearray, memoryview, mmap, numpy arrays...
+	Py_buffer view;
+	bool haveView = false;
+	const void *data;
+	Py_ssize_t data_len;
+	if (PyObject_CheckBuffer(data_obj))
+	{
+		if (PyObject_GetBuffer(data_obj, &view, PyBUF_ANY_CONTIGUOUS) < 0)
+			return NULL;
+		haveView = true;
+		data = view.buf;
+		data_len = view.len;
+	}
+	else if (PyObject_AsReadBuffer(data_obj, &data, &data_len) < 0)
 	{
 		return NULL;
 	}
+	
 	unsigned frame_size = DMDFrameGetBufferSize(self->frame);
-	if (PyString_Size(data_str) != frame_size)
+	if (data_len != frame_size)
 	{
-		fprintf(stderr, "length=%d != %d", (int)PyString_Size(data_str), frame_size);
+		fprintf(stderr, "length=%d != %d", (int)data_len, frame_size);
+		if (haveView)
+			PyBuffer_Release(&view);
 		PyErr_SetString(PyExc_ValueError, "Buffer length is incorrect");
 		return NULL;
 	}
 
-	memcpy(self->frame->buffer, PyString_AsString(data_str), frame_size);
+	memmove(self->frame->buffer, data, frame_size);
+	if (haveView)
+		PyBuffer_Release(&view);
+	DMDFrameMarkDirty(self->frame, DMDFrameGetBounds(self->frame));
 
 	Py_INCREF(Py_None);
 	return Py_None;
@@ -88,14 +163,17 @@ DMDBuffer_get_data(pinproc_DMDBufferObject *self, PyObject *args, PyObject *kwds
 static PyObject *
 DMDBuffer_get_data_mult(pinproc_DMDBufferObject *self, PyObject *args, PyObject *kwds)
 {
-	DMDFrame *scratch = DMDFrameCopy(self->frame);
-	for (unsigned i = 0; i < self->frame->size.width * self->frame->size.height; i++)
+	// Scale straight into the new string rather than going through a scratch frame.
+	unsigned frame_size = DMDFrameGetBufferSize(self->frame);
+	PyObject *output = PyString_FromStringAndSize(NULL, frame_size);
+	if (output == NULL)
+		return NULL;
+	unsigned char *data = (unsigned char *)PyString_AS_STRING(output);
+	for (unsigned i = 0; i < frame_size; i++)
 	{
 		unsigned char c = (self->frame->buffer[i] + 1) * 16 - 1;
-		scratch->buffer[i] = c > 15 ? c : 0;
+		data[i] = c > 15 ? c : 0;
 	}
-	PyObject *output = PyString_FromStringAndSize((char*)scratch->buffer, DMDFrameGetBufferSize(self->frame));
-	DMDFrameDelete(scratch);
 	return output;
 }
 static PyObject *
@@ -124,6 +202,8 @@ DMDBuffer_set_dot(pinproc_DMDBufferObject *self, PyObject *args, PyObject *kwds)
 	{
 		return NULL;
 	}
+	if (!DMDBufferCheckWritable(self))
+		return NULL;
 	if (x >= self->frame->size.width || y >= self->frame->size.height)
 	{
 		PyErr_SetString(PyExc_ValueError, "X or Y are out of range");
@@ -144,6 +224,8 @@ DMDBuffer_fill_rect(pinproc_DMDBufferObject *self, PyObject *args, PyObject *kwd
 	{
 		return NULL;
 	}
+	if (!DMDBufferCheckWritable(self))
+		return NULL;
 	
 	DMDFrameFillRect(self->frame, DMDRectMake(x0, y0, width, height), (DMDColor)value);
 	
@@ -151,6 +233,143 @@ DMDBuffer_fill_rect(pinproc_DMDBufferObject *self, PyObject *args, PyObject *kwd
 	return Py_None;
 }
 
+/* Names given to blend modes by register_blend_mode(), mapped to their modes. */
+static PyObject *gBlendModeNames = NULL;
+
+/* Maps the op names used by copy_to_rect() to blend modes. */
+bool
+DMDBlendModeFromString(const char *opStr, DMDBlendMode *blendMode)
+{
+	if (strcmp(opStr, "copy") == 0)
+		*blendMode = DMDBlendModeCopy;
+	else if(strcmp(opStr, "add") == 0)
+		*blendMode = DMDBlendModeAdd;
+	else if(strcmp(opStr, "sub") == 0)
+		*blendMode = DMDBlendModeSubtract;
+	else if(strcmp(opStr, "blacksrc") == 0)
+		*blendMode = DMDBlendModeBlackSource;
+	else if(strcmp(opStr, "alpha") == 0)
+		*blendMode = DMDBlendModeAlpha;
+	else if(strcmp(opStr, "alphaboth") == 0)
+		*blendMode = DMDBlendModeAlphaBoth;
+	else
+	{
+		PyObject *mode = gBlendModeNames ? PyDict_GetItemString(gBlendModeNames, opStr) : NULL;
+		if (mode == NULL)
+			return false;
+		*blendMode = (DMDBlendMode)PyInt_AsLong(mode);
+	}
+	return true;
+}
+
+/* As DMDBlendModeFromString(), but also accepts None (copy) and the integer BlendMode* constants.
+ * Sets a Python exception on failure. */
+bool
+DMDBlendModeFromObject(PyObject *opObj, DMDBlendMode *blendMode)
+{
+	if (opObj == NULL || opObj == Py_None)
+	{
+		*blendMode = DMDBlendModeCopy;
+		return true;
+	}
+	if (PyString_Check(opObj))
+	{
+		if (DMDBlendModeFromString(PyString_AsString(opObj), blendMode))
+			return true;
+	}
+	else if (PyInt_Check(opObj))
+	{
+		long mode = PyInt_AsLong(opObj);
+		if (mode >= 0 && DMDBlendModeIsValid((DMDBlendMode)mode))
+		{
+			*blendMode = (DMDBlendMode)mode;
+			return true;
+		}
+	}
+	PyErr_SetString(PyExc_ValueError, "Operation type not recognized.");
+	return false;
+}
+
+PyObject *
+pinproc_register_blend_mode(PyObject *self, PyObject *args, PyObject *kwds)
+{
+	PyObject *tableObj;
+	const char *name = NULL;
+	static char *kwlist[] = {"table", "name", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|z", kwlist, &tableObj, &name))
+	{
+		return NULL;
+	}
+	const void *table;
+	Py_ssize_t tableLength;
+	if (PyObject_AsReadBuffer(tableObj, &table, &tableLength) < 0)
+		return NULL;
+	if (tableLength != 256 * 256)
+	{
+		PyErr_SetString(PyExc_ValueError, "Blend table must be 65536 bytes, indexed by src * 256 + dst");
+		return NULL;
+	}
+	DMDBlendMode blendMode;
+	if (name != NULL && DMDBlendModeFromString(name, &blendMode))
+	{
+		PyErr_SetString(PyExc_ValueError, "A blend mode with that name already exists");
+		return NULL;
+	}
+	
+	blendMode = DMDBlendModeRegister((const DMDColor *)table);
+	if ((int)blendMode < 0)
+	{
+		PyErr_SetString(PyExc_ValueError, "No more blend modes can be registered");
+		return NULL;
+	}
+	PyObject *mode = PyInt_FromLong(blendMode);
+	if (mode == NULL)
+		return NULL;
+	if (name != NULL)
+	{
+		if (gBlendModeNames == NULL && (gBlendModeNames = PyDict_New()) == NULL)
+		{
+			Py_DECREF(mode);
+			return NULL;
+		}
+		if (PyDict_SetItemString(gBlendModeNames, name, mode) < 0)
+		{
+			Py_DECREF(mode);
+			return NULL;
+		}
+	}
+	return mode;
+}
+
+PyObject *
+pinproc_blend_table(PyObject *self, PyObject *args, PyObject *kwds)
+{
+	const char *kindStr;
+	double opacity = 1.0;
+	static char *kwlist[] = {"kind", "opacity", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|d", kwlist, &kindStr, &opacity))
+	{
+		return NULL;
+	}
+	static const char *kindNames[] = {"multiply", "screen", "min", "max", "opacity"};
+	int kind;
+	for (kind = 0; kind < 5; kind++)
+		if (strcmp(kindStr, kindNames[kind]) == 0)
+			break;
+	if (kind == 5)
+	{
+		PyErr_SetString(PyExc_ValueError, "Blend table kind not recognized.");
+		return NULL;
+	}
+	
+	PyObject *table = PyString_FromStringAndSize(NULL, 256 * 256);
+	if (table == NULL)
+		return NULL;
+	opacity = MAX(0.0, MIN(opacity, 1.0));
+	DMDBlendTableInit((DMDColor *)PyString_AS_STRING(table), (DMDBlendTableKind)kind, (unsigned char)(opacity * 255.0 + 0.5));
+	return table;
+}
+
 static PyObject *
 DMDBuffer_copy_to_rect(pinproc_DMDBufferObject *self, PyObject *args, PyObject *kwds)
 {
@@ -159,26 +378,15 @@ DMDBuffer_copy_to_rect(pinproc_DMDBufferObject *self, PyObject *args, PyObject *
 	unsigned dst_x, dst_y, src_x, src_y, width, height;
 	const char *opStr = NULL;
 	static char *kwlist[] = {"dst", "dst_x", "dst_y", "src_x", "src_y", "width", "height", "op", NULL};
-	if (!PyArg_ParseTupleAndKeywords(args, kwds, "OIIIIII|s", kwlist, &dst, &dst_x, &dst_y, &src_x, &src_y, &width, &height, &opStr))
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!IIIIII|s", kwlist, &pinproc_DMDBufferType, &dst, &dst_x, &dst_y, &src_x, &src_y, &width, &height, &opStr))
 	{
 		return NULL;
 	}
+	if (!DMDBufferCheckWritable(dst))
+		return NULL;
 	
 	DMDBlendMode blendMode = DMDBlendModeCopy;
-	
-	if (opStr == NULL || strcmp(opStr, "copy") == 0)
-		blendMode = DMDBlendModeCopy;
-	else if(strcmp(opStr, "add") == 0)
-		blendMode = DMDBlendModeAdd;
-	else if(strcmp(opStr, "sub") == 0)
-		blendMode = DMDBlendModeSubtract;
-	else if(strcmp(opStr, "blacksrc") == 0)
-		blendMode = DMDBlendModeBlackSource;
-	else if(strcmp(opStr, "alpha") == 0)
-		blendMode = DMDBlendModeAlpha;
-	else if(strcmp(opStr, "alphaboth") == 0)
-		blendMode = DMDBlendModeAlphaBoth;
-	else
+	if (opStr != NULL && !DMDBlendModeFromString(opStr, &blendMode))
 	{
 		PyErr_SetString(PyExc_ValueError, "Operation type not recognized.");
 		return NULL;
@@ -186,19 +394,207 @@ DMDBuffer_copy_to_rect(pinproc_DMDBufferObject *self, PyObject *args, PyObject *
 	
 	DMDRect srcRect = DMDRectMake(src_x, src_y, width, height);
 	DMDPoint dstPoint = DMDPointMake(dst_x, dst_y);
-	DMDFrameCopyRect(src->frame, srcRect, dst->frame, dstPoint, blendMode);
+	// Go by the area left once clipped to both frames, as an oversized rect may copy next to nothing.
+	DMDRect srcClipped = DMDRectIntersection(srcRect, DMDFrameGetBounds(src->frame));
+	DMDRect dstClipped = DMDRectIntersection(DMDRectMake(dstPoint.x + srcClipped.origin.x - srcRect.origin.x,
+		dstPoint.y + srcClipped.origin.y - srcRect.origin.y, srcClipped.size.width, srcClipped.size.height),
+		DMDFrameGetBounds(dst->frame));
+	if ((unsigned long)dstClipped.size.width * dstClipped.size.height < kDMDBufferReleaseGILDots)
+	{
+		DMDFrameCopyRect(src->frame, srcRect, dst->frame, dstPoint, blendMode);
+		Py_INCREF(Py_None);
+		return Py_None;
+	}
+	
+	// Large copies run with the GIL released.  They draw through a frame sharing dst's dots,
+	// so that dst's dirty region is only ever updated with the GIL held.
+	DMDFrame *dstView = DMDFrameCreateWithBuffer(dst->frame->size, dst->frame->buffer);
+	if (dstView == NULL)
+	{
+		PyErr_SetString(PyExc_IOError, "Failed to allocate memory");
+		return NULL;
+	}
+	DMDFrameClearDirty(dstView);
+	DMDFrame *srcFrame = src->frame;
+	src->threadUses++;
+	dst->threadUses++;
+	Py_BEGIN_ALLOW_THREADS
+	DMDFrameCopyRect(srcFrame, srcRect, dstView, dstPoint, blendMode);
+	Py_END_ALLOW_THREADS
+	src->threadUses--;
+	dst->threadUses--;
+	DMDFrameMarkDirty(dst->frame, DMDFrameGetDirtyRect(dstView));
+	DMDFrameDelete(dstView);
+	
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+/* Transforms draw into dst at (x, y) if given, or back into the buffer itself at (x, y) if dst is None.
+ * Returns the destination frame, or NULL with an exception set. */
+static DMDFrame *
+DMDBuffer_transform_dst(pinproc_DMDBufferObject *self, PyObject *dstObj)
+{
+	pinproc_DMDBufferObject *dst = self;
+	if (dstObj != NULL && dstObj != Py_None)
+	{
+		if (!PyObject_TypeCheck(dstObj, &pinproc_DMDBufferType))
+		{
+			PyErr_SetString(PyExc_TypeError, "dst must be a DMDBuffer or None");
+			return NULL;
+		}
+		dst = (pinproc_DMDBufferObject *)dstObj;
+	}
+	if (!DMDBufferCheckInitialized(self) || !DMDBufferCheckInitialized(dst) || !DMDBufferCheckWritable(dst))
+		return NULL;
+	return dst->frame;
+}
+
+static PyObject *
+DMDBuffer_scroll(pinproc_DMDBufferObject *self, PyObject *args, PyObject *kwds)
+{
+	int dx, dy, x = 0, y = 0;
+	PyObject *dstObj = Py_None, *opObj = Py_None;
+	static char *kwlist[] = {"dx", "dy", "dst", "x", "y", "op", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "ii|OiiO", kwlist, &dx, &dy, &dstObj, &x, &y, &opObj))
+	{
+		return NULL;
+	}
+	DMDBlendMode blendMode;
+	DMDFrame *dst = DMDBuffer_transform_dst(self, dstObj);
+	if (dst == NULL || !DMDBlendModeFromObject(opObj, &blendMode))
+		return NULL;
+	
+	DMDFrameScroll(self->frame, dst, DMDPointMake(x, y), DMDPointMake(dx, dy), blendMode);
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject *
+DMDBuffer_flip(pinproc_DMDBufferObject *self, PyObject *args, PyObject *kwds)
+{
+	PyObject *horizontalObj = Py_True, *verticalObj = Py_False;
+	int x = 0, y = 0;
+	PyObject *dstObj = Py_None, *opObj = Py_None;
+	static char *kwlist[] = {"horizontal", "vertical", "dst", "x", "y", "op", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|OOOiiO", kwlist, &horizontalObj, &verticalObj, &dstObj, &x, &y, &opObj))
+	{
+		return NULL;
+	}
+	DMDBlendMode blendMode;
+	DMDFrame *dst = DMDBuffer_transform_dst(self, dstObj);
+	if (dst == NULL || !DMDBlendModeFromObject(opObj, &blendMode))
+		return NULL;
+	
+	unsigned flip = 0;
+	if (PyObject_IsTrue(horizontalObj))
+		flip |= DMDFlipHorizontal;
+	if (PyObject_IsTrue(verticalObj))
+		flip |= DMDFlipVertical;
+	DMDFrameFlip(self->frame, dst, DMDPointMake(x, y), flip, blendMode);
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject *
+DMDBuffer_rotate(pinproc_DMDBufferObject *self, PyObject *args, PyObject *kwds)
+{
+	int degrees, x = 0, y = 0;
+	PyObject *dstObj = Py_None, *opObj = Py_None;
+	static char *kwlist[] = {"degrees", "dst", "x", "y", "op", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "i|OiiO", kwlist, &degrees, &dstObj, &x, &y, &opObj))
+	{
+		return NULL;
+	}
+	if (degrees % 90 != 0)
+	{
+		PyErr_SetString(PyExc_ValueError, "degrees must be a multiple of 90");
+		return NULL;
+	}
+	DMDBlendMode blendMode;
+	DMDFrame *dst = DMDBuffer_transform_dst(self, dstObj);
+	if (dst == NULL || !DMDBlendModeFromObject(opObj, &blendMode))
+		return NULL;
+	
+	DMDFrameRotate(self->frame, dst, DMDPointMake(x, y), degrees / 90, blendMode);
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject *
+DMDBuffer_scale(pinproc_DMDBufferObject *self, PyObject *args, PyObject *kwds)
+{
+	unsigned up, down = 1;
+	int x = 0, y = 0;
+	PyObject *dstObj = Py_None, *opObj = Py_None;
+	static char *kwlist[] = {"up", "down", "dst", "x", "y", "op", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "I|IOiiO", kwlist, &up, &down, &dstObj, &x, &y, &opObj))
+	{
+		return NULL;
+	}
+	if (up == 0 || down == 0)
+	{
+		PyErr_SetString(PyExc_ValueError, "Scale factors must be at least 1");
+		return NULL;
+	}
+	DMDBlendMode blendMode;
+	DMDFrame *dst = DMDBuffer_transform_dst(self, dstObj);
+	if (dst == NULL || !DMDBlendModeFromObject(opObj, &blendMode))
+		return NULL;
 	
+	DMDFrameScale(self->frame, dst, DMDPointMake(x, y), up, down, blendMode);
 	Py_INCREF(Py_None);
 	return Py_None;
 }
 
+static PyObject *
+DMDBuffer_content_hash(pinproc_DMDBufferObject *self, PyObject *args)
+{
+	if (!DMDBufferCheckInitialized(self))
+		return NULL;
+	return PyLong_FromUnsignedLongLong(DMDFrameHash(self->frame));
+}
+
+static PyObject *
+DMDBuffer_digest(pinproc_DMDBufferObject *self, PyObject *args)
+{
+	if (!DMDBufferCheckInitialized(self))
+		return NULL;
+	// Most significant byte first, as hashlib does.
+	unsigned long long hash = DMDFrameHash(self->frame);
+	char digest[8];
+	for (int i = 7; i >= 0; i--, hash >>= 8)
+		digest[i] = (char)(hash & 0xff);
+	return PyString_FromStringAndSize(digest, sizeof(digest));
+}
+
+static PyObject *
+DMDBuffer_same_content(pinproc_DMDBufferObject *self, PyObject *args, PyObject *kwds)
+{
+	pinproc_DMDBufferObject *other;
+	static char *kwlist[] = {"other", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!", kwlist, &pinproc_DMDBufferType, &other))
+	{
+		return NULL;
+	}
+	if (!DMDBufferCheckInitialized(self) || !DMDBufferCheckInitialized(other))
+		return NULL;
+	return PyBool_FromLong(DMDFrameIsEqual(self->frame, other->frame));
+}
+
+static PyObject *
+DMDBuffer_get_readonly(pinproc_DMDBufferObject *self, void *closure)
+{
+	return PyBool_FromLong(self->readonly);
+}
+
 
 PyMethodDef DMDBuffer_methods[] = {
     {"clear", (PyCFunction)DMDBuffer_clear, METH_VARARGS,
      "Sets the DMD surface to be all black."
     },
     {"set_data", (PyCFunction)DMDBuffer_set_data, METH_VARARGS|METH_KEYWORDS,
-     "Sets the DMD surface to the contents of the given string."
+     "Sets the DMD surface to the contents of the given string or other buffer object."
     },
 	{"get_data", (PyCFunction)DMDBuffer_get_data, METH_VARARGS|METH_KEYWORDS,
      "Gets the dots of the DMD surface in string format."
@@ -218,41 +614,3018 @@ PyMethodDef DMDBuffer_methods[] = {
     {"copy_to_rect", (PyCFunction)DMDBuffer_copy_to_rect, METH_VARARGS|METH_KEYWORDS,
      "Copies a rect from this buffer to the given buffer."
     },
+    {"scroll", (PyCFunction)DMDBuffer_scroll, METH_VARARGS|METH_KEYWORDS,
+     "Draws this buffer moved by (dx, dy) with wrap-around into dst (default: this buffer) at (x, y)."
+    },
+    {"flip", (PyCFunction)DMDBuffer_flip, METH_VARARGS|METH_KEYWORDS,
+     "Draws this buffer mirrored horizontally and/or vertically into dst (default: this buffer) at (x, y)."
+    },
+    {"rotate", (PyCFunction)DMDBuffer_rotate, METH_VARARGS|METH_KEYWORDS,
+     "Draws this buffer rotated clockwise by a multiple of 90 degrees into dst (default: this buffer) at (x, y)."
+    },
+    {"scale", (PyCFunction)DMDBuffer_scale, METH_VARARGS|METH_KEYWORDS,
+     "Draws this buffer scaled by up/down (nearest neighbour) into dst (default: this buffer) at (x, y)."
+    },
+    {"content_hash", (PyCFunction)DMDBuffer_content_hash, METH_NOARGS,
+     "Returns a 64 bit hash of the size and dots, for keying caches on what the buffer holds.  Buffers can share a hash without being equal."
+    },
+    {"digest", (PyCFunction)DMDBuffer_digest, METH_NOARGS,
+     "Returns content_hash() as a string of 8 bytes, most significant first."
+    },
+    {"same_content", (PyCFunction)DMDBuffer_same_content, METH_VARARGS|METH_KEYWORDS,
+     "Returns True if the other buffer has the same size and dots."
+    },
     {NULL, NULL, NULL, NULL}  /* Sentinel */
 };
 
-PyTypeObject pinproc_DMDBufferType = {
-    PyObject_HEAD_INIT(NULL)
-    0,                         /*ob_size*/
-    "pinproc.DMDBuffer",         /*tp_name*/
-    sizeof(pinproc_DMDBufferObject), /*tp_basicsize*/
-    0,                         /*tp_itemsize*/
-    DMDBuffer_dealloc,           /*tp_dealloc*/
-    0,                         /*tp_print*/
-    0,                         /*tp_getattr*/
-    0,                         /*tp_setattr*/
-    0,                         /*tp_compare*/
-    0,                         /*tp_repr*/
-    0,                         /*tp_as_number*/
-    0,                         /*tp_as_sequence*/
-    0,                         /*tp_as_mapping*/
-    0,                         /*tp_hash */
-    0,                         /*tp_call*/
-    0,                         /*tp_str*/
-    0,                         /*tp_getattro*/
-    0,                         /*tp_setattro*/
-    0,                         /*tp_as_buffer*/
-    Py_TPFLAGS_DEFAULT|Py_TPFLAGS_BASETYPE, /*tp_flags*/
-    "DMDBuffer object",         /* tp_doc */
-    0,		               /* tp_traverse */
-    0,		               /* tp_clear */
-    0,		               /* tp_richcompare */
-    0,		               /* tp_weaklistoffset */
-    0,		               /* tp_iter */
-    0,		               /* tp_iternext */
-    DMDBuffer_methods,             /* tp_methods */
-    0, //PinPROC_members,             /* tp_members */
-    0,                         /* tp_getset */
+static PyGetSetDef DMDBuffer_getset[] = {
+    {"readonly", (getter)DMDBuffer_get_readonly, NULL, "True for the shared buffers handed out by a DMDFrameStore, which can't be drawn into.", NULL},
+    {NULL}  /* Sentinel */
+};
+
+/*
+ * Compositing
+ * 
+ * A layer is given as a tuple (buffer, src_rect, dst_point[, op[, opacity]]):
+ * src_rect is (x, y, width, height) or None for the whole buffer, dst_point is
+ * (x, y), op is a copy_to_rect() op name or BlendMode* constant and opacity runs
+ * from 0.0 to 1.0.  composite() draws a whole stack of layers in one call, and a
+ * DMDCompositePlan keeps a parsed stack around for drawing again and again.
+ */
+
+/* Parses one layer tuple.  On success *bufferOut is a borrowed reference to its DMDBuffer. */
+static bool
+DMDLayerFromObject(PyObject *item, DMDLayer *layer, pinproc_DMDBufferObject **bufferOut)
+{
+	PyObject *bufferObj, *rectObj = Py_None, *pointObj = Py_None, *opObj = Py_None;
+	double opacity = 1.0;
+	if (!PyTuple_Check(item))
+	{
+		PyErr_SetString(PyExc_TypeError, "layers must be tuples of (buffer, src_rect, dst_point[, op[, opacity]])");
+		return false;
+	}
+	if (!PyArg_ParseTuple(item, "O!|OOOd:layer", &pinproc_DMDBufferType, &bufferObj, &rectObj, &pointObj, &opObj, &opacity))
+		return false;
+	
+	pinproc_DMDBufferObject *buffer = (pinproc_DMDBufferObject *)bufferObj;
+	if (buffer->frame == NULL)
+	{
+		PyErr_SetString(PyExc_ValueError, "DMDBuffer is not initialized");
+		return false;
+	}
+	
+	layer->frame = NULL; // Filled in when drawn, in case the buffer is re-initialized meanwhile.
+	layer->srcRect = DMDFrameGetBounds(buffer->frame);
+	layer->dstPoint = DMDPointMake(0, 0);
+	if (rectObj != Py_None && !PyArg_ParseTuple(rectObj, "iiii:src_rect", &layer->srcRect.origin.x, &layer->srcRect.origin.y, &layer->srcRect.size.width, &layer->srcRect.size.height))
+		return false;
+	if (pointObj != Py_None && !PyArg_ParseTuple(pointObj, "ii:dst_point", &layer->dstPoint.x, &layer->dstPoint.y))
+		return false;
+	if (!DMDBlendModeFromObject(opObj, &layer->blendMode))
+		return false;
+	opacity = MAX(0.0, MIN(1.0, opacity));
+	layer->opacity = (unsigned char)(opacity * 255.0 + 0.5);
+	
+	*bufferOut = buffer;
+	return true;
+}
+
+static void
+DMDCompositePlan_clear(pinproc_DMDCompositePlanObject *self)
+{
+	for (Py_ssize_t i = 0; i < self->count; i++)
+		Py_XDECREF(self->buffers[i]);
+	free(self->buffers);
+	free(self->layers);
+	self->buffers = NULL;
+	self->layers = NULL;
+	self->count = 0;
+}
+
+static PyObject *
+DMDCompositePlan_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+	pinproc_DMDCompositePlanObject *self;
+	
+	self = (pinproc_DMDCompositePlanObject *)type->tp_alloc(type, 0);
+	if (self != NULL) {
+		self->count = 0;
+		self->layers = NULL;
+		self->buffers = NULL;
+	}
+	
+	return (PyObject *)self;
+}
+
+static void
+DMDCompositePlan_dealloc(PyObject* _self)
+{
+	pinproc_DMDCompositePlanObject *self = (pinproc_DMDCompositePlanObject *)_self;
+	DMDCompositePlan_clear(self);
+	self->ob_type->tp_free((PyObject*)self);
+}
+
+static int
+DMDCompositePlan_init(pinproc_DMDCompositePlanObject *self, PyObject *args, PyObject *kwds)
+{
+	PyObject *layersObj;
+	static char *kwlist[] = {"layers", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O", kwlist, &layersObj))
+	{
+		return -1;
+	}
+	PyObject *seq = PySequence_Fast(layersObj, "layers must be a sequence");
+	if (seq == NULL)
+		return -1;
+	
+	DMDCompositePlan_clear(self);
+	Py_ssize_t count = PySequence_Fast_GET_SIZE(seq);
+	self->layers = (DMDLayer *)calloc(count ? count : 1, sizeof(DMDLayer));
+	self->buffers = (pinproc_DMDBufferObject **)calloc(count ? count : 1, sizeof(pinproc_DMDBufferObject *));
+	if (self->layers == NULL || self->buffers == NULL)
+	{
+		Py_DECREF(seq);
+		DMDCompositePlan_clear(self);
+		PyErr_NoMemory();
+		return -1;
+	}
+	for (Py_ssize_t i = 0; i < count; i++)
+	{
+		pinproc_DMDBufferObject *buffer;
+		if (!DMDLayerFromObject(PySequence_Fast_GET_ITEM(seq, i), &self->layers[i], &buffer))
+		{
+			Py_DECREF(seq);
+			DMDCompositePlan_clear(self);
+			return -1;
+		}
+		Py_INCREF(buffer);
+		self->buffers[i] = buffer;
+		self->count = i + 1;
+	}
+	Py_DECREF(seq);
+	return 0;
+}
+
+static void
+DMDCompositePlan_draw(pinproc_DMDCompositePlanObject *self, DMDFrame *dst)
+{
+	for (Py_ssize_t i = 0; i < self->count; i++)
+		self->layers[i].frame = self->buffers[i]->frame;
+	DMDFrameCompositeLayers(dst, self->layers, (unsigned)self->count);
+}
+
+static PyObject *
+DMDCompositePlan_run(pinproc_DMDCompositePlanObject *self, PyObject *args, PyObject *kwds)
+{
+	pinproc_DMDBufferObject *dst;
+	static char *kwlist[] = {"dst", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!", kwlist, &pinproc_DMDBufferType, &dst))
+	{
+		return NULL;
+	}
+	if (!DMDBufferCheckWritable(dst))
+		return NULL;
+	DMDCompositePlan_draw(self, dst->frame);
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject *
+DMDCompositePlan_set_dst_point(pinproc_DMDCompositePlanObject *self, PyObject *args, PyObject *kwds)
+{
+	Py_ssize_t index;
+	int x, y;
+	static char *kwlist[] = {"index", "x", "y", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "nii", kwlist, &index, &x, &y))
+	{
+		return NULL;
+	}
+	if (index < 0 || index >= self->count)
+	{
+		PyErr_SetString(PyExc_IndexError, "layer index out of range");
+		return NULL;
+	}
+	self->layers[index].dstPoint = DMDPointMake(x, y);
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static Py_ssize_t
+DMDCompositePlan_length(PyObject *_self)
+{
+	return ((pinproc_DMDCompositePlanObject *)_self)->count;
+}
+
+PyObject *
+pinproc_composite(PyObject *self, PyObject *args, PyObject *kwds)
+{
+	pinproc_DMDBufferObject *dst;
+	PyObject *layersObj;
+	static char *kwlist[] = {"dst", "layers", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!O", kwlist, &pinproc_DMDBufferType, &dst, &layersObj))
+	{
+		return NULL;
+	}
+	if (!DMDBufferCheckWritable(dst))
+		return NULL;
+	
+	if (PyObject_TypeCheck(layersObj, &pinproc_DMDCompositePlanType))
+	{
+		DMDCompositePlan_draw((pinproc_DMDCompositePlanObject *)layersObj, dst->frame);
+		Py_INCREF(Py_None);
+		return Py_None;
+	}
+	
+	PyObject *seq = PySequence_Fast(layersObj, "layers must be a sequence or DMDCompositePlan");
+	if (seq == NULL)
+		return NULL;
+	
+	const Py_ssize_t kStackLayers = 32;
+	DMDLayer stackLayers[kStackLayers];
+	Py_ssize_t count = PySequence_Fast_GET_SIZE(seq);
+	DMDLayer *layers = stackLayers;
+	if (count > kStackLayers)
+	{
+		layers = (DMDLayer *)malloc(count * sizeof(DMDLayer));
+		if (layers == NULL)
+		{
+			Py_DECREF(seq);
+			return PyErr_NoMemory();
+		}
+	}
+	
+	// The sequence holds references to the buffers until we're done.
+	bool ok = true;
+	for (Py_ssize_t i = 0; i < count && ok; i++)
+	{
+		pinproc_DMDBufferObject *buffer;
+		ok = DMDLayerFromObject(PySequence_Fast_GET_ITEM(seq, i), &layers[i], &buffer);
+		if (ok)
+			layers[i].frame = buffer->frame;
+	}
+	if (ok)
+		DMDFrameCompositeLayers(dst->frame, layers, (unsigned)count);
+	
+	if (layers != stackLayers)
+		free(layers);
+	Py_DECREF(seq);
+	if (!ok)
+		return NULL;
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+PyMethodDef DMDCompositePlan_methods[] = {
+    {"run", (PyCFunction)DMDCompositePlan_run, METH_VARARGS|METH_KEYWORDS,
+     "Draws the layers of this plan into the given buffer."
+    },
+    {"set_dst_point", (PyCFunction)DMDCompositePlan_set_dst_point, METH_VARARGS|METH_KEYWORDS,
+     "Moves the layer at the given index to a new destination point."
+    },
+    {NULL, NULL, NULL, NULL}  /* Sentinel */
+};
+
+static PySequenceMethods DMDCompositePlan_as_sequence = {
+    DMDCompositePlan_length,   /* sq_length */
+};
+
+PyTypeObject pinproc_DMDCompositePlanType = {
+    PyObject_HEAD_INIT(NULL)
+    0,                         /*ob_size*/
+    "pinproc.DMDCompositePlan", /*tp_name*/
+    sizeof(pinproc_DMDCompositePlanObject), /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    DMDCompositePlan_dealloc,  /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    &DMDCompositePlan_as_sequence, /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT|Py_TPFLAGS_BASETYPE, /*tp_flags*/
+    "Precompiled list of layers for composite()", /* tp_doc */
+    0,		               /* tp_traverse */
+    0,		               /* tp_clear */
+    0,		               /* tp_richcompare */
+    0,		               /* tp_weaklistoffset */
+    0,		               /* tp_iter */
+    0,		               /* tp_iternext */
+    DMDCompositePlan_methods,  /* tp_methods */
+    0,                         /* tp_members */
+    0,                         /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    (initproc)DMDCompositePlan_init, /* tp_init */
+    0,                         /* tp_alloc */
+    DMDCompositePlan_new,      /* tp_new */
+};
+
+/*
+ * Batched blits
+ * 
+ * blit_many() draws many rects of one buffer, such as a sprite sheet, into another
+ * in a single call.  The rects and points are passed as packed arrays of C ints
+ * rather than tuples: array.array('i'), numpy int32 arrays, struct.pack() strings
+ * or anything else that exposes its bytes.  rects holds (x, y, width, height)
+ * quadruples and points (x, y) pairs.
+ */
+
+typedef struct {
+	const int *ints;
+	Py_ssize_t count;
+	Py_buffer view;
+	bool haveView;
+	int *copy;           /* Aligned copy of the ints, if the object's were misaligned. */
+} DMDIntArray;
+
+static bool
+DMDIntArrayGet(PyObject *obj, const char *name, DMDIntArray *array)
+{
+	const void *data;
+	Py_ssize_t length;
+	array->haveView = false;
+	array->copy = NULL;
+	if (PyObject_CheckBuffer(obj))
+	{
+		if (PyObject_GetBuffer(obj, &array->view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) < 0)
+			return false;
+		array->haveView = true;
+		// Raw bytes are taken as native ints; typed arrays must hold ints.
+		const char *format = array->view.format ? array->view.format : "B";
+		if (*format == '@' || *format == '=')
+			format++;
+		bool isBytes = strcmp(format, "B") == 0 || strcmp(format, "b") == 0 || strcmp(format, "c") == 0;
+		bool isInts = (strcmp(format, "i") == 0 || strcmp(format, "l") == 0) && array->view.itemsize == sizeof(int);
+		if (!isBytes && !isInts)
+		{
+			PyBuffer_Release(&array->view);
+			array->haveView = false;
+			PyErr_Format(PyExc_TypeError, "%s must be an array of 32 bit ints", name);
+			return false;
+		}
+		data = array->view.buf;
+		length = array->view.len;
+	}
+	else if (PyObject_AsReadBuffer(obj, &data, &length) < 0)
+	{
+		return false;
+	}
+	
+	if (length % sizeof(int) != 0)
+	{
+		if (array->haveView)
+			PyBuffer_Release(&array->view);
+		array->haveView = false;
+		PyErr_Format(PyExc_ValueError, "%s length is not a whole number of 32 bit ints", name);
+		return false;
+	}
+	array->count = length / sizeof(int);
+	array->ints = (const int *)data;
+	if ((size_t)data % sizeof(int) != 0)
+	{
+		array->copy = (int *)malloc(length ? length : 1);
+		if (array->copy == NULL)
+		{
+			if (array->haveView)
+				PyBuffer_Release(&array->view);
+			array->haveView = false;
+			PyErr_NoMemory();
+			return false;
+		}
+		memcpy(array->copy, data, length);
+		array->ints = array->copy;
+	}
+	return true;
+}
+
+static void
+DMDIntArrayRelease(DMDIntArray *array)
+{
+	free(array->copy);
+	array->copy = NULL;
+	if (array->haveView)
+		PyBuffer_Release(&array->view);
+	array->haveView = false;
+}
+
+PyObject *
+pinproc_blit_many(PyObject *self, PyObject *args, PyObject *kwds)
+{
+	pinproc_DMDBufferObject *dst, *src;
+	PyObject *rectsObj, *pointsObj, *opObj = Py_None;
+	static char *kwlist[] = {"dst", "src", "rects", "points", "op", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!O!OO|O", kwlist, &pinproc_DMDBufferType, &dst, &pinproc_DMDBufferType, &src, &rectsObj, &pointsObj, &opObj))
+	{
+		return NULL;
+	}
+	DMDBlendMode blendMode;
+	if (!DMDBufferCheckInitialized(dst) || !DMDBufferCheckInitialized(src) ||
+		!DMDBufferCheckWritable(dst) || !DMDBlendModeFromObject(opObj, &blendMode))
+		return NULL;
+	
+	DMDIntArray points;
+	if (!DMDIntArrayGet(pointsObj, "points", &points))
+		return NULL;
+	if (points.count % 2 != 0)
+	{
+		DMDIntArrayRelease(&points);
+		PyErr_SetString(PyExc_ValueError, "points must hold (x, y) pairs");
+		return NULL;
+	}
+	Py_ssize_t count = points.count / 2;
+	
+	// DMDRect and DMDPoint are laid out as plain ints, so the arrays are used as they are.
+	DMDIntArray rects;
+	DMDRect wholeRect = DMDFrameGetBounds(src->frame);
+	const DMDRect *srcRects = &wholeRect;
+	Py_ssize_t rectCount = 1;
+	if (rectsObj != Py_None)
+	{
+		if (!DMDIntArrayGet(rectsObj, "rects", &rects))
+		{
+			DMDIntArrayRelease(&points);
+			return NULL;
+		}
+		rectCount = rects.count / 4;
+		if (rects.count % 4 != 0 || (rectCount != 1 && rectCount != count))
+		{
+			DMDIntArrayRelease(&rects);
+			DMDIntArrayRelease(&points);
+			PyErr_SetString(PyExc_ValueError, "rects must hold one (x, y, width, height) rect, or one per point");
+			return NULL;
+		}
+		srcRects = (const DMDRect *)rects.ints;
+	}
+	
+	DMDFrameCopyRects(src->frame, srcRects, (unsigned)rectCount, dst->frame, (const DMDPoint *)points.ints, (unsigned)count, blendMode);
+	
+	if (rectsObj != Py_None)
+		DMDIntArrayRelease(&rects);
+	DMDIntArrayRelease(&points);
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+/*
+ * Transitions
+ * 
+ * transition() draws one state of a transition between two buffers, and
+ * transition_frames() a whole run of them in one call, for example every frame
+ * of the transition up front.  Effects and directions are given by name
+ * ('crossfade', 'wipe', 'push', 'slide', 'iris'; 'north', 'south', 'east',
+ * 'west', as in pyprocgame) or by the Transition* and Direction* constants.
+ */
+
+/* Parses an effect or direction given as one of names (in enum order) or its integer value.  Sets a Python exception on failure. */
+static bool
+DMDEnumFromObject(PyObject *obj, const char **names, int count, const char *what, int *value)
+{
+	if (PyString_Check(obj))
+	{
+		const char *str = PyString_AsString(obj);
+		for (int i = 0; i < count; i++)
+		{
+			if (strcmp(str, names[i]) == 0)
+			{
+				*value = i;
+				return true;
+			}
+		}
+	}
+	else if (PyInt_Check(obj))
+	{
+		long i = PyInt_AsLong(obj);
+		if (i >= 0 && i < count)
+		{
+			*value = (int)i;
+			return true;
+		}
+	}
+	PyErr_Format(PyExc_ValueError, "%s not recognized.", what);
+	return false;
+}
+
+static bool
+DMDTransitionFromObjects(PyObject *effectObj, PyObject *directionObj, DMDTransition *transition, DMDDirection *direction)
+{
+	static const char *effectNames[] = {"crossfade", "wipe", "push", "slide", "iris"};
+	static const char *directionNames[] = {"north", "south", "east", "west"};
+	int effect, dir = DMDDirectionWest;
+	if (!DMDEnumFromObject(effectObj, effectNames, 5, "Transition effect", &effect))
+		return false;
+	if (directionObj != NULL && directionObj != Py_None && !DMDEnumFromObject(directionObj, directionNames, 4, "Transition direction", &dir))
+		return false;
+	*transition = (DMDTransition)effect;
+	*direction = (DMDDirection)dir;
+	return true;
+}
+
+static bool
+DMDTransitionCheckSize(DMDFrame *frame, DMDFrame *reference)
+{
+	if (frame == NULL || reference == NULL)
+	{
+		PyErr_SetString(PyExc_ValueError, "DMDBuffer is not initialized");
+		return false;
+	}
+	if (frame->size.width != reference->size.width || frame->size.height != reference->size.height)
+	{
+		PyErr_SetString(PyExc_ValueError, "Transition buffers must all be the same size");
+		return false;
+	}
+	return true;
+}
+
+PyObject *
+pinproc_transition(PyObject *self, PyObject *args, PyObject *kwds)
+{
+	pinproc_DMDBufferObject *from, *to, *dst;
+	PyObject *effectObj, *directionObj = Py_None;
+	float progress;
+	static char *kwlist[] = {"from_buffer", "to_buffer", "dst", "effect", "progress", "direction", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!O!O!Of|O", kwlist, &pinproc_DMDBufferType, &from, &pinproc_DMDBufferType, &to, &pinproc_DMDBufferType, &dst, &effectObj, &progress, &directionObj))
+	{
+		return NULL;
+	}
+	DMDTransition transition;
+	DMDDirection direction;
+	if (!DMDTransitionFromObjects(effectObj, directionObj, &transition, &direction))
+		return NULL;
+	if (!DMDTransitionCheckSize(to->frame, from->frame) || !DMDTransitionCheckSize(dst->frame, from->frame))
+		return NULL;
+	if (!DMDBufferCheckWritable(dst))
+		return NULL;
+	
+	DMDFrameTransition(from->frame, to->frame, dst->frame, transition, direction, progress);
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+PyObject *
+pinproc_transition_frames(PyObject *self, PyObject *args, PyObject *kwds)
+{
+	pinproc_DMDBufferObject *from, *to;
+	PyObject *dstsObj, *effectObj, *directionObj = Py_None;
+	float start = 0.0f, end = 1.0f;
+	static char *kwlist[] = {"from_buffer", "to_buffer", "dsts", "effect", "start", "end", "direction", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!O!OO|ffO", kwlist, &pinproc_DMDBufferType, &from, &pinproc_DMDBufferType, &to, &dstsObj, &effectObj, &start, &end, &directionObj))
+	{
+		return NULL;
+	}
+	DMDTransition transition;
+	DMDDirection direction;
+	if (!DMDTransitionFromObjects(effectObj, directionObj, &transition, &direction))
+		return NULL;
+	if (!DMDTransitionCheckSize(to->frame, from->frame))
+		return NULL;
+	
+	PyObject *seq = PySequence_Fast(dstsObj, "dsts must be a sequence of DMDBuffers");
+	if (seq == NULL)
+		return NULL;
+	Py_ssize_t count = PySequence_Fast_GET_SIZE(seq);
+	DMDFrame **dsts = (DMDFrame **)malloc(sizeof(DMDFrame *) * (count > 0 ? count : 1));
+	if (dsts == NULL)
+	{
+		Py_DECREF(seq);
+		return PyErr_NoMemory();
+	}
+	for (Py_ssize_t i = 0; i < count; i++)
+	{
+		PyObject *item = PySequence_Fast_GET_ITEM(seq, i);
+		if (!PyObject_TypeCheck(item, &pinproc_DMDBufferType))
+		{
+			PyErr_SetString(PyExc_TypeError, "dsts must be a sequence of DMDBuffers");
+			free(dsts);
+			Py_DECREF(seq);
+			return NULL;
+		}
+		dsts[i] = ((pinproc_DMDBufferObject *)item)->frame;
+		if (!DMDTransitionCheckSize(dsts[i], from->frame) || !DMDBufferCheckWritable((pinproc_DMDBufferObject *)item))
+		{
+			free(dsts);
+			Py_DECREF(seq);
+			return NULL;
+		}
+	}
+	
+	DMDFrameTransitionSteps(from->frame, to->frame, dsts, (unsigned)count, transition, direction, start, end);
+	free(dsts);
+	Py_DECREF(seq);
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+/*
+ * Fonts
+ * 
+ * A DMDFont draws text from a glyph atlas (a DMDBuffer) using a table of glyph
+ * rects and advances, laid out the same way as pyprocgame's fonts: glyphs for
+ * first_char onwards in a grid of char_size cells, columns cells across.  The
+ * x offset of every character in recently drawn or measured strings is kept
+ * in a small cache, since score displays redraw the same strings every frame.
+ */
+
+static void
+DMDFont_invalidate_layouts(pinproc_DMDFontObject *self)
+{
+	for (int i = 0; i < kDMDFontLayoutCacheSize; i++)
+	{
+		DMDFontLayout *layout = &self->layouts[i];
+		Py_CLEAR(layout->text);
+		free(layout->offsets);
+		layout->offsets = NULL;
+	}
+}
+
+static inline int
+DMDFont_kerning(pinproc_DMDFontObject *self, unsigned char left, unsigned char right)
+{
+	return self->kerning ? self->kerning[left * 256 + right] : 0;
+}
+
+/* Returns the cached layout of text (a str), laying it out first if need be, or NULL if out of memory. */
+static DMDFontLayout *
+DMDFont_layout(pinproc_DMDFontObject *self, PyObject *text)
+{
+	long hash = PyObject_Hash(text);
+	DMDFontLayout *layout = &self->layouts[(unsigned long)hash % kDMDFontLayoutCacheSize];
+	if (layout->text != NULL)
+	{
+		if (layout->text == text || (PyString_GET_SIZE(layout->text) == PyString_GET_SIZE(text) &&
+			memcmp(PyString_AS_STRING(layout->text), PyString_AS_STRING(text), PyString_GET_SIZE(text)) == 0))
+			return layout;
+		Py_CLEAR(layout->text);
+		free(layout->offsets);
+		layout->offsets = NULL;
+	}
+	
+	Py_ssize_t length = PyString_GET_SIZE(text);
+	const unsigned char *chars = (const unsigned char *)PyString_AS_STRING(text);
+	layout->offsets = (DMDDimension *)malloc((length ? length : 1) * sizeof(DMDDimension));
+	if (layout->offsets == NULL)
+	{
+		PyErr_NoMemory();
+		return NULL;
+	}
+	DMDDimension x = 0;
+	for (Py_ssize_t i = 0; i < length; i++)
+	{
+		layout->offsets[i] = x;
+		x += self->glyphs[chars[i]].advance + self->tracking;
+		if (i + 1 < length)
+			x += DMDFont_kerning(self, chars[i], chars[i + 1]);
+	}
+	layout->width = x;
+	Py_INCREF(text);
+	layout->text = text;
+	return layout;
+}
+
+static PyObject *
+DMDFont_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+	pinproc_DMDFontObject *self;
+	
+	self = (pinproc_DMDFontObject *)type->tp_alloc(type, 0);
+	if (self != NULL) {
+		// tp_alloc zeroes the glyphs, kerning and layout cache for us.
+		self->atlas = NULL;
+		self->blendMode = DMDBlendModeBlackSource;
+	}
+	
+	return (PyObject *)self;
+}
+
+static void
+DMDFont_dealloc(PyObject* _self)
+{
+	pinproc_DMDFontObject *self = (pinproc_DMDFontObject *)_self;
+	DMDFont_invalidate_layouts(self);
+	free(self->kerning);
+	Py_XDECREF(self->atlas);
+	self->ob_type->tp_free((PyObject*)self);
+}
+
+static int
+DMDFont_init(pinproc_DMDFontObject *self, PyObject *args, PyObject *kwds)
+{
+	pinproc_DMDBufferObject *atlas;
+	int charSize, tracking = 0, firstChar = 32, columns = 10;
+	PyObject *widthsObj, *opObj = NULL;
+	static char *kwlist[] = {"atlas", "char_size", "char_widths", "tracking", "first_char", "columns", "op", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!iO|iiiO", kwlist, &pinproc_DMDBufferType, &atlas, &charSize, &widthsObj, &tracking, &firstChar, &columns, &opObj))
+	{
+		return -1;
+	}
+	if (charSize <= 0 || columns <= 0 || firstChar < 0 || firstChar > 255)
+	{
+		PyErr_SetString(PyExc_ValueError, "char_size and columns must be positive and first_char must be 0-255");
+		return -1;
+	}
+	if (atlas->frame == NULL)
+	{
+		PyErr_SetString(PyExc_ValueError, "atlas DMDBuffer is not initialized");
+		return -1;
+	}
+	DMDBlendMode blendMode = DMDBlendModeBlackSource;
+	if (opObj != NULL && !DMDBlendModeFromObject(opObj, &blendMode))
+		return -1;
+	
+	PyObject *widths = PySequence_Fast(widthsObj, "char_widths must be a sequence");
+	if (widths == NULL)
+		return -1;
+	Py_ssize_t count = MIN(PySequence_Fast_GET_SIZE(widths), 256 - firstChar);
+	DMDGlyph glyphs[256];
+	memset(glyphs, 0, sizeof(glyphs));
+	for (Py_ssize_t i = 0; i < count; i++)
+	{
+		long width = PyInt_AsLong(PySequence_Fast_GET_ITEM(widths, i));
+		if (width == -1 && PyErr_Occurred())
+		{
+			Py_DECREF(widths);
+			return -1;
+		}
+		DMDGlyph *glyph = &glyphs[firstChar + i];
+		glyph->rect = DMDRectMake((i % columns) * charSize, (i / columns) * charSize, width, charSize);
+		glyph->offset = DMDPointMake(0, 0);
+		glyph->advance = width;
+	}
+	Py_DECREF(widths);
+	
+	DMDFont_invalidate_layouts(self);
+	Py_INCREF(atlas);
+	Py_XDECREF(self->atlas);
+	self->atlas = atlas;
+	memcpy(self->glyphs, glyphs, sizeof(glyphs));
+	self->tracking = tracking;
+	self->lineHeight = charSize;
+	self->blendMode = blendMode;
+	return 0;
+}
+
+/* Parses the align argument of draw_text(): 'left', 'center' or 'right'.  Returns -1 with an exception set if unrecognized. */
+static int
+DMDFont_parse_align(const char *alignStr)
+{
+	if (alignStr == NULL || strcmp(alignStr, "left") == 0)
+		return 0;
+	else if (strcmp(alignStr, "center") == 0)
+		return 1;
+	else if (strcmp(alignStr, "right") == 0)
+		return 2;
+	PyErr_SetString(PyExc_ValueError, "align must be 'left', 'center' or 'right'");
+	return -1;
+}
+
+static PyObject *
+DMDFont_draw_text(pinproc_DMDFontObject *self, PyObject *args, PyObject *kwds)
+{
+	pinproc_DMDBufferObject *dst;
+	int x, y;
+	PyObject *text, *opObj = NULL;
+	const char *alignStr = NULL;
+	static char *kwlist[] = {"dst", "x", "y", "text", "op", "align", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!iiS|Oz", kwlist, &pinproc_DMDBufferType, &dst, &x, &y, &text, &opObj, &alignStr))
+	{
+		return NULL;
+	}
+	if (!DMDBufferCheckWritable(dst))
+		return NULL;
+	if (self->atlas == NULL)
+	{
+		PyErr_SetString(PyExc_ValueError, "DMDFont is not initialized");
+		return NULL;
+	}
+	if (self->atlas->frame == NULL || dst->frame == NULL)
+	{
+		PyErr_SetString(PyExc_ValueError, "DMDBuffer is not initialized");
+		return NULL;
+	}
+	DMDBlendMode blendMode = self->blendMode;
+	if (opObj != NULL && !DMDBlendModeFromObject(opObj, &blendMode))
+		return NULL;
+	int align = DMDFont_parse_align(alignStr);
+	if (align < 0)
+		return NULL;
+	
+	DMDFontLayout *layout = DMDFont_layout(self, text);
+	if (layout == NULL)
+		return NULL;
+	if (align == 1)
+		x -= layout->width / 2;
+	else if (align == 2)
+		x -= layout->width;
+	
+	DMDFrame *atlas = self->atlas->frame;
+	const unsigned char *chars = (const unsigned char *)PyString_AS_STRING(text);
+	Py_ssize_t length = PyString_GET_SIZE(text);
+	for (Py_ssize_t i = 0; i < length; i++)
+	{
+		const DMDGlyph *glyph = &self->glyphs[chars[i]];
+		if (DMDRectIsEmpty(glyph->rect))
+			continue;
+		DMDPoint dstPoint = DMDPointMake(x + layout->offsets[i] + glyph->offset.x, y + glyph->offset.y);
+		DMDFrameCopyRect(atlas, glyph->rect, dst->frame, dstPoint, blendMode);
+	}
+	
+	return Py_BuildValue("i", layout->width);
+}
+
+static PyObject *
+DMDFont_measure(pinproc_DMDFontObject *self, PyObject *args, PyObject *kwds)
+{
+	PyObject *text;
+	static char *kwlist[] = {"text", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "S", kwlist, &text))
+	{
+		return NULL;
+	}
+	DMDFontLayout *layout = DMDFont_layout(self, text);
+	if (layout == NULL)
+		return NULL;
+	return Py_BuildValue("(ii)", layout->width, self->lineHeight);
+}
+
+static PyObject *
+DMDFont_set_glyph(pinproc_DMDFontObject *self, PyObject *args, PyObject *kwds)
+{
+	int ch, x, y, width, height, advance = -1, xOffset = 0, yOffset = 0;
+	static char *kwlist[] = {"char", "x", "y", "width", "height", "advance", "x_offset", "y_offset", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "iiiii|iii", kwlist, &ch, &x, &y, &width, &height, &advance, &xOffset, &yOffset))
+	{
+		return NULL;
+	}
+	if (ch < 0 || ch > 255)
+	{
+		PyErr_SetString(PyExc_ValueError, "char must be 0-255");
+		return NULL;
+	}
+	DMDGlyph *glyph = &self->glyphs[ch];
+	glyph->rect = DMDRectMake(x, y, width, height);
+	glyph->offset = DMDPointMake(xOffset, yOffset);
+	glyph->advance = advance < 0 ? width : advance;
+	DMDFont_invalidate_layouts(self);
+	
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject *
+DMDFont_set_kerning(pinproc_DMDFontObject *self, PyObject *args, PyObject *kwds)
+{
+	int left, right, adjust;
+	static char *kwlist[] = {"left", "right", "adjust", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "iii", kwlist, &left, &right, &adjust))
+	{
+		return NULL;
+	}
+	if (left < 0 || left > 255 || right < 0 || right > 255 || adjust < -128 || adjust > 127)
+	{
+		PyErr_SetString(PyExc_ValueError, "left and right must be 0-255 and adjust -128-127");
+		return NULL;
+	}
+	if (self->kerning == NULL)
+	{
+		self->kerning = (signed char *)calloc(256 * 256, 1);
+		if (self->kerning == NULL)
+			return PyErr_NoMemory();
+	}
+	self->kerning[left * 256 + right] = (signed char)adjust;
+	DMDFont_invalidate_layouts(self);
+	
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject *
+DMDFont_get_tracking(pinproc_DMDFontObject *self, void *closure)
+{
+	return Py_BuildValue("i", self->tracking);
+}
+
+static int
+DMDFont_set_tracking(pinproc_DMDFontObject *self, PyObject *value, void *closure)
+{
+	long tracking = value ? PyInt_AsLong(value) : -1;
+	if (value == NULL || (tracking == -1 && PyErr_Occurred()))
+	{
+		if (!PyErr_Occurred())
+			PyErr_SetString(PyExc_TypeError, "Cannot delete tracking");
+		return -1;
+	}
+	self->tracking = tracking;
+	DMDFont_invalidate_layouts(self);
+	return 0;
+}
+
+PyMethodDef DMDFont_methods[] = {
+    {"draw_text", (PyCFunction)DMDFont_draw_text, METH_VARARGS|METH_KEYWORDS,
+     "Draws text into the given buffer with its left edge, center or right edge at x; returns the width of the text."
+    },
+    {"measure", (PyCFunction)DMDFont_measure, METH_VARARGS|METH_KEYWORDS,
+     "Returns the (width, height) of the given text."
+    },
+    {"set_glyph", (PyCFunction)DMDFont_set_glyph, METH_VARARGS|METH_KEYWORDS,
+     "Sets the atlas rect, advance and drawing offset of a character."
+    },
+    {"set_kerning", (PyCFunction)DMDFont_set_kerning, METH_VARARGS|METH_KEYWORDS,
+     "Sets the extra space (usually negative) between the given pair of characters."
+    },
+    {NULL, NULL, NULL, NULL}  /* Sentinel */
+};
+
+static PyGetSetDef DMDFont_getset[] = {
+    {(char *)"tracking", (getter)DMDFont_get_tracking, (setter)DMDFont_set_tracking,
+     (char *)"Space added after every character.", NULL},
+    {NULL, NULL, NULL, NULL, NULL}  /* Sentinel */
+};
+
+PyTypeObject pinproc_DMDFontType = {
+    PyObject_HEAD_INIT(NULL)
+    0,                         /*ob_size*/
+    "pinproc.DMDFont",         /*tp_name*/
+    sizeof(pinproc_DMDFontObject), /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    DMDFont_dealloc,           /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    0,                         /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT|Py_TPFLAGS_BASETYPE, /*tp_flags*/
+    "Bitmap font drawn from a DMDBuffer glyph atlas", /* tp_doc */
+    0,		               /* tp_traverse */
+    0,		               /* tp_clear */
+    0,		               /* tp_richcompare */
+    0,		               /* tp_weaklistoffset */
+    0,		               /* tp_iter */
+    0,		               /* tp_iternext */
+    DMDFont_methods,           /* tp_methods */
+    0,                         /* tp_members */
+    DMDFont_getset,            /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    (initproc)DMDFont_init,    /* tp_init */
+    0,                         /* tp_alloc */
+    DMDFont_new,               /* tp_new */
+};
+
+/*
+ * Packed buffers
+ * 
+ * A DMDPackedBuffer holds the 16 shades of each dot in 4 bits, two dots per byte,
+ * for large libraries of frames that don't need alpha.  pack() and unpack()
+ * convert from and to a DMDBuffer; get_data() and set_data() work on the packed
+ * bytes, (width + 1) / 2 per row.  dmd_draw() accepts one directly.
+ */
+
+static PyObject *
+DMDPackedBuffer_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    pinproc_DMDPackedBufferObject *self;
+
+    self = (pinproc_DMDPackedBufferObject *)type->tp_alloc(type, 0);
+    if (self != NULL) {
+		self->frame = NULL;
+    }
+
+    return (PyObject *)self;
+}
+
+static void
+DMDPackedBuffer_dealloc(PyObject* _self)
+{
+	pinproc_DMDPackedBufferObject *self = (pinproc_DMDPackedBufferObject *)_self;
+	if (self->frame != NULL)
+	{
+		DMDPackedFrameDelete(self->frame);
+		self->frame = NULL;
+	}
+    self->ob_type->tp_free((PyObject*)self);
+}
+
+static int
+DMDPackedBuffer_init(pinproc_DMDPackedBufferObject *self, PyObject *args, PyObject *kwds)
+{
+	unsigned width, height;
+	static char *kwlist[] = {"width", "height", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "II", kwlist, &width, &height))
+	{
+		return -1;
+	}
+	if (self->frame != NULL)
+	{
+		DMDPackedFrameDelete(self->frame);
+		self->frame = NULL;
+	}
+	self->frame = DMDPackedFrameCreate(DMDSizeMake(width, height));
+	if (self->frame == NULL)
+	{
+		PyErr_SetString(PyExc_IOError, "Failed to allocate memory");
+		return -1;
+	}
+    return 0;
+}
+
+static PyObject *
+DMDPackedBuffer_clear(pinproc_DMDPackedBufferObject *self, PyObject *args)
+{
+	memset(self->frame->buffer, 0, DMDPackedFrameGetBufferSize(self->frame));
+	DMDPackedFrameMarkDirty(self->frame, DMDPackedFrameGetBounds(self->frame));
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject *
+DMDPackedBuffer_set_data(pinproc_DMDPackedBufferObject *self, PyObject *args, PyObject *kwds)
+{
+	const char *data;
+	int data_len;
+	static char *kwlist[] = {"data", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "s#", kwlist, &data, &data_len))
+	{
+		return NULL;
+	}
+	if ((unsigned)data_len != DMDPackedFrameGetBufferSize(self->frame))
+	{
+		PyErr_SetString(PyExc_ValueError, "Buffer length is incorrect");
+		return NULL;
+	}
+	memcpy(self->frame->buffer, data, data_len);
+	DMDPackedFrameMarkDirty(self->frame, DMDPackedFrameGetBounds(self->frame));
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject *
+DMDPackedBuffer_get_data(pinproc_DMDPackedBufferObject *self, PyObject *args, PyObject *kwds)
+{
+	return PyString_FromStringAndSize((char *)self->frame->buffer, DMDPackedFrameGetBufferSize(self->frame));
+}
+
+static PyObject *
+DMDPackedBuffer_get_dot(pinproc_DMDPackedBufferObject *self, PyObject *args, PyObject *kwds)
+{
+	unsigned x, y;
+	static char *kwlist[] = {"x", "y", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "II", kwlist, &x, &y))
+	{
+		return NULL;
+	}
+	if (x >= self->frame->size.width || y >= self->frame->size.height)
+	{
+		PyErr_SetString(PyExc_ValueError, "X or Y are out of range");
+		return NULL;
+	}
+	return Py_BuildValue("i", DMDPackedFrameGetDot(self->frame, DMDPointMake(x, y)));
+}
+
+static PyObject *
+DMDPackedBuffer_set_dot(pinproc_DMDPackedBufferObject *self, PyObject *args, PyObject *kwds)
+{
+	unsigned x, y, value;
+	static char *kwlist[] = {"x", "y", "value", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "III", kwlist, &x, &y, &value))
+	{
+		return NULL;
+	}
+	if (x >= self->frame->size.width || y >= self->frame->size.height)
+	{
+		PyErr_SetString(PyExc_ValueError, "X or Y are out of range");
+		return NULL;
+	}
+	DMDPackedFrameSetDot(self->frame, DMDPointMake(x, y), value);
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject *
+DMDPackedBuffer_fill_rect(pinproc_DMDPackedBufferObject *self, PyObject *args, PyObject *kwds)
+{
+	unsigned x0, y0, width, height, value;
+	static char *kwlist[] = {"x", "y", "width", "height", "value", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "IIIII", kwlist, &x0, &y0, &width, &height, &value))
+	{
+		return NULL;
+	}
+	DMDPackedFrameFillRect(self->frame, DMDRectMake(x0, y0, width, height), (DMDColor)value);
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject *
+DMDPackedBuffer_copy_to_rect(pinproc_DMDPackedBufferObject *self, PyObject *args, PyObject *kwds)
+{
+	pinproc_DMDPackedBufferObject *dst;
+	unsigned dst_x, dst_y, src_x, src_y, width, height;
+	PyObject *opObj = Py_None;
+	static char *kwlist[] = {"dst", "dst_x", "dst_y", "src_x", "src_y", "width", "height", "op", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!IIIIII|O", kwlist, &pinproc_DMDPackedBufferType, &dst, &dst_x, &dst_y, &src_x, &src_y, &width, &height, &opObj))
+	{
+		return NULL;
+	}
+	DMDBlendMode blendMode;
+	if (!DMDBlendModeFromObject(opObj, &blendMode))
+		return NULL;
+	
+	DMDRect srcRect = DMDRectMake(src_x, src_y, width, height);
+	if (DMDPackedFrameCopyRect(self->frame, srcRect, dst->frame, DMDPointMake(dst_x, dst_y), blendMode) < 0)
+	{
+		PyErr_SetString(PyExc_ValueError, "Packed buffers only support the copy, add, sub and blacksrc operations");
+		return NULL;
+	}
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject *
+DMDPackedBuffer_pack(pinproc_DMDPackedBufferObject *self, PyObject *args, PyObject *kwds)
+{
+	pinproc_DMDBufferObject *buffer;
+	static char *kwlist[] = {"buffer", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!", kwlist, &pinproc_DMDBufferType, &buffer))
+	{
+		return NULL;
+	}
+	if (!DMDBufferCheckInitialized(buffer))
+		return NULL;
+	DMDPackedFramePack(self->frame, buffer->frame);
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject *
+DMDPackedBuffer_unpack(pinproc_DMDPackedBufferObject *self, PyObject *args, PyObject *kwds)
+{
+	PyObject *dstObj = Py_None;
+	static char *kwlist[] = {"dst", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O", kwlist, &dstObj))
+	{
+		return NULL;
+	}
+	if (dstObj == Py_None)
+	{
+		dstObj = PyObject_CallFunction((PyObject *)&pinproc_DMDBufferType, (char *)"II", self->frame->size.width, self->frame->size.height);
+		if (dstObj == NULL)
+			return NULL;
+	}
+	else if (PyObject_TypeCheck(dstObj, &pinproc_DMDBufferType))
+	{
+		if (!DMDBufferCheckInitialized((pinproc_DMDBufferObject *)dstObj) || !DMDBufferCheckWritable((pinproc_DMDBufferObject *)dstObj))
+			return NULL;
+		Py_INCREF(dstObj);
+	}
+	else
+	{
+		PyErr_SetString(PyExc_TypeError, "dst must be a DMDBuffer or None");
+		return NULL;
+	}
+	DMDPackedFrameUnpack(self->frame, ((pinproc_DMDBufferObject *)dstObj)->frame);
+	return dstObj;
+}
+
+static PyObject *
+DMDPackedBuffer_get_width(pinproc_DMDPackedBufferObject *self, void *closure)
+{
+	return PyInt_FromLong(self->frame->size.width);
+}
+
+static PyObject *
+DMDPackedBuffer_get_height(pinproc_DMDPackedBufferObject *self, void *closure)
+{
+	return PyInt_FromLong(self->frame->size.height);
+}
+
+PyMethodDef DMDPackedBuffer_methods[] = {
+    {"clear", (PyCFunction)DMDPackedBuffer_clear, METH_VARARGS,
+     "Sets the DMD surface to be all black."
+    },
+    {"set_data", (PyCFunction)DMDPackedBuffer_set_data, METH_VARARGS|METH_KEYWORDS,
+     "Sets the DMD surface to the given string of packed dots."
+    },
+    {"get_data", (PyCFunction)DMDPackedBuffer_get_data, METH_VARARGS|METH_KEYWORDS,
+     "Gets the packed dots of the DMD surface in string format."
+    },
+    {"get_dot", (PyCFunction)DMDPackedBuffer_get_dot, METH_VARARGS|METH_KEYWORDS,
+     "Returns the value of the given dot."
+    },
+    {"set_dot", (PyCFunction)DMDPackedBuffer_set_dot, METH_VARARGS|METH_KEYWORDS,
+     "Assigns the value of the given dot."
+    },
+    {"fill_rect", (PyCFunction)DMDPackedBuffer_fill_rect, METH_VARARGS|METH_KEYWORDS,
+     "Fills a rectangle with the given dot value."
+    },
+    {"copy_to_rect", (PyCFunction)DMDPackedBuffer_copy_to_rect, METH_VARARGS|METH_KEYWORDS,
+     "Copies a rect from this buffer to the given DMDPackedBuffer using op 'copy', 'add', 'sub' or 'blacksrc'."
+    },
+    {"pack", (PyCFunction)DMDPackedBuffer_pack, METH_VARARGS|METH_KEYWORDS,
+     "Sets the dots of this buffer from a DMDBuffer, dropping their alpha."
+    },
+    {"unpack", (PyCFunction)DMDPackedBuffer_unpack, METH_VARARGS|METH_KEYWORDS,
+     "Draws the dots of this buffer into dst, or a new DMDBuffer if dst is None, and returns it."
+    },
+    {NULL, NULL, NULL, NULL}  /* Sentinel */
+};
+
+static PyGetSetDef DMDPackedBuffer_getset[] = {
+    {"width", (getter)DMDPackedBuffer_get_width, NULL, "Width in dots.", NULL},
+    {"height", (getter)DMDPackedBuffer_get_height, NULL, "Height in dots.", NULL},
+    {NULL}  /* Sentinel */
+};
+
+PyTypeObject pinproc_DMDPackedBufferType = {
+    PyObject_HEAD_INIT(NULL)
+    0,                         /*ob_size*/
+    "pinproc.DMDPackedBuffer", /*tp_name*/
+    sizeof(pinproc_DMDPackedBufferObject), /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    DMDPackedBuffer_dealloc,   /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    0,                         /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT|Py_TPFLAGS_BASETYPE, /*tp_flags*/
+    "DMD surface stored at 4 bits per dot", /* tp_doc */
+    0,		               /* tp_traverse */
+    0,		               /* tp_clear */
+    0,		               /* tp_richcompare */
+    0,		               /* tp_weaklistoffset */
+    0,		               /* tp_iter */
+    0,		               /* tp_iternext */
+    DMDPackedBuffer_methods,   /* tp_methods */
+    0,                         /* tp_members */
+    DMDPackedBuffer_getset,    /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    (initproc)DMDPackedBuffer_init, /* tp_init */
+    0,                         /* tp_alloc */
+    DMDPackedBuffer_new,       /* tp_new */
+};
+
+/*
+ * Grayscale import
+ * 
+ * A DMDQuantizer converts images of 8 bit gray levels, such as decoded video,
+ * into DMDBuffers of 16 shades: width x height pixels of one byte each, stride
+ * bytes from the start of one row to the next.  The method is 'threshold',
+ * 'ordered' (Bayer) or 'floyd-steinberg', or a Quantize* constant.  gamma and
+ * contrast build a curve each level goes through first.  convert() does one
+ * frame; stream() returns an iterator that converts frame after frame from a
+ * buffer holding them back to back, or from a file-like object such as a pipe
+ * from a video decoder, which is read a frame at a time.
+ */
+
+/* Returns a new reference to dstObj, checked against the quantizer's size, or to a new DMDBuffer if it is None. */
+static pinproc_DMDBufferObject *
+DMDQuantizer_get_dst(pinproc_DMDQuantizerObject *self, PyObject *dstObj)
+{
+	if (dstObj == NULL || dstObj == Py_None)
+		return (pinproc_DMDBufferObject *)PyObject_CallFunction((PyObject *)&pinproc_DMDBufferType, (char *)"II", self->size.width, self->size.height);
+	if (!PyObject_TypeCheck(dstObj, &pinproc_DMDBufferType))
+	{
+		PyErr_SetString(PyExc_TypeError, "dst must be a DMDBuffer or None");
+		return NULL;
+	}
+	pinproc_DMDBufferObject *dst = (pinproc_DMDBufferObject *)dstObj;
+	if (!DMDBufferCheckInitialized(dst))
+		return NULL;
+	if (dst->frame->size.width != self->size.width || dst->frame->size.height != self->size.height)
+	{
+		PyErr_SetString(PyExc_ValueError, "Buffer size does not match the quantizer");
+		return NULL;
+	}
+	if (!DMDBufferCheckWritable(dst))
+		return NULL;
+	Py_INCREF(dst);
+	return dst;
+}
+
+static inline Py_ssize_t
+DMDQuantizer_frame_bytes(pinproc_DMDQuantizerObject *self)
+{
+	return self->rowBytes * (self->size.height - 1) + self->size.width;
+}
+
+/* Converts one frame of pixels into dst.  Large frames are converted with the GIL released, but
+ * only if pinned is set: the pixels must belong to a held Py_buffer view or an immutable str.  A
+ * pointer from the old buffer interface isn't pinned, so another thread could resize or free it. */
+static bool
+DMDQuantizer_convert_into(pinproc_DMDQuantizerObject *self, const unsigned char *pixels, bool pinned, pinproc_DMDBufferObject *dst)
+{
+	const unsigned char *curve = self->useCurve ? self->curve : NULL;
+	if (!pinned || (unsigned long)self->size.width * self->size.height < kDMDBufferReleaseGILDots)
+	{
+		DMDFrameQuantizeGray(dst->frame, pixels, self->rowBytes, curve, self->method);
+		return true;
+	}
+	
+	// As in copy_to_rect(), draw through a view of dst's dots so its dirty region is only touched with the GIL held.
+	DMDFrame *dstView = DMDFrameCreateWithBuffer(dst->frame->size, dst->frame->buffer);
+	if (dstView == NULL)
+	{
+		PyErr_SetString(PyExc_IOError, "Failed to allocate memory");
+		return false;
+	}
+	dst->threadUses++;
+	Py_BEGIN_ALLOW_THREADS
+	DMDFrameQuantizeGray(dstView, pixels, self->rowBytes, curve, self->method);
+	Py_END_ALLOW_THREADS
+	dst->threadUses--;
+	DMDFrameDelete(dstView);
+	DMDFrameMarkDirty(dst->frame, DMDFrameGetBounds(dst->frame));
+	return true;
+}
+
+static PyObject *
+DMDQuantizer_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    pinproc_DMDQuantizerObject *self;
+
+    self = (pinproc_DMDQuantizerObject *)type->tp_alloc(type, 0);
+    if (self != NULL) {
+		self->size = DMDSizeMake(0, 0);
+		self->rowBytes = 0;
+		self->method = DMDQuantizeThreshold;
+		self->useCurve = false;
+    }
+
+    return (PyObject *)self;
+}
+
+static void
+DMDQuantizer_dealloc(PyObject* _self)
+{
+    _self->ob_type->tp_free(_self);
+}
+
+static int
+DMDQuantizer_init(pinproc_DMDQuantizerObject *self, PyObject *args, PyObject *kwds)
+{
+	unsigned width, height;
+	PyObject *methodObj = NULL;
+	float gamma = 1.0f, contrast = 1.0f;
+	Py_ssize_t stride = 0;
+	static char *kwlist[] = {"width", "height", "method", "gamma", "contrast", "stride", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "II|Offn", kwlist, &width, &height, &methodObj, &gamma, &contrast, &stride))
+	{
+		return -1;
+	}
+	static const char *methodNames[] = {"threshold", "ordered", "floyd-steinberg"};
+	int method = DMDQuantizeThreshold;
+	if (methodObj != NULL && methodObj != Py_None && !DMDEnumFromObject(methodObj, methodNames, 3, "Quantize method", &method))
+		return -1;
+	if (width == 0 || height == 0 || width > 0x7fffffff || height > 0x7fffffff)
+	{
+		PyErr_SetString(PyExc_ValueError, "width and height must be at least 1");
+		return -1;
+	}
+	if (stride != 0 && stride < (Py_ssize_t)width)
+	{
+		PyErr_SetString(PyExc_ValueError, "stride must be at least width");
+		return -1;
+	}
+	if (gamma <= 0.0f)
+	{
+		PyErr_SetString(PyExc_ValueError, "gamma must be greater than 0");
+		return -1;
+	}
+	
+	self->size = DMDSizeMake(width, height);
+	self->rowBytes = stride ? stride : width;
+	self->method = (DMDQuantizeMethod)method;
+	DMDGrayCurveInit(self->curve, gamma, contrast);
+	self->useCurve = false;
+	for (int i = 0; i < 256; i++)
+		if (self->curve[i] != i)
+			self->useCurve = true;
+	return 0;
+}
+
+static PyObject *
+DMDQuantizer_convert(pinproc_DMDQuantizerObject *self, PyObject *args, PyObject *kwds)
+{
+	PyObject *dataObj, *dstObj = Py_None;
+	Py_ssize_t offset = 0;
+	static char *kwlist[] = {"data", "dst", "offset", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|On", kwlist, &dataObj, &dstObj, &offset))
+	{
+		return NULL;
+	}
+	if (self->size.width == 0)
+	{
+		PyErr_SetString(PyExc_ValueError, "DMDQuantizer is not initialized");
+		return NULL;
+	}
+	
+	Py_buffer view;
+	bool haveView = false;
+	const void *data;
+	Py_ssize_t dataLength;
+	if (PyObject_CheckBuffer(dataObj))
+	{
+		if (PyObject_GetBuffer(dataObj, &view, PyBUF_SIMPLE) < 0)
+			return NULL;
+		haveView = true;
+		data = view.buf;
+		dataLength = view.len;
+	}
+	else if (PyObject_AsReadBuffer(dataObj, &data, &dataLength) < 0)
+	{
+		return NULL;
+	}
+	
+	pinproc_DMDBufferObject *dst = NULL;
+	if (offset < 0 || offset > dataLength || dataLength - offset < DMDQuantizer_frame_bytes(self))
+		PyErr_SetString(PyExc_ValueError, "data is too short for a frame at that offset");
+	else if ((dst = DMDQuantizer_get_dst(self, dstObj)) != NULL &&
+			 !DMDQuantizer_convert_into(self, (const unsigned char *)data + offset, haveView || PyString_CheckExact(dataObj), dst))
+		Py_CLEAR(dst);
+	if (haveView)
+		PyBuffer_Release(&view);
+	return (PyObject *)dst;
+}
+
+static PyObject *
+DMDQuantizer_stream(pinproc_DMDQuantizerObject *self, PyObject *args, PyObject *kwds)
+{
+	PyObject *sourceObj, *dstObj = Py_None;
+	static char *kwlist[] = {"source", "dst", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|O", kwlist, &sourceObj, &dstObj))
+	{
+		return NULL;
+	}
+	if (self->size.width == 0)
+	{
+		PyErr_SetString(PyExc_ValueError, "DMDQuantizer is not initialized");
+		return NULL;
+	}
+	pinproc_DMDBufferObject *dst = NULL;
+	if (dstObj != Py_None && (dst = DMDQuantizer_get_dst(self, dstObj)) == NULL)
+		return NULL;
+	
+	pinproc_DMDQuantizerStreamObject *stream = PyObject_GC_New(pinproc_DMDQuantizerStreamObject, &pinproc_DMDQuantizerStreamType);
+	if (stream == NULL)
+	{
+		Py_XDECREF(dst);
+		return NULL;
+	}
+	Py_INCREF(self);
+	stream->quantizer = self;
+	Py_INCREF(sourceObj);
+	stream->source = sourceObj;
+	stream->haveView = false;
+	stream->offset = 0;
+	stream->dst = dst;
+	PyObject_GC_Track(stream);
+	
+	// Buffers are held for as long as the stream runs; anything else must have read().
+	if (PyObject_CheckBuffer(sourceObj))
+	{
+		if (PyObject_GetBuffer(sourceObj, &stream->view, PyBUF_SIMPLE) < 0)
+		{
+			Py_DECREF(stream);
+			return NULL;
+		}
+		stream->haveView = true;
+	}
+	else if (!PyObject_CheckReadBuffer(sourceObj) && !PyObject_HasAttrString(sourceObj, "read"))
+	{
+		Py_DECREF(stream);
+		PyErr_SetString(PyExc_TypeError, "source must be a buffer or have a read() method");
+		return NULL;
+	}
+	return (PyObject *)stream;
+}
+
+static PyObject *
+DMDQuantizer_get_width(pinproc_DMDQuantizerObject *self, void *closure)
+{
+	return PyInt_FromLong(self->size.width);
+}
+
+static PyObject *
+DMDQuantizer_get_height(pinproc_DMDQuantizerObject *self, void *closure)
+{
+	return PyInt_FromLong(self->size.height);
+}
+
+static PyObject *
+DMDQuantizer_get_frame_bytes(pinproc_DMDQuantizerObject *self, void *closure)
+{
+	return PyInt_FromSsize_t(self->size.width ? DMDQuantizer_frame_bytes(self) : 0);
+}
+
+PyMethodDef DMDQuantizer_methods[] = {
+    {"convert", (PyCFunction)DMDQuantizer_convert, METH_VARARGS|METH_KEYWORDS,
+     "Converts the frame of gray levels at offset in data into dst (default: a new DMDBuffer) and returns dst."
+    },
+    {"stream", (PyCFunction)DMDQuantizer_stream, METH_VARARGS|METH_KEYWORDS,
+     "Returns an iterator converting each frame in a buffer, or read() from a file-like source, into dst (default: a new DMDBuffer each time)."
+    },
+    {NULL, NULL, NULL, NULL}  /* Sentinel */
+};
+
+static PyGetSetDef DMDQuantizer_getset[] = {
+    {"width", (getter)DMDQuantizer_get_width, NULL, "Width of each frame in pixels.", NULL},
+    {"height", (getter)DMDQuantizer_get_height, NULL, "Height of each frame in pixels.", NULL},
+    {"frame_bytes", (getter)DMDQuantizer_get_frame_bytes, NULL, "Bytes of source data each frame takes up.", NULL},
+    {NULL}  /* Sentinel */
+};
+
+PyTypeObject pinproc_DMDQuantizerType = {
+    PyObject_HEAD_INIT(NULL)
+    0,                         /*ob_size*/
+    "pinproc.DMDQuantizer",    /*tp_name*/
+    sizeof(pinproc_DMDQuantizerObject), /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    DMDQuantizer_dealloc,      /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    0,                         /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT|Py_TPFLAGS_BASETYPE, /*tp_flags*/
+    "Converts 8 bit grayscale images to DMD frames", /* tp_doc */
+    0,		               /* tp_traverse */
+    0,		               /* tp_clear */
+    0,		               /* tp_richcompare */
+    0,		               /* tp_weaklistoffset */
+    0,		               /* tp_iter */
+    0,		               /* tp_iternext */
+    DMDQuantizer_methods,      /* tp_methods */
+    0,                         /* tp_members */
+    DMDQuantizer_getset,       /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    (initproc)DMDQuantizer_init, /* tp_init */
+    0,                         /* tp_alloc */
+    DMDQuantizer_new,          /* tp_new */
+};
+
+static void
+DMDQuantizerStream_release(pinproc_DMDQuantizerStreamObject *self)
+{
+	if (self->haveView)
+	{
+		PyBuffer_Release(&self->view);
+		self->haveView = false;
+	}
+	Py_CLEAR(self->source);
+}
+
+static int
+DMDQuantizerStream_traverse(pinproc_DMDQuantizerStreamObject *self, visitproc visit, void *arg)
+{
+	Py_VISIT(self->quantizer);
+	Py_VISIT(self->source);
+	Py_VISIT(self->dst);
+	return 0;
+}
+
+static int
+DMDQuantizerStream_clear(pinproc_DMDQuantizerStreamObject *self)
+{
+	DMDQuantizerStream_release(self);
+	Py_CLEAR(self->quantizer);
+	Py_CLEAR(self->dst);
+	return 0;
+}
+
+static void
+DMDQuantizerStream_dealloc(PyObject* _self)
+{
+	pinproc_DMDQuantizerStreamObject *self = (pinproc_DMDQuantizerStreamObject *)_self;
+	PyObject_GC_UnTrack(_self);
+	DMDQuantizerStream_clear(self);
+	PyObject_GC_Del(_self);
+}
+
+static PyObject *
+DMDQuantizerStream_next(PyObject *_self)
+{
+	pinproc_DMDQuantizerStreamObject *self = (pinproc_DMDQuantizerStreamObject *)_self;
+	pinproc_DMDQuantizerObject *quantizer = self->quantizer;
+	if (self->source == NULL || quantizer == NULL)
+		return NULL;
+	Py_ssize_t frameBytes = DMDQuantizer_frame_bytes(quantizer);
+	// Frames start rowBytes * height apart; the last may stop short of its trailing padding.
+	Py_ssize_t frameStride = quantizer->rowBytes * quantizer->size.height;
+	
+	// A partial frame at the end of the source is dropped.
+	const void *data;
+	Py_ssize_t dataLength;
+	PyObject *chunk = NULL;
+	bool pinned = self->haveView || PyString_CheckExact(self->source);
+	if (self->haveView)
+	{
+		data = (const unsigned char *)self->view.buf + self->offset;
+		dataLength = self->view.len - self->offset;
+	}
+	else if (PyObject_CheckReadBuffer(self->source))
+	{
+		// An old-style buffer such as an mmap, which can't be held; look it up each time.
+		if (PyObject_AsReadBuffer(self->source, &data, &dataLength) < 0)
+			return NULL;
+		data = (const unsigned char *)data + MIN(self->offset, dataLength);
+		dataLength -= MIN(self->offset, dataLength);
+	}
+	else
+	{
+		chunk = PyObject_CallMethod(self->source, (char *)"read", (char *)"n", frameStride);
+		if (chunk == NULL)
+			return NULL;
+		if (PyObject_AsReadBuffer(chunk, &data, &dataLength) < 0)
+		{
+			Py_DECREF(chunk);
+			return NULL;
+		}
+		pinned = PyString_CheckExact(chunk);
+	}
+	if (dataLength < frameBytes)
+	{
+		Py_XDECREF(chunk);
+		DMDQuantizerStream_release(self);
+		return NULL;
+	}
+	
+	pinproc_DMDBufferObject *dst = DMDQuantizer_get_dst(quantizer, (PyObject *)self->dst);
+	if (dst != NULL && !DMDQuantizer_convert_into(quantizer, (const unsigned char *)data, pinned, dst))
+		Py_CLEAR(dst);
+	Py_XDECREF(chunk);
+	self->offset += frameStride;
+	return (PyObject *)dst;
+}
+
+PyTypeObject pinproc_DMDQuantizerStreamType = {
+    PyObject_HEAD_INIT(NULL)
+    0,                         /*ob_size*/
+    "pinproc.DMDQuantizerStream", /*tp_name*/
+    sizeof(pinproc_DMDQuantizerStreamObject), /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    DMDQuantizerStream_dealloc, /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    0,                         /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC, /*tp_flags*/
+    "Iterator returned by DMDQuantizer.stream()", /* tp_doc */
+    (traverseproc)DMDQuantizerStream_traverse, /* tp_traverse */
+    (inquiry)DMDQuantizerStream_clear, /* tp_clear */
+    0,		               /* tp_richcompare */
+    0,		               /* tp_weaklistoffset */
+    PyObject_SelfIter,         /* tp_iter */
+    DMDQuantizerStream_next,   /* tp_iternext */
+};
+
+/*
+ * Animations
+ * 
+ * A DMDAnimation opens a pyprocgame .dmd file (a 16 byte header of magic,
+ * frame count, width and height, then the dots of each frame in turn) by
+ * mapping it into memory rather than reading it.  Indexing it returns a
+ * DMDBuffer that draws straight from the mapping, so nothing is copied and
+ * only the pages of the frames actually used are ever read from disk.  The
+ * mapping is private: writing to a frame changes it for this process only.
+ */
+
+#define kDMDAnimationMagic (0x00646D64) /* 'dmd\0' */
+#define kDMDAnimationHeaderSize (16)
+
+static PyObject *
+DMDAnimation_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    pinproc_DMDAnimationObject *self;
+
+    self = (pinproc_DMDAnimationObject *)type->tp_alloc(type, 0);
+    if (self != NULL) {
+		self->map = NULL;
+		self->mapSize = 0;
+		self->mapped = false;
+		self->frameCount = 0;
+		self->frameSize = DMDSizeMake(0, 0);
+    }
+
+    return (PyObject *)self;
+}
+
+/* Releases a file loaded by DMDAnimationMapFile(). */
+static void
+DMDAnimationUnmapFile(unsigned char *map, size_t size, bool mapped)
+{
+#ifndef _WIN32
+	if (mapped)
+		munmap(map, size);
+	else
+#endif
+		free(map);
+}
+
+static void
+DMDAnimation_unmap(pinproc_DMDAnimationObject *self)
+{
+	if (self->map != NULL)
+	{
+		DMDAnimationUnmapFile(self->map, self->mapSize, self->mapped);
+		self->map = NULL;
+	}
+	self->mapSize = 0;
+	self->frameCount = 0;
+}
+
+static void
+DMDAnimation_dealloc(PyObject* _self)
+{
+	// Frames hold a reference to us, so none are left by now.
+	DMDAnimation_unmap((pinproc_DMDAnimationObject *)_self);
+    _self->ob_type->tp_free(_self);
+}
+
+/* Maps (or, where mmap() isn't available, reads) the file at path, which must be at least minSize bytes long.
+ * Returns false with an exception set on failure. */
+static bool
+DMDAnimationMapFile(const char *path, size_t minSize, unsigned char **mapOut, size_t *sizeOut, bool *mappedOut)
+{
+#ifndef _WIN32
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		PyErr_SetFromErrnoWithFilename(PyExc_IOError, (char *)path);
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) < 0)
+	{
+		PyErr_SetFromErrnoWithFilename(PyExc_IOError, (char *)path);
+		close(fd);
+		return false;
+	}
+	if ((size_t)st.st_size < minSize)
+	{
+		close(fd);
+		PyErr_SetString(PyExc_ValueError, "File is too short to be a DMD animation");
+		return false;
+	}
+	void *map = mmap(NULL, (size_t)st.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd); // The mapping keeps the file open.
+	if (map == MAP_FAILED)
+	{
+		PyErr_SetFromErrnoWithFilename(PyExc_IOError, (char *)path);
+		return false;
+	}
+	*mapOut = (unsigned char *)map;
+	*sizeOut = (size_t)st.st_size;
+	*mappedOut = true;
+#else
+	FILE *f = fopen(path, "rb");
+	if (f == NULL)
+	{
+		PyErr_SetFromErrnoWithFilename(PyExc_IOError, (char *)path);
+		return false;
+	}
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	if (size < 0 || (size_t)size < minSize)
+	{
+		fclose(f);
+		PyErr_SetString(PyExc_ValueError, "File is too short to be a DMD animation");
+		return false;
+	}
+	unsigned char *map = (unsigned char *)malloc(size);
+	if (map == NULL)
+	{
+		fclose(f);
+		PyErr_NoMemory();
+		return false;
+	}
+	bool ok = fread(map, 1, (size_t)size, f) == (size_t)size;
+	fclose(f);
+	if (!ok)
+	{
+		free(map);
+		PyErr_SetFromErrnoWithFilename(PyExc_IOError, (char *)path);
+		return false;
+	}
+	*mapOut = map;
+	*sizeOut = (size_t)size;
+	*mappedOut = false;
+#endif
+	return true;
+}
+
+static int
+DMDAnimation_init(pinproc_DMDAnimationObject *self, PyObject *args, PyObject *kwds)
+{
+	const char *path;
+	static char *kwlist[] = {"path", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "s", kwlist, &path))
+	{
+		return -1;
+	}
+	if (self->map != NULL)
+	{
+		// Frames handed out earlier point into the current mapping.
+		PyErr_SetString(PyExc_ValueError, "DMDAnimation is already open");
+		return -1;
+	}
+	if (!DMDAnimationMapFile(path, kDMDAnimationHeaderSize, &self->map, &self->mapSize, &self->mapped))
+		return -1;
+	
+	uint32_t header[4];
+	memcpy(header, self->map, sizeof(header));
+	if (header[0] != kDMDAnimationMagic)
+	{
+		DMDAnimation_unmap(self);
+		PyErr_SetString(PyExc_ValueError, "File is not a DMD animation");
+		return -1;
+	}
+	// Check the frame size against the file before multiplying by the count, which could overflow.
+	unsigned long long frameBytes = (unsigned long long)header[2] * header[3];
+	unsigned long long dataBytes = self->mapSize - kDMDAnimationHeaderSize;
+	if (header[2] > 0x7fffffff || header[3] > 0x7fffffff ||
+		(header[1] != 0 && frameBytes > dataBytes / header[1]) ||
+		frameBytes * header[1] != dataBytes)
+	{
+		DMDAnimation_unmap(self);
+		PyErr_SetString(PyExc_ValueError, "File size inconsistent with header information");
+		return -1;
+	}
+	self->frameCount = header[1];
+	self->frameSize = DMDSizeMake(header[2], header[3]);
+	return 0;
+}
+
+static inline unsigned char *
+DMDAnimation_frame_pointer(pinproc_DMDAnimationObject *self, Py_ssize_t index)
+{
+	return self->map + kDMDAnimationHeaderSize + (size_t)index * self->frameSize.width * self->frameSize.height;
+}
+
+static Py_ssize_t
+DMDAnimation_length(PyObject *_self)
+{
+	return ((pinproc_DMDAnimationObject *)_self)->frameCount;
+}
+
+static PyObject *
+DMDAnimation_item(PyObject *_self, Py_ssize_t index)
+{
+	pinproc_DMDAnimationObject *self = (pinproc_DMDAnimationObject *)_self;
+	if (index < 0 || index >= (Py_ssize_t)self->frameCount)
+	{
+		PyErr_SetString(PyExc_IndexError, "frame index out of range");
+		return NULL;
+	}
+	pinproc_DMDBufferObject *buffer = (pinproc_DMDBufferObject *)DMDBuffer_new(&pinproc_DMDBufferType, NULL, NULL);
+	if (buffer == NULL)
+		return NULL;
+	DMDFrame *frame = DMDFrameCreateWithBuffer(self->frameSize, (DMDColor *)DMDAnimation_frame_pointer(self, index));
+	if (frame == NULL)
+	{
+		Py_DECREF(buffer);
+		PyErr_SetString(PyExc_IOError, "Failed to allocate memory");
+		return NULL;
+	}
+	DMDBuffer_set_frame(buffer, frame);
+	Py_INCREF(_self);
+	buffer->base = _self;
+	return (PyObject *)buffer;
+}
+
+static PyObject *
+DMDAnimation_prefetch(pinproc_DMDAnimationObject *self, PyObject *args, PyObject *kwds)
+{
+	Py_ssize_t start = 0, count = -1;
+	static char *kwlist[] = {"start", "count", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|nn", kwlist, &start, &count))
+	{
+		return NULL;
+	}
+	if (start < 0 || start > (Py_ssize_t)self->frameCount)
+	{
+		PyErr_SetString(PyExc_IndexError, "frame index out of range");
+		return NULL;
+	}
+	if (count < 0 || count > (Py_ssize_t)self->frameCount - start)
+		count = self->frameCount - start;
+	
+#if !defined(_WIN32) && defined(MADV_WILLNEED)
+	if (self->mapped && count > 0)
+	{
+		// madvise() wants a page aligned start.
+		uintptr_t pageMask = (uintptr_t)sysconf(_SC_PAGESIZE) - 1;
+		uintptr_t begin = (uintptr_t)DMDAnimation_frame_pointer(self, start);
+		uintptr_t end = (uintptr_t)DMDAnimation_frame_pointer(self, start + count);
+		begin &= ~pageMask;
+		madvise((void *)begin, end - begin, MADV_WILLNEED); // Only a hint; ignore failures.
+	}
+#endif
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject *
+DMDAnimation_get_width(pinproc_DMDAnimationObject *self, void *closure)
+{
+	return PyInt_FromLong(self->frameSize.width);
+}
+
+static PyObject *
+DMDAnimation_get_height(pinproc_DMDAnimationObject *self, void *closure)
+{
+	return PyInt_FromLong(self->frameSize.height);
+}
+
+PyMethodDef DMDAnimation_methods[] = {
+    {"prefetch", (PyCFunction)DMDAnimation_prefetch, METH_VARARGS|METH_KEYWORDS,
+     "Asks the OS to start reading count frames (default: the rest) from start in the background."
+    },
+    {NULL, NULL, NULL, NULL}  /* Sentinel */
+};
+
+static PyGetSetDef DMDAnimation_getset[] = {
+    {"width", (getter)DMDAnimation_get_width, NULL, "Width of each frame in dots.", NULL},
+    {"height", (getter)DMDAnimation_get_height, NULL, "Height of each frame in dots.", NULL},
+    {NULL}  /* Sentinel */
+};
+
+static PySequenceMethods DMDAnimation_as_sequence = {
+    DMDAnimation_length,       /* sq_length */
+    0,                         /* sq_concat */
+    0,                         /* sq_repeat */
+    DMDAnimation_item,         /* sq_item */
+};
+
+PyTypeObject pinproc_DMDAnimationType = {
+    PyObject_HEAD_INIT(NULL)
+    0,                         /*ob_size*/
+    "pinproc.DMDAnimation",    /*tp_name*/
+    sizeof(pinproc_DMDAnimationObject), /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    DMDAnimation_dealloc,      /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    &DMDAnimation_as_sequence, /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT|Py_TPFLAGS_BASETYPE, /*tp_flags*/
+    "Memory-mapped .dmd animation whose items are DMDBuffer views of its frames", /* tp_doc */
+    0,		               /* tp_traverse */
+    0,		               /* tp_clear */
+    0,		               /* tp_richcompare */
+    0,		               /* tp_weaklistoffset */
+    0,		               /* tp_iter */
+    0,		               /* tp_iternext */
+    DMDAnimation_methods,      /* tp_methods */
+    0,                         /* tp_members */
+    DMDAnimation_getset,       /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    (initproc)DMDAnimation_init, /* tp_init */
+    0,                         /* tp_alloc */
+    DMDAnimation_new,          /* tp_new */
+};
+
+/*
+ * A DMDCompressedAnimation holds frames encoded with DMDFrameEncodeDelta(): a
+ * keyframe every keyframe_interval frames and deltas in between.  The file is a
+ * 20 byte header (magic, frame count, width, height, keyframe interval), then the
+ * offset of each encoded frame from the start of the file plus one for the end,
+ * then the frames.  dmd_encode_animation() creates one from a sequence of
+ * DMDBuffers, such as a DMDAnimation.
+ */
+
+#define kDMDCompressedAnimationMagic (0x7A646D64) /* 'dmdz' */
+#define kDMDCompressedAnimationHeaderSize (20)
+
+static PyObject *
+DMDCompressedAnimation_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    pinproc_DMDCompressedAnimationObject *self;
+
+    self = (pinproc_DMDCompressedAnimationObject *)type->tp_alloc(type, 0);
+    if (self != NULL) {
+		self->map = NULL;
+		self->mapSize = 0;
+		self->mapped = false;
+		self->frameCount = 0;
+		self->frameSize = DMDSizeMake(0, 0);
+		self->keyframeInterval = 0;
+		self->offsets = NULL;
+		self->lastDst = NULL;
+		self->lastIndex = -1;
+		self->lastGeneration = 0;
+    }
+
+    return (PyObject *)self;
+}
+
+static void
+DMDCompressedAnimation_unmap(pinproc_DMDCompressedAnimationObject *self)
+{
+	if (self->map != NULL)
+	{
+		DMDAnimationUnmapFile(self->map, self->mapSize, self->mapped);
+		self->map = NULL;
+	}
+	self->mapSize = 0;
+	self->frameCount = 0;
+	self->offsets = NULL;
+	Py_CLEAR(self->lastDst);
+	self->lastIndex = -1;
+}
+
+static void
+DMDCompressedAnimation_dealloc(PyObject* _self)
+{
+	DMDCompressedAnimation_unmap((pinproc_DMDCompressedAnimationObject *)_self);
+    _self->ob_type->tp_free(_self);
+}
+
+/* Checks the header and frame offsets of the loaded file. */
+static bool
+DMDCompressedAnimation_parse(pinproc_DMDCompressedAnimationObject *self)
+{
+	uint32_t header[5];
+	memcpy(header, self->map, sizeof(header));
+	if (header[0] != kDMDCompressedAnimationMagic)
+	{
+		PyErr_SetString(PyExc_ValueError, "File is not a compressed DMD animation");
+		return false;
+	}
+	unsigned long long indexSize = 4 * ((unsigned long long)header[1] + 1);
+	if (header[2] > 0x7fffffff || header[3] > 0x7fffffff ||
+		kDMDCompressedAnimationHeaderSize + indexSize > self->mapSize)
+	{
+		PyErr_SetString(PyExc_ValueError, "File size inconsistent with header information");
+		return false;
+	}
+	self->frameCount = header[1];
+	self->frameSize = DMDSizeMake(header[2], header[3]);
+	self->keyframeInterval = header[4];
+	self->offsets = (const uint32_t *)(self->map + kDMDCompressedAnimationHeaderSize);
+	
+	uint32_t previous = (uint32_t)(kDMDCompressedAnimationHeaderSize + indexSize);
+	for (unsigned i = 0; i <= self->frameCount; i++)
+	{
+		// Every frame needs at least its type byte, and the first must be a keyframe.
+		uint32_t offset = self->offsets[i];
+		if (offset < previous || (i > 0 && offset == previous) || offset > self->mapSize ||
+			(i == self->frameCount && offset != self->mapSize) ||
+			(i == 1 && !DMDDeltaIsKeyframe(self->map + previous)))
+		{
+			PyErr_SetString(PyExc_ValueError, "Compressed DMD animation has a corrupt frame index");
+			return false;
+		}
+		previous = offset;
+	}
+	return true;
+}
+
+static int
+DMDCompressedAnimation_init(pinproc_DMDCompressedAnimationObject *self, PyObject *args, PyObject *kwds)
+{
+	const char *path = NULL;
+	const char *data = NULL;
+	Py_ssize_t dataLength = 0;
+	static char *kwlist[] = {"path", "data", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|zs#", kwlist, &path, &data, &dataLength))
+	{
+		return -1;
+	}
+	if ((path == NULL) == (data == NULL))
+	{
+		PyErr_SetString(PyExc_ValueError, "Exactly one of path and data must be given");
+		return -1;
+	}
+	DMDCompressedAnimation_unmap(self);
+	
+	if (path != NULL)
+	{
+		if (!DMDAnimationMapFile(path, kDMDCompressedAnimationHeaderSize, &self->map, &self->mapSize, &self->mapped))
+			return -1;
+	}
+	else
+	{
+		if (dataLength < kDMDCompressedAnimationHeaderSize)
+		{
+			PyErr_SetString(PyExc_ValueError, "Data is too short to be a compressed DMD animation");
+			return -1;
+		}
+		self->map = (unsigned char *)malloc(dataLength);
+		if (self->map == NULL)
+		{
+			PyErr_NoMemory();
+			return -1;
+		}
+		memcpy(self->map, data, dataLength);
+		self->mapSize = dataLength;
+		self->mapped = false;
+	}
+	
+	if (!DMDCompressedAnimation_parse(self))
+	{
+		DMDCompressedAnimation_unmap(self);
+		return -1;
+	}
+	return 0;
+}
+
+static inline bool
+DMDCompressedAnimation_decode_one(pinproc_DMDCompressedAnimationObject *self, DMDFrame *frame, Py_ssize_t index)
+{
+	const unsigned char *data = self->map + self->offsets[index];
+	return DMDFrameDecodeDelta(frame, data, self->offsets[index + 1] - self->offsets[index]) == 0;
+}
+
+/* Decodes frame index into dst, starting from the nearest keyframe unless dst already holds the previous frame.
+ * If remember is set, dst is noted as holding frame index for the next call.  That only holds while
+ * nothing else draws into dst, which its frame's generation shows; writes through an exported buffer
+ * can't be seen, so a buffer that has exported one always starts from a keyframe. */
+static bool
+DMDCompressedAnimation_decode_into(pinproc_DMDCompressedAnimationObject *self, pinproc_DMDBufferObject *dst, Py_ssize_t index, bool remember)
+{
+	if (dst->frame == NULL)
+	{
+		PyErr_SetString(PyExc_ValueError, "DMDBuffer is not initialized");
+		return false;
+	}
+	if (dst->frame->size.width != self->frameSize.width || dst->frame->size.height != self->frameSize.height)
+	{
+		PyErr_SetString(PyExc_ValueError, "Buffer size does not match the animation");
+		return false;
+	}
+	
+	bool holdsLast = self->lastDst == dst && DMDFrameGetGeneration(dst->frame) == self->lastGeneration &&
+		dst->exports == 0 && !dst->legacyWriteExported;
+	Py_ssize_t start;
+	if (holdsLast && self->lastIndex == index)
+		return true;
+	if (holdsLast && self->lastIndex == index - 1)
+		start = index;
+	else
+		for (start = index; start > 0 && !DMDDeltaIsKeyframe(self->map + self->offsets[start]); start--)
+			;
+	
+	if (self->lastDst == dst || remember)
+		Py_CLEAR(self->lastDst);
+	for (Py_ssize_t i = start; i <= index; i++)
+	{
+		if (!DMDCompressedAnimation_decode_one(self, dst->frame, i))
+		{
+			PyErr_SetString(PyExc_ValueError, "Compressed DMD animation has a corrupt frame");
+			return false;
+		}
+	}
+	if (remember)
+	{
+		Py_INCREF(dst);
+		self->lastDst = dst;
+		self->lastIndex = index;
+		self->lastGeneration = DMDFrameGetGeneration(dst->frame);
+	}
+	return true;
+}
+
+static PyObject *
+DMDCompressedAnimation_decode(pinproc_DMDCompressedAnimationObject *self, PyObject *args, PyObject *kwds)
+{
+	Py_ssize_t index;
+	pinproc_DMDBufferObject *dst;
+	static char *kwlist[] = {"index", "dst", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "nO!", kwlist, &index, &pinproc_DMDBufferType, &dst))
+	{
+		return NULL;
+	}
+	if (!DMDBufferCheckWritable(dst))
+		return NULL;
+	if (index < 0)
+		index += self->frameCount;
+	if (index < 0 || index >= (Py_ssize_t)self->frameCount)
+	{
+		PyErr_SetString(PyExc_IndexError, "frame index out of range");
+		return NULL;
+	}
+	if (!DMDCompressedAnimation_decode_into(self, dst, index, true))
+		return NULL;
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject *
+DMDCompressedAnimation_reset(pinproc_DMDCompressedAnimationObject *self, PyObject *args)
+{
+	Py_CLEAR(self->lastDst);
+	self->lastIndex = -1;
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static Py_ssize_t
+DMDCompressedAnimation_length(PyObject *_self)
+{
+	return ((pinproc_DMDCompressedAnimationObject *)_self)->frameCount;
+}
+
+static PyObject *
+DMDCompressedAnimation_item(PyObject *_self, Py_ssize_t index)
+{
+	pinproc_DMDCompressedAnimationObject *self = (pinproc_DMDCompressedAnimationObject *)_self;
+	if (index < 0 || index >= (Py_ssize_t)self->frameCount)
+	{
+		PyErr_SetString(PyExc_IndexError, "frame index out of range");
+		return NULL;
+	}
+	pinproc_DMDBufferObject *buffer = (pinproc_DMDBufferObject *)DMDBuffer_new(&pinproc_DMDBufferType, NULL, NULL);
+	if (buffer == NULL)
+		return NULL;
+	DMDFrame *frame = DMDFrameCreate(self->frameSize);
+	if (frame == NULL)
+	{
+		Py_DECREF(buffer);
+		PyErr_SetString(PyExc_IOError, "Failed to allocate memory");
+		return NULL;
+	}
+	DMDBuffer_set_frame(buffer, frame);
+	if (!DMDCompressedAnimation_decode_into(self, buffer, index, false))
+	{
+		Py_DECREF(buffer);
+		return NULL;
+	}
+	return (PyObject *)buffer;
+}
+
+static PyObject *
+DMDCompressedAnimation_get_width(pinproc_DMDCompressedAnimationObject *self, void *closure)
+{
+	return PyInt_FromLong(self->frameSize.width);
+}
+
+static PyObject *
+DMDCompressedAnimation_get_height(pinproc_DMDCompressedAnimationObject *self, void *closure)
+{
+	return PyInt_FromLong(self->frameSize.height);
+}
+
+static PyObject *
+DMDCompressedAnimation_get_keyframe_interval(pinproc_DMDCompressedAnimationObject *self, void *closure)
+{
+	return PyInt_FromLong(self->keyframeInterval);
+}
+
+static PyObject *
+DMDCompressedAnimation_get_encoded_size(pinproc_DMDCompressedAnimationObject *self, void *closure)
+{
+	return PyInt_FromSsize_t((Py_ssize_t)self->mapSize);
+}
+
+PyObject *
+pinproc_dmd_encode_animation(PyObject *self, PyObject *args, PyObject *kwds)
+{
+	PyObject *framesObj;
+	unsigned keyframeInterval = 30;
+	static char *kwlist[] = {"frames", "keyframe_interval", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|I", kwlist, &framesObj, &keyframeInterval))
+	{
+		return NULL;
+	}
+	if (keyframeInterval == 0)
+	{
+		PyErr_SetString(PyExc_ValueError, "keyframe_interval must be at least 1");
+		return NULL;
+	}
+	PyObject *seq = PySequence_Fast(framesObj, "frames must be a sequence of DMDBuffers");
+	if (seq == NULL)
+		return NULL;
+	
+	Py_ssize_t count = PySequence_Fast_GET_SIZE(seq);
+	DMDSize size = DMDSizeMake(0, 0);
+	for (Py_ssize_t i = 0; i < count; i++)
+	{
+		PyObject *item = PySequence_Fast_GET_ITEM(seq, i);
+		if (!PyObject_TypeCheck(item, &pinproc_DMDBufferType))
+		{
+			Py_DECREF(seq);
+			PyErr_SetString(PyExc_TypeError, "frames must be a sequence of DMDBuffers");
+			return NULL;
+		}
+		if (((pinproc_DMDBufferObject *)item)->frame == NULL)
+		{
+			Py_DECREF(seq);
+			PyErr_SetString(PyExc_ValueError, "DMDBuffer is not initialized");
+			return NULL;
+		}
+		DMDSize itemSize = ((pinproc_DMDBufferObject *)item)->frame->size;
+		if (i > 0 && (itemSize.width != size.width || itemSize.height != size.height))
+		{
+			Py_DECREF(seq);
+			PyErr_SetString(PyExc_ValueError, "All frames must be the same size");
+			return NULL;
+		}
+		size = itemSize;
+	}
+	
+	// Grow the output as we go; compressed animations are usually a fraction of the worst case.
+	size_t headerSize = kDMDCompressedAnimationHeaderSize + 4 * (count + 1);
+	size_t maxFrameSize = DMDFrameGetMaxDeltaSize(size);
+	size_t capacity = headerSize + 2 * maxFrameSize;
+	unsigned char *out = (unsigned char *)malloc(capacity);
+	if (out == NULL)
+	{
+		Py_DECREF(seq);
+		return PyErr_NoMemory();
+	}
+	uint32_t header[5] = {kDMDCompressedAnimationMagic, (uint32_t)count, (uint32_t)size.width, (uint32_t)size.height, keyframeInterval};
+	memcpy(out, header, sizeof(header));
+	
+	size_t used = headerSize;
+	uint32_t *offsets = (uint32_t *)(out + kDMDCompressedAnimationHeaderSize);
+	DMDFrame *previous = NULL;
+	for (Py_ssize_t i = 0; i < count; i++)
+	{
+		if (used + maxFrameSize > capacity)
+		{
+			capacity = MAX(capacity * 2, used + maxFrameSize);
+			unsigned char *grown = (unsigned char *)realloc(out, capacity);
+			if (grown == NULL)
+			{
+				free(out);
+				Py_DECREF(seq);
+				return PyErr_NoMemory();
+			}
+			out = grown;
+			offsets = (uint32_t *)(out + kDMDCompressedAnimationHeaderSize);
+		}
+		DMDFrame *frame = ((pinproc_DMDBufferObject *)PySequence_Fast_GET_ITEM(seq, i))->frame;
+		offsets[i] = (uint32_t)used;
+		used += DMDFrameEncodeDelta(frame, (i % keyframeInterval) ? previous : NULL, out + used);
+		previous = frame;
+	}
+	offsets[count] = (uint32_t)used;
+	
+	PyObject *result = PyString_FromStringAndSize((char *)out, used);
+	free(out);
+	Py_DECREF(seq);
+	return result;
+}
+
+PyMethodDef DMDCompressedAnimation_methods[] = {
+    {"decode", (PyCFunction)DMDCompressedAnimation_decode, METH_VARARGS|METH_KEYWORDS,
+     "Decodes the frame at index into dst.  If dst holds the previous frame from the last decode() only the delta is applied, "
+     "so call reset() after drawing into dst by other means."
+    },
+    {"reset", (PyCFunction)DMDCompressedAnimation_reset, METH_NOARGS,
+     "Forgets the last decoded frame, so the next decode() starts from a keyframe."
+    },
+    {NULL, NULL, NULL, NULL}  /* Sentinel */
+};
+
+static PyGetSetDef DMDCompressedAnimation_getset[] = {
+    {"width", (getter)DMDCompressedAnimation_get_width, NULL, "Width of each frame in dots.", NULL},
+    {"height", (getter)DMDCompressedAnimation_get_height, NULL, "Height of each frame in dots.", NULL},
+    {"keyframe_interval", (getter)DMDCompressedAnimation_get_keyframe_interval, NULL, "Number of frames from one keyframe to the next.", NULL},
+    {"encoded_size", (getter)DMDCompressedAnimation_get_encoded_size, NULL, "Size of the compressed animation in bytes.", NULL},
+    {NULL}  /* Sentinel */
+};
+
+static PySequenceMethods DMDCompressedAnimation_as_sequence = {
+    DMDCompressedAnimation_length, /* sq_length */
+    0,                         /* sq_concat */
+    0,                         /* sq_repeat */
+    DMDCompressedAnimation_item, /* sq_item */
+};
+
+PyTypeObject pinproc_DMDCompressedAnimationType = {
+    PyObject_HEAD_INIT(NULL)
+    0,                         /*ob_size*/
+    "pinproc.DMDCompressedAnimation", /*tp_name*/
+    sizeof(pinproc_DMDCompressedAnimationObject), /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    DMDCompressedAnimation_dealloc, /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    &DMDCompressedAnimation_as_sequence, /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT|Py_TPFLAGS_BASETYPE, /*tp_flags*/
+    "Keyframe and delta compressed animation, decoded on demand", /* tp_doc */
+    0,		               /* tp_traverse */
+    0,		               /* tp_clear */
+    0,		               /* tp_richcompare */
+    0,		               /* tp_weaklistoffset */
+    0,		               /* tp_iter */
+    0,		               /* tp_iternext */
+    DMDCompressedAnimation_methods, /* tp_methods */
+    0,                         /* tp_members */
+    DMDCompressedAnimation_getset, /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    (initproc)DMDCompressedAnimation_init, /* tp_init */
+    0,                         /* tp_alloc */
+    DMDCompressedAnimation_new, /* tp_new */
+};
+
+/*
+ * Frame stores
+ * 
+ * A DMDFrameStore keeps one copy of each distinct frame given to add() and hands
+ * out that copy, read-only, to everyone who adds the same dots again.  Animations
+ * that repeat frames, and layers that keep re-rendering the same content, then
+ * share their memory:
+ * 
+ *   frames = store.add_many(pinproc.DMDAnimation('attract.dmd'))
+ * 
+ * The handles stay valid after clear() or once the store is gone.  Frames are
+ * found by DMDFrameHash() and then compared dot for dot, so frames that merely
+ * share a hash are kept apart.
+ */
+
+static PyObject *
+DMDFrameStore_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    pinproc_DMDFrameStoreObject *self;
+
+    self = (pinproc_DMDFrameStoreObject *)type->tp_alloc(type, 0);
+    if (self != NULL) {
+		self->entries = NULL;
+		self->capacity = 0;
+		self->count = 0;
+		self->storedBytes = 0;
+		self->hits = 0;
+    }
+
+    return (PyObject *)self;
+}
+
+static void
+DMDFrameStore_clear_entries(pinproc_DMDFrameStoreObject *self)
+{
+	DMDFrameStoreEntry *entries = self->entries;
+	Py_ssize_t capacity = self->capacity;
+	self->entries = NULL;
+	self->capacity = 0;
+	self->count = 0;
+	self->storedBytes = 0;
+	for (Py_ssize_t i = 0; i < capacity; i++)
+		Py_XDECREF(entries[i].buffer);
+	free(entries);
+}
+
+static void
+DMDFrameStore_dealloc(PyObject* _self)
+{
+	DMDFrameStore_clear_entries((pinproc_DMDFrameStoreObject *)_self);
+    _self->ob_type->tp_free(_self);
+}
+
+/* Returns the slot holding a frame equal to frame, or the free slot it would go in. */
+static Py_ssize_t
+DMDFrameStore_find_slot(pinproc_DMDFrameStoreObject *self, unsigned long long hash, DMDFrame *frame)
+{
+	Py_ssize_t mask = self->capacity - 1;
+	Py_ssize_t i = (Py_ssize_t)(hash & mask);
+	for (;; i = (i + 1) & mask)
+	{
+		DMDFrameStoreEntry *entry = &self->entries[i];
+		if (entry->buffer == NULL)
+			return i;
+		if (entry->hash == hash && DMDFrameIsEqual(entry->buffer->frame, frame))
+			return i;
+	}
+}
+
+/* Makes room for one more frame, keeping the table at most three quarters full. */
+static bool
+DMDFrameStore_reserve(pinproc_DMDFrameStoreObject *self)
+{
+	if ((self->count + 1) * 4 <= self->capacity * 3)
+		return true;
+	Py_ssize_t capacity = self->capacity ? self->capacity * 2 : 64;
+	DMDFrameStoreEntry *entries = (DMDFrameStoreEntry *)calloc(capacity, sizeof(DMDFrameStoreEntry));
+	if (entries == NULL)
+	{
+		PyErr_NoMemory();
+		return false;
+	}
+	DMDFrameStoreEntry *old = self->entries;
+	Py_ssize_t oldCapacity = self->capacity;
+	self->entries = entries;
+	self->capacity = capacity;
+	for (Py_ssize_t i = 0; i < oldCapacity; i++)
+	{
+		if (old[i].buffer != NULL)
+			entries[DMDFrameStore_find_slot(self, old[i].hash, old[i].buffer->frame)] = old[i];
+	}
+	free(old);
+	return true;
+}
+
+/* Returns a new reference to the stored copy of buffer's dots, storing them first if need be. */
+static PyObject *
+DMDFrameStore_add_one(pinproc_DMDFrameStoreObject *self, pinproc_DMDBufferObject *buffer)
+{
+	if (!DMDBufferCheckInitialized(buffer) || !DMDFrameStore_reserve(self))
+		return NULL;
+	unsigned long long hash = DMDFrameHash(buffer->frame);
+	DMDFrameStoreEntry *entry = &self->entries[DMDFrameStore_find_slot(self, hash, buffer->frame)];
+	if (entry->buffer != NULL)
+	{
+		self->hits++;
+		Py_INCREF(entry->buffer);
+		return (PyObject *)entry->buffer;
+	}
+	
+	pinproc_DMDBufferObject *shared = (pinproc_DMDBufferObject *)DMDBuffer_new(&pinproc_DMDBufferType, NULL, NULL);
+	if (shared == NULL)
+		return NULL;
+	DMDFrame *frame = DMDFrameCopy(buffer->frame);
+	if (frame == NULL)
+	{
+		Py_DECREF(shared);
+		PyErr_SetString(PyExc_IOError, "Failed to allocate memory");
+		return NULL;
+	}
+	DMDBuffer_set_frame(shared, frame);
+	shared->readonly = true;
+	entry->hash = hash;
+	entry->buffer = shared;
+	self->count++;
+	self->storedBytes += DMDFrameGetBufferSize(frame);
+	Py_INCREF(shared);
+	return (PyObject *)shared;
+}
+
+static int
+DMDFrameStore_init(pinproc_DMDFrameStoreObject *self, PyObject *args, PyObject *kwds)
+{
+	static char *kwlist[] = {NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "", kwlist))
+	{
+		return -1;
+	}
+	DMDFrameStore_clear_entries(self);
+	self->hits = 0;
+	return 0;
+}
+
+static PyObject *
+DMDFrameStore_add(pinproc_DMDFrameStoreObject *self, PyObject *args, PyObject *kwds)
+{
+	pinproc_DMDBufferObject *buffer;
+	static char *kwlist[] = {"buffer", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!", kwlist, &pinproc_DMDBufferType, &buffer))
+	{
+		return NULL;
+	}
+	return DMDFrameStore_add_one(self, buffer);
+}
+
+static PyObject *
+DMDFrameStore_add_many(pinproc_DMDFrameStoreObject *self, PyObject *args, PyObject *kwds)
+{
+	PyObject *framesObj;
+	static char *kwlist[] = {"frames", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O", kwlist, &framesObj))
+	{
+		return NULL;
+	}
+	PyObject *seq = PySequence_Fast(framesObj, "frames must be a sequence of DMDBuffers");
+	if (seq == NULL)
+		return NULL;
+	Py_ssize_t count = PySequence_Fast_GET_SIZE(seq);
+	PyObject *result = PyList_New(count);
+	if (result == NULL)
+	{
+		Py_DECREF(seq);
+		return NULL;
+	}
+	for (Py_ssize_t i = 0; i < count; i++)
+	{
+		PyObject *item = PySequence_Fast_GET_ITEM(seq, i);
+		PyObject *shared = NULL;
+		if (!PyObject_TypeCheck(item, &pinproc_DMDBufferType))
+			PyErr_SetString(PyExc_TypeError, "frames must be a sequence of DMDBuffers");
+		else
+			shared = DMDFrameStore_add_one(self, (pinproc_DMDBufferObject *)item);
+		if (shared == NULL)
+		{
+			Py_DECREF(result);
+			Py_DECREF(seq);
+			return NULL;
+		}
+		PyList_SET_ITEM(result, i, shared);
+	}
+	Py_DECREF(seq);
+	return result;
+}
+
+static PyObject *
+DMDFrameStore_find(pinproc_DMDFrameStoreObject *self, PyObject *args, PyObject *kwds)
+{
+	pinproc_DMDBufferObject *buffer;
+	static char *kwlist[] = {"buffer", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!", kwlist, &pinproc_DMDBufferType, &buffer))
+	{
+		return NULL;
+	}
+	if (!DMDBufferCheckInitialized(buffer))
+		return NULL;
+	PyObject *shared = Py_None;
+	if (self->count > 0)
+	{
+		DMDFrameStoreEntry *entry = &self->entries[DMDFrameStore_find_slot(self, DMDFrameHash(buffer->frame), buffer->frame)];
+		if (entry->buffer != NULL)
+			shared = (PyObject *)entry->buffer;
+	}
+	Py_INCREF(shared);
+	return shared;
+}
+
+static PyObject *
+DMDFrameStore_clear(pinproc_DMDFrameStoreObject *self, PyObject *args)
+{
+	DMDFrameStore_clear_entries(self);
+	self->hits = 0;
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static Py_ssize_t
+DMDFrameStore_length(PyObject *_self)
+{
+	return ((pinproc_DMDFrameStoreObject *)_self)->count;
+}
+
+static int
+DMDFrameStore_contains(PyObject *_self, PyObject *item)
+{
+	pinproc_DMDFrameStoreObject *self = (pinproc_DMDFrameStoreObject *)_self;
+	if (!PyObject_TypeCheck(item, &pinproc_DMDBufferType))
+		return 0;
+	if (!DMDBufferCheckInitialized((pinproc_DMDBufferObject *)item))
+		return -1;
+	if (self->count == 0)
+		return 0;
+	DMDFrame *frame = ((pinproc_DMDBufferObject *)item)->frame;
+	return self->entries[DMDFrameStore_find_slot(self, DMDFrameHash(frame), frame)].buffer != NULL;
+}
+
+static PyObject *
+DMDFrameStore_get_hits(pinproc_DMDFrameStoreObject *self, void *closure)
+{
+	return PyLong_FromUnsignedLong(self->hits);
+}
+
+static PyObject *
+DMDFrameStore_get_stored_bytes(pinproc_DMDFrameStoreObject *self, void *closure)
+{
+	return PyInt_FromSize_t(self->storedBytes);
+}
+
+PyMethodDef DMDFrameStore_methods[] = {
+    {"add", (PyCFunction)DMDFrameStore_add, METH_VARARGS|METH_KEYWORDS,
+     "Returns the store's read-only copy of the given DMDBuffer's dots, adding one if there isn't one yet."
+    },
+    {"add_many", (PyCFunction)DMDFrameStore_add_many, METH_VARARGS|METH_KEYWORDS,
+     "As add() for each of a sequence of DMDBuffers, such as a DMDAnimation; returns a list of the shared copies."
+    },
+    {"find", (PyCFunction)DMDFrameStore_find, METH_VARARGS|METH_KEYWORDS,
+     "Returns the store's copy of the given DMDBuffer's dots, or None if it has none."
+    },
+    {"clear", (PyCFunction)DMDFrameStore_clear, METH_NOARGS,
+     "Forgets every stored frame.  Handles already given out are unaffected."
+    },
+    {NULL, NULL, NULL, NULL}  /* Sentinel */
+};
+
+static PyGetSetDef DMDFrameStore_getset[] = {
+    {"hits", (getter)DMDFrameStore_get_hits, NULL, "Number of add() calls answered with a frame already in the store.", NULL},
+    {"stored_bytes", (getter)DMDFrameStore_get_stored_bytes, NULL, "Bytes of dots held by the stored frames.", NULL},
+    {NULL}  /* Sentinel */
+};
+
+static PySequenceMethods DMDFrameStore_as_sequence = {
+    DMDFrameStore_length,      /* sq_length */
+    0,                         /* sq_concat */
+    0,                         /* sq_repeat */
+    0,                         /* sq_item */
+    0,                         /* sq_slice */
+    0,                         /* sq_ass_item */
+    0,                         /* sq_ass_slice */
+    DMDFrameStore_contains,    /* sq_contains */
+};
+
+PyTypeObject pinproc_DMDFrameStoreType = {
+    PyObject_HEAD_INIT(NULL)
+    0,                         /*ob_size*/
+    "pinproc.DMDFrameStore",   /*tp_name*/
+    sizeof(pinproc_DMDFrameStoreObject), /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    DMDFrameStore_dealloc,     /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    &DMDFrameStore_as_sequence, /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT|Py_TPFLAGS_BASETYPE, /*tp_flags*/
+    "Deduplicating store of read-only DMD frames", /* tp_doc */
+    0,		               /* tp_traverse */
+    0,		               /* tp_clear */
+    0,		               /* tp_richcompare */
+    0,		               /* tp_weaklistoffset */
+    0,		               /* tp_iter */
+    0,		               /* tp_iternext */
+    DMDFrameStore_methods,     /* tp_methods */
+    0,                         /* tp_members */
+    DMDFrameStore_getset,      /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    (initproc)DMDFrameStore_init, /* tp_init */
+    0,                         /* tp_alloc */
+    DMDFrameStore_new,         /* tp_new */
+};
+
+/*
+ * Buffer protocol
+ * 
+ * Exposes the dots in place as a writable height x width array of unsigned bytes
+ * (format 'B'), for memoryview, numpy and friends.  The old-style buffer calls are
+ * implemented too for code that still uses them.
+ */
+
+static int
+DMDBuffer_getbuffer(PyObject *_self, Py_buffer *view, int flags)
+{
+	pinproc_DMDBufferObject *self = (pinproc_DMDBufferObject *)_self;
+	if (self->frame == NULL)
+	{
+		PyErr_SetString(PyExc_BufferError, "DMDBuffer is not initialized");
+		view->obj = NULL;
+		return -1;
+	}
+	if (self->readonly && (flags & PyBUF_WRITABLE))
+	{
+		PyErr_SetString(PyExc_BufferError, "DMDBuffer is read-only");
+		view->obj = NULL;
+		return -1;
+	}
+	
+	view->buf = self->frame->buffer;
+	view->obj = _self;
+	Py_INCREF(_self);
+	view->len = DMDFrameGetBufferSize(self->frame);
+	view->readonly = self->readonly;
+	view->itemsize = 1;
+	view->format = (flags & PyBUF_FORMAT) ? (char *)"B" : NULL;
+	view->ndim = 2;
+	view->shape = (flags & PyBUF_ND) ? self->shape : NULL;
+	view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? self->strides : NULL;
+	view->suboffsets = NULL;
+	view->internal = NULL;
+	if (view->shape == NULL)
+		view->ndim = 1; // A plain run of bytes.
+	
+	self->exports++;
+	return 0;
+}
+
+static void
+DMDBuffer_releasebuffer(PyObject *_self, Py_buffer *view)
+{
+	pinproc_DMDBufferObject *self = (pinproc_DMDBufferObject *)_self;
+	self->exports--;
+	if (self->readonly)
+		return;
+	// The consumer may have written anywhere.
+	DMDFrameMarkDirty(self->frame, DMDFrameGetBounds(self->frame));
+}
+
+static Py_ssize_t
+DMDBuffer_getreadbuffer(PyObject *_self, Py_ssize_t segment, void **ptr)
+{
+	pinproc_DMDBufferObject *self = (pinproc_DMDBufferObject *)_self;
+	if (segment != 0)
+	{
+		PyErr_SetString(PyExc_SystemError, "accessing non-existent DMDBuffer segment");
+		return -1;
+	}
+	if (self->frame == NULL)
+	{
+		PyErr_SetString(PyExc_BufferError, "DMDBuffer is not initialized");
+		return -1;
+	}
+	*ptr = self->frame->buffer;
+	return DMDFrameGetBufferSize(self->frame);
+}
+
+static Py_ssize_t
+DMDBuffer_getwritebuffer(PyObject *_self, Py_ssize_t segment, void **ptr)
+{
+	pinproc_DMDBufferObject *self = (pinproc_DMDBufferObject *)_self;
+	if (self->readonly)
+	{
+		PyErr_SetString(PyExc_TypeError, "DMDBuffer is read-only");
+		return -1;
+	}
+	// There's no release for old-style buffers, so from now on every draw has to assume the worst.
+	Py_ssize_t size = DMDBuffer_getreadbuffer(_self, segment, ptr);
+	if (size >= 0)
+		self->legacyWriteExported = true;
+	return size;
+}
+
+static Py_ssize_t
+DMDBuffer_getsegcount(PyObject *_self, Py_ssize_t *lenp)
+{
+	pinproc_DMDBufferObject *self = (pinproc_DMDBufferObject *)_self;
+	if (lenp)
+		*lenp = self->frame != NULL ? DMDFrameGetBufferSize(self->frame) : 0;
+	return 1;
+}
+
+static Py_ssize_t
+DMDBuffer_getcharbuffer(PyObject *_self, Py_ssize_t segment, char **ptr)
+{
+	return DMDBuffer_getreadbuffer(_self, segment, (void **)ptr);
+}
+
+static PyBufferProcs DMDBuffer_as_buffer = {
+	DMDBuffer_getreadbuffer,   /* bf_getreadbuffer */
+	DMDBuffer_getwritebuffer,  /* bf_getwritebuffer */
+	DMDBuffer_getsegcount,     /* bf_getsegcount */
+	DMDBuffer_getcharbuffer,   /* bf_getcharbuffer */
+	DMDBuffer_getbuffer,       /* bf_getbuffer */
+	DMDBuffer_releasebuffer,   /* bf_releasebuffer */
+};
+
+PyObject *
+pinproc_dmd_frame_stats(PyObject *self, PyObject *args)
+{
+	DMDFrameStats stats;
+	DMDFrameGetStats(&stats);
+	return Py_BuildValue("{s:k,s:k,s:k,s:n}",
+		"live", stats.live,
+		"pool_hits", stats.poolHits,
+		"pool_misses", stats.poolMisses,
+		"pooled_bytes", (Py_ssize_t)stats.pooledBytes);
+}
+
+PyObject *
+pinproc_dmd_frame_pool_trim(PyObject *self, PyObject *args)
+{
+	DMDFramePoolTrim();
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+PyObject *
+pinproc_dmd_set_worker_count(PyObject *self, PyObject *args, PyObject *kwds)
+{
+	unsigned int count;
+	static char *kwlist[] = {"count", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "I", kwlist, &count))
+		return NULL;
+	return Py_BuildValue("I", DMDSetWorkerCount(count));
+}
+
+PyObject *
+pinproc_dmd_set_parallel_threshold(PyObject *self, PyObject *args, PyObject *kwds)
+{
+	unsigned int dots;
+	static char *kwlist[] = {"dots", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "I", kwlist, &dots))
+		return NULL;
+	DMDSetParallelThreshold(dots);
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+PyTypeObject pinproc_DMDBufferType = {
+    PyObject_HEAD_INIT(NULL)
+    0,                         /*ob_size*/
+    "pinproc.DMDBuffer",         /*tp_name*/
+    sizeof(pinproc_DMDBufferObject), /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    DMDBuffer_dealloc,           /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    0,                         /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    &DMDBuffer_as_buffer,      /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT|Py_TPFLAGS_BASETYPE|Py_TPFLAGS_HAVE_NEWBUFFER, /*tp_flags*/
+    "DMDBuffer object",         /* tp_doc */
+    0,		               /* tp_traverse */
+    0,		               /* tp_clear */
+    0,		               /* tp_richcompare */
+    0,		               /* tp_weaklistoffset */
+    0,		               /* tp_iter */
+    0,		               /* tp_iternext */
+    DMDBuffer_methods,             /* tp_methods */
+    0, //PinPROC_members,             /* tp_members */
+    DMDBuffer_getset,          /* tp_getset */
     0,                         /* tp_base */
     0,                         /* tp_dict */
     0,                         /* tp_descr_get */
@@ -2,16 +2,168 @@
 #define _DMDUTIL_H_
 
 #include <Python.h>
+#include <stdint.h>
 #include "dmd.h"
 
 typedef struct {
     PyObject_HEAD
     /* Type-specific fields go here. */
     DMDFrame *frame;
+    PyObject *base;          /* Owner of the dots if the frame doesn't own them (e.g. a DMDAnimation), or NULL. */
+    /* Buffer protocol state: the dots are exported as a height x width array of bytes. */
+    Py_ssize_t shape[2];
+    Py_ssize_t strides[2];
+    int exports;             /* Outstanding new-style buffer exports. */
+    bool legacyWriteExported; /* A writable old-style buffer was handed out at some point. */
+    int threadUses;          /* Operations drawing with the GIL released; the frame can't be replaced meanwhile. */
+    bool readonly;           /* Shared by a DMDFrameStore, so nothing may draw into it. */
 } pinproc_DMDBufferObject;
 
+/* Returns false with an exception set if buffer can't be drawn into. */
+static inline bool DMDBufferCheckWritable(pinproc_DMDBufferObject *buffer)
+{
+	if (!buffer->readonly)
+		return true;
+	PyErr_SetString(PyExc_TypeError, "DMDBuffer is read-only");
+	return false;
+}
+
+/* Returns false with an exception set if buffer was never given a frame, as after DMDBuffer.__new__(). */
+static inline bool DMDBufferCheckInitialized(pinproc_DMDBufferObject *buffer)
+{
+	if (buffer->frame != NULL)
+		return true;
+	PyErr_SetString(PyExc_ValueError, "DMDBuffer is not initialized");
+	return false;
+}
+
+/* Writes made through an exported buffer can't be seen by the frame's dirty tracking,
+ * so while any are possible treat the whole frame as dirty. */
+static inline void DMDBufferSyncDirty(pinproc_DMDBufferObject *buffer)
+{
+	if (buffer->exports > 0 || buffer->legacyWriteExported)
+		DMDFrameMarkDirty(buffer->frame, DMDFrameGetBounds(buffer->frame));
+}
+
+typedef struct {
+    PyObject_HEAD
+    Py_ssize_t count;
+    DMDLayer *layers;
+    pinproc_DMDBufferObject **buffers; /* Owned references, one per layer. */
+} pinproc_DMDCompositePlanObject;
+
+typedef struct {
+    DMDRect rect;        /* Location in the atlas; empty if the character has no glyph. */
+    DMDPoint offset;     /* Added to the pen position when drawing. */
+    DMDDimension advance;
+} DMDGlyph;
+
+#define kDMDFontLayoutCacheSize (64)
+
+typedef struct {
+    PyObject *text;      /* The str laid out, or NULL if the entry is unused. */
+    DMDDimension *offsets; /* x of each character relative to the start of the text. */
+    DMDDimension width;
+} DMDFontLayout;
+
+typedef struct {
+    PyObject_HEAD
+    DMDPackedFrame *frame;
+} pinproc_DMDPackedBufferObject;
+
+typedef struct {
+    PyObject_HEAD
+    pinproc_DMDBufferObject *atlas;
+    DMDGlyph glyphs[256];
+    DMDDimension tracking;
+    DMDDimension lineHeight;
+    DMDBlendMode blendMode;  /* Used when draw_text() isn't given an op. */
+    signed char *kerning;    /* 256x256 adjustments indexed by [left][right], or NULL if none are set. */
+    DMDFontLayout layouts[kDMDFontLayoutCacheSize];
+} pinproc_DMDFontObject;
+
+typedef struct {
+    PyObject_HEAD
+    DMDSize size;
+    Py_ssize_t rowBytes;     /* Bytes from one row of source pixels to the next. */
+    DMDQuantizeMethod method;
+    unsigned char curve[256];
+    bool useCurve;           /* False if the curve leaves every level as it is. */
+} pinproc_DMDQuantizerObject;
+
+typedef struct {
+    PyObject_HEAD
+    pinproc_DMDQuantizerObject *quantizer;
+    PyObject *source;        /* A buffer object, or a file-like object to read() a frame at a time from. */
+    Py_buffer view;          /* The source's bytes, while haveView is set. */
+    bool haveView;
+    Py_ssize_t offset;       /* Offset of the next frame in view. */
+    pinproc_DMDBufferObject *dst; /* Buffer every frame is converted into, or NULL for a new one each time. */
+} pinproc_DMDQuantizerStreamObject;
+
+typedef struct {
+    PyObject_HEAD
+    unsigned char *map;      /* The whole file, mapped copy-on-write, or NULL if not open. */
+    size_t mapSize;
+    bool mapped;             /* map came from mmap() rather than malloc(). */
+    unsigned frameCount;
+    DMDSize frameSize;
+} pinproc_DMDAnimationObject;
+
+typedef struct {
+    PyObject_HEAD
+    unsigned char *map;      /* The whole file, or NULL if not open. */
+    size_t mapSize;
+    bool mapped;
+    unsigned frameCount;
+    DMDSize frameSize;
+    unsigned keyframeInterval;
+    const uint32_t *offsets; /* frameCount + 1 file offsets of the encoded frames, pointing into map. */
+    pinproc_DMDBufferObject *lastDst; /* Buffer holding the last frame decoded, or NULL. */
+    Py_ssize_t lastIndex;
+    unsigned long long lastGeneration; /* Generation of lastDst's frame after the decode. */
+} pinproc_DMDCompressedAnimationObject;
+
+typedef struct {
+    unsigned long long hash;
+    pinproc_DMDBufferObject *buffer; /* Owned reference to the shared read-only copy, or NULL if the slot is free. */
+} DMDFrameStoreEntry;
+
+typedef struct {
+    PyObject_HEAD
+    DMDFrameStoreEntry *entries; /* Open addressed on the content hash. */
+    Py_ssize_t capacity;     /* A power of two, or 0 before the first add(). */
+    Py_ssize_t count;
+    size_t storedBytes;
+    unsigned long hits;      /* add() calls that found an identical frame already stored. */
+} pinproc_DMDFrameStoreObject;
+
 extern "C" {
 	extern PyTypeObject pinproc_DMDBufferType;
+	extern PyTypeObject pinproc_DMDCompositePlanType;
+	extern PyTypeObject pinproc_DMDFontType;
+	extern PyTypeObject pinproc_DMDPackedBufferType;
+	extern PyTypeObject pinproc_DMDQuantizerType;
+	extern PyTypeObject pinproc_DMDQuantizerStreamType;
+	extern PyTypeObject pinproc_DMDAnimationType;
+	extern PyTypeObject pinproc_DMDCompressedAnimationType;
+	extern PyTypeObject pinproc_DMDFrameStoreType;
+	
+	bool DMDBlendModeFromString(const char *opStr, DMDBlendMode *blendMode);
+	bool DMDBlendModeFromObject(PyObject *opObj, DMDBlendMode *blendMode);
+	
+	PyObject *pinproc_register_blend_mode(PyObject *self, PyObject *args, PyObject *kwds);
+	PyObject *pinproc_blend_table(PyObject *self, PyObject *args, PyObject *kwds);
+	PyObject *pinproc_composite(PyObject *self, PyObject *args, PyObject *kwds);
+	PyObject *pinproc_blit_many(PyObject *self, PyObject *args, PyObject *kwds);
+	PyObject *pinproc_transition(PyObject *self, PyObject *args, PyObject *kwds);
+	PyObject *pinproc_transition_frames(PyObject *self, PyObject *args, PyObject *kwds);
+	PyObject *pinproc_dmd_encode_animation(PyObject *self, PyObject *args, PyObject *kwds);
+	
+	PyObject *pinproc_dmd_frame_stats(PyObject *self, PyObject *args);
+	PyObject *pinproc_dmd_set_worker_count(PyObject *self, PyObject *args, PyObject *kwds);
+	PyObject *pinproc_dmd_set_parallel_threshold(PyObject *self, PyObject *args, PyObject *kwds);
+	PyObject *pinproc_dmd_frame_pool_trim(PyObject *self, PyObject *args);
 }
 
 #endif /* _DMDUTIL_H_ */
@@ -0,0 +1,74 @@
+# Generates dmdtables.c, the blend tables used by dmd.c, so they are computed once
+# at build time and end up in read-only memory.  setup.py runs this from build_ext, build_bench
+# and test_dmd; it can also be run by hand: python gendmdtables.py [output.c]
+import struct
+import sys
+
+
+def f32(x):
+	"""Rounds x to single precision, as each float operation in C does."""
+	return struct.unpack('f', struct.pack('f', x))[0]
+
+
+def to_char(x):
+	"""Converts a float to a C char by truncation, as x86 does: NaN and out of range values become 0x80000000."""
+	if x != x or x >= 2**31 or x < -2**31:
+		return 0
+	return int(x) & 0xff
+
+
+def alpha_map():
+	"""The 'alpha' blending table indexed by src * 256 + dst; see http://en.wikipedia.org/wiki/Alpha_compositing#Alpha_blending"""
+	table = bytearray(256 * 256)
+	for src in range(256):
+		src_dot, src_a = src & 0xf, src >> 4
+		src_weight = f32(f32(15.0 - src_a) / 15.0)
+		for dst in range(256):
+			dst_dot, dst_a = dst & 0xf, dst >> 4
+			a = to_char(f32(src_a + f32(dst_a * src_weight)))
+			numerator = f32(f32(src_dot * f32(src_a / 15.0)) + f32(f32(dst_dot * f32(dst_a / 15.0)) * src_weight))
+			denominator = f32(a / 15.0)
+			if denominator == 0:
+				dot = to_char(float('nan') if numerator == 0 else float('inf'))
+			else:
+				dot = to_char(f32(numerator / denominator))
+			table[src * 256 + dst] = ((a << 4) | (dot & 0xf)) & 0xff
+	return table
+
+
+def alpha_map_properties(table):
+	"""The properties the vector kernels rely on to skip the table lookups."""
+	clear_keeps_dst = all((table[src * 256 + (dst | 0xf0)] & 0xf) == dst for src in range(0x10) for dst in range(0x10))
+	opaque_takes_src = all((table[src * 256 + (dst | 0xf0)] & 0xf) == (src & 0xf) for src in range(0xf0, 0x100) for dst in range(0x100))
+	both_opaque_is_src = all(table[src * 256 + dst] == src for src in range(0xf0, 0x100) for dst in range(0x100))
+	return clear_keeps_dst, opaque_takes_src, both_opaque_is_src
+
+
+def main(path='dmdtables.c'):
+	table = alpha_map()
+	clear_keeps_dst, opaque_takes_src, both_opaque_is_src = alpha_map_properties(table)
+	lines = ['/* Generated by gendmdtables.py; do not edit. */',
+		'#include "dmd.h"',
+		'',
+		'const int gDMDAlphaClearKeepsDst = %d;' % clear_keeps_dst,
+		'const int gDMDAlphaOpaqueTakesSrc = %d;' % opaque_takes_src,
+		'const int gDMDAlphaBothOpaqueIsSrc = %d;' % both_opaque_is_src,
+		'',
+		'const DMDColor gDMDAlphaMap[256 * 256] = {']
+	for i in range(0, len(table), 32):
+		lines.append('\t' + ','.join('%d' % v for v in table[i:i + 32]) + ',')
+	lines.append('};')
+	lines.append('')
+	contents = '\n'.join(lines)
+	try:
+		with open(path) as f:
+			if f.read() == contents:
+				return # Leave it alone so it isn't rebuilt.
+	except IOError:
+		pass
+	with open(path, 'w') as f:
+		f.write(contents)
+
+
+if __name__ == '__main__':
+	main(*sys.argv[1:])
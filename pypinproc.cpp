@@ -1,24 +1,111 @@
 #include <Python.h>
+#include <pythread.h>
+#include <structseq.h>
 #include "pinproc.h"
 #include "dmdutil.h"
+#if !defined(_WIN32)
+#include <pthread.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#endif
+#define PINPROC_HAVE_DMD_OUTPUT_THREAD 1
+#define PINPROC_HAVE_EVENT_POLLER 1
+#else
+#include <windows.h>
+#endif
 
 extern "C" {
 
 static PRMachineType g_machineType;
 
-#define ReturnOnErrorAndSetIOError(res) { if (res != kPRSuccess) { PyErr_SetString(PyExc_IOError, PRGetLastErrorText()); return NULL; } }
+#define ReturnOnErrorAndSetIOError(res, error) { if (res != kPRSuccess) { PyErr_SetString(PyExc_IOError, error); return NULL; } }
 
 const static int dmdMappingSize = 16;
 
+// The geometry and subframe count used until dmd_update_config() says otherwise.
+#define kDMDColumns (128)
+#define kDMDRows (32)
+#define kDMDSubFrames (4)
+#define kDMDFrameBuffers (3)
+#define kDMDMaxRows (255) // PRDMDConfig.numRows is a byte.
+#define kDMDMaxColumns (1024)
+#define kDMDFrameCycles (707) // deHighCycles per frame for the default subframe count; 60fps.
+
+typedef struct _PinPROCDMDOutput PinPROCDMDOutput; // See "Asynchronous DMD output" below.
+typedef struct _PinPROCEventPoller PinPROCEventPoller; // See "Background event polling" below.
+
 typedef struct {
     PyObject_HEAD
     /* Type-specific fields go here. */
 	PRHandle handle;
+	PyThread_type_lock handleLock; // Serializes calls on handle and use of the dmd* fields below; see PinPROC_lock().
 	PRMachineType machineType; // We save it here because there's no "get machine type" in libpinproc.
 	bool dmdConfigured;
+	DMDDimension dmdColumns, dmdRows; // Set by dmd_update_config(); frames drawn must be this size.
+	unsigned dmdSubFrames;
 	unsigned char dmdMapping[dmdMappingSize];
+	DMDPROCColorTable dmdColorTable; // dmdMapping combined with the mapping to dmdSubFrames subframes
+	DMDFrame *dmdEncodedFrame; // Frame whose subframes are cached in dmdDots; only its dirty rows are re-encoded.
+	DMDPackedFrame *dmdEncodedPackedFrame; // The same for a DMDPackedBuffer; at most one of the two is set.
+	size_t dmdDotsSize; // dmdSubFrames*dmdColumns*dmdRows/8
+	uint8_t *dmdDots;
+	bool dmdSentValid; // dmdSentDots holds the last frame sent to the P-ROC.
+	uint8_t *dmdSentDots;
+	PinPROCDMDOutput *dmdOutput; // Set while dmd_draw() hands frames to the output thread.
+	PinPROCEventPoller *eventPoller; // Set while get_events() drains events polled by a separate thread.
+	bool switchStatesValid; // switchStates holds what switch_get_changes() last saw.
+	uint8_t switchStates[kPRSwitchPhysicalLast + 1];
 } pinproc_PinPROCObject;
 
+static void PinPROC_dmd_invalidate_sent(pinproc_PinPROCObject *self);
+static void PinPROC_dmd_output_stop(pinproc_PinPROCObject *self);
+static bool PinPROC_dmd_output_start(pinproc_PinPROCObject *self);
+static void PinPROC_dmd_output_note_events(PinPROCDMDOutput *output, PREvent *events, int numEvents);
+static void PinPROC_events_poller_stop(pinproc_PinPROCObject *self);
+
+/* Calls on the handle are made with handleLock held so that the ones that wait on the
+ * USB transfer can release the GIL.  Waiting for the lock releases the GIL too, so the
+ * thread holding the lock can always get the GIL back. */
+static void
+PinPROC_lock(pinproc_PinPROCObject *self)
+{
+	if (!PyThread_acquire_lock(self->handleLock, NOWAIT_LOCK))
+	{
+		Py_BEGIN_ALLOW_THREADS
+		PyThread_acquire_lock(self->handleLock, WAIT_LOCK);
+		Py_END_ALLOW_THREADS
+	}
+}
+
+static void
+PinPROC_unlock(pinproc_PinPROCObject *self)
+{
+	PyThread_release_lock(self->handleLock);
+}
+
+#define kPinPROCErrorTextSize (256)
+
+/* Releases handleLock after a call that returned res, first copying libpinproc's error text
+ * into error (kPinPROCErrorTextSize bytes) if it failed: the text is replaced by the next call
+ * any thread makes once the lock is released. */
+static void
+PinPROC_unlock_result(pinproc_PinPROCObject *self, PRResult res, char *error)
+{
+	if (res != kPRSuccess)
+	{
+		strncpy(error, PRGetLastErrorText(), kPinPROCErrorTextSize - 1);
+		error[kPinPROCErrorTextSize - 1] = '\0';
+	}
+	PinPROC_unlock(self);
+}
+
 static PyObject *
 PinPROC_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
 {
@@ -28,10 +115,29 @@ PinPROC_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
     if (self != NULL) {
 		self->handle = kPRHandleInvalid;
 		self->dmdConfigured = false;
+		self->dmdColumns = kDMDColumns;
+		self->dmdRows = kDMDRows;
+		self->dmdSubFrames = kDMDSubFrames;
 		for (int i = 0; i < dmdMappingSize; i++)
 		{
 			self->dmdMapping[i] = i;
 		}
+		DMDPROCColorTableInitForSubframes(&self->dmdColorTable, self->dmdMapping, self->dmdSubFrames);
+		self->dmdEncodedFrame = NULL;
+		self->dmdEncodedPackedFrame = NULL;
+		self->dmdDotsSize = kDMDSubFrames*kDMDColumns*kDMDRows/8;
+		self->dmdDots = (uint8_t *)calloc(self->dmdDotsSize, 1);
+		self->dmdSentDots = (uint8_t *)calloc(self->dmdDotsSize, 1);
+		self->dmdSentValid = false;
+		self->dmdOutput = NULL;
+		self->eventPoller = NULL;
+		self->switchStatesValid = false;
+		self->handleLock = PyThread_allocate_lock();
+		if (self->handleLock == NULL || self->dmdDots == NULL || self->dmdSentDots == NULL)
+		{
+			Py_DECREF(self);
+			return PyErr_NoMemory();
+		}
     }
 
     return (PyObject *)self;
@@ -41,11 +147,19 @@ static void
 PinPROC_dealloc(PyObject* _self)
 {
 	pinproc_PinPROCObject *self = (pinproc_PinPROCObject *)_self;
+	if (self->dmdOutput != NULL)
+		PinPROC_dmd_output_stop(self);
+	if (self->eventPoller != NULL)
+		PinPROC_events_poller_stop(self);
 	if (self->handle != kPRHandleInvalid)
 	{
 		PRDelete(self->handle);
 		self->handle = kPRHandleInvalid;
 	}
+	if (self->handleLock != NULL)
+		PyThread_free_lock(self->handleLock);
+	free(self->dmdDots);
+	free(self->dmdSentDots);
     self->ob_type->tp_free((PyObject*)self);
 }
 
@@ -124,9 +238,17 @@ PinPROC_reset(pinproc_PinPROCObject *self, PyObject *args)
 	uint32_t resetFlags;
 	if (!PyArg_ParseTuple(args, "i", &resetFlags))
 		return NULL;
-	if (PRReset(self->handle, resetFlags) == kPRFailure)
+	PRResult res;
+	PinPROC_lock(self);
+	Py_BEGIN_ALLOW_THREADS
+	res = PRReset(self->handle, resetFlags);
+	Py_END_ALLOW_THREADS
+	PinPROC_dmd_invalidate_sent(self);
+	char error[kPinPROCErrorTextSize];
+	PinPROC_unlock_result(self, res, error);
+	if (res == kPRFailure)
 	{
-		PyErr_SetString(PyExc_IOError, PRGetLastErrorText());
+		PyErr_SetString(PyExc_IOError, error);
 		return NULL;
 	}
 	Py_INCREF(Py_None);
@@ -173,7 +295,9 @@ PinPROC_driver_update_global_config(pinproc_PinPROCObject *self, PyObject *args,
 	globals.watchdogResetTime = watchdogResetTime;
 
 	PRResult res;
+        PinPROC_lock(self);
         res = PRDriverUpdateGlobalConfig(self->handle, &globals);
+        PinPROC_unlock(self);
 
 	if (res == kPRSuccess)
 	{
@@ -219,7 +343,9 @@ PinPROC_driver_update_group_config(pinproc_PinPROCObject *self, PyObject *args,
         group.disableStrobeAfter = disableStrobeAfter == Py_True;
 
 	PRResult res;
+        PinPROC_lock(self);
         res = PRDriverUpdateGroupConfig(self->handle, &group);
+        PinPROC_unlock(self);
 
 	if (res == kPRSuccess)
 	{
@@ -244,7 +370,9 @@ PinPROC_driver_group_disable(pinproc_PinPROCObject *self, PyObject *args, PyObje
 	}
 	
 	PRResult res;
+	PinPROC_lock(self);
 	res = PRDriverGroupDisable(self->handle, number);
+	PinPROC_unlock(self);
 	if (res == kPRSuccess)
 	{
 		Py_INCREF(Py_None);
@@ -268,7 +396,9 @@ PinPROC_driver_pulse(pinproc_PinPROCObject *self, PyObject *args, PyObject *kwds
 	}
 	
 	PRResult res;
+	PinPROC_lock(self);
 	res = PRDriverPulse(self->handle, number, milliseconds);
+	PinPROC_unlock(self);
 	if (res == kPRSuccess)
 	{
 		Py_INCREF(Py_None);
@@ -292,7 +422,9 @@ PinPROC_driver_future_pulse(pinproc_PinPROCObject *self, PyObject *args, PyObjec
 	}
 	
 	PRResult res;
+	PinPROC_lock(self);
 	res = PRDriverFuturePulse(self->handle, number, milliseconds, futureTime);
+	PinPROC_unlock(self);
 	if (res == kPRSuccess)
 	{
 		Py_INCREF(Py_None);
@@ -318,7 +450,9 @@ PinPROC_driver_schedule(pinproc_PinPROCObject *self, PyObject *args, PyObject *k
 	}
 	
 	PRResult res;
+	PinPROC_lock(self);
 	res = PRDriverSchedule(self->handle, number, (uint32_t)schedule, cycleSeconds, now == Py_True);
+	PinPROC_unlock(self);
 	if (res == kPRSuccess)
 	{
 		Py_INCREF(Py_None);
@@ -341,7 +475,9 @@ PinPROC_driver_patter(pinproc_PinPROCObject *self, PyObject *args, PyObject *kwd
 		return NULL;
 	
 	PRResult res;
+	PinPROC_lock(self);
 	res = PRDriverPatter(self->handle, number, millisOn, millisOff, originalOnTime, now == Py_True);
+	PinPROC_unlock(self);
 	if (res == kPRSuccess)
 	{
 		Py_INCREF(Py_None);
@@ -364,7 +500,9 @@ PinPROC_driver_pulsed_patter(pinproc_PinPROCObject *self, PyObject *args, PyObje
 		return NULL;
 	
 	PRResult res;
+	PinPROC_lock(self);
 	res = PRDriverPulsedPatter(self->handle, number, millisOn, millisOff, millisPatterTime, now == Py_True);
+	PinPROC_unlock(self);
 	if (res == kPRSuccess)
 	{
 		Py_INCREF(Py_None);
@@ -388,7 +526,9 @@ PinPROC_driver_disable(pinproc_PinPROCObject *self, PyObject *args, PyObject *kw
 	}
 	
 	PRResult res;
+	PinPROC_lock(self);
 	res = PRDriverDisable(self->handle, number);
+	PinPROC_unlock(self);
 	if (res == kPRSuccess)
 	{
 		Py_INCREF(Py_None);
@@ -485,7 +625,9 @@ PinPROC_driver_get_state(pinproc_PinPROCObject *self, PyObject *args, PyObject *
 	
 	PRResult res;
 	PRDriverState driver;
+	PinPROC_lock(self);
 	res = PRDriverGetState(self->handle, number, &driver);
+	PinPROC_unlock(self);
 	if (res == kPRSuccess)
 	{
 		return PyDictFromDriverState(&driver);
@@ -511,7 +653,10 @@ PinPROC_driver_update_state(pinproc_PinPROCObject *self, PyObject *args, PyObjec
 	if (!PyDictToDriverState(dict, &driver))
 		return NULL;
 
-	if (PRDriverUpdateState(self->handle, &driver) == kPRSuccess)
+	PinPROC_lock(self);
+	PRResult res = PRDriverUpdateState(self->handle, &driver);
+	PinPROC_unlock(self);
+	if (res == kPRSuccess)
 	{
 		Py_INCREF(Py_None);
 		return Py_None;
@@ -524,25 +669,110 @@ PinPROC_driver_update_state(pinproc_PinPROCObject *self, PyObject *args, PyObjec
 }
 
 
-static PyObject *
-PinPROC_switch_get_states(pinproc_PinPROCObject *self, PyObject *args)
-{
-	const int numSwitches = kPRSwitchPhysicalLast + 1;
-	PyObject *list = PyList_New(numSwitches);
-	PREventType procSwitchStates[numSwitches];
-    // Get all of the switch states from the P-ROC.
-    if (PRSwitchGetStates(self->handle, procSwitchStates, numSwitches) == kPRFailure)
-    {
+#define kSwitchStatesCount (kPRSwitchPhysicalLast + 1)
+#define kSwitchStateBytes ((kSwitchStatesCount + 7) / 8) // One bit per switch in each half of switch_get_states(packed=True).
+
+// Gets all of the switch states from the P-ROC.  Returns false with an exception set on failure.
+static bool
+PinPROC_fetch_switch_states(pinproc_PinPROCObject *self, PREventType *states)
+{
+	PRResult res;
+	PinPROC_lock(self);
+	Py_BEGIN_ALLOW_THREADS
+	res = PRSwitchGetStates(self->handle, states, kSwitchStatesCount);
+	Py_END_ALLOW_THREADS
+	PinPROC_unlock(self);
+	if (res == kPRFailure)
+	{
 		PyErr_SetString(PyExc_IOError, "Error getting driver state");
+		return false;
+	}
+	return true;
+}
+
+static PyObject *
+PinPROC_switch_get_states(pinproc_PinPROCObject *self, PyObject *args, PyObject *kwds)
+{
+	PyObject *packedObj = Py_False;
+	static char *kwlist[] = {"packed", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O", kwlist, &packedObj))
 		return NULL;
+	int packed = PyObject_IsTrue(packedObj);
+	if (packed < 0)
+		return NULL;
+	
+	PREventType procSwitchStates[kSwitchStatesCount];
+	if (!PinPROC_fetch_switch_states(self, procSwitchStates))
+		return NULL;
+	
+	if (packed)
+	{
+		// Closed bits for every switch, then debounced bits, least significant bit first.
+		uint8_t bits[2 * kSwitchStateBytes];
+		memset(bits, 0, sizeof(bits));
+		for (int i = 0; i < kSwitchStatesCount; i++)
+		{
+			PREventType state = procSwitchStates[i];
+			if (state == kPREventTypeSwitchClosedDebounced || state == kPREventTypeSwitchClosedNondebounced)
+				bits[i / 8] |= 1 << (i % 8);
+			if (state == kPREventTypeSwitchClosedDebounced || state == kPREventTypeSwitchOpenDebounced)
+				bits[kSwitchStateBytes + i / 8] |= 1 << (i % 8);
+		}
+		return PyString_FromStringAndSize((const char *)bits, sizeof(bits));
 	}
 	
-	for (int i = 0; i < numSwitches; i++)
-		PyList_SetItem(list, i, Py_BuildValue("i", procSwitchStates[i]));
+	PyObject *list = PyList_New(kSwitchStatesCount);
+	if (list == NULL)
+		return NULL;
+	for (int i = 0; i < kSwitchStatesCount; i++)
+	{
+		PyObject *state = PyInt_FromLong(procSwitchStates[i]);
+		if (state == NULL)
+		{
+			Py_DECREF(list);
+			return NULL;
+		}
+		PyList_SET_ITEM(list, i, state);
+	}
     
 	return list;
 }	
 
+/* Returns (number, state) for each switch whose state differs from the last call, or
+ * every switch on the first call.  The comparison is a memcmp() in the common case that
+ * nothing has changed, so checking every frame costs next to nothing. */
+static PyObject *
+PinPROC_switch_get_changes(pinproc_PinPROCObject *self, PyObject *args)
+{
+	PREventType procSwitchStates[kSwitchStatesCount];
+	if (!PinPROC_fetch_switch_states(self, procSwitchStates))
+		return NULL;
+	
+	uint8_t states[kSwitchStatesCount];
+	for (int i = 0; i < kSwitchStatesCount; i++)
+		states[i] = (uint8_t)procSwitchStates[i];
+	
+	PyObject *list = PyList_New(0);
+	if (list == NULL || (self->switchStatesValid && memcmp(states, self->switchStates, sizeof(states)) == 0))
+		return list;
+	for (int i = 0; i < kSwitchStatesCount; i++)
+	{
+		if (self->switchStatesValid && states[i] == self->switchStates[i])
+			continue;
+		PyObject *change = Py_BuildValue("(ii)", i, (int)states[i]);
+		if (change == NULL || PyList_Append(list, change) < 0)
+		{
+			Py_XDECREF(change);
+			Py_DECREF(list);
+			return NULL;
+		}
+		Py_DECREF(change);
+	}
+	memcpy(self->switchStates, states, sizeof(states));
+	self->switchStatesValid = true;
+	return list;
+}
+
 
 static PyObject *
 PinPROC_switch_update_rule(pinproc_PinPROCObject *self, PyObject *args, PyObject *kwds)
@@ -598,7 +828,9 @@ PinPROC_switch_update_rule(pinproc_PinPROCObject *self, PyObject *args, PyObject
             switchConfig.inactivePulsesAfterBurst = 12;
             switchConfig.pulsesPerBurst = 6;
             switchConfig.pulseHalfPeriodTime = 13; // milliseconds
+            PinPROC_lock(self);
             PRSwitchUpdateConfig(self->handle, &switchConfig);
+            PinPROC_unlock(self);
         }
 
 	if (numDrivers > 0)
@@ -614,7 +846,11 @@ PinPROC_switch_update_rule(pinproc_PinPROCObject *self, PyObject *args, PyObject
 		}
 	}
 
-	if (PRSwitchUpdateRule(self->handle, number, eventType, &rule, drivers, numDrivers, drive_outputs_now == Py_True) == kPRSuccess)
+	PinPROC_lock(self);
+	PRResult res = PRSwitchUpdateRule(self->handle, number, eventType, &rule, drivers, numDrivers, drive_outputs_now == Py_True);
+	char error[kPinPROCErrorTextSize];
+	PinPROC_unlock_result(self, res, error);
+	if (res == kPRSuccess)
 	{
 		if (drivers)
 			free(drivers);
@@ -625,7 +861,7 @@ PinPROC_switch_update_rule(pinproc_PinPROCObject *self, PyObject *args, PyObject
 	{
 		if (drivers)
 			free(drivers);
-		PyErr_SetString(PyExc_IOError, PRGetLastErrorText()); //"Error updating switch rule");
+		PyErr_SetString(PyExc_IOError, error); //"Error updating switch rule");
 		return NULL;
 	}
 }
@@ -676,7 +912,11 @@ PinPROC_aux_send_commands(pinproc_PinPROCObject *self, PyObject *args, PyObject
 
 	fprintf(stderr, "\n\nSending Aux Commands: numCommands:%d, addr:%d\n\n", numCommands, address);
 	
-	if (PRDriverAuxSendCommands(self->handle, commands, numCommands, address) == kPRSuccess)
+	PinPROC_lock(self);
+	PRResult res = PRDriverAuxSendCommands(self->handle, commands, numCommands, address);
+	char error[kPinPROCErrorTextSize];
+	PinPROC_unlock_result(self, res, error);
+	if (res == kPRSuccess)
 	{
 		if (commands)
 			free(commands);
@@ -687,7 +927,7 @@ PinPROC_aux_send_commands(pinproc_PinPROCObject *self, PyObject *args, PyObject
 	{
 		if (commands)
 			free(commands);
-		PyErr_SetString(PyExc_IOError, PRGetLastErrorText()); //"Error sending aux commands");
+		PyErr_SetString(PyExc_IOError, error); //"Error sending aux commands");
 		return NULL;
 	}
 }
@@ -705,20 +945,24 @@ PinPROC_write_data(pinproc_PinPROCObject *self, PyObject *args, PyObject *kwds)
 	}
 
 	// Always flush previously staged writes first.
-	if (PRFlushWriteData(self->handle) != kPRSuccess)
-	{
-		PyErr_SetString(PyExc_IOError, PRGetLastErrorText()); //"Error writing data");
-		return NULL;
-	}
-		
-	if (PRWriteData(self->handle, module, address, 1, (uint32_t *)&data) == kPRSuccess)
+	PRResult res;
+	PinPROC_lock(self);
+	Py_BEGIN_ALLOW_THREADS
+	res = PRFlushWriteData(self->handle);
+	if (res == kPRSuccess)
+		res = PRWriteData(self->handle, module, address, 1, (uint32_t *)&data);
+	Py_END_ALLOW_THREADS
+	char error[kPinPROCErrorTextSize];
+	PinPROC_unlock_result(self, res, error);
+	
+	if (res == kPRSuccess)
 	{
 		Py_INCREF(Py_None);
 		return Py_None;
 	}
 	else
 	{
-		PyErr_SetString(PyExc_IOError, PRGetLastErrorText()); //"Error writing data");
+		PyErr_SetString(PyExc_IOError, error); //"Error writing data");
 		return NULL;
 	}
 }
@@ -726,41 +970,643 @@ PinPROC_write_data(pinproc_PinPROCObject *self, PyObject *args, PyObject *kwds)
 static PyObject *
 PinPROC_watchdog_tickle(pinproc_PinPROCObject *self, PyObject *args)
 {
+	PinPROC_lock(self);
 	PRDriverWatchdogTickle(self->handle);
+	PinPROC_unlock(self);
 	Py_INCREF(Py_None);
 	return Py_None;
 }
 
+//#define kEventsMax (16)
+#define kEventsMax (2048)
+
+/* get_events_into() writes each event as three native uint32s: type, value and time. */
+#define kEventRecordSize (3 * sizeof(uint32_t))
+
+// Nanoseconds on a monotonic clock; what events are stamped with when they're fetched.
+static uint64_t
+PinPROC_host_time()
+{
+#if defined(_WIN32)
+	LARGE_INTEGER counter, frequency;
+	QueryPerformanceCounter(&counter);
+	QueryPerformanceFrequency(&frequency);
+	return (uint64_t)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+#endif
+}
+
+#if !defined(_WIN32)
+/* Starts a background thread with every signal blocked, so that signals such as SIGINT go to a
+ * thread running Python, which can act on them, rather than to one that never looks. */
+static int
+PinPROC_thread_create(pthread_t *thread, void *(*main)(void *), void *arg)
+{
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	int res = pthread_create(thread, NULL, main, arg);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	return res;
+}
+#endif
+
+/* Background event polling
+ *
+ * With events_set_async(True), a thread calls PRGetEvents() in a loop and stamps each
+ * event with PinPROC_host_time() as it arrives, so switch latency no longer depends on
+ * how often Python gets round to calling get_events().  Events go through a single
+ * producer, single consumer ring: the poller only writes head and the draining side,
+ * always with the GIL held, only writes tail, so neither ever waits for the other.
+ * If the ring is full the newest events are dropped and counted in overflowed.
+ *
+ * The poller takes handleLock for each PRGetEvents() call, like the DMD output thread,
+ * and sleeps for the poll interval between calls that return nothing.
+ *
+ * events_fileno() is readable whenever the ring holds events (or the poller has failed),
+ * so select() and asyncio can sleep until a switch changes; wait_events() does the same
+ * with the GIL released.  It's an eventfd on Linux and a pipe elsewhere.  The poller
+ * signals it when it pushes events and it isn't already signalled; the draining side
+ * clears it once the ring is empty, then checks again in case events came in meanwhile.
+ */
+
+#define kEventRingSize (4096) // A power of two.
+#define kEventPollInterval (250) // us
+
+typedef struct {
+	PREvent event;
+	uint64_t hostTime;
+} PinPROCPolledEvent;
+
+#if PINPROC_HAVE_EVENT_POLLER
+
+struct _PinPROCEventPoller {
+	pinproc_PinPROCObject *owner; // Not a reference; dealloc stops the thread first.
+	PinPROCPolledEvent ring[kEventRingSize];
+	unsigned head; // Events pushed; only written by the poller.
+	unsigned tail; // Events drained; only written by the draining side.
+	unsigned interval; // us to sleep after a poll that found nothing; events_set_async() may change it at any time.
+	pthread_t thread;
+	volatile int stop;
+	unsigned long long polls, received, overflowed; // Only written by the poller.
+	volatile int failed; // Set by the poller once error is written; cleared by the draining side.
+	char error[256];
+	int readFD, writeFD; // The same eventfd, or the two ends of a pipe.
+	int signalled; // Set while writeFD has been written to and not cleared since.
+	int refs; // The owner's, plus one per wait_events() sleeping on readFD; only changed with the GIL.
+};
+
+static void
+PinPROC_events_poller_signal(PinPROCEventPoller *poller)
+{
+	if (__atomic_exchange_n(&poller->signalled, 1, __ATOMIC_SEQ_CST))
+		return;
+#if defined(__linux__)
+	uint64_t one = 1;
+	ssize_t written = write(poller->writeFD, &one, sizeof(one));
+#else
+	char one = 1;
+	ssize_t written = write(poller->writeFD, &one, sizeof(one));
+#endif
+	(void)written; // Only fails if it's full, in which case it's readable anyway.
+}
+
+// Called by the draining side once the ring is empty.
+static void
+PinPROC_events_poller_clear(PinPROCEventPoller *poller)
+{
+	if (!__atomic_load_n(&poller->signalled, __ATOMIC_SEQ_CST))
+		return;
+	char drain[64];
+	while (read(poller->readFD, drain, sizeof(drain)) > 0)
+		;
+	__atomic_store_n(&poller->signalled, 0, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&poller->head, __ATOMIC_SEQ_CST) != poller->tail || __atomic_load_n(&poller->failed, __ATOMIC_SEQ_CST))
+		PinPROC_events_poller_signal(poller);
+}
+
+static bool
+PinPROC_events_poller_open_fds(PinPROCEventPoller *poller)
+{
+#if defined(__linux__)
+	poller->readFD = poller->writeFD = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	return poller->readFD >= 0;
+#else
+	int fds[2];
+	if (pipe(fds) != 0)
+		return false;
+	for (int i = 0; i < 2; i++)
+	{
+		fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+		fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+	}
+	poller->readFD = fds[0];
+	poller->writeFD = fds[1];
+	return true;
+#endif
+}
+
+static void
+PinPROC_events_poller_release(PinPROCEventPoller *poller)
+{
+	if (--poller->refs > 0)
+		return;
+	close(poller->readFD);
+	if (poller->writeFD != poller->readFD)
+		close(poller->writeFD);
+	free(poller);
+}
+
+static void *
+PinPROC_events_poller_main(void *arg)
+{
+	PinPROCEventPoller *poller = (PinPROCEventPoller *)arg;
+	pinproc_PinPROCObject *self = poller->owner;
+	PREvent events[kEventsMax];
+	while (!__atomic_load_n(&poller->stop, __ATOMIC_ACQUIRE))
+	{
+		PyThread_acquire_lock(self->handleLock, WAIT_LOCK);
+		int numEvents = PRGetEvents(self->handle, events, kEventsMax);
+		if (numEvents < 0 && !__atomic_load_n(&poller->failed, __ATOMIC_ACQUIRE))
+		{
+			strncpy(poller->error, PRGetLastErrorText(), sizeof(poller->error) - 1);
+			poller->error[sizeof(poller->error) - 1] = '\0';
+			__atomic_store_n(&poller->failed, 1, __ATOMIC_SEQ_CST);
+			PinPROC_events_poller_signal(poller);
+		}
+		PyThread_release_lock(self->handleLock);
+		__atomic_store_n(&poller->polls, poller->polls + 1, __ATOMIC_RELAXED);
+		
+		if (numEvents > 0)
+		{
+			uint64_t hostTime = PinPROC_host_time();
+			unsigned head = poller->head;
+			unsigned space = kEventRingSize - (head - __atomic_load_n(&poller->tail, __ATOMIC_ACQUIRE));
+			unsigned count = (unsigned)numEvents < space ? (unsigned)numEvents : space;
+			for (unsigned i = 0; i < count; i++)
+			{
+				PinPROCPolledEvent *slot = &poller->ring[(head + i) & (kEventRingSize - 1)];
+				slot->event = events[i];
+				slot->hostTime = hostTime;
+			}
+			__atomic_store_n(&poller->head, head + count, __ATOMIC_SEQ_CST);
+			__atomic_store_n(&poller->received, poller->received + count, __ATOMIC_RELAXED);
+			if (count > 0)
+				PinPROC_events_poller_signal(poller);
+			if (count < (unsigned)numEvents)
+				__atomic_store_n(&poller->overflowed, poller->overflowed + (numEvents - count), __ATOMIC_RELAXED);
+		}
+		else
+		{
+			unsigned interval = __atomic_load_n(&poller->interval, __ATOMIC_RELAXED);
+			if (interval > 0)
+			{
+				struct timespec delay;
+				delay.tv_sec = interval / 1000000;
+				delay.tv_nsec = (long)(interval % 1000000) * 1000;
+				nanosleep(&delay, NULL);
+			}
+		}
+	}
+	return NULL;
+}
+
+static bool
+PinPROC_events_poller_start(pinproc_PinPROCObject *self, unsigned interval)
+{
+	PinPROCEventPoller *poller = (PinPROCEventPoller *)calloc(1, sizeof(PinPROCEventPoller));
+	if (poller == NULL)
+	{
+		PyErr_NoMemory();
+		return false;
+	}
+	poller->owner = self;
+	poller->interval = interval;
+	poller->refs = 1;
+	if (!PinPROC_events_poller_open_fds(poller))
+	{
+		free(poller);
+		PyErr_SetFromErrno(PyExc_OSError);
+		return false;
+	}
+	if (PinPROC_thread_create(&poller->thread, PinPROC_events_poller_main, poller) != 0)
+	{
+		PinPROC_events_poller_release(poller);
+		PyErr_SetString(PyExc_OSError, "Couldn't start the event polling thread");
+		return false;
+	}
+	self->eventPoller = poller;
+	return true;
+}
+
+// Stops the poller; events it has polled but get_events() hasn't returned are lost.
+static void
+PinPROC_events_poller_stop(pinproc_PinPROCObject *self)
+{
+	PinPROCEventPoller *poller = self->eventPoller;
+	self->eventPoller = NULL;
+	__atomic_store_n(&poller->stop, 1, __ATOMIC_RELEASE);
+	// The thread may be waiting for handleLock, which a thread waiting for the GIL could hold.
+	Py_BEGIN_ALLOW_THREADS
+	pthread_join(poller->thread, NULL);
+	Py_END_ALLOW_THREADS
+	// Wake any wait_events(); the last of them closes the fd.
+	PinPROC_events_poller_signal(poller);
+	PinPROC_events_poller_release(poller);
+}
+
+/* Takes up to maxEvents events from the ring.  Returns -1 with an exception set if the
+ * poller has failed since the last call; the events it got before that come next time. */
+static int
+PinPROC_events_poller_drain(PinPROCEventPoller *poller, PREvent *events, uint64_t *hostTimes, int maxEvents)
+{
+	if (__atomic_load_n(&poller->failed, __ATOMIC_ACQUIRE))
+	{
+		PyErr_SetString(PyExc_IOError, poller->error);
+		__atomic_store_n(&poller->failed, 0, __ATOMIC_RELEASE);
+		return -1;
+	}
+	unsigned tail = poller->tail;
+	unsigned available = __atomic_load_n(&poller->head, __ATOMIC_ACQUIRE) - tail;
+	unsigned count = available < (unsigned)maxEvents ? available : (unsigned)maxEvents;
+	for (unsigned i = 0; i < count; i++)
+	{
+		const PinPROCPolledEvent *slot = &poller->ring[(tail + i) & (kEventRingSize - 1)];
+		events[i] = slot->event;
+		if (hostTimes != NULL)
+			hostTimes[i] = slot->hostTime;
+	}
+	__atomic_store_n(&poller->tail, tail + count, __ATOMIC_RELEASE);
+	if (count == available)
+		PinPROC_events_poller_clear(poller);
+	return (int)count;
+}
+
+static bool
+PinPROC_events_poller_ready(PinPROCEventPoller *poller)
+{
+	return __atomic_load_n(&poller->head, __ATOMIC_ACQUIRE) != poller->tail || __atomic_load_n(&poller->failed, __ATOMIC_ACQUIRE);
+}
+
+/* Sleeps until the poller has events or a failure to report, or timeout ms pass (forever
+ * if negative).  Returns whether there's anything for get_events(). */
 static PyObject *
-PinPROC_get_events(pinproc_PinPROCObject *self, PyObject *args)
+PinPROC_events_poller_wait(PinPROCEventPoller *poller, int timeout)
 {
-	PyObject *list = PyList_New(0);
+	if (PinPROC_events_poller_ready(poller))
+		Py_RETURN_TRUE;
+	struct pollfd fd = {poller->readFD, POLLIN, 0};
+	int res, pollErrno = 0;
+	uint64_t deadline = timeout > 0 ? PinPROC_host_time() + (uint64_t)timeout * 1000000 : 0;
+	poller->refs++;
+	for (;;)
+	{
+		Py_BEGIN_ALLOW_THREADS
+		res = poll(&fd, 1, timeout);
+		if (res < 0)
+			pollErrno = errno;
+		Py_END_ALLOW_THREADS
+		if (res >= 0 || pollErrno != EINTR)
+			break;
+		// Run the handlers of any signal that interrupted the wait, so that Ctrl-C stops it.
+		if (PyErr_CheckSignals() < 0)
+		{
+			PinPROC_events_poller_release(poller);
+			return NULL;
+		}
+		if (timeout > 0)
+		{
+			uint64_t now = PinPROC_host_time();
+			timeout = now >= deadline ? 0 : (int)((deadline - now + 999999) / 1000000);
+		}
+	}
+	bool stopped = __atomic_load_n(&poller->stop, __ATOMIC_ACQUIRE);
+	bool ready = !stopped && PinPROC_events_poller_ready(poller);
+	PinPROC_events_poller_release(poller);
+	if (res < 0)
+	{
+		errno = pollErrno;
+		return PyErr_SetFromErrno(PyExc_OSError);
+	}
+	return PyBool_FromLong(ready);
+}
+
+static int
+PinPROC_events_poller_fileno(PinPROCEventPoller *poller)
+{
+	return poller->readFD;
+}
+
+static void
+PinPROC_events_poller_set_interval(PinPROCEventPoller *poller, unsigned interval)
+{
+	__atomic_store_n(&poller->interval, interval, __ATOMIC_RELAXED);
+}
+
+static PyObject *
+PinPROC_events_poller_stats(PinPROCEventPoller *poller)
+{
+	unsigned pending = __atomic_load_n(&poller->head, __ATOMIC_ACQUIRE) - poller->tail;
+	return Py_BuildValue("{s:K,s:K,s:K,s:I}",
+		"polls", (unsigned long long)__atomic_load_n(&poller->polls, __ATOMIC_RELAXED),
+		"received", (unsigned long long)__atomic_load_n(&poller->received, __ATOMIC_RELAXED),
+		"overflowed", (unsigned long long)__atomic_load_n(&poller->overflowed, __ATOMIC_RELAXED),
+		"pending", pending);
+}
+
+#else
+
+// No poller on this platform; eventPoller is never set.
+static bool
+PinPROC_events_poller_start(pinproc_PinPROCObject *self, unsigned interval)
+{
+	PyErr_SetString(PyExc_NotImplementedError, "Background event polling isn't supported on this platform");
+	return false;
+}
+
+static void PinPROC_events_poller_stop(pinproc_PinPROCObject *self) { }
+static void PinPROC_events_poller_set_interval(PinPROCEventPoller *poller, unsigned interval) { }
+static int PinPROC_events_poller_drain(PinPROCEventPoller *poller, PREvent *events, uint64_t *hostTimes, int maxEvents) { return -1; }
+static PyObject *PinPROC_events_poller_stats(PinPROCEventPoller *poller) { return NULL; }
+static PyObject *PinPROC_events_poller_wait(PinPROCEventPoller *poller, int timeout) { return NULL; }
+static int PinPROC_events_poller_fileno(PinPROCEventPoller *poller) { return -1; }
+
+#endif /* PINPROC_HAVE_EVENT_POLLER */
+
+static PyObject *
+PinPROC_events_set_async(pinproc_PinPROCObject *self, PyObject *args, PyObject *kwds)
+{
+	PyObject *enabledObj;
+	unsigned int interval = kEventPollInterval;
+	static char *kwlist[] = {"enabled", "interval", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|I", kwlist, &enabledObj, &interval))
+		return NULL;
+	int enabled = PyObject_IsTrue(enabledObj);
+	if (enabled < 0)
+		return NULL;
 	
-	//const int maxEvents = 16;
-	const int maxEvents = 2048;
-	PREvent events[maxEvents];
-	int numEvents = PRGetEvents(self->handle, events, maxEvents);
-	if (numEvents < 0)
+	// A running poller only picks up the new interval; events it has queued stay put.
+	if (enabled && self->eventPoller != NULL)
+		PinPROC_events_poller_set_interval(self->eventPoller, interval);
+	else if (!enabled && self->eventPoller != NULL)
+		PinPROC_events_poller_stop(self);
+	else if (enabled && !PinPROC_events_poller_start(self, interval))
+		return NULL;
+	
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject *
+PinPROC_events_async_stats(pinproc_PinPROCObject *self, PyObject *args)
+{
+	if (self->eventPoller == NULL)
 	{
-		PyErr_SetString(PyExc_IOError, PRGetLastErrorText());
+		Py_INCREF(Py_None);
+		return Py_None;
+	}
+	return PinPROC_events_poller_stats(self->eventPoller);
+}
+
+static bool
+PinPROC_events_check_async(pinproc_PinPROCObject *self)
+{
+	if (self->eventPoller != NULL)
+		return true;
+	PyErr_SetString(PyExc_RuntimeError, "Event polling isn't running; call events_set_async(True) first");
+	return false;
+}
+
+static PyObject *
+PinPROC_events_fileno(pinproc_PinPROCObject *self, PyObject *args)
+{
+	if (!PinPROC_events_check_async(self))
+		return NULL;
+	return PyInt_FromLong(PinPROC_events_poller_fileno(self->eventPoller));
+}
+
+static PyObject *
+PinPROC_wait_events(pinproc_PinPROCObject *self, PyObject *args, PyObject *kwds)
+{
+	PyObject *timeoutObj = Py_None;
+	static char *kwlist[] = {"timeout", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O", kwlist, &timeoutObj))
+		return NULL;
+	int timeout = -1;
+	if (timeoutObj != Py_None)
+	{
+		double seconds = PyFloat_AsDouble(timeoutObj);
+		if (seconds == -1.0 && PyErr_Occurred())
+			return NULL;
+		if (seconds != seconds)
+		{
+			PyErr_SetString(PyExc_ValueError, "timeout must not be NaN");
+			return NULL;
+		}
+		// Round up, so a short timeout doesn't become a busy poll; poll() takes at most INT_MAX ms.
+		double ms = seconds * 1000 + 0.999;
+		timeout = seconds <= 0 ? 0 : ms >= INT_MAX ? INT_MAX : (int)ms;
+	}
+	if (!PinPROC_events_check_async(self))
 		return NULL;
+	return PinPROC_events_poller_wait(self->eventPoller, timeout);
+}
+
+static PyTypeObject pinproc_EventType;
+
+static PyStructSequence_Field pinproc_EventFields[] = {
+	{"type", "Event type, one of the EventType* constants"},
+	{"value", "Switch number, or the event's value"},
+	{"time", "P-ROC timestamp"},
+	{"host_time", "host_time() when the event was fetched from the P-ROC"},
+	{NULL}
+};
+
+static PyStructSequence_Desc pinproc_EventDesc = {
+	"pinproc.Event",
+	"An event from get_events(tuples=True): (type, value, time), plus host_time by name.",
+	pinproc_EventFields,
+	3
+};
+
+/* Fetches up to maxEvents events, from the poller if there is one and otherwise from the
+ * P-ROC, along with their host times if hostTimes isn't NULL.  Returns -1 with an
+ * exception set on failure. */
+static int
+PinPROC_fetch_events(pinproc_PinPROCObject *self, PREvent *events, uint64_t *hostTimes, int maxEvents)
+{
+	int numEvents;
+	if (self->eventPoller != NULL)
+	{
+		numEvents = PinPROC_events_poller_drain(self->eventPoller, events, hostTimes, maxEvents);
+		if (numEvents < 0)
+			return -1;
+	}
+	else
+	{
+		PinPROC_lock(self);
+		Py_BEGIN_ALLOW_THREADS
+		numEvents = PRGetEvents(self->handle, events, maxEvents);
+		Py_END_ALLOW_THREADS
+		char error[kPinPROCErrorTextSize];
+		PinPROC_unlock_result(self, numEvents < 0 ? kPRFailure : kPRSuccess, error);
+		if (numEvents < 0)
+		{
+			PyErr_SetString(PyExc_IOError, error);
+			return -1;
+		}
+		if (hostTimes != NULL && numEvents > 0)
+		{
+			uint64_t hostTime = PinPROC_host_time();
+			for (int i = 0; i < numEvents; i++)
+				hostTimes[i] = hostTime;
+		}
 	}
+	if (self->dmdOutput != NULL)
+		PinPROC_dmd_output_note_events(self->dmdOutput, events, numEvents);
+	return numEvents;
+}
+
+static PyObject *
+PinPROC_event_dict(const PREvent *event, uint64_t hostTime)
+{
+	return Py_BuildValue("{s:i,s:i,s:i,s:K}", "type", (int)event->type, "value", (int)event->value, "time", (int)event->time,
+		"host_time", (unsigned long long)hostTime);
+}
+
+static PyObject *
+PinPROC_event_tuple(const PREvent *event, uint64_t hostTime)
+{
+	PyObject *tuple = PyStructSequence_New(&pinproc_EventType);
+	if (tuple == NULL)
+		return NULL;
+	PyObject *items[] = {PyInt_FromLong(event->type), PyInt_FromLong(event->value), PyInt_FromLong(event->time),
+		PyLong_FromUnsignedLongLong(hostTime)};
+	// Unfilled items are NULL, which the struct sequence's dealloc allows for.
+	bool failed = false;
+	for (int i = 0; i < 4; i++)
+	{
+		failed |= items[i] == NULL;
+		PyStructSequence_SET_ITEM(tuple, i, items[i]);
+	}
+	if (failed)
+		Py_CLEAR(tuple);
+	return tuple;
+}
+
+static PyObject *
+PinPROC_get_events(pinproc_PinPROCObject *self, PyObject *args, PyObject *kwds)
+{
+	PyObject *tuplesObj = Py_False;
+	static char *kwlist[] = {"tuples", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O", kwlist, &tuplesObj))
+		return NULL;
+	int tuples = PyObject_IsTrue(tuplesObj);
+	if (tuples < 0)
+		return NULL;
+	
+	PREvent events[kEventsMax];
+	uint64_t hostTimes[kEventsMax];
+	int numEvents = PinPROC_fetch_events(self, events, hostTimes, kEventsMax);
+	if (numEvents < 0)
+		return NULL;
+	PyObject *list = PyList_New(numEvents);
+	if (list == NULL)
+		return NULL;
 	for (int i = 0; i < numEvents; i++)
 	{
-		PyObject *dict = PyDict_New();
-		PyDict_SetItemString(dict, "type", Py_BuildValue("i", events[i].type));
-		PyDict_SetItemString(dict, "value", Py_BuildValue("i", events[i].value));
-		PyDict_SetItemString(dict, "time", Py_BuildValue("i", events[i].time));
-		PyList_Append(list, dict);
+		PyObject *event = tuples ? PinPROC_event_tuple(&events[i], hostTimes[i]) : PinPROC_event_dict(&events[i], hostTimes[i]);
+		if (event == NULL)
+		{
+			Py_DECREF(list);
+			return NULL;
+		}
+		PyList_SET_ITEM(list, i, event);
 	}
 	return list;
 }
 
+/* Writes as many events as fit into a writable buffer as kEventRecordSize records and
+ * returns how many; events that don't fit are left for the next call.  Nothing is
+ * allocated, so the caller can reuse one bytearray (or numpy array) every time.
+ * Objects with only the old buffer protocol (array.array, mmap) aren't pinned while
+ * the GIL is released for the fetch, so their pointer is looked up again afterwards. */
+static PyObject *
+PinPROC_get_events_into(pinproc_PinPROCObject *self, PyObject *args, PyObject *kwds)
+{
+	PyObject *bufferObj;
+	static char *kwlist[] = {"buffer", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O", kwlist, &bufferObj))
+		return NULL;
+	
+	Py_buffer view;
+	bool haveView = false;
+	void *data;
+	Py_ssize_t dataLen;
+	if (PyObject_CheckBuffer(bufferObj))
+	{
+		if (PyObject_GetBuffer(bufferObj, &view, PyBUF_WRITABLE | PyBUF_C_CONTIGUOUS) < 0)
+			return NULL;
+		haveView = true;
+		data = view.buf;
+		dataLen = view.len;
+	}
+	else if (PyObject_AsWriteBuffer(bufferObj, &data, &dataLen) < 0)
+	{
+		return NULL;
+	}
+	
+	Py_ssize_t capacity = dataLen / kEventRecordSize;
+	if (capacity == 0)
+	{
+		if (haveView)
+			PyBuffer_Release(&view);
+		PyErr_SetString(PyExc_ValueError, "Buffer is too small for an event record");
+		return NULL;
+	}
+	
+	PREvent events[kEventsMax];
+	int numEvents = PinPROC_fetch_events(self, events, NULL, capacity < kEventsMax ? (int)capacity : kEventsMax);
+	if (numEvents > 0 && !haveView)
+	{
+		if (PyObject_AsWriteBuffer(bufferObj, &data, &dataLen) < 0)
+			return NULL;
+		if (dataLen / (Py_ssize_t)kEventRecordSize < numEvents)
+		{
+			PyErr_SetString(PyExc_BufferError, "Buffer shrank while events were being fetched");
+			return NULL;
+		}
+	}
+	if (numEvents > 0)
+	{
+		uint32_t *record = (uint32_t *)data;
+		for (int i = 0; i < numEvents; i++, record += 3)
+		{
+			uint32_t packed[3] = {(uint32_t)events[i].type, events[i].value, events[i].time};
+			memcpy(record, packed, sizeof(packed)); // The buffer needn't be aligned.
+		}
+	}
+	if (haveView)
+		PyBuffer_Release(&view);
+	if (numEvents < 0)
+		return NULL;
+	return PyInt_FromLong(numEvents);
+}
+
 static PyObject *
 PinPROC_flush(pinproc_PinPROCObject *self, PyObject *args)
 {
-	PRResult res = PRFlushWriteData(self->handle);
-	ReturnOnErrorAndSetIOError(res);
+	PRResult res;
+	PinPROC_lock(self);
+	Py_BEGIN_ALLOW_THREADS
+	res = PRFlushWriteData(self->handle);
+	Py_END_ALLOW_THREADS
+	char error[kPinPROCErrorTextSize];
+	PinPROC_unlock_result(self, res, error);
+	ReturnOnErrorAndSetIOError(res, error);
 	Py_INCREF(Py_None);
 	return Py_None;
 }
@@ -777,7 +1623,9 @@ PinPROC_led_fade_rate(pinproc_PinPROCObject *self, PyObject *args, PyObject *kwd
 	}
 	
 	PRResult res;
+	PinPROC_lock(self);
 	res = PRLEDFadeRate(self->handle, boardAddr, fadeRate);
+	PinPROC_unlock(self);
 	if (res == kPRSuccess)
 	{
 		Py_INCREF(Py_None);
@@ -807,7 +1655,9 @@ PinPROC_led_color(pinproc_PinPROCObject *self, PyObject *args, PyObject *kwds)
 	LED.LEDIndex = LEDIndex;
 	
 	PRResult res;
+	PinPROC_lock(self);
 	res = PRLEDColor(self->handle, &LED, color);
+	PinPROC_unlock(self);
 	if (res == kPRSuccess)
 	{
 		Py_INCREF(Py_None);
@@ -838,7 +1688,9 @@ PinPROC_led_fade(pinproc_PinPROCObject *self, PyObject *args, PyObject *kwds)
 	LED.LEDIndex = LEDIndex;
 	
 	PRResult res;
+	PinPROC_lock(self);
 	res = PRLEDFade(self->handle, &LED, color, fadeRate);
+	PinPROC_unlock(self);
 	if (res == kPRSuccess)
 	{
 		Py_INCREF(Py_None);
@@ -868,7 +1720,9 @@ PinPROC_led_fade_color(pinproc_PinPROCObject *self, PyObject *args, PyObject *kw
 	LED.LEDIndex = LEDIndex;
 	
 	PRResult res;
+	PinPROC_lock(self);
 	res = PRLEDFadeColor(self->handle, &LED, color);
+	PinPROC_unlock(self);
 	if (res == kPRSuccess)
 	{
 		Py_INCREF(Py_None);
@@ -881,18 +1735,13 @@ PinPROC_led_fade_color(pinproc_PinPROCObject *self, PyObject *args, PyObject *kw
 	}
 }
 
-#define kDMDColumns (128)
-#define kDMDRows (32)
-#define kDMDSubFrames (4)
-#define kDMDFrameBuffers (3)
-
-void PRDMDConfigPopulateDefaults(PRDMDConfig *dmdConfig)
+void PRDMDConfigPopulateDefaults(PRDMDConfig *dmdConfig, DMDDimension columns, DMDDimension rows, unsigned subFrames)
 {
 	memset(dmdConfig, 0x0, sizeof(PRDMDConfig));
 	dmdConfig->enableFrameEvents = true;
-	dmdConfig->numRows = kDMDRows;
-	dmdConfig->numColumns = kDMDColumns;
-	dmdConfig->numSubFrames = kDMDSubFrames;
+	dmdConfig->numRows = rows;
+	dmdConfig->numColumns = columns;
+	dmdConfig->numSubFrames = subFrames;
 	dmdConfig->numFrameBuffers = kDMDFrameBuffers;
 	dmdConfig->autoIncBufferWrPtr = true;
 
@@ -903,10 +1752,23 @@ void PRDMDConfigPopulateDefaults(PRDMDConfig *dmdConfig)
 		dmdConfig->dotclkHalfPeriod[i] = 1;
 	}
 	
-	dmdConfig->deHighCycles[0] = 90;
-	dmdConfig->deHighCycles[1] = 190; //250;
-	dmdConfig->deHighCycles[2] = 50;
-	dmdConfig->deHighCycles[3] = 377; // 60fps
+	if (subFrames == kDMDSubFrames)
+	{
+		dmdConfig->deHighCycles[0] = 90;
+		dmdConfig->deHighCycles[1] = 190; //250;
+		dmdConfig->deHighCycles[2] = 50;
+		dmdConfig->deHighCycles[3] = 377; // 60fps
+	}
+	else
+	{
+		// Other counts use binary weighted subframes (see DMDPROCColorTableInitForSubframes()),
+		// sharing out the same time per frame.
+		for (unsigned i = 0; i < subFrames; i++)
+		{
+			unsigned cycles = (kDMDFrameCycles << i) / ((1 << subFrames) - 1);
+			dmdConfig->deHighCycles[i] = cycles > 0 ? cycles : 1;
+		}
+	}
 }
 
 static PyObject *
@@ -914,24 +1776,40 @@ PinPROC_dmd_update_config(pinproc_PinPROCObject *self, PyObject *args, PyObject
 {
 	int i;
 	PyObject *high_cycles_list = NULL;
-	static char *kwlist[] = {"high_cycles", NULL};
-	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O", kwlist, &high_cycles_list))
+	int columns = self->dmdColumns, rows = self->dmdRows, subframes = self->dmdSubFrames;
+	static char *kwlist[] = {"high_cycles", "columns", "rows", "subframes", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|Oiii", kwlist, &high_cycles_list, &columns, &rows, &subframes))
+	{
+		return NULL;
+	}
+	if (columns < 8 || columns > kDMDMaxColumns || columns % 8 != 0)
+	{
+		PyErr_Format(PyExc_ValueError, "columns must be a multiple of 8 from 8 to %d", kDMDMaxColumns);
+		return NULL;
+	}
+	if (rows < 1 || rows > kDMDMaxRows)
+	{
+		PyErr_Format(PyExc_ValueError, "rows must be 1 to %d", kDMDMaxRows);
+		return NULL;
+	}
+	if (subframes < 1 || subframes > kDMDPROCMaxSubframes)
 	{
+		PyErr_Format(PyExc_ValueError, "subframes must be 1 to %d", kDMDPROCMaxSubframes);
 		return NULL;
 	}
 	
 	PRDMDConfig dmdConfig;
-	PRDMDConfigPopulateDefaults(&dmdConfig);
+	PRDMDConfigPopulateDefaults(&dmdConfig, columns, rows, subframes);
 
 	if (high_cycles_list != NULL)
 	{
 		int cycles_len = PySequence_Length(high_cycles_list);
-		if (cycles_len != 4)
+		if (cycles_len != subframes)
 		{
-			PyErr_SetString(PyExc_ValueError, "len(high_cycles) must be 4");
+			PyErr_Format(PyExc_ValueError, "len(high_cycles) must be %d", subframes);
 			return NULL;
 		}
-		for (i = 0; i < 4; i++)
+		for (i = 0; i < subframes; i++)
 		{
 			PyObject *item = PySequence_GetItem(high_cycles_list, i);
 			if (PyInt_Check(item) == 0)
@@ -944,8 +1822,55 @@ PinPROC_dmd_update_config(pinproc_PinPROCObject *self, PyObject *args, PyObject
 		}
 	}
 	
+	bool resized = columns != self->dmdColumns || rows != self->dmdRows || subframes != (int)self->dmdSubFrames;
+	uint8_t *dots = NULL, *sentDots = NULL;
+	size_t dotsSize = (size_t)subframes * columns * rows / 8;
+	bool restartOutput = false;
+	if (resized)
+	{
+		dots = (uint8_t *)calloc(dotsSize, 1);
+		sentDots = (uint8_t *)calloc(dotsSize, 1);
+		if (dots == NULL || sentDots == NULL)
+		{
+			free(dots);
+			free(sentDots);
+			return PyErr_NoMemory();
+		}
+	}
+	
+	// The output thread's buffers are sized for the old geometry; stop it and start a new one
+	// afterwards.  Stopping it and taking handleLock both let other threads run, and one of them
+	// may have started another thread in the meantime, so check again once the lock is held.
+	PinPROC_lock(self);
+	while (resized && self->dmdOutput != NULL)
+	{
+		PinPROC_unlock(self);
+		restartOutput = true;
+		PinPROC_dmd_output_stop(self);
+		PinPROC_lock(self);
+	}
+	if (resized)
+	{
+		free(self->dmdDots);
+		free(self->dmdSentDots);
+		self->dmdDots = dots;
+		self->dmdSentDots = sentDots;
+		self->dmdDotsSize = dotsSize;
+		self->dmdColumns = columns;
+		self->dmdRows = rows;
+		self->dmdSubFrames = subframes;
+		DMDPROCColorTableInitForSubframes(&self->dmdColorTable, self->dmdMapping, self->dmdSubFrames);
+		self->dmdEncodedFrame = NULL;
+		self->dmdEncodedPackedFrame = NULL;
+	}
 	PRDMDUpdateConfig(self->handle, &dmdConfig);
 	self->dmdConfigured = true;
+	PinPROC_dmd_invalidate_sent(self);
+	PinPROC_unlock(self);
+	
+	// Another thread may have started one with the new geometry already.
+	if (restartOutput && self->dmdOutput == NULL && !PinPROC_dmd_output_start(self))
+		return NULL;
 
 	Py_INCREF(Py_None);
 	return Py_None;
@@ -979,50 +1904,517 @@ PinPROC_dmd_set_color_mapping(pinproc_PinPROCObject *self, PyObject *args, PyObj
 		self->dmdMapping[i] = PyInt_AsLong(item);
 		fprintf(stderr, "dmdMapping[%d] = %d\n", i, self->dmdMapping[i]);
 	}
+	PinPROC_lock(self);
+	DMDPROCColorTableInitForSubframes(&self->dmdColorTable, self->dmdMapping, self->dmdSubFrames);
+	self->dmdEncodedFrame = NULL;
+	self->dmdEncodedPackedFrame = NULL;
+	PinPROC_dmd_invalidate_sent(self);
+	PinPROC_unlock(self);
+	
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+// Called with handleLock held before the first frame is drawn.
+static PRResult
+PinPROC_dmd_configure(pinproc_PinPROCObject *self)
+{
+	if (self->dmdConfigured)
+		return kPRSuccess;
+	PRDMDConfig dmdConfig;
+	PRDMDConfigPopulateDefaults(&dmdConfig, self->dmdColumns, self->dmdRows, self->dmdSubFrames);
+	PRResult res = PRDMDUpdateConfig(self->handle, &dmdConfig);
+	if (res == kPRSuccess)
+		self->dmdConfigured = true;
+	return res;
+}
+
+/* Asynchronous DMD output
+ *
+ * With dmd_set_async(True), dmd_draw() only copies the frame and hands it to an output
+ * thread, which encodes it and waits on the USB transfer with neither the GIL nor the
+ * caller's time.  Frames go through three slots: the drawing thread fills its own,
+ * then atomically swaps it with the pending one; the output thread swaps the pending
+ * one with its own when it's ready for the next frame.  Neither side ever waits for
+ * the other, and a frame that's drawn before the last one was taken replaces it, so
+ * the P-ROC always gets the latest frame.  The drawing side is only ever run with the
+ * GIL held, which keeps it to one thread at a time.
+ *
+ * Once get_events() has returned a DMD frame displayed event, the thread sends at most
+ * one frame per event, since the P-ROC can't show them any faster.  If the events stop
+ * coming it goes on after kDMDOutputPaceTimeout without one.
+ */
+
+#define kDMDOutputSlots (3)
+#define kDMDOutputFresh (0x4) // Set in pending while its slot holds a frame the output thread hasn't taken.
+#define kDMDOutputPaceTimeout (40) // ms; more than two frames at 60 Hz.
+
+typedef struct {
+	bool packed;
+	uint8_t *dots; // A DMDFrame's dots, or a DMDPackedFrame's pairs, at the geometry the thread was started with.
+} PinPROCDMDOutputSlot;
+
+#if PINPROC_HAVE_DMD_OUTPUT_THREAD
+
+struct _PinPROCDMDOutput {
+	pinproc_PinPROCObject *owner; // Not a reference; dealloc stops the thread first.
+	PinPROCDMDOutputSlot slots[kDMDOutputSlots];
+	int writeSlot; // Owned by the drawing side.
+	int readSlot; // Owned by the output thread.
+	volatile int pending; // The third slot, plus kDMDOutputFresh; only changed by DMDOutputExchange().
+	void *lastFrame; // Frame last handed over, so it needn't be copied again until it changes.
+	unsigned long long submitted, dropped; // Owned by the drawing side.
+	uint8_t *dots; // The output thread's encoding of its slot; owner->dmdDotsSize bytes.
+	pthread_t thread;
+	pthread_mutex_t mutex; // Guards the fields below, and is what the output thread sleeps on.
+	pthread_cond_t wake;
+	bool stop;
+	bool paced; // Set by the first frame displayed event.
+	unsigned frameTicks; // Frame displayed events seen by get_events().
+	unsigned long long sent;
+	bool failed;
+	char error[256]; // Why the last transfer failed; reported by the next dmd_draw().
+};
+
+static int
+DMDOutputExchange(volatile int *value, int newValue)
+{
+	int oldValue;
+	do
+		oldValue = *value;
+	while (__sync_val_compare_and_swap(value, oldValue, newValue) != oldValue); // A full barrier.
+	return oldValue;
+}
+
+// Encodes the output thread's slot and sends it, unless it's what the P-ROC already has.
+static void
+PinPROC_dmd_output_send(PinPROCDMDOutput *output)
+{
+	pinproc_PinPROCObject *self = output->owner;
+	PinPROCDMDOutputSlot *slot = &output->slots[output->readSlot];
+	PRResult res = kPRSuccess;
+	bool sent = false;
+	char error[sizeof(output->error)];
+	
+	PyThread_acquire_lock(self->handleLock, WAIT_LOCK);
+	DMDSize size = DMDSizeMake(self->dmdColumns, self->dmdRows);
+	memset(output->dots, 0, self->dmdDotsSize);
+	if (slot->packed)
+	{
+		DMDPackedFrame frame = {size, slot->dots, DMDRectMake(0, 0, 0, 0)};
+		DMDPackedFrameCopyPROCSubframesWithTable(&frame, output->dots, size.width, size.height, self->dmdSubFrames, &self->dmdColorTable);
+	}
+	else
+	{
+		DMDFrame frame = {size, slot->dots, DMDRectMake(0, 0, 0, 0)};
+		DMDFrameCopyPROCSubframesWithTable(&frame, output->dots, size.width, size.height, self->dmdSubFrames, &self->dmdColorTable);
+	}
+	if (!self->dmdSentValid || memcmp(output->dots, self->dmdSentDots, self->dmdDotsSize) != 0)
+	{
+		self->dmdSentValid = false;
+		res = PRDMDDraw(self->handle, output->dots);
+		if (res == kPRSuccess)
+		{
+			memcpy(self->dmdSentDots, output->dots, self->dmdDotsSize);
+			self->dmdSentValid = true;
+			sent = true;
+		}
+		else
+		{
+			strncpy(error, PRGetLastErrorText(), sizeof(error) - 1);
+			error[sizeof(error) - 1] = '\0';
+		}
+	}
+	PyThread_release_lock(self->handleLock);
+	
+	pthread_mutex_lock(&output->mutex);
+	if (sent)
+		output->sent++;
+	if (res != kPRSuccess)
+	{
+		output->failed = true;
+		memcpy(output->error, error, sizeof(error));
+	}
+	pthread_mutex_unlock(&output->mutex);
+}
+
+static void *
+PinPROC_dmd_output_main(void *arg)
+{
+	PinPROCDMDOutput *output = (PinPROCDMDOutput *)arg;
+	unsigned ticksAtSend = 0;
+	pthread_mutex_lock(&output->mutex);
+	for (;;)
+	{
+		while (!(output->pending & kDMDOutputFresh) && !output->stop)
+			pthread_cond_wait(&output->wake, &output->mutex);
+		if (!(output->pending & kDMDOutputFresh))
+			break; // Stopped, with the last frame drawn already sent.
+		
+		// Wait for the last frame sent to be displayed; frames drawn meanwhile replace the pending one.
+		if (output->paced && !output->stop && output->frameTicks == ticksAtSend)
+		{
+			struct timeval now;
+			gettimeofday(&now, NULL);
+			long long nsec = (long long)now.tv_usec * 1000 + kDMDOutputPaceTimeout * 1000000LL;
+			struct timespec deadline;
+			deadline.tv_sec = now.tv_sec + (time_t)(nsec / 1000000000);
+			deadline.tv_nsec = (long)(nsec % 1000000000);
+			while (output->frameTicks == ticksAtSend && !output->stop)
+				if (pthread_cond_timedwait(&output->wake, &output->mutex, &deadline) == ETIMEDOUT)
+					break;
+		}
+		ticksAtSend = output->frameTicks;
+		output->readSlot = DMDOutputExchange(&output->pending, output->readSlot) & ~kDMDOutputFresh;
+		pthread_mutex_unlock(&output->mutex);
+		
+		PinPROC_dmd_output_send(output);
+		
+		pthread_mutex_lock(&output->mutex);
+	}
+	pthread_mutex_unlock(&output->mutex);
+	return NULL;
+}
+
+static void
+PinPROC_dmd_output_free(PinPROCDMDOutput *output)
+{
+	for (int i = 0; i < kDMDOutputSlots; i++)
+		free(output->slots[i].dots);
+	free(output->dots);
+	free(output);
+}
+
+static bool
+PinPROC_dmd_output_start(pinproc_PinPROCObject *self)
+{
+	PinPROCDMDOutput *output = (PinPROCDMDOutput *)calloc(1, sizeof(PinPROCDMDOutput));
+	if (output == NULL)
+	{
+		PyErr_NoMemory();
+		return false;
+	}
+	output->owner = self;
+	// The geometry can't change while the thread runs; dmd_update_config() stops it first.
+	size_t slotSize = (size_t)self->dmdColumns * self->dmdRows;
+	output->dots = (uint8_t *)malloc(self->dmdDotsSize);
+	for (int i = 0; i < kDMDOutputSlots; i++)
+		output->slots[i].dots = (uint8_t *)malloc(slotSize);
+	if (output->dots == NULL || output->slots[0].dots == NULL || output->slots[1].dots == NULL || output->slots[2].dots == NULL)
+	{
+		PinPROC_dmd_output_free(output);
+		PyErr_NoMemory();
+		return false;
+	}
+	output->writeSlot = 0;
+	output->pending = 1;
+	output->readSlot = 2;
+	pthread_mutex_init(&output->mutex, NULL);
+	pthread_cond_init(&output->wake, NULL);
+	if (PinPROC_thread_create(&output->thread, PinPROC_dmd_output_main, output) != 0)
+	{
+		pthread_cond_destroy(&output->wake);
+		pthread_mutex_destroy(&output->mutex);
+		PinPROC_dmd_output_free(output);
+		PyErr_SetString(PyExc_OSError, "Couldn't start the DMD output thread");
+		return false;
+	}
+	self->dmdOutput = output;
+	return true;
+}
+
+// Stops the output thread once it has sent the last frame drawn.
+static void
+PinPROC_dmd_output_stop(pinproc_PinPROCObject *self)
+{
+	PinPROCDMDOutput *output = self->dmdOutput;
+	self->dmdOutput = NULL;
+	pthread_mutex_lock(&output->mutex);
+	output->stop = true;
+	pthread_cond_signal(&output->wake);
+	pthread_mutex_unlock(&output->mutex);
+	// The thread may be waiting for handleLock, which a thread waiting for the GIL could hold.
+	Py_BEGIN_ALLOW_THREADS
+	pthread_join(output->thread, NULL);
+	Py_END_ALLOW_THREADS
+	pthread_cond_destroy(&output->wake);
+	pthread_mutex_destroy(&output->mutex);
+	PinPROC_dmd_output_free(output);
+}
+
+static void
+PinPROC_dmd_output_note_events(PinPROCDMDOutput *output, PREvent *events, int numEvents)
+{
+	unsigned ticks = 0;
+	for (int i = 0; i < numEvents; i++)
+		if (events[i].type == kPREventTypeDMDFrameDisplayed)
+			ticks++;
+	if (ticks == 0)
+		return;
+	pthread_mutex_lock(&output->mutex);
+	output->frameTicks += ticks;
+	output->paced = true;
+	pthread_cond_signal(&output->wake);
+	pthread_mutex_unlock(&output->mutex);
+}
+
+static PyObject *
+PinPROC_dmd_output_draw(pinproc_PinPROCObject *self, PyObject *dotsObj, bool packed)
+{
+	PinPROCDMDOutput *output = self->dmdOutput;
+	void *frameID;
+	DMDSize size;
+	DMDRect dirty;
+	if (!packed)
+	{
+		pinproc_DMDBufferObject *buffer = (pinproc_DMDBufferObject *)dotsObj;
+		DMDBufferSyncDirty(buffer);
+		frameID = buffer->frame;
+		size = buffer->frame->size;
+		dirty = DMDFrameGetDirtyRect(buffer->frame);
+	}
+	else
+	{
+		DMDPackedFrame *frame = ((pinproc_DMDPackedBufferObject *)dotsObj)->frame;
+		frameID = frame;
+		size = frame->size;
+		dirty = DMDPackedFrameGetDirtyRect(frame);
+	}
+	if (size.width != self->dmdColumns || size.height != self->dmdRows)
+	{
+		PyErr_SetString(PyExc_ValueError, "Buffer dimensions are incorrect");
+		return NULL;
+	}
+	
+	char error[sizeof(output->error)];
+	bool failed;
+	pthread_mutex_lock(&output->mutex);
+	failed = output->failed;
+	if (failed)
+		memcpy(error, output->error, sizeof(error));
+	output->failed = false;
+	pthread_mutex_unlock(&output->mutex);
+	if (failed)
+	{
+		output->lastFrame = NULL;
+		PyErr_SetString(PyExc_IOError, error);
+		return NULL;
+	}
+	
+	if (!self->dmdConfigured)
+	{
+		PinPROC_lock(self);
+		PRResult res = PinPROC_dmd_configure(self);
+		char error[kPinPROCErrorTextSize];
+		PinPROC_unlock_result(self, res, error);
+		ReturnOnErrorAndSetIOError(res, error);
+	}
+	
+	if (frameID != output->lastFrame || !DMDRectIsEmpty(dirty))
+	{
+		PinPROCDMDOutputSlot *slot = &output->slots[output->writeSlot];
+		slot->packed = packed;
+		if (!packed)
+		{
+			DMDFrame *frame = ((pinproc_DMDBufferObject *)dotsObj)->frame;
+			memcpy(slot->dots, frame->buffer, (size_t)size.width * size.height);
+			DMDFrameClearDirty(frame);
+		}
+		else
+		{
+			DMDPackedFrame *frame = ((pinproc_DMDPackedBufferObject *)dotsObj)->frame;
+			memcpy(slot->dots, frame->buffer, DMDPackedFrameGetBufferSize(frame));
+			DMDPackedFrameClearDirty(frame);
+		}
+		output->lastFrame = frameID;
+		
+		int previous = DMDOutputExchange(&output->pending, output->writeSlot | kDMDOutputFresh);
+		output->writeSlot = previous & ~kDMDOutputFresh;
+		output->submitted++;
+		if (previous & kDMDOutputFresh)
+			output->dropped++;
+		pthread_mutex_lock(&output->mutex);
+		pthread_cond_signal(&output->wake);
+		pthread_mutex_unlock(&output->mutex);
+	}
+	
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject *
+PinPROC_dmd_output_stats(PinPROCDMDOutput *output)
+{
+	unsigned long long sent;
+	pthread_mutex_lock(&output->mutex);
+	sent = output->sent;
+	pthread_mutex_unlock(&output->mutex);
+	return Py_BuildValue("{s:K,s:K,s:K}", "submitted", output->submitted, "dropped", output->dropped, "sent", sent);
+}
+
+#else
+
+// No output thread on this platform; dmdOutput is never set.
+static bool
+PinPROC_dmd_output_start(pinproc_PinPROCObject *self)
+{
+	PyErr_SetString(PyExc_NotImplementedError, "Asynchronous DMD output isn't supported on this platform");
+	return false;
+}
+
+static void PinPROC_dmd_output_stop(pinproc_PinPROCObject *self) { }
+static void PinPROC_dmd_output_note_events(PinPROCDMDOutput *output, PREvent *events, int numEvents) { }
+static PyObject *PinPROC_dmd_output_draw(pinproc_PinPROCObject *self, PyObject *dotsObj, bool packed) { return NULL; }
+static PyObject *PinPROC_dmd_output_stats(PinPROCDMDOutput *output) { return NULL; }
+
+#endif /* PINPROC_HAVE_DMD_OUTPUT_THREAD */
+
+// Makes the next frame drawn go to the P-ROC even if it has it already, e.g. after a reset.
+static void
+PinPROC_dmd_invalidate_sent(pinproc_PinPROCObject *self)
+{
+	self->dmdSentValid = false;
+#if PINPROC_HAVE_DMD_OUTPUT_THREAD
+	if (self->dmdOutput != NULL)
+		self->dmdOutput->lastFrame = NULL;
+#endif
+}
+
+static PyObject *
+PinPROC_dmd_set_async(pinproc_PinPROCObject *self, PyObject *args, PyObject *kwds)
+{
+	PyObject *enabledObj;
+	static char *kwlist[] = {"enabled", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O", kwlist, &enabledObj))
+		return NULL;
+	int enabled = PyObject_IsTrue(enabledObj);
+	if (enabled < 0)
+		return NULL;
+	
+	if (enabled && self->dmdOutput == NULL)
+	{
+		if (!PinPROC_dmd_output_start(self))
+			return NULL;
+		// The synchronous path's cached encoding is stale once the thread has sent anything.
+		self->dmdEncodedFrame = NULL;
+		self->dmdEncodedPackedFrame = NULL;
+	}
+	else if (!enabled && self->dmdOutput != NULL)
+		PinPROC_dmd_output_stop(self);
 	
 	Py_INCREF(Py_None);
 	return Py_None;
 }
 
+static PyObject *
+PinPROC_dmd_async_stats(pinproc_PinPROCObject *self, PyObject *args)
+{
+	if (self->dmdOutput == NULL)
+	{
+		Py_INCREF(Py_None);
+		return Py_None;
+	}
+	return PinPROC_dmd_output_stats(self->dmdOutput);
+}
+
 static PyObject *
 PinPROC_dmd_draw(pinproc_PinPROCObject *self, PyObject *args)
 {
-	PRResult res;
+	PRResult res = kPRSuccess;
 	PyObject *dotsObj;
 	if (!PyArg_ParseTuple(args, "O", &dotsObj))
 		return NULL;
 	
-	if (!self->dmdConfigured)
+	bool packed = PyObject_TypeCheck(dotsObj, &pinproc_DMDPackedBufferType);
+	if (!packed && !PyObject_TypeCheck(dotsObj, &pinproc_DMDBufferType))
 	{
-		PRDMDConfig dmdConfig;
-		PRDMDConfigPopulateDefaults(&dmdConfig);
-		res = PRDMDUpdateConfig(self->handle, &dmdConfig);
-		ReturnOnErrorAndSetIOError(res);
-		self->dmdConfigured = true;
+		PyErr_SetString(PyExc_ValueError, "Expected DMDBuffer, DMDPackedBuffer or string.");
+		return NULL;
 	}
 	
-	uint8_t dots[4*kDMDColumns*kDMDRows/8];
-	memset(dots, 0, sizeof(dots));
+	if (self->dmdOutput != NULL)
+		return PinPROC_dmd_output_draw(self, dotsObj, packed);
+	
+	// The encoding is done with the GIL held, so the buffer can't change underneath it;
+	// only the transfer to the P-ROC runs without it.  Take the frame after locking, as
+	// waiting for the lock lets other threads run.
+	PinPROC_lock(self);
+	
+	char error[kPinPROCErrorTextSize];
+	res = PinPROC_dmd_configure(self);
+	if (res != kPRSuccess)
+	{
+		PinPROC_unlock_result(self, res, error);
+		ReturnOnErrorAndSetIOError(res, error);
+	}
 	
-	if (PyObject_TypeCheck(dotsObj, &pinproc_DMDBufferType))
+	if (!packed)
 	{
 		pinproc_DMDBufferObject *buffer = (pinproc_DMDBufferObject *)dotsObj;
-		if (buffer->frame->size.width != kDMDColumns || buffer->frame->size.height != kDMDRows)
+		DMDFrame *frame = buffer->frame;
+		if (frame->size.width != self->dmdColumns || frame->size.height != self->dmdRows)
 		{
-			fprintf(stderr, "w=%d h=%d", buffer->frame->size.width, buffer->frame->size.height);
+			PinPROC_unlock(self);
+			fprintf(stderr, "w=%d h=%d", frame->size.width, frame->size.height);
 			PyErr_SetString(PyExc_ValueError, "Buffer dimensions are incorrect");
 			return NULL;
 		}
-		DMDFrameCopyPROCSubframes(buffer->frame, dots, kDMDColumns, kDMDRows, 4, self->dmdMapping);
+		DMDBufferSyncDirty(buffer);
+		// If this is the frame we encoded last time only its dirty rows need to be redone.
+		// Note that drawing clears the frame's dirty region.
+		if (frame == self->dmdEncodedFrame)
+		{
+			DMDRect dirty = DMDFrameGetDirtyRect(frame);
+			DMDFrameUpdatePROCSubframeRows(frame, self->dmdDots, self->dmdColumns, self->dmdRows, self->dmdSubFrames, &self->dmdColorTable, DMDRectGetMinY(dirty), DMDRectGetMaxY(dirty));
+		}
+		else
+		{
+			memset(self->dmdDots, 0, self->dmdDotsSize);
+			DMDFrameCopyPROCSubframesWithTable(frame, self->dmdDots, self->dmdColumns, self->dmdRows, self->dmdSubFrames, &self->dmdColorTable);
+			self->dmdEncodedFrame = frame;
+			self->dmdEncodedPackedFrame = NULL;
+		}
+		DMDFrameClearDirty(frame);
 	}
 	else
 	{
-		PyErr_SetString(PyExc_ValueError, "Expected DMDBuffer or string.");
-		return NULL;
+		DMDPackedFrame *frame = ((pinproc_DMDPackedBufferObject *)dotsObj)->frame;
+		if (frame->size.width != self->dmdColumns || frame->size.height != self->dmdRows)
+		{
+			PinPROC_unlock(self);
+			PyErr_SetString(PyExc_ValueError, "Buffer dimensions are incorrect");
+			return NULL;
+		}
+		if (frame == self->dmdEncodedPackedFrame)
+		{
+			DMDRect dirty = DMDPackedFrameGetDirtyRect(frame);
+			DMDPackedFrameUpdatePROCSubframeRows(frame, self->dmdDots, self->dmdColumns, self->dmdRows, self->dmdSubFrames, &self->dmdColorTable, DMDRectGetMinY(dirty), DMDRectGetMaxY(dirty));
+		}
+		else
+		{
+			memset(self->dmdDots, 0, self->dmdDotsSize);
+			DMDPackedFrameCopyPROCSubframesWithTable(frame, self->dmdDots, self->dmdColumns, self->dmdRows, self->dmdSubFrames, &self->dmdColorTable);
+			self->dmdEncodedPackedFrame = frame;
+			self->dmdEncodedFrame = NULL;
+		}
+		DMDPackedFrameClearDirty(frame);
 	}
 	
-	res = PRDMDDraw(self->handle, dots);
-	ReturnOnErrorAndSetIOError(res);
+	// Nothing to send if the P-ROC already has this frame.
+	if (!self->dmdSentValid || memcmp(self->dmdDots, self->dmdSentDots, self->dmdDotsSize) != 0)
+	{
+		self->dmdSentValid = false;
+		Py_BEGIN_ALLOW_THREADS
+		res = PRDMDDraw(self->handle, self->dmdDots);
+		Py_END_ALLOW_THREADS
+		if (res == kPRSuccess)
+		{
+			memcpy(self->dmdSentDots, self->dmdDots, self->dmdDotsSize);
+			self->dmdSentValid = true;
+		}
+	}
+	PinPROC_unlock_result(self, res, error);
+	ReturnOnErrorAndSetIOError(res, error);
 	
 	Py_INCREF(Py_None);
 	return Py_None;
@@ -1041,11 +2433,17 @@ static PyMethodDef PinPROC_methods[] = {
     {"dmd_draw", (PyCFunction)PinPROC_dmd_draw, METH_VARARGS,
      "Fetches recent events from P-ROC."
     },
+    {"dmd_set_async", (PyCFunction)PinPROC_dmd_set_async, METH_VARARGS | METH_KEYWORDS,
+     "Sends frames drawn with dmd_draw() from a separate thread, dropping all but the latest"
+    },
+    {"dmd_async_stats", (PyCFunction)PinPROC_dmd_async_stats, METH_NOARGS,
+     "Returns counts of frames submitted, dropped and sent by the DMD output thread, or None"
+    },
     {"set_dmd_color_mapping", (PyCFunction)PinPROC_dmd_set_color_mapping, METH_VARARGS | METH_KEYWORDS,
      "Configures the DMD color mapping"
     },
     {"dmd_update_config", (PyCFunction)PinPROC_dmd_update_config, METH_VARARGS | METH_KEYWORDS,
-     "Configures the DMD"
+     "Configures the DMD; columns, rows and subframes (1 to 8) set the geometry dmd_draw() expects"
     },
     {"driver_update_global_config", (PyCFunction)PinPROC_driver_update_global_config, METH_VARARGS | METH_KEYWORDS,
      "Sets the driver global configuratiaon"
@@ -1083,8 +2481,11 @@ static PyMethodDef PinPROC_methods[] = {
     {"flush", (PyCFunction)PinPROC_flush, METH_VARARGS,
      "Writes out all buffered data to the hardware"
     },
-    {"switch_get_states", (PyCFunction)PinPROC_switch_get_states, METH_VARARGS,
-     "Gets the current state of all of the switches"
+    {"switch_get_states", (PyCFunction)PinPROC_switch_get_states, METH_VARARGS | METH_KEYWORDS,
+     "Gets the current state of all of the switches; with packed=True, as a string of SwitchStateBytes bytes of closed bits followed by as many of debounced bits"
+    },
+    {"switch_get_changes", (PyCFunction)PinPROC_switch_get_changes, METH_NOARGS,
+     "Returns (number, state) for each switch whose state has changed since the last call, or for every switch the first time"
     },
     {"switch_update_rule", (PyCFunction)PinPROC_switch_update_rule, METH_VARARGS | METH_KEYWORDS,
      "Sets the state of the specified driver"
@@ -1098,8 +2499,24 @@ static PyMethodDef PinPROC_methods[] = {
     {"watchdog_tickle", (PyCFunction)PinPROC_watchdog_tickle, METH_VARARGS, 
 	 "Tickles the watchdog"
     },
-    {"get_events", (PyCFunction)PinPROC_get_events, METH_VARARGS,
-     "Fetches recent events from P-ROC."
+    {"get_events", (PyCFunction)PinPROC_get_events, METH_VARARGS | METH_KEYWORDS,
+     "Fetches recent events from P-ROC, as dicts or, with tuples=True, as pinproc.Event tuples."
+    },
+    {"get_events_into", (PyCFunction)PinPROC_get_events_into, METH_VARARGS | METH_KEYWORDS,
+     "Writes recent events into a writable buffer as EventRecordSize byte (type, value, time) records of native uint32s and returns the count."
+    },
+    {"events_set_async", (PyCFunction)PinPROC_events_set_async, METH_VARARGS | METH_KEYWORDS,
+     "Polls the P-ROC for events from a separate thread every interval us, for get_events() to drain.  "
+     "Calling it again while polling only changes the interval."
+    },
+    {"events_async_stats", (PyCFunction)PinPROC_events_async_stats, METH_NOARGS,
+     "Returns counts of polls, events received and events overflowed by the event polling thread, and how many are pending, or None"
+    },
+    {"events_fileno", (PyCFunction)PinPROC_events_fileno, METH_NOARGS,
+     "Returns a file descriptor that is readable while the event polling thread has events for get_events(); closed by events_set_async(False)"
+    },
+    {"wait_events", (PyCFunction)PinPROC_wait_events, METH_VARARGS | METH_KEYWORDS,
+     "Waits up to timeout seconds (forever if None) for the event polling thread to have events, without the GIL, and returns whether it has"
     },
     {"reset", (PyCFunction)PinPROC_reset, METH_VARARGS,
      "Loads defaults into memory and optionally writes them to hardware."
@@ -1355,7 +2772,14 @@ pinproc_aux_command_disable(PyObject *self, PyObject *args, PyObject *kwds)
 	return PyDictFromAuxCommand(&auxCommand);
 }
 
+static PyObject *
+pinproc_host_time(PyObject *self, PyObject *args)
+{
+	return PyLong_FromUnsignedLongLong(PinPROC_host_time());
+}
+
 PyMethodDef methods[] = {
+		{"host_time", (PyCFunction)pinproc_host_time, METH_NOARGS, "Returns the monotonic clock, in ns, that events' host_time is taken from."},
 		{"decode", (PyCFunction)pinproc_decode, METH_VARARGS | METH_KEYWORDS, "Decode a switch, coil, or lamp number."},
 		{"normalize_machine_type", (PyCFunction)pinproc_normalize_machine_type, METH_VARARGS | METH_KEYWORDS, "Converts a string to an integer style machine type.  Integers pass through."},
 		{"driver_state_disable", (PyCFunction)pinproc_driver_state_disable, METH_VARARGS | METH_KEYWORDS, "Return a copy of the given driver state to disable the driver"},
@@ -1370,6 +2794,17 @@ PyMethodDef methods[] = {
 		{"aux_command_delay", (PyCFunction)pinproc_aux_command_delay, METH_VARARGS | METH_KEYWORDS, "Return a copy of the given aux delay command"},
 		{"aux_command_jump", (PyCFunction)pinproc_aux_command_jump, METH_VARARGS | METH_KEYWORDS, "Return a copy of the given aux jump command"},
 		{"aux_command_disable", (PyCFunction)pinproc_aux_command_disable, METH_VARARGS | METH_KEYWORDS, "Return a copy of the given aux command disabled"},
+		{"register_blend_mode", (PyCFunction)pinproc_register_blend_mode, METH_VARARGS | METH_KEYWORDS, "Registers a blend mode from a 65536 byte table indexed by src * 256 + dst, optionally under an op name, and returns its BlendMode value."},
+		{"blend_table", (PyCFunction)pinproc_blend_table, METH_VARARGS | METH_KEYWORDS, "Returns a blend table for register_blend_mode(): 'multiply', 'screen', 'min', 'max' or 'opacity' (with opacity 0.0-1.0)."},
+		{"composite", (PyCFunction)pinproc_composite, METH_VARARGS | METH_KEYWORDS, "Draws a sequence of (buffer, src_rect, dst_point[, op[, opacity]]) layers, or a DMDCompositePlan, into the given DMDBuffer."},
+		{"blit_many", (PyCFunction)pinproc_blit_many, METH_VARARGS | METH_KEYWORDS, "Draws rects of src, given as packed (x, y, width, height) ints or None for the whole of src, at each of the packed (x, y) points in dst with the same op."},
+		{"transition", (PyCFunction)pinproc_transition, METH_VARARGS | METH_KEYWORDS, "Draws the state of a transition between two DMDBuffers at the given progress (0.0-1.0) into dst."},
+		{"transition_frames", (PyCFunction)pinproc_transition_frames, METH_VARARGS | METH_KEYWORDS, "Draws evenly spaced states of a transition, from progress start to end, into each of a sequence of DMDBuffers."},
+		{"dmd_encode_animation", (PyCFunction)pinproc_dmd_encode_animation, METH_VARARGS | METH_KEYWORDS, "Compresses a sequence of equally sized DMDBuffers into the string form read by DMDCompressedAnimation."},
+		{"dmd_frame_stats", (PyCFunction)pinproc_dmd_frame_stats, METH_NOARGS, "Returns a dict of DMD frame allocation counters: live, pool_hits, pool_misses and pooled_bytes."},
+		{"dmd_frame_pool_trim", (PyCFunction)pinproc_dmd_frame_pool_trim, METH_NOARGS, "Releases the memory held by the DMD frame pool."},
+		{"dmd_set_worker_count", (PyCFunction)pinproc_dmd_set_worker_count, METH_VARARGS | METH_KEYWORDS, "Starts count worker threads for large DMD fills and rect copies (0 stops them) and returns the number actually started."},
+		{"dmd_set_parallel_threshold", (PyCFunction)pinproc_dmd_set_parallel_threshold, METH_VARARGS | METH_KEYWORDS, "Sets the area, in dots, below which DMD fills and rect copies always run on the calling thread."},
 		{NULL, NULL, 0, NULL}};
 
 PyMODINIT_FUNC initpinproc()
@@ -1379,6 +2814,23 @@ PyMODINIT_FUNC initpinproc()
         return;
     if (PyType_Ready(&pinproc_DMDBufferType) < 0)
         return;
+    if (PyType_Ready(&pinproc_DMDCompositePlanType) < 0)
+        return;
+    if (PyType_Ready(&pinproc_DMDFontType) < 0)
+        return;
+    if (PyType_Ready(&pinproc_DMDPackedBufferType) < 0)
+        return;
+    if (PyType_Ready(&pinproc_DMDQuantizerType) < 0)
+        return;
+    if (PyType_Ready(&pinproc_DMDQuantizerStreamType) < 0)
+        return;
+    if (PyType_Ready(&pinproc_DMDAnimationType) < 0)
+        return;
+    if (PyType_Ready(&pinproc_DMDCompressedAnimationType) < 0)
+        return;
+    if (PyType_Ready(&pinproc_DMDFrameStoreType) < 0)
+        return;
+    PyStructSequence_InitType(&pinproc_EventType, &pinproc_EventDesc);
 	
 	PyObject *m = Py_InitModule("pinproc", methods);
 	
@@ -1386,6 +2838,22 @@ PyMODINIT_FUNC initpinproc()
 	PyModule_AddObject(m, "PinPROC", (PyObject*)&pinproc_PinPROCType);
 	Py_INCREF(&pinproc_DMDBufferType);
 	PyModule_AddObject(m, "DMDBuffer", (PyObject*)&pinproc_DMDBufferType);
+	Py_INCREF(&pinproc_DMDCompositePlanType);
+	PyModule_AddObject(m, "DMDCompositePlan", (PyObject*)&pinproc_DMDCompositePlanType);
+	Py_INCREF(&pinproc_DMDFontType);
+	PyModule_AddObject(m, "DMDFont", (PyObject*)&pinproc_DMDFontType);
+	Py_INCREF(&pinproc_DMDPackedBufferType);
+	PyModule_AddObject(m, "DMDPackedBuffer", (PyObject*)&pinproc_DMDPackedBufferType);
+	Py_INCREF(&pinproc_DMDQuantizerType);
+	PyModule_AddObject(m, "DMDQuantizer", (PyObject*)&pinproc_DMDQuantizerType);
+	Py_INCREF(&pinproc_DMDAnimationType);
+	PyModule_AddObject(m, "DMDAnimation", (PyObject*)&pinproc_DMDAnimationType);
+	Py_INCREF(&pinproc_DMDCompressedAnimationType);
+	PyModule_AddObject(m, "DMDCompressedAnimation", (PyObject*)&pinproc_DMDCompressedAnimationType);
+	Py_INCREF(&pinproc_DMDFrameStoreType);
+	PyModule_AddObject(m, "DMDFrameStore", (PyObject*)&pinproc_DMDFrameStoreType);
+	Py_INCREF(&pinproc_EventType);
+	PyModule_AddObject(m, "Event", (PyObject*)&pinproc_EventType);
 	
     PyModule_AddIntConstant(m, "EventTypeSwitchClosedDebounced", kPREventTypeSwitchClosedDebounced);
     PyModule_AddIntConstant(m, "EventTypeSwitchOpenDebounced", kPREventTypeSwitchOpenDebounced);
@@ -1398,6 +2866,7 @@ PyMODINIT_FUNC initpinproc()
     PyModule_AddIntConstant(m, "EventTypeAccelerometerY", kPREventTypeAccelerometerY);
     PyModule_AddIntConstant(m, "EventTypeAccelerometerZ", kPREventTypeAccelerometerZ);
     PyModule_AddIntConstant(m, "EventTypeAccelerometerIRQ", kPREventTypeAccelerometerIRQ);
+    PyModule_AddIntConstant(m, "EventRecordSize", kEventRecordSize);
     PyModule_AddIntConstant(m, "MachineTypeWPC", kPRMachineWPC);
     PyModule_AddIntConstant(m, "MachineTypeWPCAlphanumeric", kPRMachineWPCAlphanumeric);
     PyModule_AddIntConstant(m, "MachineTypeWPC95", kPRMachineWPC95);
@@ -1407,9 +2876,28 @@ PyMODINIT_FUNC initpinproc()
     PyModule_AddIntConstant(m, "MachineTypeCustom", kPRMachineCustom);
     PyModule_AddIntConstant(m, "MachineTypeInvalid", kPRMachineInvalid);
     PyModule_AddIntConstant(m, "SwitchCount", kPRSwitchPhysicalLast);
+    PyModule_AddIntConstant(m, "SwitchStateBytes", kSwitchStateBytes);
     PyModule_AddIntConstant(m, "SwitchNeverDebounceFirst", kPRSwitchNeverDebounceFirst);
     PyModule_AddIntConstant(m, "SwitchNeverDebounceLast", kPRSwitchNeverDebounceLast);
     PyModule_AddIntConstant(m, "DriverCount", kPRDriverCount);
+    PyModule_AddIntConstant(m, "BlendModeCopy", DMDBlendModeCopy);
+    PyModule_AddIntConstant(m, "BlendModeAdd", DMDBlendModeAdd);
+    PyModule_AddIntConstant(m, "BlendModeSubtract", DMDBlendModeSubtract);
+    PyModule_AddIntConstant(m, "BlendModeBlackSource", DMDBlendModeBlackSource);
+    PyModule_AddIntConstant(m, "BlendModeAlpha", DMDBlendModeAlpha);
+    PyModule_AddIntConstant(m, "BlendModeAlphaBoth", DMDBlendModeAlphaBoth);
+    PyModule_AddIntConstant(m, "TransitionCrossfade", DMDTransitionCrossfade);
+    PyModule_AddIntConstant(m, "TransitionWipe", DMDTransitionWipe);
+    PyModule_AddIntConstant(m, "TransitionPush", DMDTransitionPush);
+    PyModule_AddIntConstant(m, "TransitionSlide", DMDTransitionSlide);
+    PyModule_AddIntConstant(m, "TransitionIris", DMDTransitionIris);
+    PyModule_AddIntConstant(m, "DirectionNorth", DMDDirectionNorth);
+    PyModule_AddIntConstant(m, "DirectionSouth", DMDDirectionSouth);
+    PyModule_AddIntConstant(m, "DirectionEast", DMDDirectionEast);
+    PyModule_AddIntConstant(m, "DirectionWest", DMDDirectionWest);
+    PyModule_AddIntConstant(m, "QuantizeThreshold", DMDQuantizeThreshold);
+    PyModule_AddIntConstant(m, "QuantizeOrdered", DMDQuantizeOrdered);
+    PyModule_AddIntConstant(m, "QuantizeFloydSteinberg", DMDQuantizeFloydSteinberg);
     
 }
 
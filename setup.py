@@ -1,10 +1,19 @@
 # To run pyprocgame under Snow Leopard when libs are compiled 32-bit: export VERSIONER_PYTHON_PREFER_32_BIT=yes
 
 # From: http://superjared.com/entry/anatomy-python-c-module/
-from distutils.core import setup, Extension
+from distutils.core import setup, Extension, Command
+from distutils.command.build_ext import build_ext
+from distutils.ccompiler import new_compiler
+from distutils.sysconfig import customize_compiler
 import os
 import sys
 
+import gendmdtables
+
+def generate_dmd_tables():
+	"""The blend tables are generated rather than computed at runtime; see gendmdtables.py."""
+	gendmdtables.main(os.path.join(os.path.dirname(os.path.abspath(__file__)), 'dmdtables.c'))
+
 
 extra_compile_args = ['-O0', '-g']
 extra_compile_args.append('-Wno-write-strings') # fix "warning: deprecated conversion from string constant to 'char*'"
@@ -22,8 +31,62 @@ module1 = Extension("pinproc",
 					library_dirs = ['/usr/local/lib', '../libpinproc/bin'],
 					extra_compile_args = extra_compile_args,
 					extra_link_args = extra_link_args,
-					sources = ['pypinproc.cpp', 'dmdutil.cpp', 'dmd.c'])
+					sources = ['pypinproc.cpp', 'dmdutil.cpp', 'dmd.c', 'dmdtables.c'])
+
+class build_ext_dmd_tables(build_ext):
+	"""Generates dmdtables.c before building the extension, so that commands that don't
+	build anything (clean, --help) don't write into the source tree."""
+	def run(self):
+		generate_dmd_tables()
+		build_ext.run(self)
+
+class build_bench(Command):
+	"""Builds the dmdbench benchmark (see dmdbench.c) into build/.
+
+	It is always optimized, unlike the extension, so its numbers mean something:
+	  python setup.py build_bench && build/dmdbench -o results.csv"""
+	description = "build the dmdbench DMD benchmark"
+	user_options = []
+
+	def initialize_options(self):
+		pass
+
+	def finalize_options(self):
+		pass
+
+	def run(self):
+		generate_dmd_tables()
+		compiler = new_compiler()
+		customize_compiler(compiler)
+		objects = compiler.compile(['dmdbench.c', 'dmd.c', 'dmdtables.c'],
+								   output_dir = 'build/temp.dmdbench',
+								   extra_postargs = ['-O2'] + extra_link_args)
+		compiler.link_executable(objects, 'dmdbench', output_dir = 'build',
+								 libraries = ['pthread', 'm'], extra_postargs = extra_link_args)
+
+class test_dmd(Command):
+	"""Builds dmdtest (see dmdtest.c) into build/ and runs it."""
+	description = "build and run the DMD library tests"
+	user_options = []
+
+	def initialize_options(self):
+		pass
+
+	def finalize_options(self):
+		pass
+
+	def run(self):
+		generate_dmd_tables()
+		compiler = new_compiler()
+		customize_compiler(compiler)
+		objects = compiler.compile(['dmdtest.c', 'dmd.c', 'dmdtables.c'],
+								   output_dir = 'build/temp.dmdtest',
+								   extra_postargs = ['-O2'] + extra_link_args)
+		compiler.link_executable(objects, 'dmdtest', output_dir = 'build',
+								 libraries = ['pthread', 'm'], extra_postargs = extra_link_args)
+		self.spawn([os.path.join('build', 'dmdtest')])
 
 setup(name = "pinproc",
       version = "2.0",
-      ext_modules = [module1])
+      ext_modules = [module1],
+      cmdclass = {'build_ext': build_ext_dmd_tables, 'build_bench': build_bench, 'test_dmd': test_dmd})
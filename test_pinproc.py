@@ -0,0 +1,213 @@
+# Behavioural tests for the pinproc extension:
+#
+#   python setup.py build_ext --inplace && python test_pinproc.py
+#
+# The DMD tests run anywhere.  The PinPROC tests need a P-ROC attached and are
+# skipped without one.
+import array
+import os
+import random
+import signal
+import StringIO
+import struct
+import threading
+import time
+import unittest
+
+import pinproc
+
+
+def open_proc(test):
+	try:
+		return pinproc.PinPROC(pinproc.MachineTypeWPC)
+	except IOError:
+		test.skipTest("no P-ROC attached")
+
+
+class EventTests(unittest.TestCase):
+	def setUp(self):
+		self.proc = open_proc(self)
+
+	def tearDown(self):
+		del self.proc
+
+	def check_records(self, data, count):
+		for i in range(count):
+			event_type, value, time = struct.unpack_from('=III', data, i * pinproc.EventRecordSize)
+			self.assertTrue(event_type > 0)
+
+	def test_get_events_into_bytearray(self):
+		data = bytearray(pinproc.EventRecordSize * 64)
+		count = self.proc.get_events_into(data)
+		self.assertTrue(0 <= count <= 64)
+		self.check_records(data, count)
+
+	def test_get_events_into_array(self):
+		# array.array only has the old buffer protocol in Python 2.
+		data = array.array('I', [0] * 3 * 64)
+		count = self.proc.get_events_into(data)
+		self.assertTrue(0 <= count <= 64)
+		self.check_records(data.tostring(), count)
+
+	def test_get_events_into_rejects_small_and_readonly_buffers(self):
+		self.assertRaises(ValueError, self.proc.get_events_into, bytearray(pinproc.EventRecordSize - 1))
+		self.assertRaises((TypeError, BufferError), self.proc.get_events_into, 'x' * pinproc.EventRecordSize)
+
+	def test_get_events_tuples(self):
+		for event in self.proc.get_events(tuples=True):
+			event_type, value, time = event
+			self.assertEqual(event.type, event_type)
+			self.assertTrue(event.host_time <= pinproc.host_time())
+
+	def test_wait_events_interrupted(self):
+		# Ctrl-C must stop a wait with no timeout.  Should the interrupt be lost, stopping the
+		# poller wakes the wait, so the test fails instead of hanging.
+		self.proc.events_set_async(True)
+		interrupt = threading.Timer(0.2, os.kill, (os.getpid(), signal.SIGINT))
+		failsafe = threading.Timer(5, self.proc.events_set_async, (False,))
+		start = time.time()
+		interrupt.start()
+		failsafe.start()
+		try:
+			with self.assertRaises(KeyboardInterrupt):
+				while True:
+					self.proc.wait_events()
+					self.proc.get_events()
+		finally:
+			interrupt.cancel()
+			failsafe.cancel()
+			failsafe.join()
+		self.assertTrue(time.time() - start < 4)
+
+
+class SwitchTests(unittest.TestCase):
+	def setUp(self):
+		self.proc = open_proc(self)
+
+	def tearDown(self):
+		del self.proc
+
+	def test_packed_states_match_list(self):
+		states = self.proc.switch_get_states()
+		packed = self.proc.switch_get_states(packed=True)
+		self.assertEqual(len(packed), 2 * pinproc.SwitchStateBytes)
+		bits = bytearray(packed)
+		for number, state in enumerate(states):
+			closed = bool(bits[number // 8] & (1 << number % 8))
+			debounced = bool(bits[pinproc.SwitchStateBytes + number // 8] & (1 << number % 8))
+			self.assertEqual(closed, state in (pinproc.EventTypeSwitchClosedDebounced, pinproc.EventTypeSwitchClosedNondebounced))
+			self.assertEqual(debounced, state in (pinproc.EventTypeSwitchClosedDebounced, pinproc.EventTypeSwitchOpenDebounced))
+
+	def test_changes(self):
+		first = self.proc.switch_get_changes()
+		self.assertEqual([number for number, state in first], range(len(self.proc.switch_get_states())))
+		current = dict(first)
+		for number, state in self.proc.switch_get_changes():
+			self.assertNotEqual(current[number], state)
+
+class DMDCompressedAnimationTests(unittest.TestCase):
+	def setUp(self):
+		rand = random.Random(1)
+		self.frames = []
+		for i in range(40):
+			frame = pinproc.DMDBuffer(32, 8)
+			for j in range(20):
+				frame.set_dot(rand.randrange(32), rand.randrange(8), rand.randrange(16))
+			self.frames.append(frame)
+		self.anim = pinproc.DMDCompressedAnimation(data=pinproc.dmd_encode_animation(self.frames, keyframe_interval=7))
+
+	def assertFramesEqual(self, a, b):
+		self.assertEqual([a.get_dot(x, y) for y in range(8) for x in range(32)],
+		                 [b.get_dot(x, y) for y in range(8) for x in range(32)])
+
+	def test_round_trip(self):
+		self.assertEqual(len(self.anim), len(self.frames))
+		for i in (0, 6, 7, 20, 39):
+			self.assertFramesEqual(self.anim[i], self.frames[i])
+
+	def test_sequential_decode(self):
+		dst = pinproc.DMDBuffer(32, 8)
+		for i in range(len(self.frames)):
+			self.anim.decode(i, dst)
+			self.assertFramesEqual(dst, self.frames[i])
+
+	def test_decode_after_drawing_into_dst(self):
+		# Drawing into dst between decodes must not leave the next delta applied on top.
+		dst = pinproc.DMDBuffer(32, 8)
+		for i in range(len(self.frames)):
+			self.anim.decode(i, dst)
+			self.assertFramesEqual(dst, self.frames[i])
+			dst.set_dot(1, 1, 15)
+		self.anim.decode(len(self.frames) - 1, dst)
+		self.assertFramesEqual(dst, self.frames[-1])
+
+	def test_uninitialized_buffers(self):
+		empty = pinproc.DMDBuffer.__new__(pinproc.DMDBuffer)
+		self.assertRaises(ValueError, pinproc.dmd_encode_animation, [empty])
+		self.assertRaises(ValueError, self.anim.decode, 0, empty)
+
+class DMDQuantizerTests(unittest.TestCase):
+	def dots(self, frame):
+		return [frame.get_dot(x, y) for y in range(4) for x in range(8)]
+
+	def test_stream_with_stride(self):
+		# Three 8x4 frames of 12-byte rows, the last without its trailing padding.
+		rand = random.Random(2)
+		data = ''.join(chr(rand.randrange(256)) for i in range(12 * 4 * 3 - 4))
+		q = pinproc.DMDQuantizer(8, 4, stride=12)
+		expected = [self.dots(q.convert(data, offset=12 * 4 * i)) for i in range(3)]
+		self.assertEqual([self.dots(frame) for frame in q.stream(data)], expected)
+		self.assertEqual([self.dots(frame) for frame in q.stream(StringIO.StringIO(data))], expected)
+
+class UninitializedDMDBufferTests(unittest.TestCase):
+	def setUp(self):
+		self.empty = pinproc.DMDBuffer.__new__(pinproc.DMDBuffer)
+
+	def test_blit_many(self):
+		points = array.array('i', [0, 0])
+		self.assertRaises(ValueError, pinproc.blit_many, pinproc.DMDBuffer(8, 8), self.empty, None, points)
+		self.assertRaises(ValueError, pinproc.blit_many, self.empty, pinproc.DMDBuffer(8, 8), None, points)
+
+	def test_hashing(self):
+		store = pinproc.DMDFrameStore()
+		store.add(pinproc.DMDBuffer(8, 8))
+		self.assertRaises(ValueError, store.add, self.empty)
+		self.assertRaises(ValueError, store.add_many, [self.empty])
+		self.assertRaises(ValueError, store.find, self.empty)
+		self.assertRaises(ValueError, store.__contains__, self.empty)
+		self.assertRaises(ValueError, self.empty.content_hash)
+		self.assertRaises(ValueError, self.empty.digest)
+		self.assertRaises(ValueError, self.empty.same_content, pinproc.DMDBuffer(8, 8))
+		self.assertRaises(ValueError, pinproc.DMDBuffer(8, 8).same_content, self.empty)
+
+	def test_transitions(self):
+		a, b = pinproc.DMDBuffer(8, 8), pinproc.DMDBuffer(8, 8)
+		for args in ((self.empty, a, b), (a, self.empty, b), (a, b, self.empty)):
+			self.assertRaises(ValueError, pinproc.transition, *(args + ('push', 0.5)))
+		self.assertRaises(ValueError, pinproc.transition_frames, self.empty, a, [], 'push')
+		self.assertRaises(ValueError, pinproc.transition_frames, a, self.empty, [], 'push')
+		self.assertRaises(ValueError, pinproc.transition_frames, a, b, [self.empty], 'push')
+
+	def test_transforms(self):
+		buffer = pinproc.DMDBuffer(8, 8)
+		self.assertRaises(ValueError, buffer.scroll, 1, 1, self.empty)
+		self.assertRaises(ValueError, buffer.flip, True, False, self.empty)
+		self.assertRaises(ValueError, self.empty.scroll, 1, 1, buffer)
+		self.assertRaises(ValueError, self.empty.scroll, 1, 1)
+
+	def test_old_style_buffer(self):
+		self.assertRaises(BufferError, str, buffer(self.empty))
+
+	def test_quantizer_dst(self):
+		q = pinproc.DMDQuantizer(8, 8)
+		self.assertRaises(ValueError, q.convert, 'x' * 64, self.empty)
+		self.assertRaises(ValueError, q.stream, 'x' * 64, self.empty)
+
+	def test_packed_buffer(self):
+		packed = pinproc.DMDPackedBuffer(8, 8)
+		self.assertRaises(ValueError, packed.pack, self.empty)
+		self.assertRaises(ValueError, packed.unpack, self.empty)
+
+
+if __name__ == '__main__':
+	unittest.main()